@@ -9,6 +9,7 @@ set( APPLICATION_ICON_NAME  "CloudSecurium" )
 set( APPLICATION_SERVER_URL "" CACHE STRING "URL for the server to use. If entered the server can only connect to this instance" )
 
 set( LINUX_PACKAGE_SHORTNAME "cloudsecurium" )
+set( APPLICATION_VIRTUALFILE_SUFFIX "cloudsecurium" CACHE STRING "Suffix of virtual file placeholders, without the dot" )
 
 set( THEME_CLASS            "NextcloudTheme" )
 set( APPLICATION_REV_DOMAIN "com.nextcloud.desktopclient" )
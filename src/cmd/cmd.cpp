@@ -32,6 +32,7 @@
 #include "simplesslerrorhandler.h"
 #include "syncengine.h"
 #include "common/syncjournaldb.h"
+#include "common/tracing.h"
 #include "config.h"
 
 #include "cmd.h"
@@ -76,6 +77,7 @@ struct CmdOptions
     int restartTimes;
     int downlimit;
     int uplimit;
+    QString traceFile;
 };
 
 // we can't use csync_set_userdata because the SyncEngine sets it already.
@@ -188,6 +190,7 @@ void help()
     std::cout << "  -h                     Sync hidden files, do not ignore them" << std::endl;
     std::cout << "  --version, -v          Display version and exit" << std::endl;
     std::cout << "  --logdebug             More verbose logging" << std::endl;
+    std::cout << "  --trace [file]         Write a Chrome trace of the sync to [file]" << std::endl;
     std::cout << "" << std::endl;
     exit(0);
 }
@@ -268,6 +271,9 @@ void parseOptions(const QStringList &app_args, CmdOptions *options)
         } else if (option == "--logdebug") {
             Logger::instance()->setLogFile("-");
             Logger::instance()->setLogDebug(true);
+        } else if (option == "--trace" && !it.peekNext().startsWith("-")) {
+            options->traceFile = it.next();
+            Tracing::setEnabled(true);
         } else {
             help();
         }
@@ -548,5 +554,11 @@ restart_sync:
         qWarning() << "Another sync is needed, but not done because restart count is exceeded" << restartCount;
     }
 
+    if (!options.traceFile.isEmpty()) {
+        QString error;
+        if (!Tracing::writeChromeTrace(options.traceFile, &error))
+            qCritical() << "Could not write trace to" << options.traceFile << error;
+    }
+
     return resultCode;
 }
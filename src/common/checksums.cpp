@@ -18,6 +18,7 @@
 #include "config.h"
 #include "filesystembase.h"
 #include "common/checksums.h"
+#include "common/tracing.h"
 
 #include <QLoggingCategory>
 #include <qtconcurrentrun.h>
@@ -187,6 +188,7 @@ QByteArray ComputeChecksum::computeNow(const QString &filePath, const QByteArray
         return QByteArray();
     }
 
+    TraceSpan span("checksum", "compute", filePath);
     if (checksumType == checkSumMD5C) {
         return FileSystem::calcMd5(filePath);
     } else if (checksumType == checkSumSHA1C) {
@@ -44,7 +44,13 @@ public:
 
     bool isOpen();
     bool openOrCreateReadWrite(const QString &filename);
-    bool openReadOnly(const QString &filename);
+    /**
+     * Opens an existing database without write access.
+     *
+     * The consistency check can be skipped for a secondary connection to a
+     * database that was already checked through its main connection.
+     */
+    bool openReadOnly(const QString &filename, bool checkConsistency = true);
     bool transaction();
     bool commit();
     void close();
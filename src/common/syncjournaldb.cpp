@@ -32,6 +32,7 @@
 #include "common/checksums.h"
 
 #include "common/c_jhash.h"
+#include "common/tracing.h"
 
 // SQL expression to check whether path.startswith(prefix + '/')
 // Note: '/' + 1 == '0'
@@ -91,8 +92,10 @@ SyncJournalDb::SyncJournalDb(const QString &dbFilePath, QObject *parent)
     : QObject(parent)
     , _dbFile(dbFilePath)
     , _mutex(QMutex::Recursive)
+    , _readConnectionAllowed(false)
     , _transaction(0)
     , _metadataTableIsEmpty(false)
+    , _recordSweepActive(false)
 {
     // Allow forcing the journal mode for debugging
     static QByteArray envJournalMode = qgetenv("OWNCLOUD_SQLITE_JOURNAL_MODE");
@@ -321,6 +324,8 @@ bool SyncJournalDb::checkConnect()
         pragma1.next();
         qCInfo(lcDb) << "sqlite3 journal_mode=" << pragma1.stringValue(0);
     }
+    // Only in WAL mode can readers on another connection proceed during a write transaction
+    bool walActive = pragma1.stringValue(0).compare(QLatin1String("wal"), Qt::CaseInsensitive) == 0;
 
     // For debugging purposes, allow temp_store to be set
     static QByteArray env_temp_store = qgetenv("OWNCLOUD_SQLITE_TEMP_STORE");
@@ -467,6 +472,14 @@ bool SyncJournalDb::checkConnect()
         return sqlFail("Create table datafingerprint", createQuery);
     }
 
+    // create the rootetag table.
+    createQuery.prepare("CREATE TABLE IF NOT EXISTS rootetag("
+                        "etag TEXT"
+                        ");");
+    if (!createQuery.exec()) {
+        return sqlFail("Create table rootetag", createQuery);
+    }
+
     // create the conflicts table.
     createQuery.prepare("CREATE TABLE IF NOT EXISTS conflicts("
                         "path TEXT PRIMARY KEY,"
@@ -591,6 +604,8 @@ bool SyncJournalDb::checkConnect()
     FileSystem::setFileHidden(databaseFilePath() + "-shm", true);
     FileSystem::setFileHidden(databaseFilePath() + "-journal", true);
 
+    _readConnectionAllowed = walActive;
+
     return rc;
 }
 
@@ -601,9 +616,17 @@ void SyncJournalDb::close()
 
     commitTransaction();
 
+    {
+        QMutexLocker readLocker(&_readMutex);
+        _readConnectionAllowed = false;
+        _getCommittedFileRecordQuery.finish();
+        _readDb.close();
+    }
+
     _db.close();
     clearEtagStorageFilter();
     _metadataTableIsEmpty = false;
+    _recordSweepActive = false;
 }
 
 
@@ -710,6 +733,16 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add contentChecksumTypeId col");
     }
 
+    if (1) {
+        SqlQuery query(_db);
+        query.prepare("CREATE INDEX IF NOT EXISTS metadata_content_checksum ON metadata(contentChecksum);");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: create index contentChecksum", query);
+            re = false;
+        }
+        commitInternal("update database structure: add contentChecksum index");
+    }
+
     if (!columns.contains("e2eMangledName")) {
         SqlQuery query(_db);
         query.prepare("ALTER TABLE metadata ADD COLUMN e2eMangledName TEXT;");
@@ -720,6 +753,21 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add e2eMangledName col");
     }
 
+    if (!tableColumns("downloadinfo").contains("ranged")) {
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE downloadinfo ADD COLUMN ranged INTEGER;");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: add ranged column", query);
+            re = false;
+        }
+        query.prepare("ALTER TABLE downloadinfo ADD COLUMN completedRanges TEXT;");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: add completedRanges column", query);
+            re = false;
+        }
+        commitInternal("update database structure: add ranged and completedRanges cols for downloadinfo");
+    }
+
     if (!tableColumns("uploadinfo").contains("contentChecksum")) {
         SqlQuery query(_db);
         query.prepare("ALTER TABLE uploadinfo ADD COLUMN contentChecksum TEXT;");
@@ -730,6 +778,21 @@ bool SyncJournalDb::updateMetadataTableStructure()
         commitInternal("update database structure: add contentChecksum col for uploadinfo");
     }
 
+    if (!tableColumns("uploadinfo").contains("confirmedBytes")) {
+        SqlQuery query(_db);
+        query.prepare("ALTER TABLE uploadinfo ADD COLUMN confirmedBytes INTEGER(8);");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: add confirmedBytes column", query);
+            re = false;
+        }
+        query.prepare("ALTER TABLE uploadinfo ADD COLUMN reservedChunks INTEGER;");
+        if (!query.exec()) {
+            sqlFail("updateMetadataTableStructure: add reservedChunks column", query);
+            re = false;
+        }
+        commitInternal("update database structure: add confirmedBytes and reservedChunks cols for uploadinfo");
+    }
+
 
     return re;
 }
@@ -968,6 +1031,33 @@ bool SyncJournalDb::getFileRecord(const QByteArray &filename, SyncJournalFileRec
     return true;
 }
 
+bool SyncJournalDb::getCommittedFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec)
+{
+    {
+        QMutexLocker readLocker(&_readMutex);
+
+        if (_readConnectionAllowed && !filename.isEmpty()
+            && (_readDb.isOpen() || _readDb.openReadOnly(_dbFile, /*checkConsistency=*/false))
+            && _getCommittedFileRecordQuery.initOrReset(QByteArrayLiteral(GET_FILE_RECORD_QUERY " WHERE phash=?1"), _readDb)) {
+            Q_ASSERT(rec);
+            rec->_path.clear();
+
+            _getCommittedFileRecordQuery.bindValue(1, getPHash(filename));
+            if (_getCommittedFileRecordQuery.exec()) {
+                if (_getCommittedFileRecordQuery.next())
+                    fillFileRecordFromGetQuery(*rec, _getCommittedFileRecordQuery);
+                _getCommittedFileRecordQuery.reset_and_clear_bindings();
+                return true;
+            }
+            qCWarning(lcDb) << "Read-only lookup failed for" << filename << _getCommittedFileRecordQuery.error();
+        }
+    }
+
+    // No sync holds the journal or the read connection doesn't work:
+    // a plain lookup won't wait long.
+    return getFileRecord(filename, rec);
+}
+
 bool SyncJournalDb::getFileRecordByE2eMangledName(const QString &mangledName, SyncJournalFileRecord *rec)
 {
     QMutexLocker locker(&_mutex);
@@ -1067,6 +1157,38 @@ bool SyncJournalDb::getFileRecordsByFileId(const QByteArray &fileId, const std::
     return true;
 }
 
+bool SyncJournalDb::getFileRecordsByChecksum(const QByteArray &checksumHeader, qint64 size, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    QMutexLocker locker(&_mutex);
+
+    QByteArray checksumType;
+    QByteArray checksum;
+    if (!parseChecksumHeader(checksumHeader, &checksumType, &checksum) || checksum.isEmpty() || _metadataTableIsEmpty)
+        return true; // no error, yet nothing found
+
+    if (!checkConnect())
+        return false;
+
+    if (!_getFileRecordQueryByChecksum.initOrReset(QByteArrayLiteral(
+            GET_FILE_RECORD_QUERY " WHERE contentChecksum=?1 AND contentchecksumtype.name=?2 AND filesize=?3"), _db))
+        return false;
+
+    _getFileRecordQueryByChecksum.bindValue(1, checksum);
+    _getFileRecordQueryByChecksum.bindValue(2, checksumType);
+    _getFileRecordQueryByChecksum.bindValue(3, size);
+
+    if (!_getFileRecordQueryByChecksum.exec())
+        return false;
+
+    while (_getFileRecordQueryByChecksum.next()) {
+        SyncJournalFileRecord rec;
+        fillFileRecordFromGetQuery(rec, _getFileRecordQueryByChecksum);
+        rowCallback(rec);
+    }
+
+    return true;
+}
+
 bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback)
 {
     QMutexLocker locker(&_mutex);
@@ -1119,11 +1241,150 @@ bool SyncJournalDb::getFilesBelowPath(const QByteArray &path, const std::functio
     return true;
 }
 
+bool SyncJournalDb::getFilesInDirectory(const QByteArray &path, const std::function<void(const SyncJournalFileRecord &)> &rowCallback)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (_metadataTableIsEmpty)
+        return true; // no error, yet nothing found
+
+    if (!checkConnect())
+        return false;
+
+    // Each query seeks to the first entry after the previous one on the path
+    // index, the entries below a child are skipped over in one step. So this
+    // costs a lookup per child instead of reading all the descendants.
+    SqlQuery *query = nullptr;
+    if (path.isEmpty()) {
+        if (!_getFilesInRootDirectoryQuery.initOrReset(QByteArrayLiteral(
+                GET_FILE_RECORD_QUERY " WHERE path >= ?1 ORDER BY path LIMIT 1"), _db)) {
+            return false;
+        }
+        query = &_getFilesInRootDirectoryQuery;
+    } else {
+        if (!_getFilesInDirectoryQuery.initOrReset(QByteArrayLiteral(
+                GET_FILE_RECORD_QUERY " WHERE path >= ?1 AND path < ?2 ORDER BY path LIMIT 1"), _db)) {
+            return false;
+        }
+        query = &_getFilesInDirectoryQuery;
+    }
+
+    const QByteArray prefix = path.isEmpty() ? QByteArray() : path + '/';
+    QByteArray from = prefix;
+    forever {
+        query->reset_and_clear_bindings();
+        query->bindValue(1, from);
+        if (!path.isEmpty())
+            query->bindValue(2, path + '0'); // '0' follows '/'
+        if (!query->exec()) {
+            return false;
+        }
+        if (!query->next())
+            break;
+
+        SyncJournalFileRecord rec;
+        fillFileRecordFromGetQuery(rec, *query);
+        const int slash = rec._path.indexOf('/', prefix.size());
+        if (slash < 0) {
+            // Nothing sorts between a path and the path followed by a 0 byte
+            from = rec._path + '\0';
+            rowCallback(rec);
+        } else {
+            // Below a child that has no record, skip that subtree
+            from = rec._path.left(slash) + '0';
+        }
+    }
+
+    return true;
+}
+
+bool SyncJournalDb::beginRecordSweep()
+{
+    QMutexLocker locker(&_mutex);
+
+    _recordSweepActive = false;
+    if (!checkConnect()) {
+        return false;
+    }
+
+    SqlQuery query(_db);
+    query.prepare("CREATE TEMP TABLE IF NOT EXISTS keptrecords(phash INTEGER PRIMARY KEY);");
+    if (!query.exec()) {
+        return sqlFail("Create temp table keptrecords", query);
+    }
+    query.prepare("DELETE FROM keptrecords;");
+    if (!query.exec()) {
+        return sqlFail("Clear temp table keptrecords", query);
+    }
+
+    _recordSweepActive = true;
+    return true;
+}
+
+void SyncJournalDb::keepFileRecord(const QString &filename)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!_recordSweepActive) {
+        return;
+    }
+
+    if (!_keepFileRecordQuery.initOrReset(QByteArrayLiteral("INSERT OR IGNORE INTO keptrecords (phash) VALUES (?1);"), _db)) {
+        return;
+    }
+    _keepFileRecordQuery.bindValue(1, getPHash(filename.toUtf8()));
+    _keepFileRecordQuery.exec();
+}
+
+bool SyncJournalDb::postSyncCleanup(const QSet<QString> &prefixesToKeep)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!_recordSweepActive) {
+        qCWarning(lcDb) << "No record sweep running, can't clean up the journal";
+        return false;
+    }
+    _recordSweepActive = false;
+
+    if (!checkConnect()) {
+        return false;
+    }
+
+    // Everything not kept goes, with the temporarily unavailable subtrees
+    // exempted as path ranges on the path index.
+    QByteArray sql = "DELETE FROM metadata WHERE phash NOT IN (SELECT phash FROM keptrecords)";
+    for (int i = 1; i <= prefixesToKeep.size(); ++i) {
+        sql += " AND NOT " + QByteArray(IS_PREFIX_PATH_OR_EQUAL("?X", "path")).replace("?X", "?" + QByteArray::number(i));
+    }
+
+    SqlQuery delQuery(_db);
+    delQuery.prepare(sql);
+    int i = 1;
+    for (const auto &prefix : prefixesToKeep) {
+        delQuery.bindValue(i++, prefix);
+    }
+    if (!delQuery.exec()) {
+        return false;
+    }
+    if (int deleted = delQuery.numRowsAffected()) {
+        qCInfo(lcDb) << "Sync Journal cleanup removed" << deleted << "records";
+    }
+
+    SqlQuery clearQuery("DELETE FROM keptrecords;", _db);
+    clearQuery.exec();
+
+    // Incorporate results back into main DB
+    walCheckpoint();
+
+    return true;
+}
+
 bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
     const QSet<QString> &prefixesToKeep)
 {
     QMutexLocker locker(&_mutex);
 
+    _recordSweepActive = false;
     if (!checkConnect()) {
         return false;
     }
@@ -1142,7 +1403,7 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
         bool keep = filepathsToKeep.contains(file);
         if (!keep) {
             foreach (const QString &prefix, prefixesToKeep) {
-                if (file.startsWith(prefix)) {
+                if (file == prefix || (file.startsWith(prefix) && file.at(prefix.size()) == QLatin1Char('/'))) {
                     keep = true;
                     break;
                 }
@@ -1155,7 +1416,7 @@ bool SyncJournalDb::postSyncCleanup(const QSet<QString> &filepathsToKeep,
 
     if (superfluousItems.count()) {
         QByteArray sql = "DELETE FROM metadata WHERE phash in (" + superfluousItems.join(",") + ")";
-        qCInfo(lcDb) << "Sync Journal cleanup for" << superfluousItems;
+        qCInfo(lcDb) << "Sync Journal cleanup removed" << superfluousItems.count() << "records";
         SqlQuery delQuery(_db);
         delQuery.prepare(sql);
         if (!delQuery.exec()) {
@@ -1269,12 +1530,43 @@ bool SyncJournalDb::setFileRecordMetadata(const SyncJournalFileRecord &record)
     return setFileRecord(existing);
 }
 
+// Ranges are stored as "start-end,start-end"
+static QByteArray rangesToString(const QVector<QPair<qint64, qint64>> &ranges)
+{
+    QByteArray result;
+    for (const auto &range : ranges) {
+        if (!result.isEmpty())
+            result += ',';
+        result += QByteArray::number(range.first) + '-' + QByteArray::number(range.second);
+    }
+    return result;
+}
+
+static QVector<QPair<qint64, qint64>> rangesFromString(const QByteArray &str)
+{
+    QVector<QPair<qint64, qint64>> ranges;
+    for (const auto &part : str.split(',')) {
+        const int dash = part.indexOf('-');
+        if (dash <= 0)
+            continue;
+        bool okStart = false;
+        bool okEnd = false;
+        const qint64 start = part.left(dash).toLongLong(&okStart);
+        const qint64 end = part.mid(dash + 1).toLongLong(&okEnd);
+        if (okStart && okEnd && start < end)
+            ranges.append(qMakePair(start, end));
+    }
+    return ranges;
+}
+
 static void toDownloadInfo(SqlQuery &query, SyncJournalDb::DownloadInfo *res)
 {
     bool ok = true;
     res->_tmpfile = query.stringValue(0);
     res->_etag = query.baValue(1);
     res->_errorCount = query.intValue(2);
+    res->_ranged = query.intValue(3) != 0;
+    res->_completedRanges = rangesFromString(query.baValue(4));
     res->_valid = ok;
 }
 
@@ -1305,7 +1597,7 @@ SyncJournalDb::DownloadInfo SyncJournalDb::getDownloadInfo(const QString &file)
     if (checkConnect()) {
 
         if (!_getDownloadInfoQuery.initOrReset(QByteArrayLiteral(
-                "SELECT tmpfile, etag, errorcount FROM downloadinfo WHERE path=?1"), _db)) {
+                "SELECT tmpfile, etag, errorcount, ranged, completedRanges FROM downloadinfo WHERE path=?1"), _db)) {
             return res;
         }
 
@@ -1336,14 +1628,16 @@ void SyncJournalDb::setDownloadInfo(const QString &file, const SyncJournalDb::Do
     if (i._valid) {
         if (!_setDownloadInfoQuery.initOrReset(QByteArrayLiteral(
                 "INSERT OR REPLACE INTO downloadinfo "
-                "(path, tmpfile, etag, errorcount) "
-                "VALUES ( ?1 , ?2, ?3, ?4 )"), _db)) {
+                "(path, tmpfile, etag, errorcount, ranged, completedRanges) "
+                "VALUES ( ?1 , ?2, ?3, ?4, ?5, ?6 )"), _db)) {
             return;
         }
         _setDownloadInfoQuery.bindValue(1, file);
         _setDownloadInfoQuery.bindValue(2, i._tmpfile);
         _setDownloadInfoQuery.bindValue(3, i._etag);
         _setDownloadInfoQuery.bindValue(4, i._errorCount);
+        _setDownloadInfoQuery.bindValue(5, i._ranged);
+        _setDownloadInfoQuery.bindValue(6, rangesToString(i._completedRanges));
         _setDownloadInfoQuery.exec();
     } else {
         _deleteDownloadInfoQuery.reset_and_clear_bindings();
@@ -1363,7 +1657,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
 
     SqlQuery query(_db);
     // The selected values *must* match the ones expected by toDownloadInfo().
-    query.prepare("SELECT tmpfile, etag, errorcount, path FROM downloadinfo");
+    query.prepare("SELECT tmpfile, etag, errorcount, ranged, completedRanges, path FROM downloadinfo");
 
     if (!query.exec()) {
         return empty_result;
@@ -1373,7 +1667,7 @@ QVector<SyncJournalDb::DownloadInfo> SyncJournalDb::getAndDeleteStaleDownloadInf
     QVector<SyncJournalDb::DownloadInfo> deleted_entries;
 
     while (query.next()) {
-        const QString file = query.stringValue(3); // path
+        const QString file = query.stringValue(5); // path
         if (!keep.contains(file)) {
             superfluousPaths.append(file);
             DownloadInfo info;
@@ -1414,7 +1708,7 @@ SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString &file)
 
     if (checkConnect()) {
         if (!_getUploadInfoQuery.initOrReset(QByteArrayLiteral(
-                "SELECT chunk, transferid, errorcount, size, modtime, contentChecksum FROM "
+                "SELECT chunk, transferid, errorcount, size, modtime, contentChecksum, confirmedBytes, reservedChunks FROM "
                 "uploadinfo WHERE path=?1"), _db)) {
             return res;
         }
@@ -1432,6 +1726,8 @@ SyncJournalDb::UploadInfo SyncJournalDb::getUploadInfo(const QString &file)
             res._size = _getUploadInfoQuery.int64Value(3);
             res._modtime = _getUploadInfoQuery.int64Value(4);
             res._contentChecksum = _getUploadInfoQuery.baValue(5);
+            res._confirmedBytes = _getUploadInfoQuery.int64Value(6);
+            res._reservedChunks = _getUploadInfoQuery.intValue(7);
             res._valid = ok;
         }
     }
@@ -1449,8 +1745,8 @@ void SyncJournalDb::setUploadInfo(const QString &file, const SyncJournalDb::Uplo
     if (i._valid) {
         if (!_setUploadInfoQuery.initOrReset(QByteArrayLiteral(
             "INSERT OR REPLACE INTO uploadinfo "
-            "(path, chunk, transferid, errorcount, size, modtime, contentChecksum) "
-            "VALUES ( ?1 , ?2, ?3 , ?4 ,  ?5, ?6 , ?7 )"), _db)) {
+            "(path, chunk, transferid, errorcount, size, modtime, contentChecksum, confirmedBytes, reservedChunks) "
+            "VALUES ( ?1 , ?2, ?3 , ?4 ,  ?5, ?6 , ?7, ?8, ?9 )"), _db)) {
             return;
         }
 
@@ -1461,6 +1757,8 @@ void SyncJournalDb::setUploadInfo(const QString &file, const SyncJournalDb::Uplo
         _setUploadInfoQuery.bindValue(5, i._size);
         _setUploadInfoQuery.bindValue(6, i._modtime);
         _setUploadInfoQuery.bindValue(7, i._contentChecksum);
+        _setUploadInfoQuery.bindValue(8, i._confirmedBytes);
+        _setUploadInfoQuery.bindValue(9, i._reservedChunks);
 
         if (!_setUploadInfoQuery.exec()) {
             return;
@@ -1934,6 +2232,44 @@ void SyncJournalDb::setDataFingerprint(const QByteArray &dataFingerprint)
     _setDataFingerprintQuery2.exec();
 }
 
+QByteArray SyncJournalDb::rootEtag()
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return QByteArray();
+    }
+
+    if (!_getRootEtagQuery.initOrReset(QByteArrayLiteral("SELECT etag FROM rootetag"), _db))
+        return QByteArray();
+
+    if (!_getRootEtagQuery.exec()) {
+        return QByteArray();
+    }
+
+    if (!_getRootEtagQuery.next()) {
+        return QByteArray();
+    }
+    return _getRootEtagQuery.baValue(0);
+}
+
+void SyncJournalDb::setRootEtag(const QByteArray &etag)
+{
+    QMutexLocker locker(&_mutex);
+    if (!checkConnect()) {
+        return;
+    }
+
+    if (!_setRootEtagQuery1.initOrReset(QByteArrayLiteral("DELETE FROM rootetag;"), _db)
+        || !_setRootEtagQuery2.initOrReset(QByteArrayLiteral("INSERT INTO rootetag (etag) VALUES (?1);"), _db)) {
+        return;
+    }
+
+    _setRootEtagQuery1.exec();
+
+    _setRootEtagQuery2.bindValue(1, etag);
+    _setRootEtagQuery2.exec();
+}
+
 void SyncJournalDb::setConflictRecord(const ConflictRecord &record)
 {
     QMutexLocker locker(&_mutex);
@@ -2030,6 +2366,7 @@ void SyncJournalDb::commitIfNeededAndStartNewTransaction(const QString &context)
 void SyncJournalDb::commitInternal(const QString &context, bool startTrans)
 {
     qCDebug(lcDb) << "Transaction commit " << context << (startTrans ? "and starting new transaction" : "");
+    TraceSpan span("journal", "commit", context);
     commitTransaction();
 
     if (startTrans) {
@@ -2054,7 +2391,9 @@ bool operator==(const SyncJournalDb::DownloadInfo &lhs,
     return lhs._errorCount == rhs._errorCount
         && lhs._etag == rhs._etag
         && lhs._tmpfile == rhs._tmpfile
-        && lhs._valid == rhs._valid;
+        && lhs._valid == rhs._valid
+        && lhs._ranged == rhs._ranged
+        && lhs._completedRanges == rhs._completedRanges;
 }
 
 bool operator==(const SyncJournalDb::UploadInfo &lhs,
@@ -2066,7 +2405,9 @@ bool operator==(const SyncJournalDb::UploadInfo &lhs,
         && lhs._valid == rhs._valid
         && lhs._size == rhs._size
         && lhs._transferid == rhs._transferid
-        && lhs._contentChecksum == rhs._contentChecksum;
+        && lhs._contentChecksum == rhs._contentChecksum
+        && lhs._confirmedBytes == rhs._confirmedBytes
+        && lhs._reservedChunks == rhs._reservedChunks;
 }
 
 } // namespace OCC
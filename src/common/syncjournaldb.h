@@ -23,7 +23,9 @@
 #include <qmutex.h>
 #include <QDateTime>
 #include <QHash>
+#include <QVector>
 #include <functional>
+#include <atomic>
 
 #include "common/utility.h"
 #include "common/ownsql.h"
@@ -57,10 +59,24 @@ public:
     // To verify that the record could be found check with SyncJournalFileRecord::isValid()
     bool getFileRecord(const QString &filename, SyncJournalFileRecord *rec) { return getFileRecord(filename.toUtf8(), rec); }
     bool getFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec);
+    /**
+     * Like getFileRecord, but doesn't wait for a running sync.
+     *
+     * While the journal is open in WAL mode the lookup goes through a separate
+     * read-only connection and sees the last committed state, so writes of
+     * the sync that are still in an open transaction aren't visible yet.
+     * Meant for lookups from the GUI and the socket API.
+     */
+    bool getCommittedFileRecord(const QString &filename, SyncJournalFileRecord *rec) { return getCommittedFileRecord(filename.toUtf8(), rec); }
+    bool getCommittedFileRecord(const QByteArray &filename, SyncJournalFileRecord *rec);
     bool getFileRecordByE2eMangledName(const QString &mangledName, SyncJournalFileRecord *rec);
     bool getFileRecordByInode(quint64 inode, SyncJournalFileRecord *rec);
     bool getFileRecordsByFileId(const QByteArray &fileId, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
+    /// Records whose content checksum equals the given checksum header and which have the given size
+    bool getFileRecordsByChecksum(const QByteArray &checksumHeader, qint64 size, const std::function<void(const SyncJournalFileRecord &)> &rowCallback);
     bool getFilesBelowPath(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
+    /// Like getFilesBelowPath, but only for the direct children of path
+    bool getFilesInDirectory(const QByteArray &path, const std::function<void(const SyncJournalFileRecord&)> &rowCallback);
     bool setFileRecord(const SyncJournalFileRecord &record);
 
     /// Like setFileRecord, but preserves checksums
@@ -96,6 +112,10 @@ public:
         QByteArray _etag;
         int _errorCount;
         bool _valid;
+        /// Whether the file is downloaded as several byte ranges at the same time
+        bool _ranged = false;
+        /// The [start, end) byte ranges of a ranged download that are in _tmpfile, sorted
+        QVector<QPair<qint64, qint64>> _completedRanges;
     };
     struct UploadInfo
     {
@@ -115,6 +135,14 @@ public:
         int _errorCount;
         bool _valid;
         QByteArray _contentChecksum;
+        /// For chunking NG: the bytes of the chunks before _chunk, which the server acknowledged
+        quint64 _confirmedBytes = 0;
+        /**
+         * For chunking NG: chunks below this number may have been sent.
+         * It is stored before the chunks are sent, so a resumed upload knows
+         * which chunks may be left over on the server.
+         */
+        int _reservedChunks = 0;
         /**
          * Returns true if this entry refers to a chunked upload that can be continued.
          * (As opposed to a small file transfer which is stored in the db so we can detect the case
@@ -198,6 +226,32 @@ public:
      */
     void forceRemoteDiscoveryNextSync();
 
+    /**
+     * Starts tracking which file records are still in use by the current sync.
+     *
+     * Paths are registered with keepFileRecord(); postSyncCleanup() then
+     * deletes every other record. The tracked ids live in a temporary table
+     * of this connection, so closing the database cancels the sweep.
+     */
+    bool beginRecordSweep();
+
+    /// Marks the record for the given path as still in use, see beginRecordSweep()
+    void keepFileRecord(const QString &filename);
+
+    /**
+     * Deletes all records that weren't marked with keepFileRecord() since
+     * beginRecordSweep(), except those for the given paths or anything below them.
+     *
+     * Fails without deleting anything if no sweep is running.
+     */
+    bool postSyncCleanup(const QSet<QString> &prefixesToKeep);
+
+    /**
+     * Deletes all records except those in filepathsToKeep and those for the
+     * paths in prefixesToKeep or anything below them.
+     *
+     * Reads every record, use it only when no record sweep could be started.
+     */
     bool postSyncCleanup(const QSet<QString> &filepathsToKeep,
         const QSet<QString> &prefixesToKeep);
 
@@ -225,6 +279,13 @@ public:
     void setDataFingerprint(const QByteArray &dataFingerprint);
     QByteArray dataFingerprint();
 
+    /**
+     * The etag of the remote root folder at the start of the last
+     * successful sync, which the records are up to date with
+     */
+    void setRootEtag(const QByteArray &etag);
+    QByteArray rootEtag();
+
 
     // Conflict record functions
 
@@ -271,15 +332,26 @@ private:
     SqlDatabase _db;
     QString _dbFile;
     QMutex _mutex; // Public functions are protected with the mutex.
+
+    // Read-only connection for getCommittedFileRecord(), usable while _db is
+    // open in WAL mode. Protected by _readMutex instead of _mutex.
+    SqlDatabase _readDb;
+    QMutex _readMutex;
+    SqlQuery _getCommittedFileRecordQuery;
+    std::atomic<bool> _readConnectionAllowed;
     int _transaction;
     bool _metadataTableIsEmpty;
+    bool _recordSweepActive;
 
     SqlQuery _getFileRecordQuery;
     SqlQuery _getFileRecordQueryByMangledName;
     SqlQuery _getFileRecordQueryByInode;
     SqlQuery _getFileRecordQueryByFileId;
+    SqlQuery _getFileRecordQueryByChecksum;
     SqlQuery _getFilesBelowPathQuery;
     SqlQuery _getAllFilesQuery;
+    SqlQuery _getFilesInDirectoryQuery;
+    SqlQuery _getFilesInRootDirectoryQuery;
     SqlQuery _setFileRecordQuery;
     SqlQuery _setFileRecordChecksumQuery;
     SqlQuery _setFileRecordLocalMetadataQuery;
@@ -300,9 +372,13 @@ private:
     SqlQuery _getDataFingerprintQuery;
     SqlQuery _setDataFingerprintQuery1;
     SqlQuery _setDataFingerprintQuery2;
+    SqlQuery _getRootEtagQuery;
+    SqlQuery _setRootEtagQuery1;
+    SqlQuery _setRootEtagQuery2;
     SqlQuery _getConflictRecordQuery;
     SqlQuery _setConflictRecordQuery;
     SqlQuery _deleteConflictRecordQuery;
+    SqlQuery _keepFileRecordQuery;
 
     /* Storing etags to these folders, or their parent folders, is filtered out.
      *
@@ -0,0 +1,146 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include "tracing.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+
+namespace OCC {
+
+QAtomicInt Tracing::s_enabled;
+
+namespace {
+    struct Span
+    {
+        const char *category;
+        const char *name;
+        QString detail;
+        qint64 start;
+        qint64 duration;
+        quintptr thread;
+    };
+
+    struct TraceBuffer
+    {
+        QMutex mutex;
+        QVector<Span> spans;
+        int capacity = 100000;
+        int next = 0; // where the next span goes once the buffer is full
+        QElapsedTimer clock;
+
+        TraceBuffer() { clock.start(); }
+    };
+
+    TraceBuffer &buffer()
+    {
+        static TraceBuffer instance;
+        return instance;
+    }
+}
+
+void Tracing::setEnabled(bool enabled)
+{
+    buffer(); // start the clock
+    s_enabled.store(enabled);
+}
+
+void Tracing::setCapacity(int spans)
+{
+    auto &b = buffer();
+    QMutexLocker lock(&b.mutex);
+    b.capacity = qMax(1, spans);
+    b.spans.clear();
+    b.next = 0;
+}
+
+qint64 Tracing::now()
+{
+    return buffer().clock.nsecsElapsed() / 1000;
+}
+
+void Tracing::addSpan(const char *category, const char *name, const QString &detail,
+    qint64 start, qint64 duration)
+{
+    Span span{ category, name, detail, start, duration, reinterpret_cast<quintptr>(QThread::currentThreadId()) };
+    auto &b = buffer();
+    QMutexLocker lock(&b.mutex);
+    if (b.spans.size() < b.capacity) {
+        b.spans.append(span);
+    } else {
+        b.spans[b.next] = span;
+        b.next = (b.next + 1) % b.capacity;
+    }
+}
+
+void Tracing::clear()
+{
+    auto &b = buffer();
+    QMutexLocker lock(&b.mutex);
+    b.spans.clear();
+    b.next = 0;
+}
+
+QByteArray Tracing::chromeTraceJson()
+{
+    auto &b = buffer();
+    QJsonArray events;
+    {
+        QMutexLocker lock(&b.mutex);
+        // Oldest first
+        for (int i = 0; i < b.spans.size(); ++i) {
+            const auto &span = b.spans.at((b.next + i) % b.spans.size());
+            QJsonObject event{
+                { "ph", "X" },
+                { "cat", span.category },
+                { "name", span.name },
+                { "ts", span.start },
+                { "dur", span.duration },
+                { "pid", QCoreApplication::applicationPid() },
+                { "tid", qint64(span.thread) },
+            };
+            if (!span.detail.isEmpty())
+                event.insert("args", QJsonObject{ { "detail", span.detail } });
+            events.append(event);
+        }
+    }
+    QJsonObject trace{
+        { "traceEvents", events },
+        { "displayTimeUnit", "ms" },
+    };
+    return QJsonDocument(trace).toJson(QJsonDocument::Compact);
+}
+
+bool Tracing::writeChromeTrace(const QString &fileName, QString *errorString)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+        || file.write(chromeTraceJson()) < 0) {
+        if (errorString)
+            *errorString = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+} // namespace OCC
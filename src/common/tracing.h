@@ -0,0 +1,100 @@
+/*
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QString>
+#include "ocsynclib.h"
+
+namespace OCC {
+
+/**
+ * @brief Opt-in recording of timed spans for performance analysis
+ *
+ * The spans are kept in a ring buffer in memory and can be exported in the
+ * Chrome trace event format, which chrome://tracing and Perfetto can show.
+ * While disabled, recording a span costs a single atomic load.
+ *
+ * The category and name arguments must be string literals, they are not copied.
+ */
+class OCSYNC_EXPORT Tracing
+{
+public:
+    static bool isEnabled() { return s_enabled.load(); }
+    static void setEnabled(bool enabled);
+
+    /// Maximum number of spans kept; the oldest ones get overwritten. Clears the buffer.
+    static void setCapacity(int spans);
+
+    /// Microseconds since the first use of the tracing clock
+    static qint64 now();
+
+    static void addSpan(const char *category, const char *name, const QString &detail,
+        qint64 start, qint64 duration);
+
+    static void clear();
+
+    /// All recorded spans as a Chrome trace JSON document
+    static QByteArray chromeTraceJson();
+    static bool writeChromeTrace(const QString &fileName, QString *errorString = nullptr);
+
+private:
+    static QAtomicInt s_enabled;
+};
+
+/**
+ * @brief Records the lifetime of the object as a span, if tracing is enabled
+ */
+class TraceSpan
+{
+public:
+    TraceSpan(const char *category, const char *name)
+        : _category(category)
+        , _name(name)
+    {
+        if (Tracing::isEnabled())
+            _start = Tracing::now();
+    }
+    TraceSpan(const char *category, const char *name, const QString &detail)
+        : TraceSpan(category, name)
+    {
+        if (_start >= 0)
+            _detail = detail;
+    }
+    TraceSpan(const char *category, const char *name, const char *detail)
+        : TraceSpan(category, name)
+    {
+        if (_start >= 0)
+            _detail = QString::fromUtf8(detail);
+    }
+    ~TraceSpan()
+    {
+        if (_start >= 0)
+            Tracing::addSpan(_category, _name, _detail, _start, Tracing::now() - _start);
+    }
+
+private:
+    Q_DISABLE_COPY(TraceSpan)
+
+    const char *_category;
+    const char *_name;
+    QString _detail;
+    qint64 _start = -1;
+};
+
+} // namespace OCC
@@ -17,6 +17,8 @@ set(SOURCEDIR ${CMAKE_CURRENT_SOURCE_DIR})
 # HEADER FILES
 check_include_file(argp.h HAVE_ARGP_H)
 
+check_symbol_exists(FICLONE "linux/fs.h" HAVE_FICLONE)
+
 # FUNCTIONS
 if (NOT LINUX)
     # librt
@@ -41,6 +43,11 @@ check_function_exists(timegm HAVE_TIMEGM)
 check_function_exists(strerror_r HAVE_STRERROR_R)
 check_function_exists(utimes HAVE_UTIMES)
 check_function_exists(lstat HAVE_LSTAT)
+check_function_exists(fstatat HAVE_FSTATAT)
+set(CMAKE_REQUIRED_DEFINITIONS -D_GNU_SOURCE)
+check_symbol_exists(statx "sys/stat.h" HAVE_STATX)
+check_symbol_exists(copy_file_range "unistd.h" HAVE_COPY_FILE_RANGE)
+unset(CMAKE_REQUIRED_DEFINITIONS)
 check_function_exists(asprintf HAVE_ASPRINTF)
 if (WIN32)
 	check_function_exists(__mingw_asprintf HAVE___MINGW_ASPRINTF)
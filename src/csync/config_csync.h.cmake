@@ -7,11 +7,15 @@
 #cmakedefine SOURCEDIR "${SOURCEDIR}"
 
 #cmakedefine HAVE_ARGP_H 1
+#cmakedefine HAVE_FICLONE 1
 
 #cmakedefine HAVE_TIMEGM 1
 #cmakedefine HAVE_STRERROR_R 1
 #cmakedefine HAVE_UTIMES 1
 #cmakedefine HAVE_LSTAT 1
+#cmakedefine HAVE_FSTATAT 1
+#cmakedefine HAVE_STATX 1
+#cmakedefine HAVE_COPY_FILE_RANGE 1
 #cmakedefine HAVE_FNMATCH 1
 
 #cmakedefine HAVE___MINGW_ASPRINTF 1
@@ -48,6 +48,7 @@
 #include "csync_rename.h"
 #include "common/c_jhash.h"
 #include "common/syncjournalfilerecord.h"
+#include "common/utility.h"
 
 Q_LOGGING_CATEGORY(lcCSync, "sync.csync.csync", QtInfoMsg)
 
@@ -88,7 +89,21 @@ int csync_update(CSYNC *ctx) {
 
   qCInfo(lcCSync, "## Starting local discovery ##");
 
+  const int prefetchThreads = LocalDirectoryPrefetcher::defaultThreadCount();
+  if (prefetchThreads > 1) {
+      ctx->local.prefetcher.reset(new LocalDirectoryPrefetcher(prefetchThreads, [ctx](const QByteArray &dir) {
+          // Don't read ahead directories whose contents will come from the database
+          // or that will be excluded anyway.
+          const QByteArray relative = dir.mid(OCC::Utility::convertSizeToInt(strlen(ctx->local.uri)) + 1);
+          if (ctx->should_discover_locally_fn && !ctx->should_discover_locally_fn(relative))
+              return false;
+          return !ctx->exclude_traversal_fn
+              || ctx->exclude_traversal_fn(relative, ItemTypeDirectory) == CSYNC_NOT_EXCLUDED;
+      }));
+  }
+
   rc = csync_ftw(ctx, ctx->local.uri, csync_walker, MAX_DEPTH);
+  ctx->local.prefetcher.reset();
   if (rc < 0) {
     if(ctx->status_code == CSYNC_STATUS_OK) {
         ctx->status_code = csync_errno_to_status(errno, CSYNC_STATUS_UPDATE_ERROR);
@@ -119,6 +134,11 @@ int csync_update(CSYNC *ctx) {
                   << "seconds walking" << ctx->remote.files.size() << "files";
   csync_memstat_check();
 
+  /* The trees don't change anymore, order them once for the merge-joins of
+   * the reconcile phase and the tree walks. */
+  ctx->local.sorted_files = ctx->local.files.sortedFiles();
+  ctx->remote.sorted_files = ctx->remote.files.sortedFiles();
+
   ctx->status |= CSYNC_STATUS_UPDATE;
 
   rc = 0;
@@ -156,8 +176,11 @@ int csync_reconcile(CSYNC *ctx) {
 
 /*
  * local visitor which calls the user visitor with repacked stat info.
+ *
+ * 'other' is the entry with the same path in the opposite tree, if the
+ * merge-join in _csync_walk_tree found one.
  */
-static int _csync_treewalk_visitor(csync_file_stat_t *cur, CSYNC * ctx, const csync_treewalk_visit_func &visitor) {
+static int _csync_treewalk_visitor(csync_file_stat_t *cur, csync_file_stat_t *other, CSYNC * ctx, const csync_treewalk_visit_func &visitor) {
     csync_s::FileMap *other_tree = nullptr;
 
     /* we need the opposite tree! */
@@ -172,24 +195,20 @@ static int _csync_treewalk_visitor(csync_file_stat_t *cur, CSYNC * ctx, const cs
         break;
     }
 
-    csync_s::FileMap::const_iterator other_file_it = other_tree->find(cur->path);
-
-    if (other_file_it == other_tree->cend()) {
+    if (!other && csync_rename_count(ctx)) {
         /* Check the renamed path as well. */
         QByteArray renamed_path = csync_rename_adjust_parent_path(ctx, cur->path);
         if (renamed_path != cur->path)
-            other_file_it = other_tree->find(renamed_path);
-    }
+            other = other_tree->findFile(renamed_path);
 
-    if (other_file_it == other_tree->cend()) {
-        /* Check the source path as well. */
-        QByteArray renamed_path = csync_rename_adjust_parent_path_source(ctx, cur->path);
-        if (renamed_path != cur->path)
-            other_file_it = other_tree->find(renamed_path);
+        if (!other) {
+            /* Check the source path as well. */
+            renamed_path = csync_rename_adjust_parent_path_source(ctx, cur->path);
+            if (renamed_path != cur->path)
+                other = other_tree->findFile(renamed_path);
+        }
     }
 
-    csync_file_stat_t *other = (other_file_it != other_tree->cend()) ? other_file_it->second.get() : NULL;
-
     ctx->status_code = CSYNC_STATUS_OK;
 
     Q_ASSERT(visitor);
@@ -198,11 +217,16 @@ static int _csync_treewalk_visitor(csync_file_stat_t *cur, CSYNC * ctx, const cs
 
 /*
  * treewalk function, called from its wrappers below.
+ *
+ * The entries are visited in path order.
  */
-static int _csync_walk_tree(CSYNC *ctx, csync_s::FileMap &tree, const csync_treewalk_visit_func &visitor)
+static int _csync_walk_tree(CSYNC *ctx, const std::vector<csync_file_stat_t *> &files,
+    const std::vector<csync_file_stat_t *> &otherFiles, const csync_treewalk_visit_func &visitor)
 {
-    for (auto &pair : tree) {
-        if (_csync_treewalk_visitor(pair.second.get(), ctx, visitor) < 0) {
+    csync_s::SortedFileCursor otherCursor(otherFiles);
+
+    for (auto *cur : files) {
+        if (_csync_treewalk_visitor(cur, otherCursor.seek(cur->path), ctx, visitor) < 0) {
             return -1;
         }
     }
@@ -216,7 +240,8 @@ int csync_walk_remote_tree(CSYNC *ctx, const csync_treewalk_visit_func &visitor)
 {
     ctx->status_code = CSYNC_STATUS_OK;
     ctx->current = REMOTE_REPLICA;
-    return _csync_walk_tree(ctx, ctx->remote.files, visitor);
+    Q_ASSERT(ctx->remote.sorted_files.size() == ctx->remote.files.size());
+    return _csync_walk_tree(ctx, ctx->remote.sorted_files, ctx->local.sorted_files, visitor);
 }
 
 /*
@@ -226,7 +251,8 @@ int csync_walk_local_tree(CSYNC *ctx, const csync_treewalk_visit_func &visitor)
 {
     ctx->status_code = CSYNC_STATUS_OK;
     ctx->current = LOCAL_REPLICA;
-    return _csync_walk_tree(ctx, ctx->local.files, visitor);
+    Q_ASSERT(ctx->local.sorted_files.size() == ctx->local.files.size());
+    return _csync_walk_tree(ctx, ctx->local.sorted_files, ctx->remote.sorted_files, visitor);
 }
 
 int csync_s::reinitialize() {
@@ -237,6 +263,8 @@ int csync_s::reinitialize() {
   remote.read_from_db = 0;
   read_remote_from_db = true;
 
+  local.sorted_files.clear();
+  remote.sorted_files.clear();
   local.files.clear();
   remote.files.clear();
 
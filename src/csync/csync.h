@@ -137,7 +137,13 @@ enum ItemType {
     ItemTypeFile = 0,
     ItemTypeSoftLink = 1,
     ItemTypeDirectory = 2,
-    ItemTypeSkip = 3
+    ItemTypeSkip = 3,
+    /// A remote file that only exists locally as a placeholder with the virtual file suffix
+    ItemTypeVirtualFile = 4,
+    /// A virtual file that will be downloaded and replace its placeholder in the next sync
+    ItemTypeVirtualFileDownload = 5,
+    /// A file that will be replaced by the placeholder of a virtual file in the next sync
+    ItemTypeVirtualFileDehydration = 6
 };
 
 
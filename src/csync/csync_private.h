@@ -38,6 +38,8 @@
 #include <stdbool.h>
 #include <map>
 #include <set>
+#include <vector>
+#include <algorithm>
 #include <functional>
 
 #include "common/syncjournaldb.h"
@@ -48,6 +50,7 @@
 #include "csync_misc.h"
 #include "csync_exclude.h"
 #include "csync_macros.h"
+#include "vio/csync_vio_local_prefetch.h"
 
 /**
  * How deep to scan directories.
@@ -120,17 +123,46 @@ struct OCSYNC_EXPORT csync_s {
           auto it = find(key);
           return it != end() ? it->second.get() : nullptr;
       }
-      csync_file_stat_t *findFileMangledName(const ByteArrayRef &key) const {
-          auto it = begin();
-          while (it != end()) {
-              csync_file_stat_t *fs = it->second.get();
-              if (fs->e2eMangledName == key) {
-                  return fs;
-              }
-              ++it;
-          }
+
+      /* Returns the entries ordered by path. Used to merge-join the local and remote trees. */
+      std::vector<csync_file_stat_t *> sortedFiles() const {
+          std::vector<csync_file_stat_t *> files;
+          files.reserve(size());
+          for (const auto &pair : *this)
+              files.push_back(pair.second.get());
+          std::sort(files.begin(), files.end(), [](const csync_file_stat_t *a, const csync_file_stat_t *b) {
+              return a->path < b->path;
+          });
+          return files;
+      }
+  };
+
+  /*
+   * Looks up entries of a list returned by FileMap::sortedFiles(), like the
+   * sorted_files of the replicas.
+   *
+   * The keys passed to seek() must be increasing, which is the case when walking
+   * the other tree in path order. This allows to find the counterpart of every
+   * entry in a single sequential pass instead of one hash lookup per entry.
+   */
+  class SortedFileCursor {
+  public:
+      explicit SortedFileCursor(const std::vector<csync_file_stat_t *> &files)
+          : _files(files)
+      {
+      }
+
+      csync_file_stat_t *seek(const QByteArray &path) {
+          while (_pos < _files.size() && _files[_pos]->path < path)
+              ++_pos;
+          if (_pos < _files.size() && _files[_pos]->path == path)
+              return _files[_pos];
           return nullptr;
       }
+
+  private:
+      const std::vector<csync_file_stat_t *> &_files;
+      size_t _pos = 0;
   };
 
   struct {
@@ -165,6 +197,16 @@ struct OCSYNC_EXPORT csync_s {
    */
   std::function<CSYNC_EXCLUDE_TYPE(const char *path, ItemType filetype)> exclude_traversal_fn;
 
+  /* Journal records of the direct children of a directory being walked */
+  struct DirectoryRecords {
+      QByteArray path;
+      QHash<QByteArray, OCC::SyncJournalFileRecord> records;
+  };
+
+  /* Directories csync_ftw is currently walking, innermost last. Lets the update
+   * detection look up entries without querying the db for each of them. */
+  std::vector<DirectoryRecords> db_directory_records;
+
   struct {
     std::unordered_map<ByteArrayRef, QByteArray, ByteArrayRefHash> folder_renamed_to; // map from->to
     std::unordered_map<ByteArrayRef, QByteArray, ByteArrayRefHash> folder_renamed_from; // map to->from
@@ -173,10 +215,16 @@ struct OCSYNC_EXPORT csync_s {
   struct {
     char *uri = nullptr;
     FileMap files;
+    /* The files ordered by path, set when the update phase is done */
+    std::vector<csync_file_stat_t *> sorted_files;
+    /* Reads directories ahead during the local update phase, may be null */
+    std::unique_ptr<LocalDirectoryPrefetcher> prefetcher;
   } local;
 
   struct {
     FileMap files;
+    /* The files ordered by path, set when the update phase is done */
+    std::vector<csync_file_stat_t *> sorted_files;
     bool read_from_db = false;
     OCC::RemotePermissions root_perms; /* Permission of the root folder. (Since the root folder is not in the db tree, we need to keep a separate entry.) */
   } remote;
@@ -207,6 +255,12 @@ struct OCSYNC_EXPORT csync_s {
 
   bool upload_conflict_files = false;
 
+  /* Suffix of the placeholders of virtual files, empty if they aren't supported */
+  QByteArray virtual_file_suffix;
+
+  /* Whether files that are new on the server are created as virtual files */
+  bool new_files_are_virtual = false;
+
   csync_s(const char *localUri, OCC::SyncJournalDb *statedb);
   ~csync_s();
   int reinitialize();
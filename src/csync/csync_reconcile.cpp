@@ -36,6 +36,9 @@ Q_LOGGING_CATEGORY(lcReconcile, "nextcloud.sync.csync.reconciler", QtInfoMsg)
 #define __STDC_FORMAT_MACROS
 #include "inttypes.h"
 
+/* Maps the e2e mangled names of the local tree to their entries */
+typedef std::unordered_map<ByteArrayRef, csync_file_stat_t *, ByteArrayRefHash> MangledNameIndex;
+
 /* Check if a file is ignored because one parent is ignored.
  * return the node of the ignored directoy if it's the case, or NULL if it is not ignored */
 static csync_file_stat_t *_csync_check_ignored(csync_s::FileMap *tree, const ByteArrayRef &path)
@@ -92,7 +95,8 @@ static csync_file_stat_t *_csync_check_ignored(csync_s::FileMap *tree, const Byt
  * (timestamp is newer), it is not overwritten. If both files, on the
  * source and the destination, have been changed, the newer file wins.
  */
-static void _csync_merge_algorithm_visitor(csync_file_stat_t *cur, CSYNC * ctx) {
+static void _csync_merge_algorithm_visitor(csync_file_stat_t *cur, csync_file_stat_t *other, CSYNC *ctx,
+    const MangledNameIndex &mangledNames) {
     csync_s::FileMap *our_tree = nullptr;
     csync_s::FileMap *other_tree = nullptr;
 
@@ -110,18 +114,20 @@ static void _csync_merge_algorithm_visitor(csync_file_stat_t *cur, CSYNC * ctx)
         break;
     }
 
-    csync_file_stat_t *other = other_tree->findFile(cur->path);
+    // 'other' was found by the caller if it has the same path as 'cur'.
     if (!other) {
         if (ctx->current == REMOTE_REPLICA) {
             // The file was not found and the other tree is the local one
             // check if the path doesn't match a mangled file name
-            other = other_tree->findFileMangledName(cur->path);
-        } else {
+            auto it = mangledNames.find(cur->path);
+            if (it != mangledNames.end())
+                other = it->second;
+        } else if (!cur->e2eMangledName.isEmpty()) {
             other = other_tree->findFile(cur->e2eMangledName);
         }
     }
 
-    if (!other) {
+    if (!other && csync_rename_count(ctx)) {
         /* Check the renamed path as well. */
         other = other_tree->findFile(csync_rename_adjust_parent_path(ctx, cur->path));
     }
@@ -449,21 +455,38 @@ static void _csync_merge_algorithm_visitor(csync_file_stat_t *cur, CSYNC * ctx)
 }
 
 void csync_reconcile_updates(CSYNC *ctx) {
-  csync_s::FileMap *tree = nullptr;
+  const std::vector<csync_file_stat_t *> *files = nullptr;
+  const std::vector<csync_file_stat_t *> *otherFiles = nullptr;
 
   switch (ctx->current) {
     case LOCAL_REPLICA:
-      tree = &ctx->local.files;
+      files = &ctx->local.sorted_files;
+      otherFiles = &ctx->remote.sorted_files;
       break;
     case REMOTE_REPLICA:
-      tree = &ctx->remote.files;
+      files = &ctx->remote.sorted_files;
+      otherFiles = &ctx->local.sorted_files;
       break;
     default:
-      break;
+      return;
+  }
+  Q_ASSERT(ctx->local.sorted_files.size() == ctx->local.files.size());
+  Q_ASSERT(ctx->remote.sorted_files.size() == ctx->remote.files.size());
+
+  /* Merge-join both trees in path order: the counterpart of most entries is found
+   * by advancing a cursor over the other tree instead of a lookup per entry. */
+  csync_s::SortedFileCursor otherCursor(*otherFiles);
+
+  MangledNameIndex mangledNames;
+  if (ctx->current == REMOTE_REPLICA) {
+      for (auto *fs : *otherFiles) {
+          if (!fs->e2eMangledName.isEmpty())
+              mangledNames.emplace(fs->e2eMangledName, fs);
+      }
   }
 
-  for (auto &pair : *tree) {
-    _csync_merge_algorithm_visitor(pair.second.get(), ctx);
+  for (auto *cur : *files) {
+    _csync_merge_algorithm_visitor(cur, otherCursor.seek(cur->path), ctx, mangledNames);
   }
 }
 
@@ -45,6 +45,7 @@
 
 #include "common/utility.h"
 #include "common/asserts.h"
+#include "common/tracing.h"
 
 #include <QtCore/QTextCodec>
 
@@ -94,6 +95,56 @@ static bool _csync_mtime_equal(time_t a, time_t b)
     return false;
 }
 
+/* Looks up the db record of path, from the records of the directory being
+ * walked if they are loaded. */
+static bool _csync_get_file_record(CSYNC *ctx, const QByteArray &path, OCC::SyncJournalFileRecord *rec) {
+  if (!ctx->db_directory_records.empty()) {
+      const auto &dir = ctx->db_directory_records.back();
+      int slash = path.lastIndexOf('/');
+      if ((slash < 0 && dir.path.isEmpty())
+          || (slash >= 0 && dir.path.size() == slash && path.startsWith(dir.path))) {
+          *rec = dir.records.value(path);
+          return true;
+      }
+  }
+  return ctx->statedb->getFileRecord(path, rec);
+}
+
+/* Loads the db records of a directory for the duration of its walk. */
+class DirectoryRecordsScope {
+public:
+  ~DirectoryRecordsScope() {
+      if (_ctx)
+          _ctx->db_directory_records.pop_back();
+  }
+
+  void load(CSYNC *ctx, const QByteArray &path) {
+      csync_s::DirectoryRecords dir;
+      dir.path = path;
+      auto rowCallback = [&dir](const OCC::SyncJournalFileRecord &rec) {
+          dir.records.insert(rec._path, rec);
+      };
+      if (!ctx->statedb->getFilesInDirectory(path, rowCallback)) {
+          // Not fatal, the entries are looked up one by one instead
+          qCWarning(lcUpdate, "Could not load db records of %s", path.constData());
+          return;
+      }
+      ctx->db_directory_records.push_back(std::move(dir));
+      _ctx = ctx;
+  }
+
+private:
+  CSYNC *_ctx = nullptr;
+};
+
+/* The file system and the server only know plain files, the virtual file
+ * types only exist in the db. */
+static bool _csync_is_virtual_file_type(ItemType type) {
+  return type == ItemTypeVirtualFile
+      || type == ItemTypeVirtualFileDownload
+      || type == ItemTypeVirtualFileDehydration;
+}
+
 /**
  * The main function of the discovery/update pass.
  *
@@ -183,7 +234,7 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
    * renamed, the db gets queried by the inode of the file as that one
    * does not change on rename.
    */
-  if(!ctx->statedb->getFileRecord(fs->path, &base)) {
+  if(!_csync_get_file_record(ctx, fs->path, &base)) {
       ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
       return -1;
   }
@@ -201,6 +252,25 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
       }
   }
 
+  /* Virtual files are recorded under the name of their placeholder, use that
+   * name for the server's file too so both trees agree. */
+  if (!base.isValid() && ctx->current == REMOTE_REPLICA && fs->type == ItemTypeFile
+      && !ctx->virtual_file_suffix.isEmpty()) {
+      OCC::SyncJournalFileRecord virtualBase;
+      if (!_csync_get_file_record(ctx, fs->path + ctx->virtual_file_suffix, &virtualBase)) {
+          ctx->status_code = CSYNC_STATUS_UNSUCCESSFUL;
+          return -1;
+      }
+      // A placeholder the user wrote to is synced as a file of its own
+      auto placeholder = ctx->local.files.findFile(fs->path + ctx->virtual_file_suffix);
+      if (virtualBase.isValid() && virtualBase._type != ItemTypeVirtualFileDehydration
+          && _csync_is_virtual_file_type(virtualBase._type)
+          && !(placeholder && placeholder->type == ItemTypeFile)) {
+          fs->path += ctx->virtual_file_suffix;
+          base = virtualBase;
+      }
+  }
+
   if(base.isValid()) { /* there is an entry in the database */
       // When the file is loaded from the file system it misses
       // the e2e mangled name
@@ -218,6 +288,43 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
                 fs->etag.constData(), base._etag.constData(), (uint64_t) fs->inode, (uint64_t) base._inode,
                 (uint64_t) fs->size, (uint64_t) base._fileSize, *reinterpret_cast<short*>(&fs->remotePerm), *reinterpret_cast<short*>(&base._remotePerm),
                 fs->checksumHeader.constData(), base._checksumHeader.constData(), base._serverHasIgnoredFiles, base._e2eMangledName.constData());
+
+      if (fs->type == ItemTypeFile && _csync_is_virtual_file_type(base._type)) {
+          fs->type = base._type;
+          if (ctx->current == LOCAL_REPLICA && base._type != ItemTypeVirtualFileDehydration) {
+              // The placeholder holds a single byte and the remote mtime. If the
+              // user wrote to it, it is a real file now and must not be replaced.
+              if (fs->size != 1 || !_csync_mtime_equal(fs->modtime, base._modtime)) {
+                  qCInfo(lcUpdate, "placeholder was changed locally, syncing it as a file: %s", fs->path.constData());
+                  fs->type = ItemTypeFile;
+                  fs->instruction = CSYNC_INSTRUCTION_EVAL;
+                  fs->child_modified = true;
+                  // List the server's folder so its file isn't taken for the placeholder
+                  ctx->statedb->avoidReadFromDbOnNextSync(fs->path);
+                  goto out;
+              }
+              fs->instruction = CSYNC_INSTRUCTION_NONE;
+              goto out;
+          }
+          if (ctx->current == REMOTE_REPLICA && base._type == ItemTypeVirtualFileDownload) {
+              qCInfo(lcUpdate, "virtual file to be downloaded: %s", fs->path.constData());
+              fs->instruction = CSYNC_INSTRUCTION_EVAL;
+              goto out;
+          }
+          if (ctx->current == REMOTE_REPLICA && base._type == ItemTypeVirtualFileDehydration) {
+              // Only files that didn't change locally are replaced by a placeholder
+              auto localNode = ctx->local.files.findFile(fs->path);
+              if (localNode && localNode->type == ItemTypeVirtualFileDehydration
+                  && (localNode->instruction == CSYNC_INSTRUCTION_NONE
+                         || localNode->instruction == CSYNC_INSTRUCTION_UPDATE_METADATA)) {
+                  qCInfo(lcUpdate, "file to be replaced by a virtual file: %s", fs->path.constData());
+                  fs->instruction = CSYNC_INSTRUCTION_EVAL;
+                  goto out;
+              }
+              fs->type = ItemTypeFile;
+          }
+      }
+
       if (ctx->current == REMOTE_REPLICA && fs->etag != base._etag) {
           fs->instruction = CSYNC_INSTRUCTION_EVAL;
 
@@ -253,6 +360,11 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
               }
           }
 
+          // A file that was changed is synced instead of being dehydrated
+          if (fs->type == ItemTypeVirtualFileDehydration) {
+              fs->type = ItemTypeFile;
+          }
+
           // Preserve the EVAL flag later on if the type has changed.
           if (base._type != fs->type) {
               fs->child_modified = true;
@@ -301,9 +413,19 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
           // Default to NEW unless we're sure it's a rename.
           fs->instruction = CSYNC_INSTRUCTION_NEW;
 
+          // A renamed placeholder keeps the size of the remote file in the db.
+          // It stays a placeholder even if it lost its suffix, otherwise it
+          // would be uploaded over the data of the server's file.
+          if (base.isValid() && base._type == ItemTypeVirtualFile && fs->type == ItemTypeFile
+              && !ctx->virtual_file_suffix.isEmpty()
+              && (fs->path.endsWith(ctx->virtual_file_suffix) || fs->size == 1)) {
+              fs->type = ItemTypeVirtualFile;
+          }
+
           bool isRename =
               base.isValid() && base._type == fs->type
-                  && ((base._modtime == fs->modtime && base._fileSize == fs->size) || fs->type == ItemTypeDirectory)
+                  && ((base._modtime == fs->modtime && (base._fileSize == fs->size || fs->type == ItemTypeVirtualFile))
+                         || fs->type == ItemTypeDirectory)
 #ifdef NO_RENAME_EXTENSION
                   && _csync_sameextension(base._path, fs->path)
 #endif
@@ -345,6 +467,16 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
               if (!base.isValid())
                   return;
 
+              // The placeholder of a virtual file moves along with the file,
+              // unless the user wrote to it
+              auto placeholder = ctx->local.files.findFile(base._path);
+              if (base._type == ItemTypeVirtualFile && fs->type == ItemTypeFile
+                  && !ctx->virtual_file_suffix.isEmpty()
+                  && !(placeholder && placeholder->type == ItemTypeFile)) {
+                  fs->type = ItemTypeVirtualFile;
+                  fs->path += ctx->virtual_file_suffix;
+              }
+
               // Some things prohibit rename detection entirely.
               // Since we don't do the same checks again in reconcile, we can't
               // just skip the candidate, but have to give up completely.
@@ -399,6 +531,18 @@ static int _csync_detect_update(CSYNC *ctx, std::unique_ptr<csync_file_stat_t> f
                   return 1;
               }
           }
+
+          // New files from the server only get a placeholder, unless there
+          // already is a local file of that name or of the placeholder's name.
+          if (fs->instruction == CSYNC_INSTRUCTION_NEW
+              && fs->type == ItemTypeFile
+              && ctx->new_files_are_virtual
+              && !ctx->virtual_file_suffix.isEmpty()
+              && !ctx->local.files.findFile(fs->path)
+              && !ctx->local.files.findFile(fs->path + ctx->virtual_file_suffix)) {
+              fs->type = ItemTypeVirtualFile;
+              fs->path += ctx->virtual_file_suffix;
+          }
           goto out;
       }
   }
@@ -588,11 +732,13 @@ static bool mark_current_item_ignored( CSYNC *ctx, csync_file_stat_t *previous_f
 /* File tree walker */
 int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
     unsigned int depth) {
+  OCC::TraceSpan span(ctx->current == LOCAL_REPLICA ? "discovery-local" : "discovery-remote", "directory", uri);
   QByteArray filename;
   QByteArray fullpath;
   csync_vio_handle_t *dh = NULL;
   std::unique_ptr<csync_file_stat_t> dirent;
   csync_file_stat_t *previous_fs = NULL;
+  DirectoryRecordsScope db_records;
   int read_from_db = 0;
   int rc = 0;
 
@@ -668,6 +814,15 @@ int csync_ftw(CSYNC *ctx, const char *uri, csync_walker_fn fn,
       goto error;
   }
 
+  if (ctx->current == LOCAL_REPLICA) {
+      const char *local_uri = uri + strlen(ctx->local.uri);
+      if (*local_uri == '/')
+          ++local_uri;
+      db_records.load(ctx, QByteArray(local_uri));
+  } else {
+      db_records.load(ctx, QByteArray(uri));
+  }
+
   while (true) {
     // Get the next item in the directory
     errno = 0;
@@ -42,6 +42,8 @@ csync_vio_handle_t *csync_vio_opendir(CSYNC *ctx, const char *name) {
 	if( ctx->callbacks.update_callback ) {
         ctx->callbacks.update_callback(/*local=*/true, name, ctx->callbacks.update_callback_userdata);
 	}
+      if (ctx->local.prefetcher)
+          return ctx->local.prefetcher->opendir(name);
       return csync_vio_local_opendir(name);
       break;
     default:
@@ -65,7 +67,10 @@ int csync_vio_closedir(CSYNC *ctx, csync_vio_handle_t *dhandle) {
       rc = 0;
       break;
   case LOCAL_REPLICA:
-      rc = csync_vio_local_closedir(dhandle);
+      if (ctx->local.prefetcher)
+          rc = ctx->local.prefetcher->closedir(dhandle);
+      else
+          rc = csync_vio_local_closedir(dhandle);
       break;
   default:
       ASSERT(false);
@@ -81,6 +86,8 @@ std::unique_ptr<csync_file_stat_t> csync_vio_readdir(CSYNC *ctx, csync_vio_handl
       return ctx->callbacks.remote_readdir_hook(dhandle, ctx->callbacks.vio_userdata);
       break;
     case LOCAL_REPLICA:
+      if (ctx->local.prefetcher)
+          return ctx->local.prefetcher->readdir(dhandle);
       return csync_vio_local_readdir(dhandle);
       break;
     default:
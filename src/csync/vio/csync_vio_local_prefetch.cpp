@@ -0,0 +1,208 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <errno.h>
+
+#include <QRunnable>
+#include <QThread>
+#include <QLoggingCategory>
+
+#include "vio/csync_vio_local_prefetch.h"
+#include "vio/csync_vio_local.h"
+
+Q_LOGGING_CATEGORY(lcCSyncPrefetch, "sync.csync.vio_local_prefetch", QtInfoMsg)
+
+struct LocalDirectoryPrefetcher::Listing
+{
+    enum State {
+        Queued, // waiting in the pool
+        Running, // being read by a worker or by the walker
+        Done
+    };
+    State state = Queued;
+
+    int openErrno = 0; // opendir failed
+    int readErrno = 0; // readdir failed after the entries below
+    std::vector<std::unique_ptr<csync_file_stat_t>> entries;
+    size_t next = 0;
+};
+
+class LocalDirectoryPrefetcher::Job : public QRunnable
+{
+public:
+    Job(LocalDirectoryPrefetcher *prefetcher, const QByteArray &name, const std::shared_ptr<Listing> &listing)
+        : _prefetcher(prefetcher)
+        , _name(name)
+        , _listing(listing)
+    {
+    }
+
+    void run() override { _prefetcher->runJob(_name, _listing); }
+
+private:
+    LocalDirectoryPrefetcher *_prefetcher;
+    QByteArray _name;
+    std::shared_ptr<Listing> _listing;
+};
+
+/* The handle given out by opendir() */
+struct LocalDirectoryPrefetcher::Handle
+{
+    std::shared_ptr<Listing> listing;
+};
+
+LocalDirectoryPrefetcher::LocalDirectoryPrefetcher(int threadCount, Filter filter)
+    : _filter(std::move(filter))
+{
+    _pool.setMaxThreadCount(threadCount);
+}
+
+LocalDirectoryPrefetcher::~LocalDirectoryPrefetcher()
+{
+    {
+        QMutexLocker lock(&_mutex);
+        _stopping = true;
+    }
+    _pool.clear();
+    _pool.waitForDone();
+}
+
+int LocalDirectoryPrefetcher::defaultThreadCount()
+{
+    static int threads = [] {
+        bool ok = false;
+        int env = qEnvironmentVariableIntValue("OWNCLOUD_LOCAL_DISCOVERY_THREADS", &ok);
+        if (ok)
+            return env;
+        return qBound(2, QThread::idealThreadCount(), 8);
+    }();
+    return threads;
+}
+
+void LocalDirectoryPrefetcher::readListing(const QByteArray &name, Listing *listing)
+{
+    errno = 0;
+    csync_vio_handle_t *dh = csync_vio_local_opendir(name.constData());
+    if (!dh) {
+        listing->openErrno = errno ? errno : EIO;
+        return;
+    }
+    while (true) {
+        errno = 0;
+        auto entry = csync_vio_local_readdir(dh);
+        if (!entry) {
+            listing->readErrno = errno;
+            break;
+        }
+        listing->entries.push_back(std::move(entry));
+    }
+    csync_vio_local_closedir(dh);
+}
+
+void LocalDirectoryPrefetcher::runJob(const QByteArray &name, const std::shared_ptr<Listing> &listing)
+{
+    {
+        QMutexLocker lock(&_mutex);
+        // The walker may have taken over this directory already
+        if (_stopping || listing->state != Listing::Queued)
+            return;
+        listing->state = Listing::Running;
+    }
+
+    readListing(name, listing.get());
+
+    QMutexLocker lock(&_mutex);
+    listing->state = Listing::Done;
+    _listingDone.wakeAll();
+}
+
+void LocalDirectoryPrefetcher::scheduleChildren(const QByteArray &name, const Listing &listing)
+{
+    for (const auto &entry : listing.entries) {
+        if (entry->type != ItemTypeDirectory || entry->path.isEmpty())
+            continue;
+        QByteArray childName = name + '/' + entry->path;
+        if (_filter && !_filter(childName))
+            continue;
+
+        auto child = std::make_shared<Listing>();
+        {
+            QMutexLocker lock(&_mutex);
+            if (_listings.contains(childName))
+                continue;
+            _listings.insert(childName, child);
+        }
+        _pool.start(new Job(this, childName, child));
+    }
+}
+
+csync_vio_handle_t *LocalDirectoryPrefetcher::opendir(const char *name)
+{
+    const QByteArray dirName(name);
+    std::shared_ptr<Listing> listing;
+    bool readNow = true;
+    {
+        QMutexLocker lock(&_mutex);
+        listing = _listings.take(dirName);
+        if (listing) {
+            if (listing->state == Listing::Queued) {
+                // Not started yet: don't wait for the pool
+                listing->state = Listing::Running;
+            } else {
+                readNow = false;
+                while (listing->state != Listing::Done)
+                    _listingDone.wait(&_mutex);
+            }
+        }
+    }
+    if (!listing)
+        listing = std::make_shared<Listing>();
+    if (readNow)
+        readListing(dirName, listing.get());
+
+    if (listing->openErrno) {
+        errno = listing->openErrno;
+        return nullptr;
+    }
+
+    scheduleChildren(dirName, *listing);
+
+    auto handle = new Handle;
+    handle->listing = std::move(listing);
+    return handle;
+}
+
+std::unique_ptr<csync_file_stat_t> LocalDirectoryPrefetcher::readdir(csync_vio_handle_t *dhandle)
+{
+    auto handle = static_cast<Handle *>(dhandle);
+    Listing &listing = *handle->listing;
+    if (listing.next < listing.entries.size())
+        return std::move(listing.entries[listing.next++]);
+    errno = listing.readErrno;
+    return {};
+}
+
+int LocalDirectoryPrefetcher::closedir(csync_vio_handle_t *dhandle)
+{
+    if (!dhandle) {
+        errno = EBADF;
+        return -1;
+    }
+    delete static_cast<Handle *>(dhandle);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/*
+ * libcsync -- a library to sync a directory with another
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef _CSYNC_VIO_LOCAL_PREFETCH_H
+#define _CSYNC_VIO_LOCAL_PREFETCH_H
+
+#include "csync.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+#include <functional>
+#include <memory>
+
+/**
+ * Reads local directories ahead of the update phase on a thread pool.
+ *
+ * Whenever the walker opens a directory, the listings of its sub directories
+ * are scheduled on the pool, so the latency of reading and stat'ing the
+ * entries of independent directories overlaps.
+ *
+ * The update detection itself stays sequential: csync_ftw consumes the
+ * listings in its usual depth-first order through csync_vio_readdir(), so
+ * the child_modified and has_ignored_files propagation is unchanged.
+ *
+ * If the walker needs a listing that a worker hasn't started yet, it reads
+ * the directory itself instead of waiting for the pool.
+ */
+class OCSYNC_EXPORT LocalDirectoryPrefetcher
+{
+public:
+    /** Decides whether a sub directory (absolute path) is worth reading ahead */
+    typedef std::function<bool(const QByteArray &)> Filter;
+
+    LocalDirectoryPrefetcher(int threadCount, Filter filter);
+    ~LocalDirectoryPrefetcher();
+
+    /** Like csync_vio_local_opendir(). Sets errno and returns nullptr on failure. */
+    csync_vio_handle_t *opendir(const char *name);
+    std::unique_ptr<csync_file_stat_t> readdir(csync_vio_handle_t *dhandle);
+    int closedir(csync_vio_handle_t *dhandle);
+
+    /**
+     * Number of threads to use for the local discovery.
+     *
+     * Can be overridden with OWNCLOUD_LOCAL_DISCOVERY_THREADS; a value
+     * below 2 disables the prefetching.
+     */
+    static int defaultThreadCount();
+
+private:
+    struct Listing;
+    struct Handle;
+    class Job;
+
+    static void readListing(const QByteArray &name, Listing *listing);
+    void runJob(const QByteArray &name, const std::shared_ptr<Listing> &listing);
+    void scheduleChildren(const QByteArray &name, const Listing &listing);
+
+    Filter _filter;
+    QThreadPool _pool;
+    QMutex _mutex;
+    QWaitCondition _listingDone;
+    QHash<QByteArray, std::shared_ptr<Listing>> _listings;
+    bool _stopping = false;
+};
+
+#endif /* _CSYNC_VIO_LOCAL_PREFETCH_H */
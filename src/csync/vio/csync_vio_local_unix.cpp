@@ -19,6 +19,12 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
  */
 
+#include "config_csync.h"
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -26,6 +32,8 @@
 #include <dirent.h>
 #include <stdio.h>
 
+#include <atomic>
+
 #include "c_private.h"
 #include "c_lib.h"
 #include "c_string.h"
@@ -44,22 +52,25 @@ Q_LOGGING_CATEGORY(lcCSyncVIOLocal, "sync.csync.vio_local", QtInfoMsg)
 typedef struct dhandle_s {
   DIR *dh;
   char *path;
+  /* Only used when entries can't be stat'ed relative to the directory fd. */
+  QByteArray fullPath;
 } dhandle_t;
 
 static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf);
+static int _csync_vio_local_stat_at(dhandle_t *handle, const char *name, csync_file_stat_t *buf);
 
 csync_vio_handle_t *csync_vio_local_opendir(const char *name) {
   dhandle_t *handle = NULL;
   mbchar_t *dirname = NULL;
 
-  handle = (dhandle_t*)c_malloc(sizeof(dhandle_t));
+  handle = new dhandle_t;
 
   dirname = c_utf8_path_to_locale(name);
 
   handle->dh = _topendir( dirname );
   if (handle->dh == NULL) {
     c_free_locale_string(dirname);
-    SAFE_FREE(handle);
+    delete handle;
     return NULL;
   }
 
@@ -82,7 +93,7 @@ int csync_vio_local_closedir(csync_vio_handle_t *dhandle) {
   rc = _tclosedir(handle->dh);
 
   SAFE_FREE(handle->path);
-  SAFE_FREE(handle);
+  delete handle;
 
   return rc;
 }
@@ -103,9 +114,8 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
 
   file_stat.reset(new csync_file_stat_t);
   file_stat->path = c_utf8_from_locale(dirent->d_name);
-  QByteArray fullPath = QByteArray() % const_cast<const char *>(handle->path) % '/' % QByteArray() % const_cast<const char *>(dirent->d_name);
   if (file_stat->path.isNull()) {
-      file_stat->original_path = fullPath;
+      file_stat->original_path = QByteArray() % const_cast<const char *>(handle->path) % '/' % QByteArray() % const_cast<const char *>(dirent->d_name);
       qCWarning(lcCSyncVIOLocal) << "Invalid characters in file/directory name, please rename:" << dirent->d_name << handle->path;
   }
 
@@ -113,9 +123,12 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
 #if defined(_DIRENT_HAVE_D_TYPE) || defined(__APPLE__)
   switch (dirent->d_type) {
     case DT_FIFO:
-    case DT_SOCK:
     case DT_CHR:
     case DT_BLK:
+      // Never synced: no need to stat them, csync_walker skips them.
+      file_stat->type = ItemTypeSkip;
+      return file_stat;
+    case DT_SOCK:
       break;
     case DT_DIR:
     case DT_REG:
@@ -133,7 +146,7 @@ std::unique_ptr<csync_file_stat_t> csync_vio_local_readdir(csync_vio_handle_t *d
   if (file_stat->path.isNull())
       return file_stat;
 
-  if (_csync_vio_local_stat_mb(fullPath.constData(), file_stat.get()) < 0) {
+  if (_csync_vio_local_stat_at(handle, dirent->d_name, file_stat.get()) < 0) {
       // Will get excluded by _csync_detect_update.
       file_stat->type = ItemTypeSkip;
   }
@@ -150,15 +163,9 @@ int csync_vio_local_stat(const char *uri, csync_file_stat_t *buf)
     return rc;
 }
 
-static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf)
+static void _csync_vio_local_fill_stat(mode_t mode, uint64_t inode, time_t modtime, int64_t size, csync_file_stat_t *buf)
 {
-    csync_stat_t sb;
-
-    if (_tstat(wuri, &sb) < 0) {
-        return -1;
-    }
-
-    switch (sb.st_mode & S_IFMT) {
+    switch (mode & S_IFMT) {
     case S_IFDIR:
       buf->type = ItemTypeDirectory;
       break;
@@ -174,14 +181,73 @@ static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf
       break;
   }
 
+  buf->inode = inode;
+  buf->modtime = modtime;
+  buf->size = size;
+}
+
+static int _csync_vio_local_stat_mb(const mbchar_t *wuri, csync_file_stat_t *buf)
+{
+    csync_stat_t sb;
+
+    if (_tstat(wuri, &sb) < 0) {
+        return -1;
+    }
+
+    _csync_vio_local_fill_stat(sb.st_mode, sb.st_ino, sb.st_mtime, sb.st_size, buf);
+
 #ifdef __APPLE__
   if (sb.st_flags & UF_HIDDEN) {
       buf->is_hidden = true;
   }
 #endif
-
-  buf->inode = sb.st_ino;
-  buf->modtime = sb.st_mtime;
-  buf->size = sb.st_size;
   return 0;
 }
+
+/*
+ * Stat an entry of the directory that is being read.
+ *
+ * The lookup is done relative to the open directory instead of re-resolving
+ * the full path from the sync root for every entry. With statx only the
+ * fields that are needed for the discovery are requested.
+ */
+static int _csync_vio_local_stat_at(dhandle_t *handle, const char *name, csync_file_stat_t *buf)
+{
+#if defined(HAVE_STATX)
+    // statx may be unavailable at runtime (old kernel, seccomp filters)
+    static std::atomic<bool> statxUnsupported(false);
+    if (!statxUnsupported) {
+        struct statx sx;
+        if (statx(dirfd(handle->dh), name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT,
+                STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME, &sx) == 0) {
+            _csync_vio_local_fill_stat(sx.stx_mode, sx.stx_ino, sx.stx_mtime.tv_sec, sx.stx_size, buf);
+            return 0;
+        }
+        if (errno != ENOSYS && errno != EPERM) {
+            return -1;
+        }
+        statxUnsupported = true;
+    }
+#endif
+#if defined(HAVE_FSTATAT)
+    csync_stat_t sb;
+    if (fstatat(dirfd(handle->dh), name, &sb, AT_SYMLINK_NOFOLLOW) < 0) {
+        return -1;
+    }
+    _csync_vio_local_fill_stat(sb.st_mode, sb.st_ino, sb.st_mtime, sb.st_size, buf);
+#ifdef __APPLE__
+    if (sb.st_flags & UF_HIDDEN) {
+        buf->is_hidden = true;
+    }
+#endif
+    return 0;
+#else
+    // Reuse the buffer of the previous entry: only the name part changes.
+    const int dirLength = int(strlen(handle->path)) + 1;
+    handle->fullPath.resize(dirLength);
+    memcpy(handle->fullPath.data(), handle->path, dirLength - 1);
+    handle->fullPath[dirLength - 1] = '/';
+    handle->fullPath.append(name);
+    return _csync_vio_local_stat_mb(handle->fullPath.constData(), buf);
+#endif
+}
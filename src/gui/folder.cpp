@@ -127,6 +127,10 @@ Folder::Folder(const FolderDefinition &definition,
     connect(&_scheduleSelfTimer, &QTimer::timeout,
         this, &Folder::slotScheduleThisFolder);
 
+    _progressForwardTimer.setSingleShot(true);
+    connect(&_progressForwardTimer, &QTimer::timeout,
+        this, &Folder::slotForwardPendingProgress);
+
     connect(ProgressDispatcher::instance(), &ProgressDispatcher::folderConflicts,
         this, &Folder::slotFolderConflicts);
 #ifdef LOCAL_FOLDER_ENCRYPTION
@@ -314,6 +318,51 @@ void Folder::setIgnoreHiddenFiles(bool ignore)
     _definition.ignoreHiddenFiles = ignore;
 }
 
+bool Folder::downloadVirtualFile(const QString &relativePath)
+{
+    return requestTypeChange(relativePath, ItemTypeVirtualFile, ItemTypeVirtualFileDownload);
+}
+
+bool Folder::dehydrateFile(const QString &relativePath)
+{
+    return requestTypeChange(relativePath, ItemTypeFile, ItemTypeVirtualFileDehydration);
+}
+
+bool Folder::requestTypeChange(const QString &relativePath, ItemType from, ItemType to)
+{
+    SyncJournalFileRecord record;
+    if (!_journal.getFileRecord(relativePath, &record) || record._type != from)
+        return false;
+
+    // The running sync owns the journal, the request waits until it is done
+    _pendingTypeChanges[record._path] = to;
+    if (isBusy())
+        return true;
+    applyPendingTypeChanges();
+    FolderMan::instance()->scheduleFolder(this);
+    return true;
+}
+
+void Folder::applyPendingTypeChanges()
+{
+    for (const auto &change : _pendingTypeChanges) {
+        SyncJournalFileRecord record;
+        if (!_journal.getFileRecord(change.first, &record) || !record.isValid())
+            continue;
+        // The sync may have changed the file in the meantime
+        if (change.second == ItemTypeVirtualFileDownload ? record._type != ItemTypeVirtualFile
+                                                         : record._type != ItemTypeFile)
+            continue;
+
+        record._type = change.second;
+        _journal.setFileRecord(record);
+        // Make sure the remote directory is listed, the etags didn't change
+        _journal.avoidReadFromDbOnNextSync(record._path);
+        _localDiscoveryPaths.insert(record._path);
+    }
+    _pendingTypeChanges.clear();
+}
+
 QString Folder::cleanPath() const
 {
     QString cleanedPath = QDir::cleanPath(_canonicalLocalPath);
@@ -623,7 +672,7 @@ void Folder::slotWatchedPathChanged(const QString &path)
 
     // Check that the mtime actually changed.
     SyncJournalFileRecord record;
-    if (_journal.getFileRecord(relativePathBytes, &record)
+    if (_journal.getCommittedFileRecord(relativePathBytes, &record)
         && record.isValid()
         && !FileSystem::fileChanged(path, record._fileSize, record._modtime)) {
         qCInfo(lcFolder) << "Ignoring spurious notification for file" << relativePath;
@@ -822,6 +871,7 @@ void Folder::setSyncOptions()
     opt._newBigFolderSizeLimit = newFolderLimit.first ? newFolderLimit.second * 1000LL * 1000LL : -1; // convert from MB to B
     opt._confirmExternalStorage = cfgFile.confirmExternalStorage();
     opt._moveFilesToTrash = cfgFile.moveToTrash();
+    opt._newFilesAreVirtual = _definition.useVirtualFiles;
 
     QByteArray chunkSizeEnv = qgetenv("OWNCLOUD_CHUNK_SIZE");
     if (!chunkSizeEnv.isEmpty()) {
@@ -856,6 +906,38 @@ void Folder::setSyncOptions()
         opt._targetChunkUploadDuration = cfgFile.targetChunkUploadDuration();
     }
 
+    QByteArray parallelChunkUploadsEnv = qgetenv("OWNCLOUD_PARALLEL_CHUNK_UPLOADS");
+    if (!parallelChunkUploadsEnv.isEmpty()) {
+        opt._parallelChunkUploads = parallelChunkUploadsEnv.toInt();
+    } else {
+        opt._parallelChunkUploads = cfgFile.parallelChunkUploads();
+    }
+
+    QByteArray minRangedDownloadSizeEnv = qgetenv("OWNCLOUD_MIN_RANGED_DOWNLOAD_SIZE");
+    if (!minRangedDownloadSizeEnv.isEmpty()) {
+        opt._minRangedDownloadSize = minRangedDownloadSizeEnv.toULongLong();
+    } else {
+        opt._minRangedDownloadSize = cfgFile.minRangedDownloadSize();
+    }
+    QByteArray parallelDownloadRangesEnv = qgetenv("OWNCLOUD_PARALLEL_DOWNLOAD_RANGES");
+    if (!parallelDownloadRangesEnv.isEmpty()) {
+        opt._parallelDownloadRanges = parallelDownloadRangesEnv.toInt();
+    } else {
+        opt._parallelDownloadRanges = cfgFile.parallelDownloadRanges();
+    }
+    QByteArray warmUpConnectionsEnv = qgetenv("OWNCLOUD_WARM_UP_CONNECTIONS");
+    if (!warmUpConnectionsEnv.isEmpty()) {
+        opt._warmUpConnections = warmUpConnectionsEnv.toInt();
+    } else {
+        opt._warmUpConnections = cfgFile.warmUpConnections();
+    }
+    QByteArray discoveryPipelineDepthEnv = qgetenv("OWNCLOUD_DISCOVERY_PIPELINE_DEPTH");
+    if (!discoveryPipelineDepthEnv.isEmpty()) {
+        opt._discoveryPipelineDepth = discoveryPipelineDepthEnv.toInt();
+    } else {
+        opt._discoveryPipelineDepth = cfgFile.discoveryPipelineDepth();
+    }
+
     _engine->setSyncOptions(opt);
 }
 
@@ -992,6 +1074,12 @@ void Folder::slotSyncFinished(bool success)
         // the folder again.
         scheduleThisFolderSoon();
     }
+
+    // Requests that came in during the sync get their own
+    if (!_pendingTypeChanges.empty()) {
+        applyPendingTypeChanges();
+        scheduleThisFolderSoon();
+    }
 }
 
 void Folder::slotEmitFinishedDelayed()
@@ -1010,10 +1098,46 @@ void Folder::slotEmitFinishedDelayed()
     }
 }
 
+static const int progressForwardIntervalMs = 200;
+
 // the progress comes without a folder and the valid path set. Add that here
 // and hand the result over to the progress dispatcher.
+//
+// The receivers look at every item in progress, and the engine reports the
+// byte progress of running transfers many times per second. Such updates
+// are forwarded at most every progressForwardIntervalMs; status changes and
+// completed items are always forwarded immediately.
 void Folder::slotTransmissionProgress(const ProgressInfo &pi)
 {
+    const bool onlyBytesChanged = pi.status() == ProgressInfo::Propagation
+        && pi.status() == _lastForwardedStatus
+        && pi.completedFiles() == _lastForwardedCompletedFiles;
+    if (onlyBytesChanged && _lastProgressForward.isValid()) {
+        const qint64 elapsed = _lastProgressForward.elapsed();
+        if (elapsed < progressForwardIntervalMs) {
+            _pendingProgress = &pi;
+            if (!_progressForwardTimer.isActive())
+                _progressForwardTimer.start(progressForwardIntervalMs - int(elapsed));
+            return;
+        }
+    }
+    forwardProgress(pi);
+}
+
+void Folder::slotForwardPendingProgress()
+{
+    if (_pendingProgress)
+        forwardProgress(*_pendingProgress);
+}
+
+void Folder::forwardProgress(const ProgressInfo &pi)
+{
+    _progressForwardTimer.stop();
+    _pendingProgress = nullptr;
+    _lastProgressForward.start();
+    _lastForwardedStatus = pi.status();
+    _lastForwardedCompletedFiles = pi.completedFiles();
+
     emit progressInfo(pi);
     ProgressDispatcher::instance()->setProgressInfo(alias(), pi);
 }
@@ -1266,6 +1390,7 @@ void FolderDefinition::save(QSettings &settings, const FolderDefinition &folder)
     settings.setValue(QLatin1String("targetPath"), folder.targetPath);
     settings.setValue(QLatin1String("paused"), folder.paused);
     settings.setValue(QLatin1String("ignoreHiddenFiles"), folder.ignoreHiddenFiles);
+    settings.setValue(QLatin1String("useVirtualFiles"), folder.useVirtualFiles);
 
     // Happens only on Windows when the explorer integration is enabled.
     if (!folder.navigationPaneClsid.isNull())
@@ -1286,6 +1411,7 @@ bool FolderDefinition::load(QSettings &settings, const QString &alias,
     folder->targetPath = settings.value(QLatin1String("targetPath")).toString();
     folder->paused = settings.value(QLatin1String("paused")).toBool();
     folder->ignoreHiddenFiles = settings.value(QLatin1String("ignoreHiddenFiles"), QVariant(true)).toBool();
+    folder->useVirtualFiles = settings.value(QLatin1String("useVirtualFiles"), false).toBool();
     folder->navigationPaneClsid = settings.value(QLatin1String("navigationPaneClsid")).toUuid();
     settings.endGroup();
 
@@ -27,6 +27,7 @@
 #include <QObject>
 #include <QStringList>
 #include <QUuid>
+#include <map>
 #include <set>
 
 #ifdef LOCAL_FOLDER_ENCRYPTION
@@ -53,6 +54,7 @@ public:
     FolderDefinition()
         : paused(false)
         , ignoreHiddenFiles(false)
+        , useVirtualFiles(false)
     {
     }
 
@@ -68,6 +70,8 @@ public:
     bool paused;
     /// whether the folder syncs hidden files
     bool ignoreHiddenFiles;
+    /// whether new remote files only get a placeholder instead of being downloaded
+    bool useVirtualFiles;
     /// the folder has client side encryption
     bool isClientSideEncrypted;
     /// The CLSID where this folder appears in registry for the Explorer navigation pane entry.
@@ -210,6 +214,23 @@ public:
     bool ignoreHiddenFiles();
     void setIgnoreHiddenFiles(bool ignore);
 
+    /**
+      * Whether new remote files are created as virtual files. This is
+      * defined in the folder definition
+      */
+    bool useVirtualFiles() const { return _definition.useVirtualFiles; }
+
+    /**
+      * Downloads the virtual file with the placeholder at \a relativePath,
+      * or replaces the file at \a relativePath by a virtual file, in the next
+      * sync, which gets scheduled. The request is written to the journal when
+      * no sync is running.
+      *
+      * Returns false if the path isn't a virtual file or a synced file, respectively.
+      */
+    bool downloadVirtualFile(const QString &relativePath);
+    bool dehydrateFile(const QString &relativePath);
+
     // Used by the Socket API
     SyncJournalDb *journalDb() { return &_journal; }
     SyncEngine &syncEngine() { return *_engine; }
@@ -305,6 +326,13 @@ public slots:
        */
     void slotWatchedPathChanged(const QString &path);
 
+    /**
+     * Compares a freshly fetched root etag with the last known one and
+     * schedules a sync if it changed. Called by the folder's own etag job
+     * and by FolderMan when it polls several folders with one request.
+     */
+    void etagRetreived(const QString &);
+
 private slots:
     void slotSyncStarted();
     void slotSyncFinished(bool);
@@ -316,10 +344,10 @@ private slots:
     void slotCsyncUnavailable();
 
     void slotTransmissionProgress(const ProgressInfo &pi);
+    void slotForwardPendingProgress();
     void slotItemCompleted(const SyncFileItemPtr &);
 
     void slotRunEtagJob();
-    void etagRetreived(const QString &);
     void etagRetreivedFromSyncEngine(const QString &);
 
     void slotEmitFinishedDelayed();
@@ -358,6 +386,12 @@ private:
 
     void setSyncOptions();
 
+    /** Queues a type change of the record at \a relativePath, see downloadVirtualFile() */
+    bool requestTypeChange(const QString &relativePath, ItemType from, ItemType to);
+
+    /** Writes the queued type changes to the journal, only call it between syncs */
+    void applyPendingTypeChanges();
+
     enum LogStatus {
         LogStatusRemove,
         LogStatusRename,
@@ -400,6 +434,16 @@ private:
 
     QTimer _scheduleSelfTimer;
 
+    /** Forwards the ProgressInfo to the GUI, see slotTransmissionProgress() */
+    void forwardProgress(const ProgressInfo &pi);
+
+    /// Last progress that was held back by the rate limit, owned by _engine.
+    const ProgressInfo *_pendingProgress = nullptr;
+    QTimer _progressForwardTimer;
+    QElapsedTimer _lastProgressForward;
+    ProgressInfo::Status _lastForwardedStatus = ProgressInfo::Starting;
+    quint64 _lastForwardedCompletedFiles = 0;
+
     /**
      * When the same local path is synced to multiple accounts, only one
      * of them can be stored in the settings in a way that's compatible
@@ -432,6 +476,12 @@ private:
      * again when the sync is done to make sure everything is retried.
      */
     std::set<QByteArray> _previousLocalDiscoveryPaths;
+
+    /**
+     * Virtual file downloads and dehydrations that were requested while a
+     * sync was running. Maps the path to the requested record type.
+     */
+    std::map<QByteArray, ItemType> _pendingTypeChanges;
 };
 }
 
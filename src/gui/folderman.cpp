@@ -106,6 +106,7 @@ void FolderMan::unloadFolder(Folder *f)
     _socketApi->slotUnregisterPath(f->alias());
 
     _folderMap.remove(f->alias());
+    _foldersInBatchedEtagJob.remove(f);
 
     disconnect(f, &Folder::syncStarted,
         this, &FolderMan::slotFolderSyncStarted);
@@ -725,6 +726,10 @@ void FolderMan::slotEtagPollTimerTimeout()
     ConfigFile cfg;
     auto polltime = cfg.remotePollInterval();
 
+    // Folders due for an etag check, grouped by account and parent collection
+    // so that siblings can share one PROPFIND.
+    QMap<QPair<AccountState *, QString>, QVector<Folder *>> dueFolders;
+
     foreach (Folder *f, _folderMap) {
         if (!f) {
             continue;
@@ -738,14 +743,98 @@ void FolderMan::slotEtagPollTimerTimeout()
         if (_disabledFolders.contains(f)) {
             continue;
         }
-        if (f->etagJob() || f->isBusy() || !f->canSync()) {
+        if (f->etagJob() || _foldersInBatchedEtagJob.contains(f) || f->isBusy() || !f->canSync()) {
             continue;
         }
         if (f->msecSinceLastSync() < polltime) {
             continue;
         }
-        QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+
+        // The etag of a subfolder only covers its whole subtree on servers
+        // that propagate etag changes upwards, see RequestEtagJob::start().
+        const QString parentPath = etagListingParentPath(f->remotePath());
+        if (parentPath.isNull() || !f->accountState()->account()->rootEtagChangesNotOnlySubFolderEtags()) {
+            QMetaObject::invokeMethod(f, "slotRunEtagJob", Qt::QueuedConnection);
+            continue;
+        }
+        dueFolders[qMakePair(f->accountState(), parentPath)].append(f);
     }
+
+    for (auto it = dueFolders.constBegin(); it != dueFolders.constEnd(); ++it) {
+        if (it.value().size() == 1) {
+            QMetaObject::invokeMethod(it.value().first(), "slotRunEtagJob", Qt::QueuedConnection);
+        } else {
+            runBatchedEtagJob(it.key().first, it.key().second, it.value());
+        }
+    }
+}
+
+QString FolderMan::etagListingParentPath(const QString &remotePath)
+{
+    QString path = remotePath;
+    while (path.endsWith(QLatin1Char('/')))
+        path.chop(1);
+    int slash = path.lastIndexOf(QLatin1Char('/'));
+    if (slash < 0)
+        return QString();
+    if (slash == 0)
+        return QStringLiteral("/");
+    return path.left(slash);
+}
+
+void FolderMan::runBatchedEtagJob(AccountState *accountState, const QString &parentPath, const QVector<Folder *> &folders)
+{
+    // Maps the name of each folder root inside parentPath to its folder
+    auto pending = QSharedPointer<QHash<QString, QPointer<Folder>>>::create();
+    for (auto f : folders) {
+        QString remotePath = f->remotePath();
+        while (remotePath.endsWith(QLatin1Char('/')))
+            remotePath.chop(1);
+        pending->insert(remotePath.mid(remotePath.lastIndexOf(QLatin1Char('/')) + 1), f);
+        _foldersInBatchedEtagJob.insert(f);
+    }
+
+    qCInfo(lcFolderMan) << "Checking" << folders.size() << "folders of" << accountState->account()->displayName()
+                        << "for changes via one ETag listing of" << parentPath;
+
+    auto job = new LsColJob(accountState->account(), parentPath, this);
+    job->setProperties(QList<QByteArray>() << "getetag");
+    job->setTimeout(60 * 1000);
+
+    connect(job, &LsColJob::directoryListingIterated, this,
+        [job, pending](const QString &href, const QMap<QString, QString> &properties) {
+            QString name = href.mid(job->reply()->request().url().path().size());
+            while (name.startsWith(QLatin1Char('/')))
+                name.remove(0, 1);
+            auto folder = pending->take(name);
+            if (folder && properties.contains(QStringLiteral("getetag"))) {
+                folder->etagRetreived(properties.value(QStringLiteral("getetag")));
+            }
+        });
+    connect(job, &LsColJob::finishedWithoutError, this, [pending]() {
+        for (const auto &folder : *pending) {
+            if (folder) {
+                qCInfo(lcFolderMan) << folder->remotePath() << "missing from the ETag listing, checking it on its own";
+                QMetaObject::invokeMethod(folder, "slotRunEtagJob", Qt::QueuedConnection);
+            }
+        }
+    });
+    connect(job, &LsColJob::finishedWithError, this, [pending](QNetworkReply *reply) {
+        // Without any HTTP status the network is down and single requests
+        // would fail just the same.
+        if (!reply || reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 0)
+            return;
+        for (const auto &folder : *pending) {
+            if (folder)
+                QMetaObject::invokeMethod(folder, "slotRunEtagJob", Qt::QueuedConnection);
+        }
+    });
+    connect(job, &QObject::destroyed, this, [this, folders]() {
+        for (auto f : folders)
+            _foldersInBatchedEtagJob.remove(f);
+    });
+
+    job->start();
 }
 
 void FolderMan::slotRemoveFoldersForAccount(AccountState *accountState)
@@ -19,6 +19,8 @@
 #include <QObject>
 #include <QQueue>
 #include <QList>
+#include <QSet>
+#include <QVector>
 
 #include "folder.h"
 #include "folderwatcher.h"
@@ -301,6 +303,22 @@ private:
 
     void setupFoldersHelper(QSettings &settings, AccountStatePtr account, bool backwardsCompatible);
 
+    /**
+     * Checks the root etags of several folders of one account with a single
+     * Depth-1 PROPFIND on their common parent collection.
+     *
+     * Folders that don't show up in the listing, or all of them if the server
+     * rejects the request, fall back to their own etag job.
+     */
+    void runBatchedEtagJob(AccountState *accountState, const QString &parentPath, const QVector<Folder *> &folders);
+
+    /**
+     * The collection whose Depth-1 listing contains the root of a folder at
+     * remotePath, "/" for top-level folders. Null for the account root, which
+     * can't be checked through a parent listing.
+     */
+    static QString etagListingParentPath(const QString &remotePath);
+
     QSet<Folder *> _disabledFolders;
     Folder::Map _folderMap;
     QString _folderConfigPath;
@@ -312,6 +330,8 @@ private:
     QTimer _etagPollTimer;
     /// The currently running etag query
     QPointer<RequestEtagJob> _currentEtagJob;
+    /// Folders whose etag is currently being checked by a batched query
+    QSet<Folder *> _foldersInBatchedEtagJob;
 
     /// Watches files that couldn't be synced due to locks
     QScopedPointer<LockWatcher> _lockWatcher;
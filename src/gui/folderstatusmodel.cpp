@@ -16,6 +16,7 @@
 #include "folderman.h"
 #include "accountstate.h"
 #include "common/asserts.h"
+#include "common/utility.h"
 #include <theme.h>
 #include <account.h>
 #include "folderstatusdelegate.h"
@@ -32,6 +33,7 @@ Q_LOGGING_CATEGORY(lcFolderStatus, "nextcloud.gui.folder.model", QtInfoMsg)
 
 static const char propertyParentIndexC[] = "oc_parentIndex";
 static const char propertyPermissionMap[] = "oc_permissionMap";
+static const char propertyKnownEtag[] = "oc_knownEtag";
 
 static QString removeTrailingSlash(const QString &s)
 {
@@ -575,6 +577,25 @@ void FolderStatusModel::fetchMore(const QModelIndex &parent)
     if (!info || info->_fetched || info->_fetchingJob)
         return;
     info->resetSubs(this, parent);
+
+    // The status of all encrypted folders of the account is fetched at once
+    if (info->_path == QLatin1String("/")
+        && _accountState->account()->capabilities().clientSideEncryptionAvaliable()) {
+        _accountState->account()->e2e()->fetchFolderEncryptedStatus();
+    }
+
+    // Show what the last sync saw right away and only list the folder on
+    // the server if it changed since.
+    QByteArray knownEtag;
+    if (populateFromJournal(info, parent, &knownEtag)) {
+        startRevalidation(info, parent, knownEtag);
+        return;
+    }
+    startLsCol(info, parent);
+}
+
+void FolderStatusModel::startLsCol(SubFolderInfo *info, const QModelIndex &parent)
+{
     QString path = info->_folder->remotePath();
     if (info->_path != QLatin1String("/")) {
         if (!path.endsWith(QLatin1Char('/'))) {
@@ -583,12 +604,6 @@ void FolderStatusModel::fetchMore(const QModelIndex &parent)
         path += info->_path;
     }
 
-		//TODO: This is the correct place, but this doesn't seems to be the right
-		// Way to call fetchFolderEncryptedStatus.
-		if (_accountState->account()->capabilities().clientSideEncryptionAvaliable()) {
-			_accountState->account()->e2e()->fetchFolderEncryptedStatus();
-		}
-
     LsColJob *job = new LsColJob(_accountState->account(), path, this);
     info->_fetchingJob = job;
     job->setProperties(QList<QByteArray>() << "resourcetype"
@@ -614,6 +629,112 @@ void FolderStatusModel::fetchMore(const QModelIndex &parent)
     QTimer::singleShot(1000, this, &FolderStatusModel::slotShowFetchProgress);
 }
 
+bool FolderStatusModel::populateFromJournal(SubFolderInfo *info, const QModelIndex &index, QByteArray *knownEtag)
+{
+    Folder *folder = info->_folder;
+    SyncJournalDb *journal = folder->journalDb();
+
+    // Excluded and undecided folders have no records
+    if (info->_checked != Qt::Checked)
+        return false;
+    const bool isRoot = info->_path == QLatin1String("/");
+    bool ok = false;
+    const auto undecidedList = journal->getSelectiveSyncList(SyncJournalDb::SelectiveSyncUndecidedList, &ok);
+    if (!ok)
+        return false;
+    foreach (const QString &undecided, undecidedList) {
+        if (isRoot || undecided.startsWith(info->_path))
+            return false;
+    }
+
+    const QString dirPath = isRoot ? QString() : removeTrailingSlash(info->_path);
+    if (isRoot) {
+        // The root has no record, the journal keeps its etag separately
+        *knownEtag = Utility::normalizeEtag(journal->rootEtag());
+    } else {
+        SyncJournalFileRecord record;
+        if (!journal->getFileRecord(dirPath, &record) || !record.isValid()
+            || record._type != ItemTypeDirectory) {
+            return false;
+        }
+        *knownEtag = Utility::normalizeEtag(record._etag);
+    }
+    if (knownEtag->isEmpty())
+        return false;
+
+    QHash<QString, SyncJournalFileRecord> records;
+    ok = journal->getFilesInDirectory(dirPath.toUtf8(), [&](const SyncJournalFileRecord &record) {
+        if (record._type == ItemTypeDirectory)
+            records.insert(QString::fromUtf8(record._path) + QLatin1Char('/'), record);
+    });
+    if (!ok)
+        return false;
+
+    QStringList sortedSubfolders = records.keys();
+    Utility::sortFilenames(sortedSubfolders);
+
+    QVector<SubFolderInfo> newSubs;
+    newSubs.reserve(sortedSubfolders.size());
+    foreach (const QString &relativePath, sortedSubfolders) {
+        if (folder->isFileExcludedRelative(relativePath))
+            continue;
+        const auto &record = records[relativePath];
+
+        SubFolderInfo newInfo;
+        newInfo._folder = folder;
+        newInfo._pathIdx = info->_pathIdx;
+        newInfo._pathIdx << newSubs.size();
+        newInfo._isExternal = record._remotePerm.hasPermission(RemotePermissions::IsMounted);
+        newInfo._path = relativePath;
+        newInfo._name = removeTrailingSlash(relativePath).split('/').last();
+        newInfo._size = record._fileSize;
+        newInfo._fileId = record._fileId;
+        newSubs.append(newInfo);
+    }
+
+    info->_lastErrorString.clear();
+    info->_fetched = true;
+    if (!newSubs.isEmpty()) {
+        beginInsertRows(index, 0, newSubs.size() - 1);
+        info->_subs = std::move(newSubs);
+        endInsertRows();
+    }
+    return true;
+}
+
+void FolderStatusModel::startRevalidation(SubFolderInfo *info, const QModelIndex &index, const QByteArray &knownEtag)
+{
+    QString path = info->_folder->remotePath();
+    if (info->_path != QLatin1String("/")) {
+        if (!path.endsWith(QLatin1Char('/')))
+            path += QLatin1Char('/');
+        path += info->_path;
+    }
+
+    auto job = new RequestEtagJob(_accountState->account(), path, this);
+    job->setProperty(propertyParentIndexC, QVariant::fromValue(QPersistentModelIndex(index)));
+    job->setProperty(propertyKnownEtag, knownEtag);
+    connect(job, &RequestEtagJob::etagRetreived, this, &FolderStatusModel::slotRevalidationEtagReceived);
+    job->start();
+}
+
+void FolderStatusModel::slotRevalidationEtagReceived(const QString &etag)
+{
+    auto job = sender();
+    QModelIndex idx = qvariant_cast<QPersistentModelIndex>(job->property(propertyParentIndexC));
+    auto info = infoForIndex(idx);
+    // Reset or fetched from the server in the meantime
+    if (!info || !info->_fetched || info->_fetchingJob)
+        return;
+
+    if (Utility::normalizeEtag(etag.toUtf8()) == job->property(propertyKnownEtag).toByteArray())
+        return;
+
+    qCInfo(lcFolderStatus) << "Subfolders of" << info->_path << "changed on the server, fetching them";
+    info->resetSubs(this, idx);
+    startLsCol(info, idx);
+}
+
 void FolderStatusModel::slotGatherPermissions(const QString &href, const QMap<QString, QString> &map)
 {
     auto it = map.find("permissions");
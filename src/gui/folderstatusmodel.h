@@ -143,6 +143,7 @@ private slots:
     void slotUpdateDirectories(const QStringList &);
     void slotGatherPermissions(const QString &name, const QMap<QString, QString> &properties);
     void slotLscolFinishedWithError(QNetworkReply *r);
+    void slotRevalidationEtagReceived(const QString &etag);
     void slotFolderSyncStateChange(Folder *f);
     void slotFolderScheduleQueueChanged();
     void slotNewBigFolder();
@@ -154,6 +155,17 @@ private slots:
     void slotShowFetchProgress();
 
 private:
+    /**
+     * Fills the subfolders of a synced folder from the journal.
+     *
+     * Returns false if the journal can't know them, because the folder or
+     * something below it is excluded by selective sync or wasn't synced yet.
+     * Otherwise knownEtag is set to the etag the journal's state belongs to.
+     */
+    bool populateFromJournal(SubFolderInfo *info, const QModelIndex &index, QByteArray *knownEtag);
+    void startRevalidation(SubFolderInfo *info, const QModelIndex &index, const QByteArray &knownEtag);
+    void startLsCol(SubFolderInfo *info, const QModelIndex &index);
+
     QStringList createBlackList(OCC::FolderStatusModel::SubFolderInfo *root,
         const QStringList &oldBlackList) const;
     const AccountState *_accountState;
@@ -1191,7 +1191,7 @@ void ownCloudGui::slotShowShareDialog(const QString &sharePath, const QString &l
     SyncJournalFileRecord fileRecord;
 
     bool resharingAllowed = true; // lets assume the good
-    if (folder->journalDb()->getFileRecord(file, &fileRecord) && fileRecord.isValid()) {
+    if (folder->journalDb()->getCommittedFileRecord(file, &fileRecord) && fileRecord.isValid()) {
         // check the permission: Is resharing allowed?
         if (!fileRecord._remotePerm.isNull() && !fileRecord._remotePerm.hasPermission(RemotePermissions::CanReshare)) {
             resharingAllowed = false;
@@ -31,6 +31,7 @@
 #include "account.h"
 #include "capabilities.h"
 #include "common/asserts.h"
+#include "common/tracing.h"
 #include "guiutility.h"
 #ifndef OWNCLOUD_TEST
 #include "sharemanager.h"
@@ -45,6 +46,7 @@
 #include <QScopedPointer>
 #include <QFile>
 #include <QDir>
+#include <QDateTime>
 #include <QApplication>
 #include <QLocalSocket>
 #include <QStringBuilder>
@@ -465,6 +467,28 @@ void SocketApi::command_SHARE_MENU_TITLE(const QString &, SocketListener *listen
     listener->sendMessage(QLatin1String("SHARE_MENU_TITLE:") + tr("Share with %1", "parameter is Nextcloud").arg(Theme::instance()->appNameGUI()));
 }
 
+void SocketApi::command_SET_TRACING(const QString &argument, SocketListener *listener)
+{
+    bool enable = argument == QLatin1String("1");
+    qCInfo(lcSocketApi) << "Tracing" << (enable ? "enabled" : "disabled");
+    Tracing::setEnabled(enable);
+    listener->sendMessage(QLatin1String("SET_TRACING:") + (enable ? QLatin1String("1") : QLatin1String("0")));
+}
+
+void SocketApi::command_DUMP_TRACE(const QString &, SocketListener *listener)
+{
+    QString fileName = QDir::temp().filePath(
+        QStringLiteral("%1-trace-%2.json")
+            .arg(Theme::instance()->appName(), QDateTime::currentDateTime().toString(QStringLiteral("yyyyMMdd-HHmmss"))));
+    QString error;
+    if (!Tracing::writeChromeTrace(fileName, &error)) {
+        qCWarning(lcSocketApi) << "Could not write trace to" << fileName << error;
+        listener->sendMessage(QLatin1String("DUMP_TRACE:ERROR:") + error);
+        return;
+    }
+    listener->sendMessage(QLatin1String("DUMP_TRACE:OK:") + QDir::toNativeSeparators(fileName));
+}
+
 // don't pull the share manager into socketapi unittests
 #ifndef OWNCLOUD_TEST
 
@@ -647,6 +671,24 @@ void SocketApi::command_OPEN_PRIVATE_LINK(const QString &localFile, SocketListen
     fetchPrivateLinkUrlHelper(localFile, &SocketApi::openPrivateLink);
 }
 
+void SocketApi::command_DOWNLOAD_VIRTUAL_FILE(const QString &filesArg, SocketListener *)
+{
+    for (const auto &file : filesArg.split(QLatin1Char('\x1e'))) {
+        auto data = FileData::get(file);
+        if (!data.folder || !data.folder->downloadVirtualFile(data.folderRelativePath))
+            qCWarning(lcSocketApi) << "Not a virtual file" << file;
+    }
+}
+
+void SocketApi::command_REPLACE_BY_VIRTUAL_FILE(const QString &filesArg, SocketListener *)
+{
+    for (const auto &file : filesArg.split(QLatin1Char('\x1e'))) {
+        auto data = FileData::get(file);
+        if (!data.folder || !data.folder->dehydrateFile(data.folderRelativePath))
+            qCWarning(lcSocketApi) << "Not a synced file" << file;
+    }
+}
+
 void SocketApi::copyUrlToClipboard(const QString &link)
 {
     QApplication::clipboard()->setText(link);
@@ -752,7 +794,7 @@ SyncJournalFileRecord SocketApi::FileData::journalRecord() const
     SyncJournalFileRecord record;
     if (!folder)
         return record;
-    folder->journalDb()->getFileRecord(folderRelativePath, &record);
+    folder->journalDb()->getCommittedFileRecord(folderRelativePath, &record);
     return record;
 }
 
@@ -761,11 +803,18 @@ void SocketApi::command_GET_MENU_ITEMS(const QString &argument, OCC::SocketListe
     listener->sendMessage(QString("GET_MENU_ITEMS:BEGIN"));
     bool hasSeveralFiles = argument.contains(QLatin1Char('\x1e')); // Record Separator
     FileData fileData = hasSeveralFiles ? FileData{} : FileData::get(argument);
-    bool isOnTheServer = fileData.journalRecord().isValid();
+    auto record = fileData.journalRecord();
+    bool isOnTheServer = record.isValid();
     auto flagString = isOnTheServer ? QLatin1String("::") : QLatin1String(":d:");
     if (fileData.folder && fileData.folder->accountState()->isConnected()) {
         sendSharingContextMenuOptions(fileData, listener);
         listener->sendMessage(QLatin1String("MENU_ITEM:OPEN_PRIVATE_LINK") + flagString + tr("Open in browser"));
+
+        if (record._type == ItemTypeVirtualFile) {
+            listener->sendMessage(QLatin1String("MENU_ITEM:DOWNLOAD_VIRTUAL_FILE::") + tr("Download file"));
+        } else if (isOnTheServer && record._type == ItemTypeFile && fileData.folder->useVirtualFiles()) {
+            listener->sendMessage(QLatin1String("MENU_ITEM:REPLACE_BY_VIRTUAL_FILE::") + tr("Replace by virtual file"));
+        }
     }
     listener->sendMessage(QString("GET_MENU_ITEMS:END"));
 }
@@ -97,6 +97,13 @@ private:
 
     Q_INVOKABLE void command_SHARE_MENU_TITLE(const QString &argument, SocketListener *listener);
 
+    /** Performance tracing, see OCC::Tracing.
+     * SET_TRACING takes "1" or "0"; DUMP_TRACE writes the recorded spans as a Chrome
+     * trace to the temporary directory and replies with DUMP_TRACE:OK:[path]
+     */
+    Q_INVOKABLE void command_SET_TRACING(const QString &argument, SocketListener *listener);
+    Q_INVOKABLE void command_DUMP_TRACE(const QString &argument, SocketListener *listener);
+
     // The context menu actions
     Q_INVOKABLE void command_SHARE(const QString &localFile, SocketListener *listener);
     Q_INVOKABLE void command_MANAGE_PUBLIC_LINKS(const QString &localFile, SocketListener *listener);
@@ -105,6 +112,12 @@ private:
     Q_INVOKABLE void command_EMAIL_PRIVATE_LINK(const QString &localFile, SocketListener *listener);
     Q_INVOKABLE void command_OPEN_PRIVATE_LINK(const QString &localFile, SocketListener *listener);
 
+    /** Download the data of virtual files or replace files by virtual ones in the next sync.
+     * argument is a list of files separated by '\x1e'
+     */
+    Q_INVOKABLE void command_DOWNLOAD_VIRTUAL_FILE(const QString &filesArg, SocketListener *listener);
+    Q_INVOKABLE void command_REPLACE_BY_VIRTUAL_FILE(const QString &filesArg, SocketListener *listener);
+
     // Windows Shell / Explorer pinning fallbacks, see issue: https://github.com/nextcloud/desktop/issues/1599
 #ifdef Q_OS_WIN
     Q_INVOKABLE void command_COPYASPATH(const QString &localFile, SocketListener *listener);
@@ -283,6 +283,26 @@ SimpleNetworkJob *Account::sendRequest(const QByteArray &verb, const QUrl &url,
     return job;
 }
 
+void Account::warmUpConnections(int count)
+{
+    if (!_am) {
+        return;
+    }
+    // All requests share a single connection with HTTP/2
+    if (isHttp2Supported()) {
+        count = qMin(count, 1);
+    }
+
+    const QUrl serverUrl = url();
+    for (int i = 0; i < count; ++i) {
+        if (serverUrl.scheme() == QLatin1String("https")) {
+            _am->connectToHostEncrypted(serverUrl.host(), serverUrl.port(443), getOrCreateSslConfig());
+        } else {
+            _am->connectToHost(serverUrl.host(), serverUrl.port(80));
+        }
+    }
+}
+
 void Account::setSslConfiguration(const QSslConfiguration &config)
 {
     _sslConfiguration = config;
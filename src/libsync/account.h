@@ -155,6 +155,13 @@ public:
         QNetworkRequest req = QNetworkRequest(),
         QIODevice *data = nullptr);
 
+    /** Opens up to @a count connections to the server ahead of the requests
+     * that will use them, so that their TCP and TLS handshakes don't delay
+     * these requests. The TLS sessions are resumed with the shared ssl
+     * configuration when the server allows it.
+     */
+    void warmUpConnections(int count);
+
     /** The ssl configuration during the first connection */
     QSslConfiguration getOrCreateSslConfig();
     QSslConfiguration sslConfiguration() const { return _sslConfiguration; }
@@ -18,378 +18,294 @@
 #include "propagatorjobs.h"
 #include "common/utility.h"
 
-#ifdef Q_OS_WIN
-#include <windef.h>
-#include <winbase.h>
-#endif
-
 #include <QLoggingCategory>
 #include <QTimer>
 #include <QObject>
 
+#include <algorithm>
+
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcBandwidthManager, "nextcloud.sync.bandwidthmanager", QtInfoMsg)
 
-// Because of the many layers of buffering inside Qt (and probably the OS and the network)
-// we cannot lower this value much more. If we do, the estimated bw will be very high
-// because the buffers fill fast while the actual network algorithms are not relevant yet.
-static qint64 relativeLimitMeasuringTimerIntervalMsec = 1000 * 2;
-// See also WritingState in http://code.woboq.org/qt5/qtbase/src/network/access/qhttpprotocolhandler.cpp.html#_ZN20QHttpProtocolHandler11sendRequestEv
-
 // FIXME At some point:
 //  * Register device only after the QNR received its metaDataChanged() signal
 //  * Incorporate Qt buffer fill state (it's a negative absolute delta).
 //  * Incorporate SSL overhead (percentage)
-//  * For relative limiting, do less measuring and more delaying+giving quota
-//  * For relative limiting, smoothen measurements
+
+void TokenBucket::setRate(qint64 bytesPerSecond)
+{
+    _rate = qMax<qint64>(0, bytesPerSecond);
+    _tokens = qMin(_tokens, capacity());
+}
+
+qint64 TokenBucket::capacity() const
+{
+    return _rate * burstMsec / 1000;
+}
+
+void TokenBucket::refill(qint64 msec)
+{
+    _milliTokens += _rate * msec;
+    _tokens = qMin(_tokens + _milliTokens / 1000, capacity());
+    _milliTokens %= 1000;
+}
+
+void TokenBucket::putBack(qint64 tokens)
+{
+    _tokens = qMin(_tokens + tokens, capacity());
+}
+
+QVector<qint64> TokenBucket::distribute(const QVector<qint64> &demands)
+{
+    // Serve the smallest demands first, so what they leave of their equal
+    // share goes to the larger ones
+    QVector<int> order(demands.size());
+    for (int i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return demands[a] < demands[b]; });
+
+    QVector<qint64> grants(demands.size(), 0);
+    int remaining = order.size();
+    for (int i : order) {
+        const qint64 grant = qBound<qint64>(0, demands[i], _tokens / remaining);
+        grants[i] = grant;
+        _tokens -= grant;
+        --remaining;
+    }
+    return grants;
+}
 
 BandwidthManager::BandwidthManager(OwncloudPropagator *p)
     : QObject()
     , _propagator(p)
-    , _relativeLimitCurrentMeasuredDevice(nullptr)
-    , _relativeUploadLimitProgressAtMeasuringRestart(0)
-    , _currentUploadLimit(0)
-    , _relativeLimitCurrentMeasuredJob(nullptr)
-    , _currentDownloadLimit(0)
 {
-    _currentUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
-    _currentDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
-
-    QObject::connect(&_switchingTimer, &QTimer::timeout, this, &BandwidthManager::switchingTimerExpired);
-    _switchingTimer.setInterval(10 * 1000);
-    _switchingTimer.start();
-    QMetaObject::invokeMethod(this, "switchingTimerExpired", Qt::QueuedConnection);
-
-    // absolute uploads/downloads
-    QObject::connect(&_absoluteLimitTimer, &QTimer::timeout, this, &BandwidthManager::absoluteLimitTimerExpired);
-    _absoluteLimitTimer.setInterval(1000);
-    _absoluteLimitTimer.start();
-
-    // Relative uploads
-    QObject::connect(&_relativeUploadMeasuringTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeUploadMeasuringTimerExpired);
-    _relativeUploadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeUploadMeasuringTimer.start();
-    _relativeUploadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
-    QObject::connect(&_relativeUploadDelayTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeUploadDelayTimerExpired);
-    _relativeUploadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
-
-    // Relative downloads
-    QObject::connect(&_relativeDownloadMeasuringTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeDownloadMeasuringTimerExpired);
-    _relativeDownloadMeasuringTimer.setInterval(relativeLimitMeasuringTimerIntervalMsec);
-    _relativeDownloadMeasuringTimer.start();
-    _relativeDownloadMeasuringTimer.setSingleShot(true); // will be restarted from the delay timer
-    QObject::connect(&_relativeDownloadDelayTimer, &QTimer::timeout,
-        this, &BandwidthManager::relativeDownloadDelayTimerExpired);
-    _relativeDownloadDelayTimer.setSingleShot(true); // will be restarted from the measuring timer
 }
 
 BandwidthManager::~BandwidthManager()
 {
+    BandwidthScheduler::instance()->unregisterManager(this);
+}
+
+qint64 BandwidthManager::uploadLimit() const
+{
+    return _propagator->_uploadLimit.fetchAndAddAcquire(0);
+}
+
+qint64 BandwidthManager::downloadLimit() const
+{
+    return _propagator->_downloadLimit.fetchAndAddAcquire(0);
 }
 
 void BandwidthManager::registerUploadDevice(UploadDevice *p)
 {
-    _absoluteUploadDeviceList.append(p);
-    _relativeUploadDeviceList.append(p);
-    QObject::connect(p, &QObject::destroyed, this, &BandwidthManager::unregisterUploadDevice);
-
-    if (usingAbsoluteUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(false);
-    } else if (usingRelativeUploadLimit()) {
-        p->setBandwidthLimited(true);
-        p->setChoked(true);
-    } else {
-        p->setBandwidthLimited(false);
-        p->setChoked(false);
-    }
+    BandwidthScheduler::instance()->registerUpload(p, p, this);
 }
 
 void BandwidthManager::unregisterUploadDevice(QObject *o)
 {
-    auto p = reinterpret_cast<UploadDevice *>(o); // note, we might already be in the ~QObject
-    _absoluteUploadDeviceList.removeAll(p);
-    _relativeUploadDeviceList.removeAll(p);
-    if (p == _relativeLimitCurrentMeasuredDevice) {
-        _relativeLimitCurrentMeasuredDevice = nullptr;
-        _relativeUploadLimitProgressAtMeasuringRestart = 0;
-    }
+    BandwidthScheduler::instance()->unregisterTransfer(o);
 }
 
 void BandwidthManager::registerDownloadJob(GETFileJob *j)
 {
-    _downloadJobList.append(j);
-    QObject::connect(j, &QObject::destroyed, this, &BandwidthManager::unregisterDownloadJob);
-
-    if (usingAbsoluteDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(false);
-    } else if (usingRelativeDownloadLimit()) {
-        j->setBandwidthLimited(true);
-        j->setChoked(true);
-    } else {
-        j->setBandwidthLimited(false);
-        j->setChoked(false);
-    }
+    BandwidthScheduler::instance()->registerDownload(j, j, this);
 }
 
 void BandwidthManager::unregisterDownloadJob(QObject *o)
 {
-    GETFileJob *j = reinterpret_cast<GETFileJob *>(o); // note, we might already be in the ~QObject
-    _downloadJobList.removeAll(j);
-    if (_relativeLimitCurrentMeasuredJob == j) {
-        _relativeLimitCurrentMeasuredJob = nullptr;
-        _relativeDownloadLimitProgressAtMeasuringRestart = 0;
-    }
+    BandwidthScheduler::instance()->unregisterTransfer(o);
 }
 
-void BandwidthManager::relativeUploadMeasuringTimerExpired()
+BandwidthScheduler *BandwidthScheduler::instance()
 {
-    if (!usingRelativeUploadLimit() || _relativeUploadDeviceList.count() == 0) {
-        // Not in this limiting mode, just wait 1 sec to continue the cycle
-        _relativeUploadDelayTimer.setInterval(1000);
-        _relativeUploadDelayTimer.start();
-        return;
-    }
-    if (_relativeLimitCurrentMeasuredDevice == nullptr) {
-        qCDebug(lcBandwidthManager) << "No device set, just waiting 1 sec";
-        _relativeUploadDelayTimer.setInterval(1000);
-        _relativeUploadDelayTimer.start();
-        return;
-    }
-
-    qCDebug(lcBandwidthManager) << _relativeUploadDeviceList.count() << "Starting Delay";
-
-    qint64 relativeLimitProgressMeasured = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                               + _relativeLimitCurrentMeasuredDevice->_read)
-        / 2;
-    qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeUploadLimitProgressAtMeasuringRestart;
-    qCDebug(lcBandwidthManager) << _relativeUploadLimitProgressAtMeasuringRestart
-                                << relativeLimitProgressMeasured << relativeLimitProgressDifference;
+    static BandwidthScheduler *scheduler = new BandwidthScheduler;
+    return scheduler;
+}
 
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec * 1000.0) / 1024.0;
-    qCDebug(lcBandwidthManager) << relativeLimitProgressDifference / 1024 << "kB =>" << speedkBPerSec << "kB/sec on full speed ("
-                                << _relativeLimitCurrentMeasuredDevice->_readWithProgress << _relativeLimitCurrentMeasuredDevice->_read
-                                << qAbs(_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                       - _relativeLimitCurrentMeasuredDevice->_read)
-                                << ")";
+BandwidthScheduler::BandwidthScheduler(bool useTimer)
+    : _useTimer(useTimer)
+{
+    _timer.setInterval(tickMsec);
+    _timer.setTimerType(Qt::PreciseTimer);
+    connect(&_timer, &QTimer::timeout, this, &BandwidthScheduler::slotTick);
+}
 
-    qint64 uploadLimitPercent = -_currentUploadLimit;
-    // don't use too extreme values
-    uploadLimitPercent = qMin(uploadLimitPercent, qint64(90));
-    uploadLimitPercent = qMax(qint64(10), uploadLimitPercent);
-    qint64 wholeTimeMsec = (100.0 / uploadLimitPercent) * relativeLimitMeasuringTimerIntervalMsec;
-    qint64 waitTimeMsec = wholeTimeMsec - relativeLimitMeasuringTimerIntervalMsec;
-    qint64 realWaitTimeMsec = waitTimeMsec + wholeTimeMsec;
-    qCDebug(lcBandwidthManager) << waitTimeMsec << " - " << realWaitTimeMsec << " msec for " << uploadLimitPercent << "%";
-
-    // We want to wait twice as long since we want to give all
-    // devices the same quota we used now since we don't want
-    // any upload to timeout
-    _relativeUploadDelayTimer.setInterval(realWaitTimeMsec);
-    _relativeUploadDelayTimer.start();
-
-    int deviceCount = _relativeUploadDeviceList.count();
-    qint64 quotaPerDevice = relativeLimitProgressDifference * (uploadLimitPercent / 100.0) / deviceCount + 1.0;
-    Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-        ud->setBandwidthLimited(true);
-        ud->setChoked(false);
-        ud->giveBandwidthQuota(quotaPerDevice);
-        qCDebug(lcBandwidthManager) << "Gave" << quotaPerDevice / 1024.0 << "kB to" << ud;
-    }
-    _relativeLimitCurrentMeasuredDevice = nullptr;
+void BandwidthScheduler::registerUpload(QObject *object, BandwidthLimitedTransfer *transfer, BandwidthManager *manager)
+{
+    registerTransfer(_upload, Transfer{ object, transfer, manager, true, false, 0, 0 });
 }
 
-void BandwidthManager::relativeUploadDelayTimerExpired()
+void BandwidthScheduler::registerDownload(QObject *object, BandwidthLimitedTransfer *transfer, BandwidthManager *manager)
 {
-    // Switch to measuring state
-    _relativeUploadMeasuringTimer.start(); // always start to continue the cycle
+    registerTransfer(_download, Transfer{ object, transfer, manager, false, false, 0, 0 });
+}
 
-    if (!usingRelativeUploadLimit()) {
-        return; // oh, not actually needed
+void BandwidthScheduler::registerTransfer(Direction &direction, const Transfer &transfer)
+{
+    for (const auto &t : direction.transfers) {
+        if (t.object == transfer.object)
+            return;
     }
-
-    if (_relativeUploadDeviceList.isEmpty()) {
-        return;
+    direction.transfers.append(transfer);
+    auto &t = direction.transfers.last();
+    t.lastPosition = t.transfer->bandwidthPosition();
+    connect(t.object, &QObject::destroyed, this, &BandwidthScheduler::unregisterTransfer, Qt::UniqueConnection);
+
+    // A limited transfer waits for its first quota, which comes with the next tick
+    setLimited(t, limitOf(t) != 0);
+    t.transfer->setChoked(false);
+
+    if (_useTimer && !_timer.isActive()) {
+        _clock.start();
+        _timer.start();
     }
+}
 
-    qCDebug(lcBandwidthManager) << _relativeUploadDeviceList.count() << "Starting measuring";
-
-    // Take first device and then append it again (= we round robin all devices)
-    _relativeLimitCurrentMeasuredDevice = _relativeUploadDeviceList.takeFirst();
-    _relativeUploadDeviceList.append(_relativeLimitCurrentMeasuredDevice);
-
-    _relativeUploadLimitProgressAtMeasuringRestart = (_relativeLimitCurrentMeasuredDevice->_readWithProgress
-                                                         + _relativeLimitCurrentMeasuredDevice->_read)
-        / 2;
-    _relativeLimitCurrentMeasuredDevice->setBandwidthLimited(false);
-    _relativeLimitCurrentMeasuredDevice->setChoked(false);
-
-    // choke all other UploadDevices
-    Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-        if (ud != _relativeLimitCurrentMeasuredDevice) {
-            ud->setBandwidthLimited(true);
-            ud->setChoked(true);
-        }
+void BandwidthScheduler::unregisterTransfer(QObject *transfer)
+{
+    // note, we might already be in the ~QObject
+    for (auto direction : { &_upload, &_download }) {
+        auto &transfers = direction->transfers;
+        transfers.erase(std::remove_if(transfers.begin(), transfers.end(),
+                            [transfer](const Transfer &t) { return t.object == transfer; }),
+            transfers.end());
     }
-
-    // now we're in measuring state
 }
 
-// for downloads:
-void BandwidthManager::relativeDownloadMeasuringTimerExpired()
+void BandwidthScheduler::unregisterManager(BandwidthManager *manager)
 {
-    if (!usingRelativeDownloadLimit() || _downloadJobList.count() == 0) {
-        // Not in this limiting mode, just wait 1 sec to continue the cycle
-        _relativeDownloadDelayTimer.setInterval(1000);
-        _relativeDownloadDelayTimer.start();
-        return;
-    }
-    if (_relativeLimitCurrentMeasuredJob == nullptr) {
-        qCDebug(lcBandwidthManager) << "No job set, just waiting 1 sec";
-        _relativeDownloadDelayTimer.setInterval(1000);
-        _relativeDownloadDelayTimer.start();
-        return;
+    for (auto direction : { &_upload, &_download }) {
+        auto &transfers = direction->transfers;
+        transfers.erase(std::remove_if(transfers.begin(), transfers.end(),
+                            [manager](const Transfer &t) { return t.manager == manager; }),
+            transfers.end());
     }
+}
 
-    qCDebug(lcBandwidthManager) << _downloadJobList.count() << "Starting Delay";
-
-    qint64 relativeLimitProgressMeasured = _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-    qint64 relativeLimitProgressDifference = relativeLimitProgressMeasured - _relativeDownloadLimitProgressAtMeasuringRestart;
-    qCDebug(lcBandwidthManager) << _relativeDownloadLimitProgressAtMeasuringRestart
-                                << relativeLimitProgressMeasured << relativeLimitProgressDifference;
+void BandwidthScheduler::slotTick()
+{
+    tick(_clock.restart());
 
-    qint64 speedkBPerSec = (relativeLimitProgressDifference / relativeLimitMeasuringTimerIntervalMsec * 1000.0) / 1024.0;
-    qCDebug(lcBandwidthManager) << relativeLimitProgressDifference / 1024 << "kB =>" << speedkBPerSec << "kB/sec on full speed ("
-                                << _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
+    if (_upload.transfers.isEmpty() && _download.transfers.isEmpty())
+        _timer.stop();
+}
 
-    qint64 downloadLimitPercent = -_currentDownloadLimit;
-    // don't use too extreme values
-    downloadLimitPercent = qMin(downloadLimitPercent, qint64(90));
-    downloadLimitPercent = qMax(qint64(10), downloadLimitPercent);
-    qint64 wholeTimeMsec = (100.0 / downloadLimitPercent) * relativeLimitMeasuringTimerIntervalMsec;
-    qint64 waitTimeMsec = wholeTimeMsec - relativeLimitMeasuringTimerIntervalMsec;
-    qint64 realWaitTimeMsec = waitTimeMsec + wholeTimeMsec;
-    qCDebug(lcBandwidthManager) << waitTimeMsec << " - " << realWaitTimeMsec << " msec for " << downloadLimitPercent << "%";
-
-    // We want to wait twice as long since we want to give all
-    // devices the same quota we used now since we don't want
-    // any download to timeout
-    _relativeDownloadDelayTimer.setInterval(realWaitTimeMsec);
-    _relativeDownloadDelayTimer.start();
-
-    int jobCount = _downloadJobList.count();
-    qint64 quota = relativeLimitProgressDifference * (downloadLimitPercent / 100.0);
-    if (quota > 20 * 1024) {
-        qCInfo(lcBandwidthManager) << "ADJUSTING QUOTA FROM " << quota << " TO " << quota - 20 * 1024;
-        quota -= 20 * 1024;
-    }
-    qint64 quotaPerJob = quota / jobCount + 1.0;
-    Q_FOREACH (GETFileJob *gfj, _downloadJobList) {
-        gfj->setBandwidthLimited(true);
-        gfj->setChoked(false);
-        gfj->giveBandwidthQuota(quotaPerJob);
-        qCDebug(lcBandwidthManager) << "Gave" << quotaPerJob / 1024.0 << "kB to" << gfj;
-    }
-    _relativeLimitCurrentMeasuredDevice = nullptr;
+void BandwidthScheduler::tick(qint64 msec)
+{
+    schedule(_upload, msec);
+    schedule(_download, msec);
 }
 
-void BandwidthManager::relativeDownloadDelayTimerExpired()
+void BandwidthScheduler::schedule(Direction &direction, qint64 msec)
 {
-    // Switch to measuring state
-    _relativeDownloadMeasuringTimer.start(); // always start to continue the cycle
+    // Keep the measurements of relative limits for the next transfers
+    if (direction.transfers.isEmpty())
+        return;
 
-    if (!usingRelativeDownloadLimit()) {
-        return; // oh, not actually needed
+    qint64 absolute = 0;
+    qint64 percent = 0;
+    qint64 progress = 0;
+    for (auto &t : direction.transfers) {
+        const qint64 limit = limitOf(t);
+        if (limit > 0)
+            absolute = absolute ? qMin(absolute, limit) : limit;
+        else if (limit < 0)
+            percent = percent ? qMin(percent, -limit) : -limit;
+
+        const qint64 position = t.transfer->bandwidthPosition();
+        progress += qMax<qint64>(0, position - t.lastPosition);
+        t.lastPosition = position;
     }
 
-    if (_downloadJobList.isEmpty()) {
-        qCDebug(lcBandwidthManager) << _downloadJobList.count() << "No jobs?";
-        return;
+    if (direction.phaseMsec >= 0)
+        direction.phaseMsec += msec;
+
+    qint64 rate = 0;
+    if (absolute > 0) {
+        direction.probing = false;
+        rate = absolute;
+    } else if (percent > 0) {
+        if (direction.probing)
+            direction.probedBytes += progress;
+        rate = relativeRate(direction, percent);
+    } else {
+        direction.probing = false;
+        direction.capacity = 0;
     }
 
-    qCDebug(lcBandwidthManager) << _downloadJobList.count() << "Starting measuring";
+    direction.bucket.setRate(rate);
+    direction.bucket.refill(msec);
 
-    // Take first device and then append it again (= we round robin all devices)
-    _relativeLimitCurrentMeasuredJob = _downloadJobList.takeFirst();
-    _downloadJobList.append(_relativeLimitCurrentMeasuredJob);
+    QVector<Transfer *> limited;
+    QVector<qint64> demands;
+    for (auto &t : direction.transfers) {
+        if (rate == 0 || limitOf(t) == 0) {
+            setLimited(t, false);
+            t.granted = 0;
+            continue;
+        }
 
-    _relativeDownloadLimitProgressAtMeasuringRestart = _relativeLimitCurrentMeasuredJob->currentDownloadPosition();
-    _relativeLimitCurrentMeasuredJob->setBandwidthLimited(false);
-    _relativeLimitCurrentMeasuredJob->setChoked(false);
+        // What wasn't used of the last quota goes back into the bucket
+        const qint64 left = qBound<qint64>(0, t.transfer->bandwidthQuota(), t.granted);
+        direction.bucket.putBack(left);
+        const qint64 used = t.granted - left;
 
-    // choke all other download jobs
-    Q_FOREACH (GETFileJob *gfj, _downloadJobList) {
-        if (gfj != _relativeLimitCurrentMeasuredJob) {
-            gfj->setBandwidthLimited(true);
-            gfj->setChoked(true);
-        }
+        limited.append(&t);
+        demands.append(qMax(2 * used, rate * tickMsec / 1000 / direction.transfers.size() + 1));
     }
 
-    // now we're in measuring state
+    const auto grants = direction.bucket.distribute(demands);
+    for (int i = 0; i < limited.size(); ++i) {
+        auto &t = *limited[i];
+        setLimited(t, true);
+        t.granted = grants[i];
+        t.transfer->giveBandwidthQuota(grants[i]);
+    }
 }
 
-// end downloads
-
-void BandwidthManager::switchingTimerExpired()
+qint64 BandwidthScheduler::relativeRate(Direction &direction, qint64 percent)
 {
-    qint64 newUploadLimit = _propagator->_uploadLimit.fetchAndAddAcquire(0);
-    if (newUploadLimit != _currentUploadLimit) {
-        qCInfo(lcBandwidthManager) << "Upload Bandwidth limit changed" << _currentUploadLimit << newUploadLimit;
-        _currentUploadLimit = newUploadLimit;
-        Q_FOREACH (UploadDevice *ud, _relativeUploadDeviceList) {
-            if (newUploadLimit == 0) {
-                ud->setBandwidthLimited(false);
-                ud->setChoked(false);
-            } else if (newUploadLimit > 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(false);
-            } else if (newUploadLimit < 0) {
-                ud->setBandwidthLimited(true);
-                ud->setChoked(true);
-            }
-        }
-    }
-    qint64 newDownloadLimit = _propagator->_downloadLimit.fetchAndAddAcquire(0);
-    if (newDownloadLimit != _currentDownloadLimit) {
-        qCInfo(lcBandwidthManager) << "Download Bandwidth limit changed" << _currentDownloadLimit << newDownloadLimit;
-        _currentDownloadLimit = newDownloadLimit;
-        Q_FOREACH (GETFileJob *j, _downloadJobList) {
-            if (usingAbsoluteDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(false);
-            } else if (usingRelativeDownloadLimit()) {
-                j->setBandwidthLimited(true);
-                j->setChoked(true);
-            } else {
-                j->setBandwidthLimited(false);
-                j->setChoked(false);
-            }
+    // don't use too extreme values
+    percent = qBound<qint64>(10, percent, 90);
+
+    if (direction.phaseMsec < 0
+        || (!direction.probing && direction.phaseMsec >= cycleMsec - probeMsec)) {
+        direction.probing = true;
+        direction.probedBytes = 0;
+        direction.phaseMsec = 0;
+    } else if (direction.probing && direction.phaseMsec >= probeMsec) {
+        const qint64 measured = direction.probedBytes * 1000 / direction.phaseMsec;
+        if (measured > 0) {
+            // Smooth out the measurements of different cycles
+            direction.capacity = direction.capacity ? (direction.capacity + measured) / 2 : measured;
+            direction.probing = false;
+            qCInfo(lcBandwidthManager) << "Measured" << measured / 1024 << "kB/sec, estimating"
+                                       << direction.capacity / 1024 << "kB/sec at full speed";
         }
+        // Without progress, keep measuring
+        direction.probedBytes = 0;
+        direction.phaseMsec = 0;
     }
+
+    if (direction.probing)
+        return 0;
+
+    // The probe runs at full speed, make up for it in the rest of the cycle
+    const qint64 rate = direction.capacity * (percent * cycleMsec - 100 * probeMsec) / (100 * (cycleMsec - probeMsec));
+    return qMax(rate, qMax<qint64>(direction.capacity * 5 / 100, 1024));
 }
 
-void BandwidthManager::absoluteLimitTimerExpired()
+qint64 BandwidthScheduler::limitOf(const Transfer &transfer)
 {
-    if (usingAbsoluteUploadLimit() && _absoluteUploadDeviceList.count() > 0) {
-        qint64 quotaPerDevice = _currentUploadLimit / qMax(1, _absoluteUploadDeviceList.count());
-        qCDebug(lcBandwidthManager) << quotaPerDevice << _absoluteUploadDeviceList.count() << _currentUploadLimit;
-        Q_FOREACH (UploadDevice *device, _absoluteUploadDeviceList) {
-            device->giveBandwidthQuota(quotaPerDevice);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerDevice / 1024.0 << " kB to" << device;
-        }
-    }
-    if (usingAbsoluteDownloadLimit() && _downloadJobList.count() > 0) {
-        qint64 quotaPerJob = _currentDownloadLimit / qMax(1, _downloadJobList.count());
-        qCDebug(lcBandwidthManager) << quotaPerJob << _downloadJobList.count() << _currentDownloadLimit;
-        Q_FOREACH (GETFileJob *j, _downloadJobList) {
-            j->giveBandwidthQuota(quotaPerJob);
-            qCDebug(lcBandwidthManager) << "Gave " << quotaPerJob / 1024.0 << " kB to" << j;
-        }
-    }
+    return transfer.upload ? transfer.manager->uploadLimit() : transfer.manager->downloadLimit();
+}
+
+void BandwidthScheduler::setLimited(Transfer &transfer, bool limited)
+{
+    if (transfer.limited == limited)
+        return;
+    transfer.limited = limited;
+    transfer.transfer->setBandwidthLimited(limited);
 }
 }
@@ -16,9 +16,12 @@
 #define BANDWIDTHMANAGER_H
 
 #include <QObject>
-#include <QLinkedList>
+#include <QElapsedTimer>
 #include <QTimer>
 #include <QIODevice>
+#include <QVector>
+
+#include "owncloudlib.h"
 
 namespace OCC {
 
@@ -27,21 +30,89 @@ class GETFileJob;
 class OwncloudPropagator;
 
 /**
- * @brief The BandwidthManager class
+ * @brief A bytes per second budget with a bounded burst
+ * @ingroup libsync
+ *
+ * Tokens are added with refill() as time passes and handed out with
+ * distribute(), which shares them max-min fairly: nobody gets more than
+ * it asks for, and what one doesn't need is split among the others.
+ */
+class OWNCLOUDSYNC_EXPORT TokenBucket
+{
+public:
+    /// How much time worth of tokens may accumulate
+    static const int burstMsec = 250;
+
+    void setRate(qint64 bytesPerSecond);
+    qint64 rate() const { return _rate; }
+
+    /// The most tokens the bucket holds, which bounds the size of a burst
+    qint64 capacity() const;
+    qint64 tokens() const { return _tokens; }
+
+    void refill(qint64 msec);
+
+    /// Returns tokens that were handed out but not used
+    void putBack(qint64 tokens);
+
+    /// Takes tokens for each demand, the grants are in the same order
+    QVector<qint64> distribute(const QVector<qint64> &demands);
+
+private:
+    qint64 _rate = 0;
+    qint64 _tokens = 0;
+    qint64 _milliTokens = 0; // carried over between refills
+};
+
+/**
+ * @brief A transfer whose speed the BandwidthScheduler controls
+ * @ingroup libsync
+ *
+ * Implemented by UploadDevice and GETFileJob.
+ */
+class OWNCLOUDSYNC_EXPORT BandwidthLimitedTransfer
+{
+public:
+    virtual ~BandwidthLimitedTransfer() {}
+
+    /// The bytes transferred so far
+    virtual qint64 bandwidthPosition() = 0;
+
+    /// What is left of the last quota
+    virtual qint64 bandwidthQuota() const = 0;
+
+    /// Whether the transfer may only move the bytes of its quota
+    virtual void setBandwidthLimited(bool limited) = 0;
+
+    /// Whether the transfer is paused
+    virtual void setChoked(bool choked) = 0;
+
+    /// Replaces the quota of a limited transfer
+    virtual void giveBandwidthQuota(qint64 quota) = 0;
+};
+
+/**
+ * @brief Registers the transfers of a propagator with the BandwidthScheduler
  * @ingroup libsync
+ *
+ * The limits are the ones of the propagator: positive values are bytes per
+ * second, negative ones a percentage of the measured speed and 0 means
+ * unlimited.
  */
-class BandwidthManager : public QObject
+class OWNCLOUDSYNC_EXPORT BandwidthManager : public QObject
 {
     Q_OBJECT
 public:
     BandwidthManager(OwncloudPropagator *p);
     ~BandwidthManager();
 
-    bool usingAbsoluteUploadLimit() { return _currentUploadLimit > 0; }
-    bool usingRelativeUploadLimit() { return _currentUploadLimit < 0; }
-    bool usingAbsoluteDownloadLimit() { return _currentDownloadLimit > 0; }
-    bool usingRelativeDownloadLimit() { return _currentDownloadLimit < 0; }
+    virtual qint64 uploadLimit() const;
+    virtual qint64 downloadLimit() const;
 
+    bool usingAbsoluteUploadLimit() const { return uploadLimit() > 0; }
+    bool usingRelativeUploadLimit() const { return uploadLimit() < 0; }
+    bool usingAbsoluteDownloadLimit() const { return downloadLimit() > 0; }
+    bool usingRelativeDownloadLimit() const { return downloadLimit() < 0; }
 
 public slots:
     void registerUploadDevice(UploadDevice *);
@@ -50,55 +121,87 @@ public slots:
     void registerDownloadJob(GETFileJob *);
     void unregisterDownloadJob(QObject *);
 
-    void absoluteLimitTimerExpired();
-    void switchingTimerExpired();
-
-    void relativeUploadMeasuringTimerExpired();
-    void relativeUploadDelayTimerExpired();
-
-    void relativeDownloadMeasuringTimerExpired();
-    void relativeDownloadDelayTimerExpired();
-
 private:
-    // for switching between absolute and relative bw limiting
-    QTimer _switchingTimer;
-
-    // FIXME this timer and this variable should be replaced
-    // by the propagator emitting the changed limit values to us as signal
+    // FIXME the propagator should emit the changed limit values to us as signal
     OwncloudPropagator *_propagator;
+};
 
-    // for absolute up/down bw limiting
-    QTimer _absoluteLimitTimer;
-
-    // FIXME merge these two lists
-    QLinkedList<UploadDevice *> _absoluteUploadDeviceList;
-    QLinkedList<UploadDevice *> _relativeUploadDeviceList;
-
-    QTimer _relativeUploadMeasuringTimer;
-
-    // for relative bw limiting, we need to wait this amount before measuring again
-    QTimer _relativeUploadDelayTimer;
-
-    // the device measured
-    UploadDevice *_relativeLimitCurrentMeasuredDevice;
+/**
+ * @brief Shares the bandwidth between all transfers of the process
+ * @ingroup libsync
+ *
+ * Every tickMsec, a token bucket per direction is refilled at the limit's
+ * rate and its tokens are split fairly between the limited transfers of
+ * every sync engine, which gives a steady rate without starving anyone.
+ * When the propagators use different limits, the strictest one applies.
+ *
+ * A relative limit needs the speed of the connection: every cycleMsec,
+ * the transfers run unlimited for probeMsec to measure it. The rate in
+ * between is chosen to average to the requested percentage.
+ */
+class OWNCLOUDSYNC_EXPORT BandwidthScheduler : public QObject
+{
+    Q_OBJECT
+public:
+    static const int tickMsec = 50;
+    static const int cycleMsec = 10 * 1000;
+    static const int probeMsec = 1000;
 
-    // for measuring how much progress we made at start
-    qint64 _relativeUploadLimitProgressAtMeasuringRestart;
-    qint64 _currentUploadLimit;
+    /// The scheduler of the process
+    static BandwidthScheduler *instance();
 
-    QLinkedList<GETFileJob *> _downloadJobList;
-    QTimer _relativeDownloadMeasuringTimer;
+    /** Creates a separate scheduler
+     *
+     * Without the timer, tick() must be called to share the bandwidth.
+     */
+    explicit BandwidthScheduler(bool useTimer = true);
 
-    // for relative bw limiting, we need to wait this amount before measuring again
-    QTimer _relativeDownloadDelayTimer;
+    void registerUpload(QObject *object, BandwidthLimitedTransfer *transfer, BandwidthManager *manager);
+    void registerDownload(QObject *object, BandwidthLimitedTransfer *transfer, BandwidthManager *manager);
+    void unregisterTransfer(QObject *transfer);
+    void unregisterManager(BandwidthManager *manager);
 
-    // the device measured
-    GETFileJob *_relativeLimitCurrentMeasuredJob;
+    /// Shares the bandwidth of the last msec between the transfers
+    void tick(qint64 msec);
 
-    // for measuring how much progress we made at start
-    qint64 _relativeDownloadLimitProgressAtMeasuringRestart;
+private slots:
+    void slotTick();
 
-    qint64 _currentDownloadLimit;
+private:
+    struct Transfer
+    {
+        QObject *object;
+        BandwidthLimitedTransfer *transfer;
+        BandwidthManager *manager;
+        bool upload;
+        bool limited;
+        qint64 granted;
+        qint64 lastPosition;
+    };
+
+    struct Direction
+    {
+        QVector<Transfer> transfers;
+        TokenBucket bucket;
+        // For relative limits
+        bool probing = false;
+        qint64 phaseMsec = -1; // time since the probe started or ended, -1 before the first one
+        qint64 probedBytes = 0;
+        qint64 capacity = 0; // bytes per second, 0 if unknown
+    };
+
+    void registerTransfer(Direction &direction, const Transfer &transfer);
+    void schedule(Direction &direction, qint64 msec);
+    qint64 relativeRate(Direction &direction, qint64 percent);
+
+    static qint64 limitOf(const Transfer &transfer);
+    static void setLimited(Transfer &transfer, bool limited);
+
+    Direction _upload;
+    Direction _download;
+    bool _useTimer;
+    QTimer _timer;
+    QElapsedTimer _clock;
 };
 }
 
@@ -147,6 +147,11 @@ bool Capabilities::chunkingParallelUploadDisabled() const
     return _capabilities["dav"].toMap()["chunkingParallelUploadDisabled"].toBool();
 }
 
+bool Capabilities::blockSignatures() const
+{
+    return _capabilities["dav"].toMap()["blockSignatures"].toByteArray() >= "1.0";
+}
+
 bool Capabilities::privateLinkPropertyAvailable() const
 {
     return _capabilities["files"].toMap()["privateLinks"].toBool();
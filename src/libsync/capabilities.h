@@ -47,6 +47,9 @@ public:
     /// disable parallel upload in chunking
     bool chunkingParallelUploadDisabled() const;
 
+    /// Whether the server serves block signatures of files for delta downloads
+    bool blockSignatures() const;
+
     /// Whether the "privatelink" DAV property is available
     bool privateLinkPropertyAvailable() const;
 
@@ -13,6 +13,7 @@
 #include "clientsideencryptionjobs.h"
 #include "theme.h"
 #include "creds/abstractcredentials.h"
+#include "filesystem.h"
 
 #include <map>
 
@@ -797,6 +798,7 @@ void ClientSideEncryption::forgetSensitiveData()
     _certificate = QSslCertificate();
     _publicKey = QSslKey();
     _mnemonic = QString();
+    _metadataCache.clear();
 
     auto startDeleteJob = [this](QString user) {
         DeletePasswordJob *job = new DeletePasswordJob(Theme::instance()->appName());
@@ -1363,6 +1365,38 @@ QVector<EncryptedFile> FolderMetadata::files() const {
     return _files;
 }
 
+FolderMetadataCache::FolderMetadataCache(int maxFolders)
+    : _entries(maxFolders)
+{
+}
+
+QSharedPointer<const FolderMetadata> FolderMetadataCache::parse(const AccountPtr &account, const QByteArray &fileId,
+    const QByteArray &json)
+{
+    auto entry = _entries.object(fileId);
+    if (entry && entry->json == json) {
+        qCDebug(lcCseMetadata) << "Reusing the parsed metadata of" << fileId;
+        return entry->metadata;
+    }
+
+    entry = new Entry;
+    entry->json = json;
+    entry->metadata.reset(new FolderMetadata(account, json));
+    auto metadata = entry->metadata;
+    _entries.insert(fileId, entry);
+    return metadata;
+}
+
+void FolderMetadataCache::invalidate(const QByteArray &fileId)
+{
+    _entries.remove(fileId);
+}
+
+void FolderMetadataCache::clear()
+{
+    _entries.clear();
+}
+
 bool ClientSideEncryption::isFolderEncrypted(const QString& path) const {
   auto it = _folder2encryptedStatus.constFind(path);
   if (it == _folder2encryptedStatus.constEnd())
@@ -1542,4 +1576,178 @@ bool EncryptionHelper::fileDecryption(const QByteArray &key, const QByteArray& i
     return true;
 }
 
+
+static EVP_CIPHER_CTX *createGcmContext(bool encrypt, const QByteArray &key, const QByteArray &iv)
+{
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+    if (!ctx)
+        return nullptr;
+    const auto init = encrypt ? EVP_EncryptInit_ex : EVP_DecryptInit_ex;
+    if (!init(ctx, EVP_aes_128_gcm(), nullptr, nullptr, nullptr)
+        || !EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, iv.size(), nullptr)
+        || !init(ctx, nullptr, nullptr, (const unsigned char *)key.constData(), (const unsigned char *)iv.constData())) {
+        EVP_CIPHER_CTX_free(ctx);
+        return nullptr;
+    }
+    EVP_CIPHER_CTX_set_padding(ctx, 0);
+    return ctx;
+}
+
+StreamingEncryptor::StreamingEncryptor(const QString &fileName, const QByteArray &key, const QByteArray &iv)
+    : _input(fileName)
+    , _key(key)
+    , _iv(iv)
+{
+    QString openError;
+    if (!FileSystem::openAndSeekFileSharedRead(&_input, &openError, 0)) {
+        fail(openError);
+        return;
+    }
+    _plainSize = _input.size();
+    restart();
+}
+
+StreamingEncryptor::~StreamingEncryptor()
+{
+    if (_ctx)
+        EVP_CIPHER_CTX_free(_ctx);
+}
+
+bool StreamingEncryptor::fail(const QString &error)
+{
+    qCWarning(lcCse) << "Encrypting" << _input.fileName() << "failed:" << error;
+    _errorString = error;
+    return false;
+}
+
+bool StreamingEncryptor::restart()
+{
+    if (_ctx)
+        EVP_CIPHER_CTX_free(_ctx);
+    _ctx = createGcmContext(true, _key, _iv);
+    if (!_ctx)
+        return fail(QStringLiteral("Could not initialize the cipher"));
+    if (!_input.seek(0))
+        return fail(_input.errorString());
+    _pos = 0;
+    _tag.clear();
+    return true;
+}
+
+bool StreamingEncryptor::encryptUntil(qint64 end, QByteArray *data)
+{
+    QByteArray in;
+    QByteArray out;
+    while (_pos < end) {
+        in.resize(int(qMin<qint64>(end - _pos, 64 * 1024)));
+        const qint64 read = _input.read(in.data(), in.size());
+        if (read <= 0)
+            return fail(read < 0 ? _input.errorString() : QStringLiteral("File shrank while encrypting"));
+        // GCM is a stream mode, the ciphertext has the size of the plaintext
+        out.resize(int(read));
+        int len = 0;
+        if (!EVP_EncryptUpdate(_ctx, (unsigned char *)out.data(), &len, (const unsigned char *)in.constData(), int(read)))
+            return fail(QStringLiteral("Could not encrypt"));
+        if (data)
+            data->append(out.constData(), len);
+        _pos += read;
+    }
+
+    if (_pos == _plainSize && _tag.isEmpty()) {
+        int len = 0;
+        unsigned char tag[TagSize];
+        unsigned char rest[TagSize]; // nothing is left over in GCM
+        if (1 != EVP_EncryptFinal_ex(_ctx, rest, &len)
+            || 1 != EVP_CIPHER_CTX_ctrl(_ctx, EVP_CTRL_GCM_GET_TAG, TagSize, tag)) {
+            return fail(QStringLiteral("Could not finalize the encryption"));
+        }
+        _tag = QByteArray((const char *)tag, TagSize);
+    }
+    return true;
+}
+
+bool StreamingEncryptor::read(qint64 start, qint64 size, QByteArray *data)
+{
+    data->clear();
+    if (!isValid())
+        return false;
+    const qint64 end = qMin(start + size, this->size());
+    if (start >= end)
+        return true;
+    data->reserve(int(end - start));
+
+    if (start < _plainSize) {
+        if (start < _pos && !restart())
+            return false;
+        if (!encryptUntil(start, nullptr) || !encryptUntil(qMin(end, _plainSize), data))
+            return false;
+    }
+    if (end > _plainSize) {
+        if (_tag.isEmpty() && !encryptUntil(_plainSize, nullptr))
+            return false;
+        const qint64 tagStart = qMax(start, _plainSize) - _plainSize;
+        data->append(_tag.mid(int(tagStart), int(end - _plainSize - tagStart)));
+    }
+    return true;
+}
+
+QByteArray StreamingEncryptor::tag()
+{
+    if (_tag.isEmpty() && isValid())
+        encryptUntil(_plainSize, nullptr);
+    return _tag;
+}
+
+StreamingDecryptor::StreamingDecryptor(const QByteArray &key, const QByteArray &iv)
+    : _ctx(createGcmContext(false, key, iv))
+{
+}
+
+StreamingDecryptor::~StreamingDecryptor()
+{
+    if (_ctx)
+        EVP_CIPHER_CTX_free(_ctx);
+}
+
+bool StreamingDecryptor::update(const char *data, qint64 size, QByteArray *plaintext)
+{
+    plaintext->clear();
+    if (!_ctx)
+        return false;
+    _pending.append(data, int(size));
+    const int available = _pending.size() - StreamingEncryptor::TagSize;
+    if (available <= 0)
+        return true;
+
+    plaintext->resize(available);
+    int len = 0;
+    if (!EVP_DecryptUpdate(_ctx, (unsigned char *)plaintext->data(), &len, (const unsigned char *)_pending.constData(), available)) {
+        qCWarning(lcCse) << "Could not decrypt";
+        return false;
+    }
+    plaintext->resize(len);
+    _pending.remove(0, available);
+    return true;
+}
+
+bool StreamingDecryptor::finish(QByteArray *plaintext)
+{
+    plaintext->clear();
+    if (!_ctx || _pending.size() != StreamingEncryptor::TagSize)
+        return false;
+
+    if (!EVP_CIPHER_CTX_ctrl(_ctx, EVP_CTRL_GCM_SET_TAG, _pending.size(), (unsigned char *)_pending.data())) {
+        qCWarning(lcCse) << "Could not set expected tag";
+        return false;
+    }
+    plaintext->resize(StreamingEncryptor::TagSize);
+    int len = 0;
+    if (1 != EVP_DecryptFinal_ex(_ctx, (unsigned char *)plaintext->data(), &len)) {
+        qCWarning(lcCse) << "The authentication tag doesn't match, the data is corrupt";
+        return false;
+    }
+    plaintext->resize(len);
+    return true;
+}
+
 }
@@ -9,6 +9,8 @@
 #include <QFile>
 #include <QVector>
 #include <QMap>
+#include <QCache>
+#include <QSharedPointer>
 
 #include <openssl/evp.h>
 
@@ -66,6 +68,113 @@ namespace EncryptionHelper {
                                QFile *input, QFile *output);
 }
 
+/**
+ * @brief Encrypts a file with AES-GCM while it is being read
+ *
+ * The encrypted stream is the ciphertext followed by the authentication tag,
+ * like EncryptionHelper::fileEncryption() writes it, but no encrypted copy
+ * of the file is created. Ranges are meant to be read in order: reading
+ * before the current position starts over at the beginning of the file,
+ * since the tag depends on all of the data.
+ */
+class OWNCLOUDSYNC_EXPORT StreamingEncryptor
+{
+public:
+    enum { TagSize = 16 };
+
+    StreamingEncryptor(const QString &fileName, const QByteArray &key, const QByteArray &iv);
+    ~StreamingEncryptor();
+
+    bool isValid() const { return _errorString.isEmpty(); }
+    QString errorString() const { return _errorString; }
+
+    /// Size of the encrypted stream, the size of the file when the encryptor was created plus the tag
+    qint64 size() const { return _plainSize + TagSize; }
+
+    /// Sets data to the encrypted stream from start, up to size bytes
+    bool read(qint64 start, qint64 size, QByteArray *data);
+
+    /// The authentication tag; encrypts the rest of the file if needed. Empty on error.
+    QByteArray tag();
+
+private:
+    Q_DISABLE_COPY(StreamingEncryptor)
+
+    bool restart();
+    bool encryptUntil(qint64 end, QByteArray *data);
+    bool fail(const QString &error);
+
+    QFile _input;
+    QByteArray _key;
+    QByteArray _iv;
+    EVP_CIPHER_CTX *_ctx = nullptr;
+    qint64 _plainSize = 0;
+    qint64 _pos = 0; // in the plaintext
+    QByteArray _tag; // once all of the plaintext was encrypted
+    QString _errorString;
+};
+
+/**
+ * @brief Decrypts an AES-GCM stream as it arrives
+ *
+ * The counterpart of StreamingEncryptor. The last TagSize bytes seen are
+ * held back as the possible authentication tag; the decrypted data must not
+ * be trusted until finish() verified it.
+ */
+class OWNCLOUDSYNC_EXPORT StreamingDecryptor
+{
+public:
+    StreamingDecryptor(const QByteArray &key, const QByteArray &iv);
+    ~StreamingDecryptor();
+
+    /// Decrypts the next part of the stream into plaintext
+    bool update(const char *data, qint64 size, QByteArray *plaintext);
+
+    /// Checks the tag; false if the stream was truncated or tampered with
+    bool finish(QByteArray *plaintext);
+
+private:
+    Q_DISABLE_COPY(StreamingDecryptor)
+
+    EVP_CIPHER_CTX *_ctx = nullptr;
+    QByteArray _pending;
+};
+
+class FolderMetadata;
+
+/**
+ * @brief Parsed folder metadata, so the asymmetric decryption happens once per folder
+ *
+ * Entries are keyed by the folder's file id. The metadata is always fetched
+ * from the server, an entry is reused when the raw metadata is identical to
+ * what it was parsed from. Our own metadata updates invalidate the folder.
+ */
+class OWNCLOUDSYNC_EXPORT FolderMetadataCache
+{
+public:
+    explicit FolderMetadataCache(int maxFolders = 50);
+
+    /** Parses the metadata received from the server and caches it.
+     *
+     * If json is identical to what the cached entry was parsed from, the
+     * entry is returned without decrypting anything. Not for 404 replies.
+     */
+    QSharedPointer<const FolderMetadata> parse(const AccountPtr &account, const QByteArray &fileId,
+        const QByteArray &json);
+
+    /// Forgets the folder, to be called after changing its metadata
+    void invalidate(const QByteArray &fileId);
+    void clear();
+
+private:
+    struct Entry
+    {
+        QByteArray json;
+        QSharedPointer<const FolderMetadata> metadata;
+    };
+    QCache<QByteArray, Entry> _entries;
+};
+
 class OWNCLOUDSYNC_EXPORT ClientSideEncryption : public QObject {
     Q_OBJECT
 public:
@@ -89,6 +198,8 @@ public:
 
     bool newMnemonicGenerated() const;
 
+    FolderMetadataCache *metadataCache() { return &_metadataCache; }
+
 public slots:
     void slotRequestMnemonic();
 
@@ -122,6 +233,7 @@ private:
     //TODO: Save this on disk.
     QMap<QByteArray, QByteArray> _folder2token;
     QMap<QString, bool> _folder2encryptedStatus;
+    FolderMetadataCache _metadataCache;
 
 public:
     //QSslKey _privateKey;
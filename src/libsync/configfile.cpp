@@ -32,10 +32,14 @@
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QFileSystemWatcher>
 #include <QLoggingCategory>
+#include <QMutex>
+#include <QPointer>
 #include <QSettings>
 #include <QNetworkProxy>
 #include <QStandardPaths>
+#include <QThread>
 
 #define QTLEGACY (QT_VERSION < QT_VERSION_CHECK(5,9,0))
 
@@ -72,6 +76,11 @@ static const char chunkSizeC[] = "chunkSize";
 static const char minChunkSizeC[] = "minChunkSize";
 static const char maxChunkSizeC[] = "maxChunkSize";
 static const char targetChunkUploadDurationC[] = "targetChunkUploadDuration";
+static const char parallelChunkUploadsC[] = "parallelChunkUploads";
+static const char minRangedDownloadSizeC[] = "minRangedDownloadSize";
+static const char parallelDownloadRangesC[] = "parallelDownloadRanges";
+static const char warmUpConnectionsC[] = "warmUpConnections";
+static const char discoveryPipelineDepthC[] = "discoveryPipelineDepth";
 static const char automaticLogDirC[] = "logToTemporaryLogDir";
 
 static const char proxyHostC[] = "Proxy/host";
@@ -98,10 +107,78 @@ const char certPasswd[] = "http_certificatePasswd";
 QString ConfigFile::_confDir = QString();
 bool ConfigFile::_askedUser = false;
 
-static chrono::milliseconds millisecondsValue(const QSettings &setting, const char *key,
-    chrono::milliseconds defaultValue)
+namespace {
+    /* Parsed contents of the config file and of the system wide settings,
+     * shared by all ConfigFile instances. The user config is reloaded after
+     * writes through ConfigFile and when the file changes on disk.
+     */
+    struct ConfigCache
+    {
+        QMutex mutex;
+        QString fileName;
+        bool valid = false;
+        QHash<QString, QVariant> values;
+        bool systemValid = false;
+        QHash<QString, QVariant> systemValues;
+        QPointer<QFileSystemWatcher> watcher;
+    };
+    Q_GLOBAL_STATIC(ConfigCache, g_configCache)
+
+    QString cacheKey(const QString &key, const QString &group)
+    {
+        QString fullKey = group.isEmpty() ? key : group + QLatin1Char('/') + key;
+#ifdef Q_OS_WIN
+        // Like QSettings, which is case insensitive there
+        fullKey = fullKey.toLower();
+#endif
+        return fullKey;
+    }
+
+    void loadInto(QSettings &settings, QHash<QString, QVariant> &values)
+    {
+        values.clear();
+        for (const auto &key : settings.allKeys())
+            values.insert(cacheKey(key, QString()), settings.value(key));
+    }
+
+    std::unique_ptr<QSettings> systemSettings()
+    {
+        if (Utility::isMac()) {
+            return std::unique_ptr<QSettings>(new QSettings(QLatin1String("/Library/Preferences/" APPLICATION_REV_DOMAIN ".plist"), QSettings::NativeFormat));
+        } else if (Utility::isUnix()) {
+            return std::unique_ptr<QSettings>(new QSettings(QString(SYSCONFDIR "/%1/%1.conf").arg(Theme::instance()->appName()), QSettings::NativeFormat));
+        } else { // Windows
+            return std::unique_ptr<QSettings>(new QSettings(QString::fromLatin1("HKEY_LOCAL_MACHINE\\Software\\%1\\%2")
+                                                                .arg(APPLICATION_VENDOR, Theme::instance()->appName()),
+                QSettings::NativeFormat));
+        }
+    }
+
+    // Must be called with the cache mutex held
+    void watchConfigFile(ConfigCache *cache)
+    {
+        // The watcher needs the event loop of the main thread
+        if (!qApp || QThread::currentThread() != qApp->thread())
+            return;
+        if (!cache->watcher) {
+            cache->watcher = new QFileSystemWatcher(qApp);
+            auto invalidate = [] { ConfigFile::invalidateCache(); };
+            QObject::connect(cache->watcher.data(), &QFileSystemWatcher::fileChanged, invalidate);
+            // Editors may replace the file instead of writing it, which
+            // removes it from the watcher.
+            QObject::connect(cache->watcher.data(), &QFileSystemWatcher::directoryChanged, invalidate);
+        }
+        if (!cache->watcher->files().contains(cache->fileName) && QFileInfo::exists(cache->fileName))
+            cache->watcher->addPath(cache->fileName);
+        const QString dir = QFileInfo(cache->fileName).absolutePath();
+        if (!cache->watcher->directories().contains(dir))
+            cache->watcher->addPath(dir);
+    }
+}
+
+static chrono::milliseconds millisecondsValue(const QVariant &value, chrono::milliseconds defaultValue)
 {
-    return chrono::milliseconds(setting.value(QLatin1String(key), qlonglong(defaultValue.count())).toLongLong());
+    return value.isValid() ? chrono::milliseconds(value.toLongLong()) : defaultValue;
 }
 
 
@@ -144,12 +221,42 @@ ConfigFile::ConfigFile()
     qApp->setApplicationName(Theme::instance()->appNameGUI());
 
     QSettings::setDefaultFormat(QSettings::IniFormat);
+}
 
-    const QString config = configFile();
+QVariant ConfigFile::cachedValue(const QString &key, const QVariant &defaultValue, const QString &group) const
+{
+    const QString file = configFile();
+    auto cache = g_configCache();
+    QMutexLocker lock(&cache->mutex);
+    if (!cache->valid || cache->fileName != file) {
+        QSettings settings(file, QSettings::IniFormat);
+        loadInto(settings, cache->values);
+        cache->fileName = file;
+        cache->valid = true;
+        watchConfigFile(cache);
+    }
+    return cache->values.value(cacheKey(key, group), defaultValue);
+}
 
+QVariant ConfigFile::cachedSystemValue(const QString &key, const QVariant &defaultValue, const QString &group) const
+{
+    auto cache = g_configCache();
+    QMutexLocker lock(&cache->mutex);
+    if (!cache->systemValid) {
+        loadInto(*systemSettings(), cache->systemValues);
+        cache->systemValid = true;
+    }
+    return cache->systemValues.value(cacheKey(key, group), defaultValue);
+}
 
-    QSettings settings(config, QSettings::IniFormat);
-    settings.beginGroup(defaultConnection());
+void ConfigFile::invalidateCache()
+{
+    auto cache = g_configCache();
+    QMutexLocker lock(&cache->mutex);
+    cache->valid = false;
+    cache->values.clear();
+    cache->systemValid = false;
+    cache->systemValues.clear();
 }
 
 bool ConfigFile::setConfDir(const QString &value)
@@ -167,6 +274,7 @@ bool ConfigFile::setConfDir(const QString &value)
         dirPath = fi.absoluteFilePath();
         qCInfo(lcConfigFile) << "Using custom config dir " << dirPath;
         _confDir = dirPath;
+        invalidateCache();
         return true;
     }
     return false;
@@ -174,8 +282,7 @@ bool ConfigFile::setConfDir(const QString &value)
 
 bool ConfigFile::optionalServerNotifications() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(optionalServerNotificationsC), true).toBool();
+    return cachedValue(QLatin1String(optionalServerNotificationsC), true).toBool();
 }
 
 bool ConfigFile::showInExplorerNavigationPane() const
@@ -191,8 +298,7 @@ bool ConfigFile::showInExplorerNavigationPane() const
         false
 #endif
         ;
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(showInExplorerNavigationPaneC), defaultValue).toBool();
+    return cachedValue(QLatin1String(showInExplorerNavigationPaneC), defaultValue).toBool();
 }
 
 void ConfigFile::setShowInExplorerNavigationPane(bool show)
@@ -200,36 +306,57 @@ void ConfigFile::setShowInExplorerNavigationPane(bool show)
     QSettings settings(configFile(), QSettings::IniFormat);
     settings.setValue(QLatin1String(showInExplorerNavigationPaneC), show);
     settings.sync();
+    invalidateCache();
 }
 
 int ConfigFile::timeout() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(timeoutC), 300).toInt(); // default to 5 min
+    return cachedValue(QLatin1String(timeoutC), 300).toInt(); // default to 5 min
 }
 
 quint64 ConfigFile::chunkSize() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(chunkSizeC), 10 * 1000 * 1000).toLongLong(); // default to 10 MB
+    return cachedValue(QLatin1String(chunkSizeC), 10 * 1000 * 1000).toLongLong(); // default to 10 MB
 }
 
 quint64 ConfigFile::maxChunkSize() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(maxChunkSizeC), 100 * 1000 * 1000).toLongLong(); // default to 100 MB
+    return cachedValue(QLatin1String(maxChunkSizeC), 100 * 1000 * 1000).toLongLong(); // default to 100 MB
 }
 
 quint64 ConfigFile::minChunkSize() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(minChunkSizeC), 1000 * 1000).toLongLong(); // default to 1 MB
+    return cachedValue(QLatin1String(minChunkSizeC), 1000 * 1000).toLongLong(); // default to 1 MB
 }
 
 chrono::milliseconds ConfigFile::targetChunkUploadDuration() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return millisecondsValue(settings, targetChunkUploadDurationC, chrono::minutes(1));
+    return millisecondsValue(cachedValue(QLatin1String(targetChunkUploadDurationC)), chrono::minutes(1));
+}
+
+int ConfigFile::parallelChunkUploads() const
+{
+    return cachedValue(QLatin1String(parallelChunkUploadsC), 3).toInt();
+}
+
+quint64 ConfigFile::minRangedDownloadSize() const
+{
+    return cachedValue(QLatin1String(minRangedDownloadSizeC), 100 * 1000 * 1000).toLongLong(); // default to 100 MB
+}
+
+int ConfigFile::parallelDownloadRanges() const
+{
+    return cachedValue(QLatin1String(parallelDownloadRangesC), 3).toInt();
+}
+
+int ConfigFile::warmUpConnections() const
+{
+    return cachedValue(QLatin1String(warmUpConnectionsC), 4).toInt();
+}
+
+int ConfigFile::discoveryPipelineDepth() const
+{
+    return cachedValue(QLatin1String(discoveryPipelineDepthC), 4).toInt();
 }
 
 void ConfigFile::setOptionalServerNotifications(bool show)
@@ -237,6 +364,7 @@ void ConfigFile::setOptionalServerNotifications(bool show)
     QSettings settings(configFile(), QSettings::IniFormat);
     settings.setValue(QLatin1String(optionalServerNotificationsC), show);
     settings.sync();
+    invalidateCache();
 }
 
 void ConfigFile::saveGeometry(QWidget *w)
@@ -247,6 +375,7 @@ void ConfigFile::saveGeometry(QWidget *w)
     settings.beginGroup(w->objectName());
     settings.setValue(QLatin1String(geometryC), w->saveGeometry());
     settings.sync();
+    invalidateCache();
 #endif
 }
 
@@ -268,6 +397,7 @@ void ConfigFile::saveGeometryHeader(QHeaderView *header)
     settings.beginGroup(header->objectName());
     settings.setValue(QLatin1String(geometryC), header->saveState());
     settings.sync();
+    invalidateCache();
 #endif
 }
 
@@ -278,9 +408,7 @@ void ConfigFile::restoreGeometryHeader(QHeaderView *header)
         return;
     ASSERT(!header->objectName().isNull());
 
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(header->objectName());
-    header->restoreState(settings.value(geometryC).toByteArray());
+    header->restoreState(cachedValue(QLatin1String(geometryC), QVariant(), header->objectName()).toByteArray());
 #endif
 }
 
@@ -427,15 +555,13 @@ void ConfigFile::storeData(const QString &group, const QString &key, const QVari
     settings.beginGroup(con);
     settings.setValue(key, value);
     settings.sync();
+    invalidateCache();
 }
 
 QVariant ConfigFile::retrieveData(const QString &group, const QString &key) const
 {
     const QString con(group.isEmpty() ? defaultConnection() : group);
-    QSettings settings(configFile(), QSettings::IniFormat);
-
-    settings.beginGroup(con);
-    return settings.value(key);
+    return cachedValue(key, QVariant(), con);
 }
 
 void ConfigFile::removeData(const QString &group, const QString &key)
@@ -445,15 +571,13 @@ void ConfigFile::removeData(const QString &group, const QString &key)
 
     settings.beginGroup(con);
     settings.remove(key);
+    invalidateCache();
 }
 
 bool ConfigFile::dataExists(const QString &group, const QString &key) const
 {
     const QString con(group.isEmpty() ? defaultConnection() : group);
-    QSettings settings(configFile(), QSettings::IniFormat);
-
-    settings.beginGroup(con);
-    return settings.contains(key);
+    return cachedValue(key, QVariant(), con).isValid();
 }
 
 chrono::milliseconds ConfigFile::remotePollInterval(const QString &connection) const
@@ -462,11 +586,8 @@ chrono::milliseconds ConfigFile::remotePollInterval(const QString &connection) c
     if (connection.isEmpty())
         con = defaultConnection();
 
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(con);
-
     auto defaultPollInterval = chrono::milliseconds(DEFAULT_REMOTE_POLL_INTERVAL);
-    auto remoteInterval = millisecondsValue(settings, remotePollIntervalC, defaultPollInterval);
+    auto remoteInterval = millisecondsValue(cachedValue(QLatin1String(remotePollIntervalC), QVariant(), con), defaultPollInterval);
     if (remoteInterval < chrono::seconds(5)) {
         qCWarning(lcConfigFile) << "Remote Interval is less than 5 seconds, reverting to" << DEFAULT_REMOTE_POLL_INTERVAL;
         remoteInterval = defaultPollInterval;
@@ -488,6 +609,7 @@ void ConfigFile::setRemotePollInterval(chrono::milliseconds interval, const QStr
     settings.beginGroup(con);
     settings.setValue(QLatin1String(remotePollIntervalC), qlonglong(interval.count()));
     settings.sync();
+    invalidateCache();
 }
 
 chrono::milliseconds ConfigFile::forceSyncInterval(const QString &connection) const
@@ -497,11 +619,9 @@ chrono::milliseconds ConfigFile::forceSyncInterval(const QString &connection) co
     QString con(connection);
     if (connection.isEmpty())
         con = defaultConnection();
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(con);
 
     auto defaultInterval = chrono::hours(2);
-    auto interval = millisecondsValue(settings, forceSyncIntervalC, defaultInterval);
+    auto interval = millisecondsValue(cachedValue(QLatin1String(forceSyncIntervalC), QVariant(), con), defaultInterval);
     if (interval < pollInterval) {
         qCWarning(lcConfigFile) << "Force sync interval is less than the remote poll inteval, reverting to" << pollInterval.count();
         interval = pollInterval;
@@ -511,9 +631,7 @@ chrono::milliseconds ConfigFile::forceSyncInterval(const QString &connection) co
 
 chrono::milliseconds OCC::ConfigFile::fullLocalDiscoveryInterval() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(defaultConnection());
-    return millisecondsValue(settings, fullLocalDiscoveryIntervalC, chrono::hours(1));
+    return millisecondsValue(cachedValue(QLatin1String(fullLocalDiscoveryIntervalC), QVariant(), defaultConnection()), chrono::hours(1));
 }
 
 chrono::milliseconds ConfigFile::notificationRefreshInterval(const QString &connection) const
@@ -521,11 +639,9 @@ chrono::milliseconds ConfigFile::notificationRefreshInterval(const QString &conn
     QString con(connection);
     if (connection.isEmpty())
         con = defaultConnection();
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(con);
 
     auto defaultInterval = chrono::minutes(5);
-    auto interval = millisecondsValue(settings, notificationRefreshIntervalC, defaultInterval);
+    auto interval = millisecondsValue(cachedValue(QLatin1String(notificationRefreshIntervalC), QVariant(), con), defaultInterval);
     if (interval < chrono::minutes(1)) {
         qCWarning(lcConfigFile) << "Notification refresh interval smaller than one minute, setting to one minute";
         interval = chrono::minutes(1);
@@ -538,11 +654,9 @@ chrono::milliseconds ConfigFile::updateCheckInterval(const QString &connection)
     QString con(connection);
     if (connection.isEmpty())
         con = defaultConnection();
-    QSettings settings(configFile(), QSettings::IniFormat);
-    settings.beginGroup(con);
 
     auto defaultInterval = chrono::hours(10);
-    auto interval = millisecondsValue(settings, updateCheckIntervalC, defaultInterval);
+    auto interval = millisecondsValue(cachedValue(QLatin1String(updateCheckIntervalC), QVariant(), con), defaultInterval);
 
     auto minInterval = chrono::minutes(5);
     if (interval < minInterval) {
@@ -576,6 +690,7 @@ void ConfigFile::setSkipUpdateCheck(bool skip, const QString &connection)
 
     settings.setValue(QLatin1String(skipUpdateCheckC), QVariant(skip));
     settings.sync();
+    invalidateCache();
 }
 
 bool ConfigFile::autoUpdateCheck(const QString &connection) const
@@ -602,18 +717,21 @@ void ConfigFile::setAutoUpdateCheck(bool autoCheck, const QString &connection)
 
     settings.setValue(QLatin1String(autoUpdateCheckC), QVariant(autoCheck));
     settings.sync();
+    invalidateCache();
 }
 
 int ConfigFile::updateSegment() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    int segment = settings.value(QLatin1String(updateSegmentC), -1).toInt();
+    int segment = cachedValue(QLatin1String(updateSegmentC), -1).toInt();
 
     // Invalid? (Unset at the very first launch)
     if(segment < 0 || segment > 99) {
         // Save valid segment value, normally has to be done only once.
         segment = qrand() % 99;
+        QSettings settings(configFile(), QSettings::IniFormat);
         settings.setValue(QLatin1String(updateSegmentC), segment);
+        settings.sync();
+        invalidateCache();
     }
 
     return segment;
@@ -621,8 +739,7 @@ int ConfigFile::updateSegment() const
 
 int ConfigFile::maxLogLines() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(maxLogLinesC), DEFAULT_MAX_LOG_LINES).toInt();
+    return cachedValue(QLatin1String(maxLogLinesC), DEFAULT_MAX_LOG_LINES).toInt();
 }
 
 void ConfigFile::setMaxLogLines(int lines)
@@ -630,6 +747,7 @@ void ConfigFile::setMaxLogLines(int lines)
     QSettings settings(configFile(), QSettings::IniFormat);
     settings.setValue(QLatin1String(maxLogLinesC), lines);
     settings.sync();
+    invalidateCache();
 }
 
 void ConfigFile::setProxyType(int proxyType,
@@ -650,39 +768,14 @@ void ConfigFile::setProxyType(int proxyType,
         settings.setValue(QLatin1String(proxyPassC), pass.toUtf8().toBase64());
     }
     settings.sync();
+    invalidateCache();
 }
 
 QVariant ConfigFile::getValue(const QString &param, const QString &group,
     const QVariant &defaultValue) const
 {
-    QVariant systemSetting;
-    if (Utility::isMac()) {
-        QSettings systemSettings(QLatin1String("/Library/Preferences/" APPLICATION_REV_DOMAIN ".plist"), QSettings::NativeFormat);
-        if (!group.isEmpty()) {
-            systemSettings.beginGroup(group);
-        }
-        systemSetting = systemSettings.value(param, defaultValue);
-    } else if (Utility::isUnix()) {
-        QSettings systemSettings(QString(SYSCONFDIR "/%1/%1.conf").arg(Theme::instance()->appName()), QSettings::NativeFormat);
-        if (!group.isEmpty()) {
-            systemSettings.beginGroup(group);
-        }
-        systemSetting = systemSettings.value(param, defaultValue);
-    } else { // Windows
-        QSettings systemSettings(QString::fromLatin1("HKEY_LOCAL_MACHINE\\Software\\%1\\%2")
-                                     .arg(APPLICATION_VENDOR, Theme::instance()->appName()),
-            QSettings::NativeFormat);
-        if (!group.isEmpty()) {
-            systemSettings.beginGroup(group);
-        }
-        systemSetting = systemSettings.value(param, defaultValue);
-    }
-
-    QSettings settings(configFile(), QSettings::IniFormat);
-    if (!group.isEmpty())
-        settings.beginGroup(group);
-
-    return settings.value(param, systemSetting);
+    QVariant systemSetting = cachedSystemValue(param, defaultValue, group);
+    return cachedValue(param, systemSetting, group);
 }
 
 void ConfigFile::setValue(const QString &key, const QVariant &value)
@@ -690,6 +783,7 @@ void ConfigFile::setValue(const QString &key, const QVariant &value)
     QSettings settings(configFile(), QSettings::IniFormat);
 
     settings.setValue(key, value);
+    invalidateCache();
 }
 
 int ConfigFile::proxyType() const
@@ -802,55 +896,55 @@ void ConfigFile::setMoveToTrash(bool isChecked)
 
 bool ConfigFile::promptDeleteFiles() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(promptDeleteC), false).toBool();
+    return cachedValue(QLatin1String(promptDeleteC), false).toBool();
 }
 
 void ConfigFile::setPromptDeleteFiles(bool promptDeleteFiles)
 {
     QSettings settings(configFile(), QSettings::IniFormat);
     settings.setValue(QLatin1String(promptDeleteC), promptDeleteFiles);
+    invalidateCache();
 }
 
 bool ConfigFile::monoIcons() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
     bool monoDefault = false; // On Mac we want bw by default
 #ifdef Q_OS_MAC
     // OEM themes are not obliged to ship mono icons
     monoDefault = (0 == (strcmp("ownCloud", APPLICATION_NAME)));
 #endif
-    return settings.value(QLatin1String(monoIconsC), monoDefault).toBool();
+    return cachedValue(QLatin1String(monoIconsC), monoDefault).toBool();
 }
 
 void ConfigFile::setMonoIcons(bool useMonoIcons)
 {
     QSettings settings(configFile(), QSettings::IniFormat);
     settings.setValue(QLatin1String(monoIconsC), useMonoIcons);
+    invalidateCache();
 }
 
 bool ConfigFile::crashReporter() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(crashReporterC), true).toBool();
+    return cachedValue(QLatin1String(crashReporterC), true).toBool();
 }
 
 void ConfigFile::setCrashReporter(bool enabled)
 {
     QSettings settings(configFile(), QSettings::IniFormat);
     settings.setValue(QLatin1String(crashReporterC), enabled);
+    invalidateCache();
 }
 
 bool ConfigFile::automaticLogDir() const
 {
-    QSettings settings(configFile(), QSettings::IniFormat);
-    return settings.value(QLatin1String(automaticLogDirC), false).toBool();
+    return cachedValue(QLatin1String(automaticLogDirC), false).toBool();
 }
 
 void ConfigFile::setAutomaticLogDir(bool enabled)
 {
     QSettings settings(configFile(), QSettings::IniFormat);
     settings.setValue(QLatin1String(automaticLogDirC), enabled);
+    invalidateCache();
 }
 
 QString ConfigFile::certificatePath() const
@@ -863,6 +957,7 @@ void ConfigFile::setCertificatePath(const QString &cPath)
     QSettings settings(configFile(), QSettings::IniFormat);
     settings.setValue(QLatin1String(certPath), cPath);
     settings.sync();
+    invalidateCache();
 }
 
 QString ConfigFile::certificatePasswd() const
@@ -875,6 +970,7 @@ void ConfigFile::setCertificatePasswd(const QString &cPasswd)
     QSettings settings(configFile(), QSettings::IniFormat);
     settings.setValue(QLatin1String(certPasswd), cPasswd);
     settings.sync();
+    invalidateCache();
 }
 
 Q_GLOBAL_STATIC(QString, g_configFileName)
@@ -139,6 +139,11 @@ public:
     quint64 maxChunkSize() const;
     quint64 minChunkSize() const;
     std::chrono::milliseconds targetChunkUploadDuration() const;
+    int parallelChunkUploads() const;
+    quint64 minRangedDownloadSize() const;
+    int parallelDownloadRanges() const;
+    int warmUpConnections() const;
+    int discoveryPipelineDepth() const;
 
     void saveGeometry(QWidget *w);
     void restoreGeometry(QWidget *w);
@@ -174,6 +179,11 @@ public:
     /// Add the system and user exclude file path to the ExcludedFiles instance.
     static void setupDefaultExcludeFilePaths(ExcludedFiles &excludedFiles);
 
+    /** Drops the in-memory copy of the settings, so the next read parses the
+        config file again. Writes through ConfigFile and changes to the file
+        on disk do this automatically. */
+    static void invalidateCache();
+
 protected:
     QVariant getPolicySetting(const QString &policy, const QVariant &defaultValue = QVariant()) const;
     void storeData(const QString &group, const QString &key, const QVariant &value);
@@ -186,6 +196,13 @@ private:
         const QVariant &defaultValue = QVariant()) const;
     void setValue(const QString &key, const QVariant &value);
 
+    /// Reads from the in-memory copy of the config file, see invalidateCache()
+    QVariant cachedValue(const QString &key, const QVariant &defaultValue = QVariant(),
+        const QString &group = QString()) const;
+    /// Same for the system wide settings, which are only read once
+    QVariant cachedSystemValue(const QString &key, const QVariant &defaultValue,
+        const QString &group) const;
+
 private:
     typedef QSharedPointer<AbstractCredentials> SharedCreds;
 
@@ -0,0 +1,297 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#include "deltasync.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QHash>
+#include <QIODevice>
+#include <QLoggingCategory>
+
+namespace OCC {
+
+Q_LOGGING_CATEGORY(lcDeltaSync, "nextcloud.sync.deltasync", QtInfoMsg)
+
+namespace {
+    const quint32 signaturesMagic = 0x6e636273; // "ncbs"
+    const quint32 signaturesVersion = 1;
+
+    // Amount of seed data read at once while scanning and assembling
+    const qint64 ioChunkSize = 1024 * 1024;
+
+    quint32 packWeak(quint32 a, quint32 b)
+    {
+        return (a & 0xffff) | (b << 16);
+    }
+}
+
+quint32 BlockSignatures::weakChecksum(const char *data, int size)
+{
+    // The rsync rolling checksum: a is the plain byte sum, b weighs each
+    // byte by its distance from the end of the block.
+    quint32 a = 0;
+    quint32 b = 0;
+    for (int i = 0; i < size; ++i) {
+        a += static_cast<uchar>(data[i]);
+        b += a;
+    }
+    return packWeak(a, b);
+}
+
+QByteArray BlockSignatures::strongHash(const char *data, int size)
+{
+    return QCryptographicHash::hash(QByteArray::fromRawData(data, size), QCryptographicHash::Sha1);
+}
+
+BlockSignatures BlockSignatures::compute(QIODevice *device, int blockSize)
+{
+    BlockSignatures result;
+    if (blockSize <= 0)
+        return result;
+
+    while (!device->atEnd()) {
+        QByteArray data = device->read(blockSize);
+        if (data.isEmpty()) {
+            qCWarning(lcDeltaSync) << "Could not read block" << result.blocks.size() << device->errorString();
+            return BlockSignatures();
+        }
+        Block block;
+        block.weak = weakChecksum(data.constData(), data.size());
+        block.strong = strongHash(data.constData(), data.size());
+        result.blocks.append(block);
+        result.fileSize += data.size();
+    }
+    result.blockSize = blockSize;
+    return result;
+}
+
+QByteArray BlockSignatures::serialize() const
+{
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << signaturesMagic << signaturesVersion << qint32(blockSize) << fileSize << qint32(blocks.size());
+    for (const auto &block : blocks)
+        stream << block.weak << block.strong;
+    return data;
+}
+
+BlockSignatures BlockSignatures::deserialize(const QByteArray &data)
+{
+    QDataStream stream(data);
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint32 blockSize = 0;
+    qint32 count = 0;
+    BlockSignatures result;
+    stream >> magic >> version >> blockSize >> result.fileSize >> count;
+    if (stream.status() != QDataStream::Ok || magic != signaturesMagic || version != signaturesVersion
+        || blockSize <= 0 || count < 0 || (result.fileSize + blockSize - 1) / blockSize != count) {
+        return BlockSignatures();
+    }
+    result.blocks.resize(count);
+    for (auto &block : result.blocks)
+        stream >> block.weak >> block.strong;
+    if (stream.status() != QDataStream::Ok)
+        return BlockSignatures();
+    result.blockSize = blockSize;
+    return result;
+}
+
+DeltaPlan DeltaPlan::compute(const BlockSignatures &target, QIODevice *seed)
+{
+    DeltaPlan plan;
+    plan.targetSize = target.fileSize;
+
+    const int blockSize = target.blockSize;
+    const int blockCount = target.blocks.size();
+    QVector<qint64> seedOffsets(blockCount, -1);
+    int unmatched = blockCount;
+
+    // Full-size blocks are searched at every offset of the seed. A short
+    // last block can only be compared at a few likely places below.
+    QHash<quint32, QVector<int>> blocksByWeak;
+    for (int i = 0; i < blockCount; ++i) {
+        if (qint64(i + 1) * blockSize <= target.fileSize)
+            blocksByWeak[target.blocks[i].weak].append(i);
+    }
+
+    QByteArray buffer;
+    qint64 bufferStart = 0; // seed offset of buffer[0]
+    int pos = 0; // start of the current window in buffer
+    bool windowSumsValid = false;
+    quint32 a = 0;
+    quint32 b = 0;
+
+    auto ensureAvailable = [&](int needed) {
+        if (buffer.size() - pos >= needed)
+            return true;
+        buffer.remove(0, pos);
+        bufferStart += pos;
+        pos = 0;
+        while (buffer.size() < needed && !seed->atEnd()) {
+            QByteArray more = seed->read(ioChunkSize);
+            if (more.isEmpty())
+                break;
+            buffer.append(more);
+        }
+        return buffer.size() >= needed;
+    };
+
+    while (unmatched > 0 && !blocksByWeak.isEmpty() && ensureAvailable(blockSize)) {
+        const char *window = buffer.constData() + pos;
+        if (!windowSumsValid) {
+            a = 0;
+            b = 0;
+            for (int i = 0; i < blockSize; ++i) {
+                a += static_cast<uchar>(window[i]);
+                b += a;
+            }
+            windowSumsValid = true;
+        }
+
+        auto candidates = blocksByWeak.constFind(packWeak(a, b));
+        if (candidates != blocksByWeak.constEnd()) {
+            QByteArray strong = BlockSignatures::strongHash(window, blockSize);
+            bool matched = false;
+            for (int index : *candidates) {
+                if (target.blocks[index].strong != strong)
+                    continue;
+                matched = true;
+                if (seedOffsets[index] < 0) {
+                    seedOffsets[index] = bufferStart + pos;
+                    --unmatched;
+                }
+            }
+            if (matched) {
+                pos += blockSize;
+                windowSumsValid = false;
+                continue;
+            }
+        }
+
+        // Roll the window forward by one byte
+        if (!ensureAvailable(blockSize + 1))
+            break;
+        const quint32 out = static_cast<uchar>(buffer.at(pos));
+        const quint32 in = static_cast<uchar>(buffer.at(pos + blockSize));
+        a += in - out;
+        b += a - blockSize * out;
+        ++pos;
+    }
+
+    // A short last block is compared against the end of the seed and
+    // against the same offset, which covers appends and in-place edits.
+    const int last = blockCount - 1;
+    if (last >= 0 && seedOffsets[last] < 0 && qint64(last + 1) * blockSize > target.fileSize) {
+        const int lastSize = int(target.fileSize - qint64(last) * blockSize);
+        for (qint64 offset : { seed->size() - lastSize, qint64(last) * blockSize }) {
+            if (offset < 0 || !seed->seek(offset))
+                continue;
+            QByteArray data = seed->read(lastSize);
+            if (data.size() == lastSize
+                && BlockSignatures::weakChecksum(data.constData(), lastSize) == target.blocks[last].weak
+                && BlockSignatures::strongHash(data.constData(), lastSize) == target.blocks[last].strong) {
+                seedOffsets[last] = offset;
+                break;
+            }
+        }
+    }
+
+    for (int i = 0; i < blockCount; ++i) {
+        Range range;
+        range.targetOffset = qint64(i) * blockSize;
+        range.length = qMin<qint64>(blockSize, target.fileSize - range.targetOffset);
+        range.seedOffset = seedOffsets[i];
+
+        if (!plan.ranges.isEmpty()) {
+            Range &previous = plan.ranges.last();
+            bool bothFetched = previous.seedOffset < 0 && range.seedOffset < 0;
+            bool contiguousCopy = previous.seedOffset >= 0 && range.seedOffset >= 0
+                && previous.seedOffset + previous.length == range.seedOffset;
+            if (bothFetched || contiguousCopy) {
+                previous.length += range.length;
+                continue;
+            }
+        }
+        plan.ranges.append(range);
+    }
+
+    qCInfo(lcDeltaSync) << "Delta plan:" << plan.bytesToFetch() << "of" << plan.targetSize
+                        << "bytes to fetch in" << plan.ranges.size() << "ranges";
+    return plan;
+}
+
+qint64 DeltaPlan::bytesToFetch() const
+{
+    qint64 total = 0;
+    for (const auto &range : ranges) {
+        if (range.seedOffset < 0)
+            total += range.length;
+    }
+    return total;
+}
+
+bool DeltaPlan::assemble(QIODevice *seed, const std::function<QByteArray(qint64, qint64)> &fetch,
+    QIODevice *output) const
+{
+    for (const auto &range : ranges) {
+        if (range.seedOffset >= 0 && !seed->seek(range.seedOffset)) {
+            qCWarning(lcDeltaSync) << "Could not seek in seed to" << range.seedOffset;
+            return false;
+        }
+        for (qint64 done = 0; done < range.length;) {
+            const qint64 length = qMin(ioChunkSize, range.length - done);
+            QByteArray data = range.seedOffset >= 0
+                ? seed->read(length)
+                : fetch(range.targetOffset + done, length);
+            if (data.size() != length) {
+                qCWarning(lcDeltaSync) << "Short data for target range at" << range.targetOffset + done;
+                return false;
+            }
+            if (output->write(data) != length) {
+                qCWarning(lcDeltaSync) << "Could not write output" << output->errorString();
+                return false;
+            }
+            done += length;
+        }
+    }
+    return true;
+}
+
+bool DeltaPlan::copyFromSeed(QIODevice *seed, QIODevice *output) const
+{
+    for (const auto &range : ranges) {
+        if (range.seedOffset < 0)
+            continue;
+        if (!seed->seek(range.seedOffset) || !output->seek(range.targetOffset)) {
+            qCWarning(lcDeltaSync) << "Could not seek to the range at" << range.targetOffset;
+            return false;
+        }
+        for (qint64 done = 0; done < range.length;) {
+            const qint64 length = qMin(ioChunkSize, range.length - done);
+            const QByteArray data = seed->read(length);
+            if (data.size() != length) {
+                qCWarning(lcDeltaSync) << "Short seed data for target range at" << range.targetOffset + done;
+                return false;
+            }
+            if (output->write(data) != length) {
+                qCWarning(lcDeltaSync) << "Could not write output" << output->errorString();
+                return false;
+            }
+            done += length;
+        }
+    }
+    return true;
+}
+
+} // namespace OCC
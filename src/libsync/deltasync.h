@@ -0,0 +1,114 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ */
+
+#pragma once
+
+#include "owncloudlib.h"
+
+#include <QByteArray>
+#include <QVector>
+
+#include <functional>
+
+class QIODevice;
+
+namespace OCC {
+
+/**
+ * @brief Per-block signatures of a file, as used by rsync/zsync style transfers
+ *
+ * Each block of blockSize bytes (the last one may be shorter) has a cheap
+ * rolling checksum to find candidate positions in another file and a strong
+ * hash to confirm them.
+ *
+ * Servers that offer the blockSignatures capability serve them for each
+ * file, see PropagateDownloadFile::startDeltaDownload().
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT BlockSignatures
+{
+public:
+    struct Block
+    {
+        quint32 weak = 0;
+        QByteArray strong;
+    };
+
+    /// Signatures of the remaining contents of device; empty on read errors
+    static BlockSignatures compute(QIODevice *device, int blockSize);
+
+    /// Compact binary form, suitable for storing next to the journal
+    QByteArray serialize() const;
+    /// Inverse of serialize(); returns invalid signatures for malformed data
+    static BlockSignatures deserialize(const QByteArray &data);
+
+    bool isValid() const { return blockSize > 0; }
+
+    /// Rolling checksum of data, compatible with the per-byte updates done during matching
+    static quint32 weakChecksum(const char *data, int size);
+    static QByteArray strongHash(const char *data, int size);
+
+    int blockSize = 0;
+    qint64 fileSize = 0;
+    QVector<Block> blocks;
+};
+
+/**
+ * @brief How to build a target file from a local seed file plus fetched ranges
+ *
+ * Blocks of the target that are found anywhere in the seed, at any offset,
+ * are copied from there; everything else has to be transferred.
+ *
+ * @ingroup libsync
+ */
+class OWNCLOUDSYNC_EXPORT DeltaPlan
+{
+public:
+    struct Range
+    {
+        qint64 targetOffset = 0;
+        qint64 length = 0;
+        /// Where the data comes from in the seed, -1 for ranges to fetch
+        qint64 seedOffset = -1;
+    };
+
+    /// Matches the blocks of target against the contents of seed
+    static DeltaPlan compute(const BlockSignatures &target, QIODevice *seed);
+
+    /**
+     * Writes the target to output, copying known ranges from seed and asking
+     * fetch for the data of the others.
+     *
+     * fetch gets the target offset and length of a range, or of a piece of
+     * a large range, and must return exactly that many bytes. Returns false
+     * on any read, write or fetch error.
+     */
+    bool assemble(QIODevice *seed, const std::function<QByteArray(qint64 offset, qint64 length)> &fetch,
+        QIODevice *output) const;
+
+    /**
+     * Writes the ranges found in seed to output at their target offsets and
+     * leaves the others untouched, so they can be fetched separately.
+     *
+     * output must be random access. Returns false on any read or write error.
+     */
+    bool copyFromSeed(QIODevice *seed, QIODevice *output) const;
+
+    /// All ranges of the target in order, adjacent ones of the same kind merged
+    QVector<Range> ranges;
+    qint64 targetSize = 0;
+
+    qint64 bytesToFetch() const;
+};
+
+} // namespace OCC
@@ -17,6 +17,7 @@
 #include "account.h"
 #include "common/asserts.h"
 #include "common/checksums.h"
+#include "common/syncjournaldb.h"
 
 #include <csync_private.h>
 #include <csync_rename.h>
@@ -475,6 +476,9 @@ void DiscoveryMainThread::setupHooks(DiscoveryJob *discoveryJob, const QString &
 {
     _discoveryJob = discoveryJob;
     _pathPrefix = pathPrefix;
+    _syncOptions = discoveryJob->_syncOptions;
+    _selectiveSyncBlackList = discoveryJob->_selectiveSyncBlackList;
+    _selectiveSyncBlackList.sort();
 
     connect(discoveryJob, &DiscoveryJob::doOpendirSignal,
         this, &DiscoveryMainThread::doOpendirSlot,
@@ -482,10 +486,13 @@ void DiscoveryMainThread::setupHooks(DiscoveryJob *discoveryJob, const QString &
     connect(discoveryJob, &DiscoveryJob::doGetSizeSignal,
         this, &DiscoveryMainThread::doGetSizeSlot,
         Qt::QueuedConnection);
+
+    // The root is always listed, the request can run while the local discovery does
+    if (_syncOptions._discoveryPipelineDepth > 0)
+        startListing(fullRemotePath(QString()));
 }
 
-// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
-void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+QString DiscoveryMainThread::fullRemotePath(const QString &subPath) const
 {
     QString fullPath = _pathPrefix;
     if (!_pathPrefix.endsWith('/')) {
@@ -496,93 +503,200 @@ void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirecto
     while (fullPath.endsWith('/')) {
         fullPath.chop(1);
     }
+    return fullPath;
+}
+
+// Coming from owncloud_opendir -> DiscoveryJob::vio_opendir_hook -> doOpendirSignal
+void DiscoveryMainThread::doOpendirSlot(const QString &subPath, DiscoveryDirectoryResult *r)
+{
+    const QString fullPath = fullRemotePath(subPath);
 
     _discoveryJob->update_job_update_callback(/*local=*/false, subPath.toUtf8(), _discoveryJob);
 
     // Result gets written in there
     _currentDiscoveryDirectoryResult = r;
     _currentDiscoveryDirectoryResult->path = fullPath;
+    _currentPath = fullPath;
 
-    // Schedule the DiscoverySingleDirectoryJob
-    _singleDirJob = new DiscoverySingleDirectoryJob(_account, fullPath, this);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithResult,
-        this, &DiscoveryMainThread::singleDirectoryJobResultSlot);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithError,
-        this, &DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::firstDirectoryPermissions,
-        this, &DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::etagConcatenation,
+    skipPrefetchesBefore(fullPath);
+    auto it = _listings.find(fullPath);
+    if (it == _listings.end()) {
+        startListing(fullPath);
+    } else if (it->second.finished) {
+        deliverListing();
+    }
+    startPrefetches();
+}
+
+void DiscoveryMainThread::startListing(const QString &fullPath)
+{
+    auto job = new DiscoverySingleDirectoryJob(_account, fullPath, this);
+    _listings[fullPath].job = job;
+
+    connect(job, &DiscoverySingleDirectoryJob::finishedWithResult, this, [this, job, fullPath] {
+        auto it = _listings.find(fullPath);
+        if (it == _listings.end())
+            return;
+        it->second.list = job->takeResults();
+        it->second.dataFingerprint = job->_dataFingerprint;
+        listingFinished(fullPath, 0, QString());
+    });
+    connect(job, &DiscoverySingleDirectoryJob::finishedWithError, this, [this, fullPath](int csyncErrnoCode, const QString &msg) {
+        listingFinished(fullPath, csyncErrnoCode, msg);
+    });
+    connect(job, &DiscoverySingleDirectoryJob::firstDirectoryPermissions, this, [this, fullPath](RemotePermissions p) {
+        auto it = _listings.find(fullPath);
+        if (it != _listings.end())
+            it->second.directoryPermissions = p;
+    });
+    connect(job, &DiscoverySingleDirectoryJob::etagConcatenation,
         this, &DiscoveryMainThread::etagConcatenation);
-    QObject::connect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::etag,
+    connect(job, &DiscoverySingleDirectoryJob::etag,
         this, &DiscoveryMainThread::etag);
 
-    if (!_firstFolderProcessed) {
-        _singleDirJob->setIsRootPath();
+    if (fullPath == fullRemotePath(QString())) {
+        job->setIsRootPath();
     }
 
-    _singleDirJob->start();
+    job->start();
 }
 
-
-void DiscoveryMainThread::singleDirectoryJobResultSlot()
+void DiscoveryMainThread::listingFinished(const QString &fullPath, int csyncErrnoCode, const QString &msg)
 {
-    if (!_currentDiscoveryDirectoryResult) {
+    auto it = _listings.find(fullPath);
+    if (it == _listings.end()) {
         return; // possibly aborted
     }
+    auto &listing = it->second;
+    listing.finished = true;
+    listing.code = csyncErrnoCode;
+    listing.msg = msg;
 
-    _currentDiscoveryDirectoryResult->list = _singleDirJob->takeResults();
-    _currentDiscoveryDirectoryResult->code = 0;
-
-    qCDebug(lcDiscovery) << "Have" << _currentDiscoveryDirectoryResult->list.size() << "results for " << _currentDiscoveryDirectoryResult->path;
+    if (csyncErrnoCode == 0 && fullPath == fullRemotePath(QString())) {
+        prefetchSubdirectories(listing.list);
+    }
+    if (fullPath == _currentPath && _currentDiscoveryDirectoryResult) {
+        deliverListing();
+    }
+}
 
-    _currentDiscoveryDirectoryResult = nullptr; // the sync thread owns it now
+void DiscoveryMainThread::deliverListing()
+{
+    auto it = _listings.find(_currentPath);
+    ASSERT(it != _listings.end() && it->second.finished);
+    auto &listing = it->second;
+
+    if (listing.code == 0) {
+        _currentDiscoveryDirectoryResult->list = std::move(listing.list);
+        _currentDiscoveryDirectoryResult->code = 0;
+        qCDebug(lcDiscovery) << "Have" << _currentDiscoveryDirectoryResult->list.size() << "results for " << _currentDiscoveryDirectoryResult->path;
+
+        if (!_firstFolderProcessed) {
+            _firstFolderProcessed = true;
+            _dataFingerprint = listing.dataFingerprint;
+        }
+    } else {
+        qCDebug(lcDiscovery) << listing.code << listing.msg;
+        _currentDiscoveryDirectoryResult->code = listing.code;
+        _currentDiscoveryDirectoryResult->msg = listing.msg;
+    }
 
-    if (!_firstFolderProcessed) {
-        _firstFolderProcessed = true;
-        _dataFingerprint = _singleDirJob->_dataFingerprint;
+    // Should be thread safe since the sync thread is blocked
+    if (!listing.directoryPermissions.isNull() && _discoveryJob->_csync_ctx->remote.root_perms.isNull()) {
+        qCDebug(lcDiscovery) << "Permissions for root dir:" << listing.directoryPermissions.toString();
+        _discoveryJob->_csync_ctx->remote.root_perms = listing.directoryPermissions;
     }
 
+    _currentDiscoveryDirectoryResult = nullptr; // the sync thread owns it now
+    _currentPath.clear();
+    _listings.erase(it);
+
     _discoveryJob->_vioMutex.lock();
     _discoveryJob->_vioWaitCondition.wakeAll();
     _discoveryJob->_vioMutex.unlock();
 }
 
-void DiscoveryMainThread::singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg)
+void DiscoveryMainThread::dropListing(const QString &fullPath)
 {
-    if (!_currentDiscoveryDirectoryResult) {
-        return; // possibly aborted
+    auto it = _listings.find(fullPath);
+    if (it == _listings.end()) {
+        return;
+    }
+    if (auto job = it->second.job.data()) {
+        disconnect(job, nullptr, this, nullptr);
+        job->abort();
     }
-    qCDebug(lcDiscovery) << csyncErrnoCode << msg;
+    _listings.erase(it);
+}
 
-    _currentDiscoveryDirectoryResult->code = csyncErrnoCode;
-    _currentDiscoveryDirectoryResult->msg = msg;
-    _currentDiscoveryDirectoryResult = nullptr; // the sync thread owns it now
+void DiscoveryMainThread::prefetchSubdirectories(const std::deque<std::unique_ptr<csync_file_stat_t>> &list)
+{
+    if (_syncOptions._discoveryPipelineDepth <= 0 || !_discoveryJob) {
+        return;
+    }
+    CSYNC *ctx = _discoveryJob->_csync_ctx;
 
-    _discoveryJob->_vioMutex.lock();
-    _discoveryJob->_vioWaitCondition.wakeAll();
-    _discoveryJob->_vioMutex.unlock();
+    for (const auto &fs : list) {
+        if (fs->type != ItemTypeDirectory) {
+            continue;
+        }
+        const QString path = QString::fromUtf8(fs->path);
+        if (findPathInList(_selectiveSyncBlackList, path)) {
+            continue;
+        }
+
+        // Like _csync_detect_update: unchanged directories are read from the database
+        SyncJournalFileRecord rec;
+        if (!ctx->statedb->getFileRecord(fs->path, &rec)) {
+            continue;
+        }
+        if (rec.isValid()) {
+            if (ctx->read_remote_from_db
+                && rec._type == ItemTypeDirectory
+                && rec._etag == fs->etag
+                && rec._fileId == fs->file_id
+                && rec._remotePerm == fs->remotePerm) {
+                continue;
+            }
+        } else if (_syncOptions._newBigFolderSizeLimit >= 0 || _syncOptions._confirmExternalStorage) {
+            // The user might not want to sync it
+            continue;
+        }
+        _prefetchQueue.append(fullRemotePath(path));
+    }
+    startPrefetches();
 }
 
-void DiscoveryMainThread::singleDirectoryJobFirstDirectoryPermissionsSlot(RemotePermissions p)
+void DiscoveryMainThread::startPrefetches()
 {
-    // Should be thread safe since the sync thread is blocked
-    if (_discoveryJob->_csync_ctx->remote.root_perms.isNull()) {
-        qCDebug(lcDiscovery) << "Permissions for root dir:" << p.toString();
-        _discoveryJob->_csync_ctx->remote.root_perms = p;
+    while (!_prefetchQueue.isEmpty() && _prefetched.size() < _syncOptions._discoveryPipelineDepth) {
+        const QString fullPath = _prefetchQueue.takeFirst();
+        qCDebug(lcDiscovery) << "Prefetching the listing of" << fullPath;
+        _prefetched.append(fullPath);
+        startListing(fullPath);
     }
 }
 
-void DiscoveryMainThread::doGetSizeSlot(const QString &path, qint64 *result)
+void DiscoveryMainThread::skipPrefetchesBefore(const QString &fullPath)
 {
-    QString fullPath = _pathPrefix;
-    if (!_pathPrefix.endsWith('/')) {
-        fullPath += '/';
+    // The sync thread walks the directories in order: when it asks for one, the
+    // prefetched listings before it won't be needed, it skipped their directories
+    int prefetchedIndex = _prefetched.indexOf(fullPath);
+    int queueIndex = _prefetchQueue.indexOf(fullPath);
+    if (prefetchedIndex < 0 && queueIndex < 0) {
+        return;
     }
-    fullPath += path;
-    // remove trailing slash
-    while (fullPath.endsWith('/')) {
-        fullPath.chop(1);
+    int skipped = queueIndex >= 0 ? _prefetched.size() : prefetchedIndex;
+    for (int i = 0; i < skipped; ++i) {
+        dropListing(_prefetched.at(i));
     }
+    _prefetched.erase(_prefetched.begin(), _prefetched.begin() + qMax(prefetchedIndex + 1, skipped));
+    _prefetchQueue.erase(_prefetchQueue.begin(), _prefetchQueue.begin() + queueIndex + 1);
+}
+
+void DiscoveryMainThread::doGetSizeSlot(const QString &path, qint64 *result)
+{
+    const QString fullPath = fullRemotePath(path);
 
     _currentGetSizeResult = result;
 
@@ -627,11 +741,11 @@ void DiscoveryMainThread::slotGetSizeResult(const QVariantMap &map)
 // called from SyncEngine
 void DiscoveryMainThread::abort()
 {
-    if (_singleDirJob) {
-        disconnect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithError, this, nullptr);
-        disconnect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::firstDirectoryPermissions, this, nullptr);
-        disconnect(_singleDirJob.data(), &DiscoverySingleDirectoryJob::finishedWithResult, this, nullptr);
-        _singleDirJob->abort();
+    _prefetchQueue.clear();
+    _prefetched.clear();
+    while (!_listings.empty()) {
+        const QString fullPath = _listings.begin()->first;
+        dropListing(fullPath);
     }
     if (_currentDiscoveryDirectoryResult) {
         if (_discoveryJob->_vioMutex.tryLock()) {
@@ -24,6 +24,7 @@
 #include <QWaitCondition>
 #include <QLinkedList>
 #include <deque>
+#include <map>
 #include "syncoptions.h"
 
 namespace OCC {
@@ -100,19 +101,52 @@ public:
 };
 
 // Lives in main thread. Deleted by the SyncEngine
+//
+// Directory listings can be requested before the sync thread asks for them:
+// the root one while the local discovery runs, and the ones of the changed
+// first level directories as soon as the root listing arrived, at most
+// SyncOptions::_discoveryPipelineDepth of them at the same time.
 class DiscoveryJob;
 class DiscoveryMainThread : public QObject
 {
     Q_OBJECT
 
+    struct Listing
+    {
+        QPointer<DiscoverySingleDirectoryJob> job;
+        bool finished = false;
+        int code = EIO;
+        QString msg;
+        std::deque<std::unique_ptr<csync_file_stat_t>> list;
+        RemotePermissions directoryPermissions;
+        QByteArray dataFingerprint;
+    };
+
     QPointer<DiscoveryJob> _discoveryJob;
-    QPointer<DiscoverySingleDirectoryJob> _singleDirJob;
     QString _pathPrefix; // remote path
     AccountPtr _account;
+    SyncOptions _syncOptions;
+    QStringList _selectiveSyncBlackList; // sorted
+    // Requested listings, by full remote path
+    std::map<QString, Listing> _listings;
+    // First level directories to prefetch and the ones being prefetched,
+    // in the order the sync thread walks them
+    QStringList _prefetchQueue;
+    QStringList _prefetched;
+    QString _currentPath; // the listing the sync thread waits for
     DiscoveryDirectoryResult *_currentDiscoveryDirectoryResult;
     qint64 *_currentGetSizeResult;
     bool _firstFolderProcessed;
 
+    QString fullRemotePath(const QString &subPath) const;
+    void startListing(const QString &fullPath);
+    void listingFinished(const QString &fullPath, int csyncErrnoCode, const QString &msg);
+    void deliverListing();
+    void dropListing(const QString &fullPath);
+    void prefetchSubdirectories(const std::deque<std::unique_ptr<csync_file_stat_t>> &list);
+    void startPrefetches();
+    void skipPrefetchesBefore(const QString &fullPath);
+
 public:
     DiscoveryMainThread(AccountPtr account)
         : QObject()
@@ -132,11 +166,6 @@ public slots:
     void doOpendirSlot(const QString &url, DiscoveryDirectoryResult *);
     void doGetSizeSlot(const QString &path, qint64 *result);
 
-    // From Job:
-    void singleDirectoryJobResultSlot();
-    void singleDirectoryJobFinishedWithErrorSlot(int csyncErrnoCode, const QString &msg);
-    void singleDirectoryJobFirstDirectoryPermissionsSlot(RemotePermissions);
-
     void slotGetSizeFinishedWithError();
     void slotGetSizeResult(const QVariantMap &);
 signals:
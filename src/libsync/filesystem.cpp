@@ -26,11 +26,26 @@ extern "C" int c_utimes(const char *, const struct timeval *);
 #include "std/c_string.h"
 #include "std/c_utf8.h"
 
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <unistd.h>
+#ifdef HAVE_FICLONE
+#include <linux/fs.h>
+#endif
+#endif
+
 namespace OCC {
 
+// Amount of data read at once when comparing or copying files
+static const qint64 ioBufferSize = 1024 * 1024;
+
 bool FileSystem::fileEquals(const QString &fn1, const QString &fn2)
 {
     // compare two files with given filename and return true if they have the same content
+    if (getSize(fn1) != getSize(fn2)) {
+        return false;
+    }
+
     QFile f1(fn1);
     QFile f2(fn2);
     if (!f1.open(QIODevice::ReadOnly) || !f2.open(QIODevice::ReadOnly)) {
@@ -38,29 +53,109 @@ bool FileSystem::fileEquals(const QString &fn1, const QString &fn2)
         return false;
     }
 
-    if (getSize(fn1) != getSize(fn2)) {
-        return false;
-    }
-
-    const int BufferSize = 16 * 1024;
-    char buffer1[BufferSize];
-    char buffer2[BufferSize];
+    QByteArray buffer1(ioBufferSize, Qt::Uninitialized);
+    QByteArray buffer2(ioBufferSize, Qt::Uninitialized);
     do {
-        int r = f1.read(buffer1, BufferSize);
-        if (f2.read(buffer2, BufferSize) != r) {
+        qint64 r = f1.read(buffer1.data(), ioBufferSize);
+        if (f2.read(buffer2.data(), ioBufferSize) != r) {
             // this should normally not happen: the files are supposed to have the same size.
             return false;
         }
         if (r <= 0) {
             return true;
         }
-        if (memcmp(buffer1, buffer2, r) != 0) {
+        if (memcmp(buffer1.constData(), buffer2.constData(), r) != 0) {
             return false;
         }
     } while (true);
     return false;
 }
 
+bool FileSystem::copyFileContents(QFile &source, QFile &destination, QString *errorString)
+{
+    if (!destination.flush()) {
+        *errorString = destination.errorString();
+        return false;
+    }
+
+#ifdef Q_OS_LINUX
+    const int in = source.handle();
+    const int out = destination.handle();
+#ifdef HAVE_FICLONE
+    // On btrfs, XFS and similar the destination can share the data extents
+    // of the source, nothing is copied at all.
+    if (ioctl(out, FICLONE, in) == 0) {
+        return true;
+    }
+#endif
+#ifdef HAVE_COPY_FILE_RANGE
+    // The kernel copies without a round trip through user space, and may
+    // offload the copy to the server on network file systems.
+    const qint64 size = source.size();
+    loff_t inOffset = 0;
+    loff_t outOffset = 0;
+    while (inOffset < size) {
+        ssize_t copied = copy_file_range(in, &inOffset, out, &outOffset, size - inOffset, 0);
+        if (copied <= 0)
+            break;
+    }
+    if (inOffset == size) {
+        return true;
+    }
+    // Not supported between these files (EXDEV on older kernels, EINVAL, ...)
+    if (inOffset > 0 && !destination.resize(0)) {
+        *errorString = destination.errorString();
+        return false;
+    }
+#endif
+#endif
+
+    if (!source.seek(0)) {
+        *errorString = source.errorString();
+        return false;
+    }
+    QByteArray buffer(ioBufferSize, Qt::Uninitialized);
+    while (!source.atEnd()) {
+        qint64 read = source.read(buffer.data(), ioBufferSize);
+        if (read <= 0) {
+            *errorString = source.errorString();
+            return false;
+        }
+        if (destination.write(buffer.constData(), read) != read) {
+            *errorString = destination.errorString();
+            return false;
+        }
+    }
+    if (!destination.flush()) {
+        *errorString = destination.errorString();
+        return false;
+    }
+    return true;
+}
+
+bool FileSystem::copyFile(const QString &source, const QString &destination, QString *errorString)
+{
+    QFile sourceFile(source);
+    if (!sourceFile.open(QIODevice::ReadOnly)) {
+        *errorString = sourceFile.errorString();
+        return false;
+    }
+    QFile destinationFile(destination);
+    if (!destinationFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        *errorString = destinationFile.errorString();
+        return false;
+    }
+    if (!copyFileContents(sourceFile, destinationFile, errorString)) {
+        qCWarning(lcFileSystem) << "Copying" << source << "to" << destination << "failed:" << *errorString;
+        destinationFile.close();
+        destinationFile.remove();
+        return false;
+    }
+    destinationFile.close();
+    destinationFile.setPermissions(sourceFile.permissions());
+    return true;
+}
+
 time_t FileSystem::getModTime(const QString &filename)
 {
     csync_file_stat_t stat;
@@ -40,7 +40,27 @@ namespace FileSystem {
     /**
  * @brief compare two files with given filename and return true if they have the same content
  */
-    bool fileEquals(const QString &fn1, const QString &fn2);
+    bool OWNCLOUDSYNC_EXPORT fileEquals(const QString &fn1, const QString &fn2);
+
+    /**
+ * @brief Copy all data of the open file \a source into the empty, open file \a destination
+ *
+ * Where the file system supports it the data is cloned (FICLONE) or copied
+ * inside the kernel (copy_file_range), otherwise it goes through a large
+ * buffer. The file positions are not meaningful afterwards.
+ *
+ * @return true on success, false and an error string otherwise. The destination
+ * may contain partial data on failure.
+ */
+    bool OWNCLOUDSYNC_EXPORT copyFileContents(QFile &source, QFile &destination, QString *errorString);
+
+    /**
+ * @brief Copy the file \a source to \a destination, replacing it if it exists
+ *
+ * Like QFile::copy(), but uses copyFileContents(). On failure no partial
+ * destination is left behind.
+ */
+    bool OWNCLOUDSYNC_EXPORT copyFile(const QString &source, const QString &destination, QString *errorString);
 
     /**
  * @brief Get the mtime for a filepath
@@ -41,6 +41,8 @@
 #include <QTimerEvent>
 #include <qmath.h>
 
+#include <algorithm>
+
 namespace OCC {
 
 Q_LOGGING_CATEGORY(lcPropagator, "nextcloud.sync.propagator", QtInfoMsg)
@@ -80,12 +82,11 @@ OwncloudPropagator::~OwncloudPropagator()
 
 int OwncloudPropagator::maximumActiveTransferJob()
 {
-    if (_downloadLimit.fetchAndAddAcquire(0) != 0
-        || _uploadLimit.fetchAndAddAcquire(0) != 0
-        || !_syncOptions._parallelNetworkJobs) {
-        // disable parallelism when there is a network limit.
+    if (!_syncOptions._parallelNetworkJobs) {
         return 1;
     }
+    // Network limits don't disable parallelism, the BandwidthScheduler
+    // shares the bandwidth fairly between the transfers.
     return qMin(3, qCeil(hardMaximumActiveJob() / 2.));
 }
 
@@ -112,6 +113,16 @@ PropagateItemJob::~PropagateItemJob()
     }
 }
 
+PropagatorJob::JobPriority PropagateItemJob::priority() const
+{
+    return propagator()->itemPriority(*_item);
+}
+
+bool PropagateItemJob::isLimitedTransfer() const
+{
+    return propagator()->isLimitedTransfer(priority(), _item->_size);
+}
+
 static qint64 getMinBlacklistTime()
 {
     return qMax(qEnvironmentVariableIntValue("OWNCLOUD_BLACKLIST_TIME_MIN"),
@@ -226,6 +237,11 @@ void PropagateItemJob::done(SyncFileItem::Status statusArg, const QString &error
     _item->_status = statusArg;
 
     _state = Finished;
+    if (_traceStarted >= 0) {
+        // Time spent waiting to be scheduled, then time spent running
+        Tracing::addSpan("propagator", "queued", _item->_file, _traceCreated, _traceStarted - _traceCreated);
+        Tracing::addSpan("propagator", metaObject()->className(), _item->_file, _traceStarted, Tracing::now() - _traceStarted);
+    }
     if (_item->_isRestoration) {
         if (_item->_status == SyncFileItem::Success
             || _item->_status == SyncFileItem::Conflict) {
@@ -366,9 +382,49 @@ quint64 OwncloudPropagator::smallFileSize()
     return smallFileSize;
 }
 
+quint64 OwncloudPropagator::largeFileSize()
+{
+    const quint64 largeFileSize = 10 * 1000 * 1000; // the default chunk size. Not dynamic right now.
+    return largeFileSize;
+}
+
+PropagatorJob::JobPriority OwncloudPropagator::itemPriority(const SyncFileItem &item)
+{
+    const bool transfersContents = !item.isDirectory()
+        && (item._instruction == CSYNC_INSTRUCTION_NEW
+               || item._instruction == CSYNC_INSTRUCTION_SYNC
+               || item._instruction == CSYNC_INSTRUCTION_CONFLICT
+               || item._instruction == CSYNC_INSTRUCTION_TYPE_CHANGE)
+        && item._type != ItemTypeVirtualFile
+        && item._type != ItemTypeVirtualFileDehydration;
+    if (!transfersContents)
+        return PropagatorJob::MetadataPriority;
+
+    if (item._size >= largeFileSize())
+        return PropagatorJob::LargeFilePriority;
+
+    const QDateTime modtime = Utility::qDateTimeFromTime_t(item._modtime);
+    const qint64 secsSinceMod = modtime.secsTo(_tasksQueuedTime);
+    if (secsSinceMod >= 0 && secsSinceMod < recentlyModifiedSecs)
+        return PropagatorJob::RecentlyModifiedPriority;
+
+    return PropagatorJob::SmallFilePriority;
+}
+
+int OwncloudPropagator::largeTransferLanes()
+{
+    return qMax(1, maximumActiveTransferJob() - 1);
+}
+
+bool OwncloudPropagator::isLimitedTransfer(PropagatorJob::JobPriority priority, quint64 size)
+{
+    return priority != PropagatorJob::MetadataPriority && size >= smallFileSize();
+}
+
 void OwncloudPropagator::start(const SyncFileItemVector &items)
 {
     Q_ASSERT(std::is_sorted(items.begin(), items.end()));
+    _tasksQueuedTime = QDateTime::currentDateTimeUtc();
 
     /* This builds all the jobs needed for the propagation.
      * Each directory is a PropagateDirectory job, which contains the files in it.
@@ -602,27 +658,48 @@ void OwncloudPropagator::scheduleNextJobImpl()
     // Down-scaling on slow networks? https://github.com/owncloud/client/issues/3382
     // Making sure we do up/down at same time? https://github.com/owncloud/client/issues/1633
 
-    if (_activeJobList.count() < maximumActiveTransferJob()) {
-        if (_rootJob->scheduleSelfOrChild()) {
-            scheduleNextJob();
-        }
-    } else if (_activeJobList.count() < hardMaximumActiveJob()) {
-        int likelyFinishedQuicklyCount = 0;
-        // NOTE: Only counts the first 3 jobs! Then for each
-        // one that is likely finished quickly, we can launch another one.
-        // When a job finishes another one will "move up" to be one of the first 3 and then
-        // be counted too.
-        for (int i = 0; i < maximumActiveTransferJob() && i < _activeJobList.count(); i++) {
-            if (_activeJobList.at(i)->isLikelyFinishedQuickly()) {
-                likelyFinishedQuicklyCount++;
-            }
-        }
-        if (_activeJobList.count() < maximumActiveTransferJob() + likelyFinishedQuicklyCount) {
-            qCDebug(lcPropagator) << "Can pump in another request! activeJobs =" << _activeJobList.count();
-            if (_rootJob->scheduleSelfOrChild()) {
-                scheduleNextJob();
-            }
-        }
+    const int activeJobs = _activeJobList.count();
+    if (activeJobs >= hardMaximumActiveJob())
+        return;
+
+    // Transfers that take a while share maximumActiveTransferJob() slots and
+    // large ones only run in their own lanes among these. Quick jobs may use
+    // all the slots.
+    int activeLimitedTransfers = 0;
+    int activeLargeTransfers = 0;
+    foreach (PropagateItemJob *job, _activeJobList) {
+        const auto priority = job->priority();
+        if (isLimitedTransfer(priority, job->_item->_size))
+            ++activeLimitedTransfers;
+        if (priority == PropagatorJob::LargeFilePriority)
+            ++activeLargeTransfers;
+    }
+    const auto maxPriority = activeLargeTransfers < largeTransferLanes()
+        ? PropagatorJob::LargeFilePriority
+        : PropagatorJob::SmallFilePriority;
+    _schedulingLimitedTransfers = activeLimitedTransfers < maximumActiveTransferJob();
+
+    // Find the most important job anywhere in the tree, then let its parent
+    // start it. The tree still decides which jobs may run, for example not
+    // before their directory was created.
+    bool started = false;
+    while (!started) {
+        _schedulingPriority = maxPriority;
+        PropagatorJob::NextJob next;
+        _rootJob->findNextJob(next);
+        if (!next.starter)
+            break;
+        _schedulingPriority = next.priority;
+        // This only fails when it started a directory that has nothing to
+        // run at that priority yet, the next walk looks into it.
+        started = next.starter->scheduleSelfOrChild();
+    }
+    _schedulingPriority = PropagatorJob::LargeFilePriority;
+    _schedulingLimitedTransfers = true;
+
+    if (started) {
+        qCDebug(lcPropagator) << "Started a job, activeJobs =" << _activeJobList.count();
+        scheduleNextJob();
     }
 }
 
@@ -631,6 +708,14 @@ void OwncloudPropagator::reportProgress(const SyncFileItem &item, quint64 bytes)
     emit progress(item, bytes);
 }
 
+void OwncloudPropagator::groupCommitJournal(const QString &context)
+{
+    if (_lastGroupCommit.isValid() && _lastGroupCommit.elapsed() < groupCommitMsec)
+        return;
+    _journal->commit(context);
+    _lastGroupCommit.start();
+}
+
 AccountPtr OwncloudPropagator::account() const
 {
     return _account;
@@ -793,25 +878,28 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
         }
     }
 
-    // Now it's our turn, check if we have something left to do.
-    // First, convert a task to a job if necessary
-    while (_jobsToDo.isEmpty() && !_tasksToDo.isEmpty()) {
-        SyncFileItemPtr nextTask = _tasksToDo.first();
-        _tasksToDo.remove(0);
+    // Now it's our turn, check if we have something left to do that may
+    // start right now. Jobs keep their order, they come first.
+    if (!_jobsToDo.isEmpty()
+        && propagator()->mayStart(_jobsToDo.first()->priority(), _jobsToDo.first()->isLimitedTransfer())) {
+        PropagatorJob *nextJob = _jobsToDo.first();
+        _jobsToDo.remove(0);
+        _runningJobs.append(nextJob);
+        return possiblyRunNextJob(nextJob);
+    }
+
+    // Then convert the most important task to a job and run it
+    for (int i = nextTaskIndex(); i >= 0; i = nextTaskIndex()) {
+        SyncFileItemPtr nextTask = _tasksToDo.at(i);
+        _tasksToDo.remove(i);
         PropagatorJob *job = propagator()->createJob(nextTask);
         if (!job) {
             qCWarning(lcDirectory) << "Useless task found for file" << nextTask->destination() << "instruction" << nextTask->_instruction;
             continue;
         }
-        appendJob(job);
-        break;
-    }
-    // Then run the next job
-    if (!_jobsToDo.isEmpty()) {
-        PropagatorJob *nextJob = _jobsToDo.first();
-        _jobsToDo.remove(0);
-        _runningJobs.append(nextJob);
-        return possiblyRunNextJob(nextJob);
+        job->setAssociatedComposite(this);
+        _runningJobs.append(job);
+        return possiblyRunNextJob(job);
     }
 
     // If neither us or our children had stuff left to do we could hang. Make sure
@@ -824,6 +912,78 @@ bool PropagatorCompositeJob::scheduleSelfOrChild()
     return false;
 }
 
+void PropagatorCompositeJob::findNextJob(NextJob &next)
+{
+    if (_state == Finished)
+        return;
+
+    for (int i = 0; i < _runningJobs.size(); ++i) {
+        _runningJobs.at(i)->findNextJob(next);
+        if (next.starter && next.priority == MetadataPriority)
+            return;
+        if (_runningJobs.at(i)->parallelism() == WaitForFinished)
+            return;
+    }
+
+    if (!_jobsToDo.isEmpty()
+        && propagator()->mayStart(_jobsToDo.first()->priority(), _jobsToDo.first()->isLimitedTransfer())) {
+        next.consider(_jobsToDo.first()->priority(), this);
+    }
+    const int task = nextTaskIndex();
+    if (task >= 0)
+        next.consider(propagator()->itemPriority(*_tasksToDo.at(task)), this);
+
+    // Nothing will start us, see scheduleSelfOrChild()
+    if (_jobsToDo.isEmpty() && _tasksToDo.isEmpty() && _runningJobs.isEmpty())
+        QMetaObject::invokeMethod(this, "finalize", Qt::QueuedConnection);
+}
+
+int PropagatorCompositeJob::nextTaskIndex()
+{
+    sortTasks();
+    auto propagator = this->propagator();
+    int i = 0;
+    while (i < _tasksToDo.size()) {
+        const auto &item = *_tasksToDo.at(i);
+        const auto priority = propagator->itemPriority(item);
+        if (propagator->mayStart(priority, propagator->isLimitedTransfer(priority, item._size)))
+            return i;
+
+        // The tasks are sorted by size, so the rest of this priority can't
+        // start either
+        i = std::partition_point(_tasksToDo.begin() + i + 1, _tasksToDo.end(),
+                [&](const SyncFileItemPtr &task) { return propagator->itemPriority(*task) <= priority; })
+            - _tasksToDo.begin();
+    }
+    return -1;
+}
+
+void PropagatorCompositeJob::sortTasks()
+{
+    if (_tasksSorted)
+        return;
+    _tasksSorted = true;
+
+    // Smaller transfers first; jobs without transfers keep their order.
+    struct KeyedTask
+    {
+        int priority;
+        quint64 size;
+        SyncFileItemPtr item;
+    };
+    QVector<KeyedTask> keyed;
+    keyed.reserve(_tasksToDo.size());
+    for (const auto &item : _tasksToDo) {
+        const auto priority = propagator()->itemPriority(*item);
+        keyed.append({ priority, priority == MetadataPriority ? 0 : item->_size, item });
+    }
+    std::stable_sort(keyed.begin(), keyed.end(), [](const KeyedTask &a, const KeyedTask &b) {
+        return a.priority != b.priority ? a.priority < b.priority : a.size < b.size;
+    });
+    for (int i = 0; i < keyed.size(); ++i)
+        _tasksToDo[i] = keyed.at(i).item;
+}
+
 void PropagatorCompositeJob::slotSubJobFinished(SyncFileItem::Status status)
 {
     PropagatorJob *subJob = static_cast<PropagatorJob *>(sender());
@@ -922,6 +1082,28 @@ bool PropagateDirectory::scheduleSelfOrChild()
     return _subJobs.scheduleSelfOrChild();
 }
 
+void PropagateDirectory::findNextJob(NextJob &next)
+{
+    if (_state == Finished)
+        return;
+
+    if (_state == NotYetStarted) {
+        next.consider(priority(), this);
+        return;
+    }
+
+    if (_firstJob && _firstJob->_state == NotYetStarted) {
+        if (propagator()->mayStart(_firstJob->priority(), _firstJob->isLimitedTransfer()))
+            next.consider(_firstJob->priority(), this);
+        return;
+    }
+
+    if (_firstJob && _firstJob->_state == Running)
+        return;
+
+    _subJobs.findNextJob(next);
+}
+
 void PropagateDirectory::slotFirstJobFinished(SyncFileItem::Status status)
 {
     _firstJob.take()->deleteLater();
@@ -20,6 +20,7 @@
 #include <QMap>
 #include <QLinkedList>
 #include <QElapsedTimer>
+#include <QDateTime>
 #include <QTimer>
 #include <QPointer>
 #include <QIODevice>
@@ -28,6 +29,7 @@
 #include "csync_util.h"
 #include "syncfileitem.h"
 #include "common/syncjournaldb.h"
+#include "common/tracing.h"
 #include "bandwidthmanager.h"
 #include "accountfwd.h"
 #include "syncoptions.h"
@@ -50,6 +52,7 @@ qint64 freeSpaceLimit();
 class SyncJournalDb;
 class OwncloudPropagator;
 class PropagatorCompositeJob;
+class EncryptedFolderTransaction;
 
 /**
  * @brief the base class of propagator jobs
@@ -91,11 +94,54 @@ public:
 
     virtual JobParallelism parallelism() { return FullParallelism; }
 
+    /** The order in which jobs are started, lower values first
+     *
+     * Jobs that don't transfer file contents are quick and come first, then
+     * the files that were modified recently and the other transfers below
+     * OwncloudPropagator::largeFileSize(). Transfers of at least
+     * OwncloudPropagator::smallFileSize() share maximumActiveTransferJob()
+     * slots and large ones only get some of these, see
+     * OwncloudPropagator::scheduleNextJobImpl().
+     */
+    enum JobPriority {
+        MetadataPriority,
+        RecentlyModifiedPriority,
+        SmallFilePriority,
+        LargeFilePriority
+    };
+
+    virtual JobPriority priority() const { return MetadataPriority; }
+
+    /** Whether the job counts against OwncloudPropagator::maximumActiveTransferJob() */
+    virtual bool isLimitedTransfer() const { return false; }
+
     /**
      * For "small" jobs
      */
     virtual bool isLikelyFinishedQuickly() { return false; }
 
+    /** The job that scheduleNextJobImpl() starts next */
+    struct NextJob
+    {
+        JobPriority priority = LargeFilePriority;
+        /// scheduleSelfOrChild() on it starts the job, null if there is none
+        PropagatorJob *starter = nullptr;
+
+        void consider(JobPriority candidatePriority, PropagatorJob *candidateStarter)
+        {
+            if (!starter || candidatePriority < priority) {
+                priority = candidatePriority;
+                starter = candidateStarter;
+            }
+        }
+    };
+
+    /** Looks for the most important job below this one that may start now
+     *
+     * Walks the same jobs as scheduleSelfOrChild() without starting any.
+     */
+    virtual void findNextJob(NextJob &next) { Q_UNUSED(next); }
+
     /** The space that the running jobs need to complete but don't actually use yet.
      *
      * Note that this does *not* include the disk space that's already
@@ -182,10 +228,14 @@ public:
     PropagateItemJob(OwncloudPropagator *propagator, const SyncFileItemPtr &item)
         : PropagatorJob(propagator)
         , _item(item)
+        , _traceCreated(Tracing::isEnabled() ? Tracing::now() : -1)
     {
     }
     ~PropagateItemJob();
 
+    JobPriority priority() const override;
+    bool isLimitedTransfer() const override;
+
     bool scheduleSelfOrChild() override
     {
         if (_state != NotYetStarted) {
@@ -195,12 +245,19 @@ public:
         qCInfo(lcPropagator) << "Starting" << instruction_str << "propagation of" << _item->_file << "by" << this;
 
         _state = Running;
+        if (_traceCreated >= 0)
+            _traceStarted = Tracing::now();
         QMetaObject::invokeMethod(this, "start"); // We could be in a different thread (neon jobs)
         return true;
     }
 
     SyncFileItemPtr _item;
 
+private:
+    // Tracing timestamps, -1 when tracing was disabled at creation
+    qint64 _traceCreated;
+    qint64 _traceStarted = -1;
+
 public slots:
     virtual void start() = 0;
 };
@@ -236,9 +293,11 @@ public:
     void appendTask(const SyncFileItemPtr &item)
     {
         _tasksToDo.append(item);
+        _tasksSorted = false;
     }
 
     bool scheduleSelfOrChild() override;
+    void findNextJob(NextJob &next) override;
     JobParallelism parallelism() override;
 
     /*
@@ -276,6 +335,15 @@ private slots:
 
     void slotSubJobFinished(SyncFileItem::Status status);
     void finalize();
+
+private:
+    /// Orders _tasksToDo by priority, keeping the order of equal ones
+    void sortTasks();
+
+    /// The index of the most important task that may start now, or -1
+    int nextTaskIndex();
+
+    bool _tasksSorted = true;
 };
 
 /**
@@ -305,6 +373,7 @@ public:
     }
 
     bool scheduleSelfOrChild() override;
+    void findNextJob(NextJob &next) override;
     JobParallelism parallelism() override;
     void abort(PropagatorJob::AbortType abortType) override
     {
@@ -406,6 +475,9 @@ public:
     /** We detected that another sync is required after this one */
     bool _anotherSyncNeeded;
 
+    /** Bytes of downloads that were served by local files, whole or in blocks */
+    quint64 _bytesReusedLocally = 0;
+
     /** Per-folder quota guesses.
      *
      * This starts out empty. When an upload in a folder fails due to insufficent
@@ -419,6 +491,13 @@ public:
      */
     QHash<QString, quint64> _folderQuota;
 
+    /** The open end-to-end encryption upload transactions, by folder.
+     *
+     * Also remembers the folders that turned out not to be encrypted.
+     * The transactions are children of the propagator.
+     */
+    QHash<QString, EncryptedFolderTransaction *> _encryptedFolderTransactions;
+
     /* the maximum number of jobs using bandwidth (uploads or downloads, in parallel) */
     int maximumActiveTransferJob();
 
@@ -431,6 +510,51 @@ public:
     quint64 _chunkSize;
     quint64 smallFileSize();
 
+    /** Transfers of at least this size are scheduled as large ones */
+    quint64 largeFileSize();
+
+    /** Files modified less than this long before the propagation started
+     * are scheduled before other transfers */
+    static const int recentlyModifiedSecs = 15 * 60;
+
+    /** The priority of the job that will propagate item
+     *
+     * Doesn't change during a propagation, the queued tasks stay sorted by it.
+     */
+    PropagatorJob::JobPriority itemPriority(const SyncFileItem &item);
+
+    /** The number of large transfers that may run at the same time
+     *
+     * Always less than maximumActiveTransferJob() when parallel jobs are
+     * allowed, so large files can't block the smaller ones.
+     */
+    int largeTransferLanes();
+
+    /** Whether a transfer counts against maximumActiveTransferJob()
+     *
+     * Only transfers below smallFileSize() may exceed that limit.
+     */
+    bool isLimitedTransfer(PropagatorJob::JobPriority priority, quint64 size);
+
+    /** Whether a job may be started in the current scheduleNextJobImpl() call */
+    bool mayStart(PropagatorJob::JobPriority priority, bool limitedTransfer) const
+    {
+        return priority <= _schedulingPriority
+            && (!limitedTransfer || _schedulingLimitedTransfers);
+    }
+
+    /** The least important priority of the jobs that may be started right now
+     *
+     * Set while scheduleNextJobImpl() walks the job tree.
+     */
+    PropagatorJob::JobPriority _schedulingPriority = PropagatorJob::LargeFilePriority;
+
+    /** Whether limited transfers may be started right now, see _schedulingPriority */
+    bool _schedulingLimitedTransfers = true;
+
+    /** When the tasks were queued, itemPriority() measures the file age against it */
+    QDateTime _tasksQueuedTime = QDateTime::currentDateTimeUtc();
+
     /* The maximum number of active jobs in parallel  */
     int hardMaximumActiveJob();
 
@@ -460,6 +584,15 @@ public:
     void scheduleNextJob();
     void reportProgress(const SyncFileItem &, quint64 bytes);
 
+    /** Commits the journal, unless this was done less than groupCommitMsec ago
+     *
+     * For records that are written often and are fine to lose in a crash,
+     * like the progress of uploads. Skipped ones are committed with the
+     * next commit of the journal.
+     */
+    void groupCommitJournal(const QString &context);
+    static const int groupCommitMsec = 1000;
+
     void abort()
     {
         bool alreadyAborting = _abortRequested.fetchAndStoreOrdered(true);
@@ -548,6 +681,7 @@ private:
     AccountPtr _account;
     QScopedPointer<PropagateDirectory> _rootJob;
     SyncOptions _syncOptions;
+    QElapsedTimer _lastGroupCommit;
 };
 
 
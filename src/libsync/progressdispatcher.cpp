@@ -145,6 +145,7 @@ void ProgressInfo::reset()
     _sizeProgress = Progress();
     _fileProgress = Progress();
     _totalSizeOfCompletedJobs = 0;
+    _bytesReusedLocally = 0;
 
     // Historically, these starting estimates were way lower, but that lead
     // to gross overestimation of ETA when a good estimate wasn't available.
@@ -212,6 +213,16 @@ quint64 ProgressInfo::currentFile() const
     return completedFiles() + _currentItems.size();
 }
 
+quint64 ProgressInfo::bytesReusedLocally() const
+{
+    return _bytesReusedLocally;
+}
+
+void ProgressInfo::setBytesReusedLocally(quint64 bytes)
+{
+    _bytesReusedLocally = bytes;
+}
+
 quint64 ProgressInfo::totalSize() const
 {
     return _sizeProgress._total;
@@ -100,10 +100,15 @@ public:
     /** Number of a file that is currently in progress. */
     quint64 currentFile() const;
 
+    /** Bytes that didn't need to be downloaded because local files had them already. */
+    quint64 bytesReusedLocally() const;
+    void setBytesReusedLocally(quint64 bytes);
+
     /** Return true if the size needs to be taken in account in the total amount of time */
     static inline bool isSizeDependent(const SyncFileItem &item)
     {
-        return !item.isDirectory() && (item._instruction == CSYNC_INSTRUCTION_CONFLICT
+        return !item.isDirectory() && !item.isVirtualFilePlaceholder()
+            && (item._instruction == CSYNC_INSTRUCTION_CONFLICT
                                          || item._instruction == CSYNC_INSTRUCTION_SYNC
                                          || item._instruction == CSYNC_INSTRUCTION_NEW
                                          || item._instruction == CSYNC_INSTRUCTION_TYPE_CHANGE);
@@ -235,6 +240,8 @@ private:
     // All size from completed jobs only.
     quint64 _totalSizeOfCompletedJobs;
 
+    quint64 _bytesReusedLocally;
+
     // The fastest observed rate of files per second in this sync.
     double _maxFilesPerSecond;
     double _maxBytesPerSecond;
@@ -26,11 +26,14 @@
 #include "common/asserts.h"
 #include "clientsideencryptionjobs.h"
 #include "propagatedownloadencrypted.h"
+#include "deltasync.h"
 
 #include <QLoggingCategory>
 #include <QNetworkAccessManager>
 #include <QFileInfo>
 #include <QDir>
+#include <QFutureWatcher>
+#include <qtconcurrentrun.h>
 #include <cmath>
 
 #ifdef Q_OS_UNIX
@@ -68,7 +71,7 @@ QString OWNCLOUDSYNC_EXPORT createDownloadTmpFileName(const QString &previous)
 }
 
 // DOES NOT take ownership of the device.
-GETFileJob::GETFileJob(AccountPtr account, const QString &path, QFile *device,
+GETFileJob::GETFileJob(AccountPtr account, const QString &path, QIODevice *device,
     const QMap<QByteArray, QByteArray> &headers, const QByteArray &expectedEtagForResume,
     quint64 resumeStart, QObject *parent)
     : AbstractNetworkJob(account, path, parent)
@@ -86,7 +89,7 @@ GETFileJob::GETFileJob(AccountPtr account, const QString &path, QFile *device,
 {
 }
 
-GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QFile *device,
+GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QIODevice *device,
     const QMap<QByteArray, QByteArray> &headers, const QByteArray &expectedEtagForResume,
     quint64 resumeStart, QObject *parent)
 
@@ -109,7 +112,10 @@ GETFileJob::GETFileJob(AccountPtr account, const QUrl &url, QFile *device,
 
 void GETFileJob::start()
 {
-    if (_resumeStart > 0) {
+    if (_rangeEnd > 0) {
+        _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-' + QByteArray::number(_rangeEnd - 1);
+        _headers["Accept-Ranges"] = "bytes";
+    } else if (_resumeStart > 0) {
         _headers["Range"] = "bytes=" + QByteArray::number(_resumeStart) + '-';
         _headers["Accept-Ranges"] = "bytes";
         qCDebug(lcGetJob) << "Retry with range " << _headers["Range"];
@@ -191,6 +197,15 @@ void GETFileJob::slotMetaDataChanged()
         return;
     }
 
+    if (_rangeEnd > 0 && httpStatus != 206) {
+        qCWarning(lcGetJob) << "Server ignored the range request" << _headers["Range"];
+        _rangeIgnored = true;
+        _errorString = tr("Server does not support range requests");
+        _errorStatus = SyncFileItem::SoftError;
+        reply()->abort();
+        return;
+    }
+
     quint64 start = 0;
     QByteArray ranges = reply()->rawHeader("Content-Range");
     if (!ranges.isEmpty()) {
@@ -335,6 +350,10 @@ QString GETFileJob::errorString() const
     return AbstractNetworkJob::errorString();
 }
 
+PropagateDownloadFile::~PropagateDownloadFile()
+{
+}
+
 void PropagateDownloadFile::start()
 {
     if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
@@ -343,6 +362,11 @@ void PropagateDownloadFile::start()
 
     qCDebug(lcPropagateDownload) << _item->_file << propagator()->_activeJobList.count();
 
+    if (_item->isVirtualFilePlaceholder()) {
+        writeVirtualFilePlaceholder();
+        return;
+    }
+
     if (propagator()->account()->capabilities().clientSideEncryptionAvaliable()) {
         _downloadEncryptedHelper = new PropagateDownloadEncrypted(propagator(), _item);
         connect(_downloadEncryptedHelper, &PropagateDownloadEncrypted::folderStatusNotEncrypted, [this] {
@@ -362,6 +386,63 @@ void PropagateDownloadFile::start()
     }
 }
 
+/*
+ * Virtual files only get a placeholder with the remote mtime, their data is
+ * downloaded on request. When a file is dehydrated, the placeholder replaces
+ * the local file.
+ */
+void PropagateDownloadFile::writeVirtualFilePlaceholder()
+{
+    const QString fn = propagator()->getFilePath(_item->_file);
+    QString placeholderFile = _item->_file;
+
+    if (_item->_type == ItemTypeVirtualFileDehydration) {
+        if (!FileSystem::verifyFileUnchanged(fn, _item->_previousSize, _item->_previousModtime)) {
+            propagator()->_anotherSyncNeeded = true;
+            done(SyncFileItem::SoftError, tr("File has changed since discovery"));
+            return;
+        }
+        placeholderFile += QLatin1String(APPLICATION_DOTVIRTUALFILE_SUFFIX);
+    }
+
+    const QString placeholderPath = propagator()->getFilePath(placeholderFile);
+
+    // Only an untouched placeholder may be overwritten, anything else holds user data
+    if (FileSystem::fileExists(placeholderPath)
+        && (FileSystem::getSize(placeholderPath) != 1
+               || (_item->_type != ItemTypeVirtualFileDehydration
+                      && !FileSystem::verifyFileUnchanged(placeholderPath, _item->_previousSize, _item->_previousModtime)))) {
+        propagator()->_anotherSyncNeeded = true;
+        done(SyncFileItem::SoftError, tr("File has changed since discovery"));
+        return;
+    }
+
+    qCDebug(lcPropagateDownload) << "Writing virtual file placeholder" << placeholderPath;
+    emit propagator()->touchedFile(placeholderPath);
+    QFile placeholder(placeholderPath);
+    if (!placeholder.open(QIODevice::WriteOnly | QIODevice::Truncate) || placeholder.write(" ") != 1) {
+        done(SyncFileItem::NormalError, placeholder.errorString());
+        return;
+    }
+    placeholder.close();
+    FileSystem::setModTime(placeholderPath, _item->_modtime);
+
+    if (_item->_type == ItemTypeVirtualFileDehydration) {
+        QString error;
+        emit propagator()->touchedFile(fn);
+        if (!FileSystem::remove(fn, &error)) {
+            FileSystem::remove(placeholderPath);
+            done(SyncFileItem::SoftError, error);
+            return;
+        }
+        propagator()->_journal->deleteFileRecord(_item->_file);
+        _item->_file = placeholderFile;
+    }
+
+    _item->_type = ItemTypeVirtualFile;
+    updateMetadata(/*isConflict=*/false);
+}
+
 void PropagateDownloadFile::startAfterIsEncryptedIsChecked()
 {
     _stopwatch.start();
@@ -432,15 +513,19 @@ void PropagateDownloadFile::startDownload()
 
     QString tmpFileName;
     QByteArray expectedEtagForResume;
+    const bool ranged = isRangedDownload();
+    _completedRanges.clear();
     const SyncJournalDb::DownloadInfo progressInfo = propagator()->_journal->getDownloadInfo(_item->_file);
     if (progressInfo._valid) {
         // if the etag has changed meanwhile, remove the already downloaded part.
-        if (progressInfo._etag != _item->_etag) {
+        // The other kind of download can't continue the temporary file either.
+        if (progressInfo._etag != _item->_etag || progressInfo._ranged != ranged) {
             FileSystem::remove(propagator()->getFilePath(progressInfo._tmpfile));
             propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
         } else {
             tmpFileName = progressInfo._tmpfile;
             expectedEtagForResume = progressInfo._etag;
+            _completedRanges = progressInfo._completedRanges;
         }
     }
 
@@ -456,14 +541,25 @@ void PropagateDownloadFile::startDownload()
 
     FileSystem::setFileHidden(_tmpFile.fileName(), true);
 
-    _resumeStart = _tmpFile.size();
-    if (_resumeStart > 0) {
-        if (_resumeStart == _item->_size) {
-            qCInfo(lcPropagateDownload) << "File is already complete, no need to download";
-            _tmpFile.close();
-            downloadFinished();
-            return;
-        }
+    if (_isEncrypted && _tmpFile.size() > 0) {
+        // The data is decrypted while it is downloaded, which can't continue
+        // in the middle of the file
+        qCInfo(lcPropagateDownload) << "Not resuming the download of encrypted file" << _item->_file;
+        _tmpFile.resize(0);
+        expectedEtagForResume.clear();
+    }
+
+    // A ranged download's temporary file has its final size from the start
+    _resumeStart = ranged ? 0 : _tmpFile.size();
+    const bool hasDownloadedData = ranged ? !_completedRanges.isEmpty() : _resumeStart > 0;
+    const bool isComplete = ranged
+        ? _completedRanges.size() == 1 && _completedRanges.first() == qMakePair(qint64(0), qint64(_item->_size))
+        : _resumeStart > 0 && _resumeStart == _item->_size;
+    if (isComplete) {
+        qCInfo(lcPropagateDownload) << "File is already complete, no need to download";
+        _tmpFile.close();
+        downloadFinished();
+        return;
     }
 
     // If there's not enough space to fully download this file, stop.
@@ -482,29 +578,50 @@ void PropagateDownloadFile::startDownload()
         }
 
         // Remove the temporary, if empty.
-        if (_resumeStart == 0) {
+        if (!hasDownloadedData) {
             _tmpFile.remove();
         }
 
         return;
     }
 
+    if (!hasDownloadedData && (startLocalContentReuse() || startDeltaDownload(tmpFileName))) {
+        return;
+    }
+
     {
         SyncJournalDb::DownloadInfo pi;
         pi._etag = _item->_etag;
         pi._tmpfile = tmpFileName;
         pi._valid = true;
+        pi._ranged = ranged;
+        pi._completedRanges = _completedRanges;
         propagator()->_journal->setDownloadInfo(_item->_file, pi);
         propagator()->_journal->commit("download file start");
     }
 
+    if (ranged) {
+        startRangedDownload();
+        return;
+    }
+
+    QIODevice *device = &_tmpFile;
+    if (_isEncrypted) {
+        _decryptingDevice.reset(new DecryptingDevice(&_tmpFile, _downloadEncryptedHelper->encryptedInfo()));
+        if (!_decryptingDevice->open(QIODevice::WriteOnly)) {
+            done(SyncFileItem::NormalError, _decryptingDevice->errorString());
+            return;
+        }
+        device = _decryptingDevice.data();
+    }
+
     QMap<QByteArray, QByteArray> headers;
 
     if (_item->_directDownloadUrl.isEmpty()) {
         // Normal job, download from oC instance
         _job = new GETFileJob(propagator()->account(),
             propagator()->_remoteFolder + _item->_file,
-            &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
+            device, headers, expectedEtagForResume, _resumeStart, this);
     } else {
         // We were provided a direct URL, use that one
         qCInfo(lcPropagateDownload) << "directDownloadUrl given for " << _item->_file << _item->_directDownloadUrl;
@@ -516,7 +633,7 @@ void PropagateDownloadFile::startDownload()
         QUrl url = QUrl::fromUserInput(_item->_directDownloadUrl);
         _job = new GETFileJob(propagator()->account(),
             url,
-            &_tmpFile, headers, expectedEtagForResume, _resumeStart, this);
+            device, headers, expectedEtagForResume, _resumeStart, this);
     }
     _job->setBandwidthManager(&propagator()->_bandwidthManager);
     connect(_job.data(), &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotGetFinished);
@@ -525,6 +642,484 @@ void PropagateDownloadFile::startDownload()
     _job->start();
 }
 
+// Adds [start, end) to the sorted and disjoint ranges, merging it with its neighbours
+static void addRange(QVector<QPair<qint64, qint64>> &ranges, qint64 start, qint64 end)
+{
+    if (start >= end)
+        return;
+    int i = 0;
+    while (i < ranges.size() && ranges[i].second < start)
+        ++i;
+    while (i < ranges.size() && ranges[i].first <= end) {
+        start = qMin(start, ranges[i].first);
+        end = qMax(end, ranges[i].second);
+        ranges.remove(i);
+    }
+    ranges.insert(i, qMakePair(start, end));
+}
+
+bool PropagateDownloadFile::isRangedDownload()
+{
+    // A delta download fetches the ranges the local file doesn't have
+    if (isDeltaDownload())
+        return true;
+    const auto &options = propagator()->syncOptions();
+    return !_isEncrypted
+        && !_rangedDownloadFailed
+        && _item->_directDownloadUrl.isEmpty()
+        && options._minRangedDownloadSize > 0
+        && _item->_size >= options._minRangedDownloadSize
+        && options._parallelDownloadRanges > 1
+        && propagator()->hardMaximumActiveJob() > 1;
+}
+
+bool PropagateDownloadFile::isDeltaDownload()
+{
+    const auto &options = propagator()->syncOptions();
+    return !_isEncrypted
+        && !_rangedDownloadFailed
+        && _item->_directDownloadUrl.isEmpty()
+        && options._minDeltaDownloadSize > 0
+        && _item->_size >= options._minDeltaDownloadSize
+        && propagator()->account()->capabilities().blockSignatures();
+}
+
+/*
+ * Large files are split into a few ranges per parallel request, which are
+ * written into the temporary file at their offsets. The ranges that are
+ * complete, or the part of a range that was received before an error, are
+ * stored in the DownloadInfo so a later sync only fetches what is missing.
+ */
+void PropagateDownloadFile::startRangedDownload()
+{
+    const qint64 size = _item->_size;
+    if (_tmpFile.size() != size) {
+        // Not the file the ranges were written to
+        _completedRanges.clear();
+        if (!_tmpFile.resize(size)) {
+            done(SyncFileItem::NormalError, _tmpFile.errorString());
+            return;
+        }
+    }
+    _tmpFile.close();
+
+    const int parallelRanges = qMax(1, propagator()->syncOptions()._parallelDownloadRanges);
+    const qint64 rangeSize = qMax<qint64>(propagator()->largeFileSize(), size / (4 * parallelRanges) + 1);
+    _pendingRanges.clear();
+    qint64 pos = 0;
+    auto addPending = [&](qint64 end) {
+        for (; pos < end; pos += rangeSize)
+            _pendingRanges.append(qMakePair(pos, qMin(pos + rangeSize, end)));
+    };
+    for (const auto &range : _completedRanges) {
+        addPending(range.first);
+        pos = range.second;
+    }
+    addPending(size);
+
+    qCInfo(lcPropagateDownload) << "Downloading" << _item->_file << "in" << _pendingRanges.size() << "ranges";
+    slotRangeProgress(0, 0);
+
+    while (!_pendingRanges.isEmpty()
+        && (_rangeJobs.isEmpty()
+               || (_rangeJobs.size() < parallelRanges
+                      && propagator()->_activeJobList.count() < propagator()->hardMaximumActiveJob()))) {
+        if (!startRangeJob())
+            return;
+    }
+}
+
+bool PropagateDownloadFile::startRangeJob()
+{
+    const auto range = _pendingRanges.takeFirst();
+    auto file = new QFile(_tmpFile.fileName(), this);
+    if (!file->open(QIODevice::ReadWrite) || !file->seek(range.first)) {
+        done(SyncFileItem::NormalError, file->errorString());
+        delete file;
+        return false;
+    }
+
+    auto job = new GETFileJob(propagator()->account(),
+        propagator()->_remoteFolder + _item->_file,
+        file, QMap<QByteArray, QByteArray>(), _item->_etag, range.first, this);
+    job->setRangeEnd(range.second);
+    job->setBandwidthManager(&propagator()->_bandwidthManager);
+    connect(job, &GETFileJob::finishedSignal, this, &PropagateDownloadFile::slotRangeFinished);
+    connect(job, &GETFileJob::downloadProgress, this, &PropagateDownloadFile::slotRangeProgress);
+    _rangeJobs.append(RangeJob{ job, file, range.first, range.second, 0 });
+    propagator()->_activeJobList.append(this);
+    job->start();
+    return true;
+}
+
+void PropagateDownloadFile::slotRangeFinished()
+{
+    auto job = qobject_cast<GETFileJob *>(sender());
+    ASSERT(job);
+    int index = 0;
+    while (index < _rangeJobs.size() && _rangeJobs.at(index).job != job)
+        ++index;
+    if (index == _rangeJobs.size())
+        return;
+    const RangeJob range = _rangeJobs.takeAt(index);
+    propagator()->_activeJobList.removeOne(this);
+
+    // Whatever was written is usable, even if the range is incomplete
+    const qint64 written = range.file->pos();
+    range.file->close();
+    range.file->deleteLater();
+    const bool complete = written == range.end;
+    if (_rangedDownloadFailed) {
+        // Once all ranges are stopped, download the file in one request
+        if (!_abortingRanges && _rangeJobs.isEmpty())
+            startDownload();
+        return;
+    }
+    addRange(_completedRanges, range.start, qMin(written, range.end));
+    saveDownloadInfo();
+
+    // Either another range failed already, or this range is being stopped
+    // by the failure of another one, which handles the outcome.
+    if (_state == Finished || _abortingRanges)
+        return;
+
+    QNetworkReply::NetworkError err = job->reply()->error();
+    if (err != QNetworkReply::NoError || !complete) {
+        if (job->rangeIgnored()) {
+            qCInfo(lcPropagateDownload) << "Downloading" << _item->_file << "in one request instead";
+            _rangedDownloadFailed = true;
+            _pendingRanges.clear();
+        }
+
+        // Don't wait for the others, they keep what they received
+        abortRangeJobs();
+
+        if (_rangedDownloadFailed) {
+            if (_rangeJobs.isEmpty())
+                startDownload();
+            return;
+        }
+
+        _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (_item->_httpErrorCode == 404) {
+            qCWarning(lcPropagateDownload) << "server replied 404, assuming file was deleted";
+            FileSystem::remove(_tmpFile.fileName());
+            propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+            propagator()->_journal->avoidReadFromDbOnNextSync(_item->_file);
+            done(SyncFileItem::SoftError, tr("File was deleted from server"));
+            return;
+        }
+        if (err == QNetworkReply::NoError) {
+            propagator()->_anotherSyncNeeded = true;
+            done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
+            return;
+        }
+        SyncFileItem::Status status = job->errorStatus();
+        if (status == SyncFileItem::NoStatus) {
+            status = classifyError(err, _item->_httpErrorCode, &propagator()->_anotherSyncNeeded);
+        }
+        done(status, job->errorString());
+        return;
+    }
+
+    if (!_pendingRanges.isEmpty()) {
+        startRangeJob();
+        return;
+    }
+    if (!_rangeJobs.isEmpty())
+        return;
+
+    // That was the last range
+    if (job->lastModified()) {
+        _item->_modtime = job->lastModified();
+    }
+    _item->_responseTimeStamp = job->responseTimestamp();
+    validateDownload(job);
+}
+
+void PropagateDownloadFile::abortRangeJobs()
+{
+    // An abort finishes the job right away, which re-enters slotRangeFinished()
+    // and removes it from _rangeJobs. So don't iterate over _rangeJobs itself.
+    QVector<QPointer<GETFileJob>> jobs;
+    for (const auto &range : _rangeJobs)
+        jobs.append(range.job);
+
+    _abortingRanges = true;
+    for (const auto &job : jobs) {
+        if (job && job->reply())
+            job->reply()->abort();
+    }
+    _abortingRanges = false;
+}
+
+void PropagateDownloadFile::slotRangeProgress(qint64 received, qint64)
+{
+    for (auto &range : _rangeJobs) {
+        if (range.job == sender())
+            range.received = received;
+    }
+    qint64 progress = 0;
+    for (const auto &range : _completedRanges)
+        progress += range.second - range.first;
+    for (const auto &range : _rangeJobs)
+        progress += range.received;
+    _downloadProgress = progress;
+    propagator()->reportProgress(*_item, progress);
+}
+
+void PropagateDownloadFile::saveDownloadInfo()
+{
+    auto pi = propagator()->_journal->getDownloadInfo(_item->_file);
+    if (!pi._valid)
+        return;
+    pi._completedRanges = _completedRanges;
+    propagator()->_journal->setDownloadInfo(_item->_file, pi);
+    propagator()->_journal->commit("download range");
+}
+
+/*
+ * A server-side copy or a restore gives the file a new fileid, so it isn't
+ * detected as a rename. If a local file with the same content checksum
+ * already exists, copy it instead of downloading the data again.
+ *
+ * Returns true if the copy is being made and validated asynchronously.
+ */
+bool PropagateDownloadFile::startLocalContentReuse()
+{
+    if (_triedLocalContentReuse || _isEncrypted || _item->_size == 0
+        || !_item->_directDownloadUrl.isEmpty()
+        || !csync_is_collision_safe_hash(_item->_checksumHeader)) {
+        return false;
+    }
+    _triedLocalContentReuse = true;
+
+    // Only files that are unchanged since their record was written are
+    // known to still have the recorded content.
+    QString source;
+    propagator()->_journal->getFileRecordsByChecksum(_item->_checksumHeader, _item->_size,
+        [&](const SyncJournalFileRecord &rec) {
+            if (!source.isEmpty() || rec._type != ItemTypeFile || rec._path == _item->_file.toUtf8())
+                return;
+            auto path = propagator()->getFilePath(QString::fromUtf8(rec._path));
+            if (FileSystem::fileExists(path) && !FileSystem::fileChanged(path, rec._fileSize, rec._modtime))
+                source = path;
+        });
+    if (source.isEmpty())
+        return false;
+
+    _tmpFile.close();
+    qCInfo(lcPropagateDownload) << "Copying identical local file" << source << "instead of downloading" << _item->_file;
+
+    // The content is checked like downloaded data; if it doesn't match after
+    // all, fall back to a normal download.
+    auto validate = [this]() {
+        auto validator = new ValidateChecksumHeader(this);
+        connect(validator, &ValidateChecksumHeader::validated, this,
+            [this](const QByteArray &checksumType, const QByteArray &checksum) {
+                if (stopIfAborted())
+                    return;
+                propagator()->_bytesReusedLocally += _item->_size;
+                propagator()->reportProgress(*_item, _item->_size);
+                transmissionChecksumValidated(checksumType, checksum);
+            });
+        connect(validator, &ValidateChecksumHeader::validationFailed, this, [this](const QString &errMsg) {
+            if (stopIfAborted())
+                return;
+            qCWarning(lcPropagateDownload) << "Local copy for" << _item->_file << "did not validate:" << errMsg;
+            FileSystem::remove(_tmpFile.fileName());
+            startDownload();
+        });
+        validator->start(_tmpFile.fileName(), _item->_checksumHeader);
+    };
+
+    // Copying a large file takes a while, do it in a different thread.
+    auto watcher = new QFutureWatcher<QString>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, source, validate]() {
+        watcher->deleteLater();
+        if (stopIfAborted())
+            return;
+        const QString error = watcher->result();
+        if (!error.isEmpty()) {
+            qCWarning(lcPropagateDownload) << "Could not copy" << source << "for" << _item->_file << error;
+            // Download into a fresh temporary file instead
+            FileSystem::remove(_tmpFile.fileName());
+            startDownload();
+            return;
+        }
+        validate();
+    });
+    const QString destination = _tmpFile.fileName();
+    watcher->setFuture(QtConcurrent::run([source, destination]() {
+        QString error;
+        FileSystem::copyFile(source, destination, &error);
+        return error;
+    }));
+    return true;
+}
+
+/*
+ * Servers with the blockSignatures capability serve the signatures of each
+ * block of a file. The blocks the local file already has, at any offset, are
+ * copied into the temporary file and only the others are downloaded, as the
+ * missing ranges of a ranged download.
+ *
+ * Returns true if the signatures are being fetched, the download continues
+ * asynchronously.
+ */
+bool PropagateDownloadFile::startDeltaDownload(const QString &tmpFileName)
+{
+    if (_triedDeltaDownload || !isDeltaDownload())
+        return false;
+    _triedDeltaDownload = true;
+
+    const QString fn = propagator()->getFilePath(_item->_file);
+    if (!QFileInfo(fn).isFile() || FileSystem::getSize(fn) == 0)
+        return false;
+
+    _tmpFile.close();
+    const QString path = QDir::cleanPath(QLatin1String("remote.php/dav/signatures/")
+        + propagator()->account()->davUser() + QLatin1Char('/')
+        + propagator()->_remoteFolder + _item->_file);
+    _signaturesJob = new SimpleNetworkJob(propagator()->account(), this);
+    connect(_signaturesJob.data(), &SimpleNetworkJob::finishedSignal, this, [this, tmpFileName](QNetworkReply *reply) {
+        propagator()->_activeJobList.removeOne(this);
+        if (stopIfAborted())
+            return;
+
+        // Signatures of another version of the file are of no use
+        BlockSignatures signatures;
+        const int httpStatus = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (reply->error() == QNetworkReply::NoError && httpStatus == 200 && getEtagFromReply(reply) == _item->_etag)
+            signatures = BlockSignatures::deserialize(reply->readAll());
+        if (!signatures.isValid() || signatures.fileSize != qint64(_item->_size)) {
+            qCInfo(lcPropagateDownload) << "No block signatures for" << _item->_file << httpStatus << ", downloading all of it";
+            startDownload();
+            return;
+        }
+        seedFromLocalFile(signatures, tmpFileName);
+    });
+    propagator()->_activeJobList.append(this);
+    _signaturesJob->startRequest("GET", Utility::concatUrlPath(propagator()->account()->url(), path));
+    return true;
+}
+
+/*
+ * The seeded ranges are stored as the completed ranges of a ranged download,
+ * startDownload() then continues it like an interrupted one.
+ */
+void PropagateDownloadFile::seedFromLocalFile(const BlockSignatures &signatures, const QString &tmpFileName)
+{
+    // Reading the local file and writing the blocks takes a while, do it in a different thread.
+    auto watcher = new QFutureWatcher<DeltaPlan>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, tmpFileName]() {
+        watcher->deleteLater();
+        if (stopIfAborted())
+            return;
+        const DeltaPlan plan = watcher->result();
+        if (plan.targetSize != qint64(_item->_size)) {
+            qCWarning(lcPropagateDownload) << "Could not copy the known blocks of" << _item->_file;
+            FileSystem::remove(_tmpFile.fileName());
+            startDownload();
+            return;
+        }
+
+        QVector<QPair<qint64, qint64>> seeded;
+        for (const auto &range : plan.ranges) {
+            if (range.seedOffset >= 0)
+                addRange(seeded, range.targetOffset, range.targetOffset + range.length);
+        }
+        propagator()->_bytesReusedLocally += plan.targetSize - plan.bytesToFetch();
+
+        SyncJournalDb::DownloadInfo pi;
+        pi._etag = _item->_etag;
+        pi._tmpfile = tmpFileName;
+        pi._valid = true;
+        pi._ranged = true;
+        pi._completedRanges = seeded;
+        propagator()->_journal->setDownloadInfo(_item->_file, pi);
+        propagator()->_journal->commit("delta download start");
+        startDownload();
+    });
+    const QString seedPath = propagator()->getFilePath(_item->_file);
+    const QString tmpPath = _tmpFile.fileName();
+    watcher->setFuture(QtConcurrent::run([signatures, seedPath, tmpPath]() {
+        QFile seed(seedPath);
+        QFile output(tmpPath);
+        if (!seed.open(QIODevice::ReadOnly) || !output.open(QIODevice::ReadWrite))
+            return DeltaPlan();
+        DeltaPlan plan = DeltaPlan::compute(signatures, &seed);
+        if (!output.resize(plan.targetSize) || !plan.copyFromSeed(&seed, &output))
+            return DeltaPlan();
+        return plan;
+    }));
+}
+
+/*
+ * The sync may be aborted while no network job of the download runs, when
+ * local data is copied or validated. Don't continue then, but finish the job
+ * so the abort can complete.
+ *
+ * Returns true if the job is finished.
+ */
+bool PropagateDownloadFile::stopIfAborted()
+{
+    if (_state == Finished)
+        return true;
+    if (!propagator()->_abortRequested.fetchAndAddRelaxed(0))
+        return false;
+    FileSystem::remove(_tmpFile.fileName());
+    done(SyncFileItem::SoftError, tr("Aborted by the user"));
+    return true;
+}
+
+/*
+ * Whether the local file fn has the same content as the downloaded temporary
+ * file. Checksums already known for the local file are tried first, the data
+ * is only compared when they can't decide.
+ */
+bool PropagateDownloadFile::localFileEqualsDownload(const QString &fn)
+{
+    const qint64 size = FileSystem::getSize(fn);
+    if (size != FileSystem::getSize(_tmpFile.fileName()))
+        return false;
+
+    QByteArray downloadedType, downloadedChecksum;
+    if (!_isEncrypted && parseChecksumHeader(_item->_checksumHeader, &downloadedType, &downloadedChecksum)
+        && !downloadedType.isEmpty()) {
+        // The journal knows the checksum of the local file if it wasn't touched
+        // since it was last synced or since an upload of it was started.
+        const time_t modtime = FileSystem::getModTime(fn);
+        QVector<QByteArray> localChecksumHeaders;
+        SyncJournalFileRecord rec;
+        if (propagator()->_journal->getFileRecord(_item->_file, &rec) && rec.isValid()
+            && rec._modtime == modtime && rec._fileSize == size) {
+            localChecksumHeaders.append(rec._checksumHeader);
+        }
+        auto uploadInfo = propagator()->_journal->getUploadInfo(_item->_file);
+        if (uploadInfo._valid && uploadInfo._modtime == modtime) {
+            localChecksumHeaders.append(uploadInfo._contentChecksum);
+        }
+
+        for (const auto &header : localChecksumHeaders) {
+            QByteArray localType, localChecksum;
+            if (!parseChecksumHeader(header, &localType, &localChecksum) || localType != downloadedType)
+                continue;
+            if (localChecksum != downloadedChecksum) {
+                qCInfo(lcPropagateDownload) << "Conflict for" << _item->_file << "decided by checksum";
+                return false;
+            }
+            // A weak checksum can only prove that the contents differ
+            if (csync_is_collision_safe_hash(header)) {
+                qCInfo(lcPropagateDownload) << "Files for conflict" << _item->_file << "have the same checksum";
+                return true;
+            }
+        }
+    }
+
+    return FileSystem::fileEquals(fn, _tmpFile.fileName());
+}
+
 qint64 PropagateDownloadFile::committedDiskSpace() const
 {
     if (_state == Running) {
@@ -572,7 +1167,10 @@ void PropagateDownloadFile::slotGetFinished()
 
         // Don't keep the temporary file if it is empty or we
         // used a bad range header or the file's not on the server anymore.
-        if (_tmpFile.size() == 0 || badRangeHeader || fileNotFound) {
+        // Partially decrypted data can't be resumed either.
+        if (_tmpFile.size() == 0 || badRangeHeader || fileNotFound || _isEncrypted) {
+            if (_decryptingDevice)
+                _decryptingDevice->close();
             _tmpFile.close();
             FileSystem::remove(_tmpFile.fileName());
             propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
@@ -629,9 +1227,19 @@ void PropagateDownloadFile::slotGetFinished()
     }
     _item->_responseTimeStamp = job->responseTimestamp();
 
+    if (_isEncrypted && !_decryptingDevice->finish()) {
+        FileSystem::remove(_tmpFile.fileName());
+        propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
+        done(SyncFileItem::NormalError, tr("The downloaded file could not be decrypted."));
+        return;
+    }
     _tmpFile.close();
     _tmpFile.flush();
 
+    // The size of what was downloaded, which is larger than the
+    // decrypted file for encrypted files
+    const qint64 downloadedSize = _isEncrypted ? _decryptingDevice->received() : _tmpFile.size();
+
     /* Check that the size of the GET reply matches the file size. There have been cases
      * reported that if a server breaks behind a proxy, the GET is still a 200 but is
      * truncated, as described here: https://github.com/owncloud/mirall/issues/2528
@@ -639,23 +1247,23 @@ void PropagateDownloadFile::slotGetFinished()
     const QByteArray sizeHeader("Content-Length");
     quint64 bodySize = job->reply()->rawHeader(sizeHeader).toULongLong();
 
-    if (!job->reply()->rawHeader(sizeHeader).isEmpty() && _tmpFile.size() > 0 && bodySize == 0) {
+    if (!job->reply()->rawHeader(sizeHeader).isEmpty() && downloadedSize > 0 && bodySize == 0) {
         // Strange bug with broken webserver or webfirewall https://github.com/owncloud/client/issues/3373#issuecomment-122672322
         // This happened when trying to resume a file. The Content-Range header was files, Content-Length was == 0
-        qCDebug(lcPropagateDownload) << bodySize << _item->_size << _tmpFile.size() << job->resumeStart();
+        qCDebug(lcPropagateDownload) << bodySize << _item->_size << downloadedSize << job->resumeStart();
         FileSystem::remove(_tmpFile.fileName());
         done(SyncFileItem::SoftError, QLatin1String("Broken webserver returning empty content length for non-empty file on resume"));
         return;
     }
 
-    if (bodySize > 0 && bodySize != _tmpFile.size() - job->resumeStart()) {
-        qCDebug(lcPropagateDownload) << bodySize << _tmpFile.size() << job->resumeStart();
+    if (bodySize > 0 && bodySize != downloadedSize - job->resumeStart()) {
+        qCDebug(lcPropagateDownload) << bodySize << downloadedSize << job->resumeStart();
         propagator()->_anotherSyncNeeded = true;
         done(SyncFileItem::SoftError, tr("The file could not be downloaded completely."));
         return;
     }
 
-    if (_tmpFile.size() == 0 && _item->_size > 0) {
+    if (downloadedSize == 0 && _item->_size > 0) {
         FileSystem::remove(_tmpFile.fileName());
         done(SyncFileItem::NormalError,
             tr("The downloaded file is empty despite that the server announced it should have been %1.")
@@ -663,6 +1271,11 @@ void PropagateDownloadFile::slotGetFinished()
         return;
     }
 
+    validateDownload(job);
+}
+
+void PropagateDownloadFile::validateDownload(GETFileJob *job)
+{
     // Did the file come with conflict headers? If so, store them now!
     // If we download conflict files but the server doesn't send conflict
     // headers, the record will be established by SyncEngine::conflictRecordMaintenance.
@@ -672,9 +1285,9 @@ void PropagateDownloadFile::slotGetFinished()
     if (job->reply()->rawHeader("OC-Conflict") == "1") {
         _conflictRecord.path = _item->_file.toUtf8();
         _conflictRecord.baseFileId = job->reply()->rawHeader("OC-ConflictBaseFileId");
-        _conflictRecord.baseEtag = _job->reply()->rawHeader("OC-ConflictBaseEtag");
+        _conflictRecord.baseEtag = job->reply()->rawHeader("OC-ConflictBaseEtag");
 
-        auto mtimeHeader = _job->reply()->rawHeader("OC-ConflictBaseMtime");
+        auto mtimeHeader = job->reply()->rawHeader("OC-ConflictBaseMtime");
         if (!mtimeHeader.isEmpty())
             _conflictRecord.baseModtime = mtimeHeader.toLongLong();
 
@@ -683,6 +1296,13 @@ void PropagateDownloadFile::slotGetFinished()
         // job will be deleted later.
     }
 
+    // The authentication tag already proved the integrity of encrypted files, a
+    // checksum header would be about the encrypted data, which is gone by now.
+    if (_isEncrypted) {
+        transmissionChecksumValidated(QByteArray(), QByteArray());
+        return;
+    }
+
     // Do checksum validation for the download. If there is no checksum header, the validator
     // will also emit the validated() signal to continue the flow in slot transmissionChecksumValidated()
     // as this is (still) also correct.
@@ -693,7 +1313,9 @@ void PropagateDownloadFile::slotGetFinished()
         this, &PropagateDownloadFile::slotChecksumFail);
     auto checksumHeader = findBestChecksum(job->reply()->rawHeader(checkSumHeaderC));
     auto contentMd5Header = job->reply()->rawHeader(contentMd5HeaderC);
-    if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty())
+    // The Content-MD5 of a partial reply is only about the range that was sent
+    const bool partialReply = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() == 206;
+    if (checksumHeader.isEmpty() && !contentMd5Header.isEmpty() && !partialReply)
         checksumHeader = "MD5:" + contentMd5Header;
     validator->start(_tmpFile.fileName(), checksumHeader);
 }
@@ -701,6 +1323,7 @@ void PropagateDownloadFile::slotGetFinished()
 void PropagateDownloadFile::slotChecksumFail(const QString &errMsg)
 {
     FileSystem::remove(_tmpFile.fileName());
+    propagator()->_journal->setDownloadInfo(_item->_file, SyncJournalDb::DownloadInfo());
     propagator()->_anotherSyncNeeded = true;
     done(SyncFileItem::SoftError, errMsg); // tr("The file downloaded with a broken checksum, will be redownloaded."));
 }
@@ -782,9 +1405,10 @@ namespace { // Anonymous namespace for the recall feature
             QString targetPath = makeRecallFileName(recalledFile);
 
             qCDebug(lcPropagateDownload) << "Copy recall file: " << recalledFile << " -> " << targetPath;
-            // Remove the target first, QFile::copy will not overwrite it.
-            FileSystem::remove(targetPath);
-            QFile::copy(recalledFile, targetPath);
+            QString error;
+            if (!FileSystem::copyFile(recalledFile, targetPath, &error)) {
+                qCWarning(lcPropagateDownload) << "Could not copy recall file" << recalledFile << error;
+            }
         }
     }
 
@@ -828,16 +1452,9 @@ void PropagateDownloadFile::contentChecksumComputed(const QByteArray &checksumTy
 {
     _item->_checksumHeader = makeChecksumHeader(checksumType, checksum);
 
-    if (_isEncrypted) {
-        if (_downloadEncryptedHelper->decryptFile(_tmpFile)) {
-          downloadFinished();
-        } else {
-          done(SyncFileItem::NormalError, _downloadEncryptedHelper->errorString());
-        }
-
-    } else {
-        downloadFinished();
-    }
+    if (_isEncrypted)
+        _downloadEncryptedHelper->restoreOriginalFileName();
+    downloadFinished();
 }
 
 void PropagateDownloadFile::downloadFinished()
@@ -852,7 +1469,7 @@ void PropagateDownloadFile::downloadFinished()
     }
 
     bool isConflict = _item->_instruction == CSYNC_INSTRUCTION_CONFLICT
-        && (QFileInfo(fn).isDir() || !FileSystem::fileEquals(fn, _tmpFile.fileName()));
+        && (QFileInfo(fn).isDir() || !localFileEqualsDownload(fn));
     if (isConflict) {
         QString error;
         if (!propagator()->createConflict(_item, _associatedComposite, &error)) {
@@ -937,6 +1554,14 @@ void PropagateDownloadFile::updateMetadata(bool isConflict)
 {
     QString fn = propagator()->getFilePath(_item->_file);
 
+    if (_item->_type == ItemTypeVirtualFileDownload) {
+        // The data is in place, the placeholder is obsolete
+        const QString placeholderFile = _item->_file + QLatin1String(APPLICATION_DOTVIRTUALFILE_SUFFIX);
+        FileSystem::remove(propagator()->getFilePath(placeholderFile));
+        propagator()->_journal->deleteFileRecord(placeholderFile);
+        _item->_type = ItemTypeFile;
+    }
+
     if (!propagator()->_journal->setFileRecord(_item->toSyncJournalFileRecordWithInode(fn))) {
         done(SyncFileItem::FatalError, tr("Error writing metadata to the database"));
         return;
@@ -977,6 +1602,16 @@ void PropagateDownloadFile::abort(PropagatorJob::AbortType abortType)
 {
     if (_job && _job->reply())
         _job->reply()->abort();
+    if (_signaturesJob && _signaturesJob->reply())
+        _signaturesJob->reply()->abort();
+    // The first range to finish reports the abort, the others are dropped
+    QVector<QPointer<GETFileJob>> rangeJobs;
+    for (const auto &range : _rangeJobs)
+        rangeJobs.append(range.job);
+    for (const auto &job : rangeJobs) {
+        if (job && job->reply())
+            job->reply()->abort();
+    }
 
     if (abortType == AbortType::Asynchronous) {
         emit abortFinished();
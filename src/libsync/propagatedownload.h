@@ -22,19 +22,23 @@
 
 namespace OCC {
 class PropagateDownloadEncrypted;
+class DecryptingDevice;
+class BlockSignatures;
 
 /**
  * @brief The GETFileJob class
  * @ingroup libsync
  */
-class GETFileJob : public AbstractNetworkJob
+class GETFileJob : public AbstractNetworkJob, public BandwidthLimitedTransfer
 {
     Q_OBJECT
-    QFile *_device;
+    QIODevice *_device;
     QMap<QByteArray, QByteArray> _headers;
     QString _errorString;
     QByteArray _expectedEtagForResume;
     quint64 _resumeStart;
+    quint64 _rangeEnd = 0; // exclusive, 0 for the end of the file
+    bool _rangeIgnored = false;
     SyncFileItem::Status _errorStatus;
     QUrl _directDownloadUrl;
     QByteArray _etag;
@@ -50,11 +54,11 @@ class GETFileJob : public AbstractNetworkJob
 
 public:
     // DOES NOT take ownership of the device.
-    explicit GETFileJob(AccountPtr account, const QString &path, QFile *device,
+    explicit GETFileJob(AccountPtr account, const QString &path, QIODevice *device,
         const QMap<QByteArray, QByteArray> &headers, const QByteArray &expectedEtagForResume,
         quint64 resumeStart, QObject *parent = nullptr);
     // For directDownloadUrl:
-    explicit GETFileJob(AccountPtr account, const QUrl &url, QFile *device,
+    explicit GETFileJob(AccountPtr account, const QUrl &url, QIODevice *device,
         const QMap<QByteArray, QByteArray> &headers, const QByteArray &expectedEtagForResume,
         quint64 resumeStart, QObject *parent = nullptr);
     virtual ~GETFileJob()
@@ -84,9 +88,11 @@ public:
     void newReplyHook(QNetworkReply *reply) override;
 
     void setBandwidthManager(BandwidthManager *bwm);
-    void setChoked(bool c);
-    void setBandwidthLimited(bool b);
-    void giveBandwidthQuota(qint64 q);
+    void setChoked(bool c) override;
+    void setBandwidthLimited(bool b) override;
+    void giveBandwidthQuota(qint64 q) override;
+    qint64 bandwidthQuota() const override { return _bandwidthQuota; }
+    qint64 bandwidthPosition() override { return currentDownloadPosition(); }
     qint64 currentDownloadPosition();
 
     QString errorString() const;
@@ -99,6 +105,15 @@ public:
 
     QByteArray &etag() { return _etag; }
     quint64 resumeStart() { return _resumeStart; }
+
+    /** Only download the data before end, starting at resumeStart()
+     *
+     * Unlike for resuming, the job fails if the server sends something else
+     * than the requested range, see rangeIgnored().
+     */
+    void setRangeEnd(quint64 end) { _rangeEnd = end; }
+    /// Whether the server replied with the whole file to a request for a range
+    bool rangeIgnored() const { return _rangeIgnored; }
     time_t lastModified() { return _lastModified; }
 
 
@@ -129,8 +144,10 @@ private slots:
     +-> startDownload() <--------------------------+
           |                                        |
           +-> run a GETFileJob                     | checksum identical?
-                                                   |
+          |    or startRangedDownload()            |
+          |                                        |
       done?-> slotGetFinished()                    |
+              or slotRangeFinished() for the last  |
                 |                                  |
                 +-> validate checksum header       |
                                                    |
@@ -159,6 +176,7 @@ public:
         , _deleteExisting(false)
     {
     }
+    ~PropagateDownloadFile();
     void start() override;
     qint64 committedDiskSpace() const override;
 
@@ -196,19 +214,62 @@ private slots:
     void slotDownloadProgress(qint64, qint64);
     void slotChecksumFail(const QString &errMsg);
 
+    /// Called when the GETFileJob of one byte range finishes
+    void slotRangeFinished();
+    void slotRangeProgress(qint64, qint64);
+
 private:
+    /// Whether the file is downloaded as several byte ranges at the same time
+    bool isRangedDownload();
+    /// Whether the ranges the local file already has may be taken from it
+    bool isDeltaDownload();
+    /// Downloads the ranges that are not in the temporary file yet, several at a time
+    void startRangedDownload();
+    /// Starts the download of the next pending range, returns false on error
+    bool startRangeJob();
+    /// Stops the running range jobs, their results don't decide the outcome
+    void abortRangeJobs();
+    /// Stores the reply's conflict headers and validates the transmission checksum
+    void validateDownload(GETFileJob *job);
+    void saveDownloadInfo();
     void startAfterIsEncryptedIsChecked();
+    void writeVirtualFilePlaceholder();
+    bool startLocalContentReuse();
+    bool startDeltaDownload(const QString &tmpFileName);
+    /// Writes the blocks the local file has into the temporary file, then downloads the rest
+    void seedFromLocalFile(const BlockSignatures &signatures, const QString &tmpFileName);
+    bool stopIfAborted();
+    bool localFileEqualsDownload(const QString &fn);
     void deleteExistingFolder();
 
     quint64 _resumeStart;
     qint64 _downloadProgress;
     QPointer<GETFileJob> _job;
     QFile _tmpFile;
+    QScopedPointer<DecryptingDevice> _decryptingDevice; // writes into _tmpFile
     bool _deleteExisting;
     bool _isEncrypted = false;
+    bool _triedLocalContentReuse = false;
+    bool _triedDeltaDownload = false;
+    QPointer<SimpleNetworkJob> _signaturesJob;
     EncryptedFile _encryptedInfo;
     ConflictRecord _conflictRecord;
 
+    // For ranged downloads, each range is written by its own job and file handle
+    struct RangeJob
+    {
+        QPointer<GETFileJob> job;
+        QFile *file;
+        qint64 start;
+        qint64 end;
+        qint64 received;
+    };
+    QVector<RangeJob> _rangeJobs;
+    QVector<QPair<qint64, qint64>> _pendingRanges;
+    QVector<QPair<qint64, qint64>> _completedRanges;
+    bool _rangedDownloadFailed = false;
+    bool _abortingRanges = false;
+
     QElapsedTimer _stopwatch;
 
     PropagateDownloadEncrypted *_downloadEncryptedHelper;
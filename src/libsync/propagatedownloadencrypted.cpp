@@ -1,11 +1,62 @@
 #include "propagatedownloadencrypted.h"
 #include "clientsideencryptionjobs.h"
+#include "account.h"
 
 Q_LOGGING_CATEGORY(lcPropagateDownloadEncrypted, "nextcloud.sync.propagator.download.encrypted", QtInfoMsg)
 
 
 namespace OCC {
 
+DecryptingDevice::DecryptingDevice(QFile *output, const EncryptedFile &encryptedInfo)
+    : _output(output)
+    , _key(encryptedInfo.encryptionKey)
+    , _iv(encryptedInfo.initializationVector)
+{
+}
+
+bool DecryptingDevice::open(OpenMode mode)
+{
+    _decryptor.reset(new StreamingDecryptor(_key, _iv));
+    _received = 0;
+
+    _output->close();
+    if (!_output->open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Unbuffered)) {
+        setErrorString(_output->errorString());
+        return false;
+    }
+    return QIODevice::open(mode);
+}
+
+void DecryptingDevice::close()
+{
+    _output->close();
+    QIODevice::close();
+}
+
+qint64 DecryptingDevice::writeData(const char *data, qint64 len)
+{
+    QByteArray plaintext;
+    if (!_decryptor->update(data, len, &plaintext)) {
+        setErrorString(tr("Could not decrypt the file"));
+        return -1;
+    }
+    if (_output->write(plaintext) != plaintext.size()) {
+        setErrorString(_output->errorString());
+        return -1;
+    }
+    _received += len;
+    return len;
+}
+
+bool DecryptingDevice::finish()
+{
+    QByteArray plaintext;
+    const bool ok = _decryptor && _decryptor->finish(&plaintext)
+        && _output->write(plaintext) == plaintext.size();
+    close();
+    return ok;
+}
+
 PropagateDownloadEncrypted::PropagateDownloadEncrypted(OwncloudPropagator *propagator, SyncFileItemPtr item) :
  _propagator(propagator), _item(item), _info(_item->_file)
 
@@ -63,6 +114,7 @@ void PropagateDownloadEncrypted::checkFolderId(const QStringList &list)
   qCDebug(lcPropagateDownloadEncrypted) << "Received id of folder" << folderId;
 
   const ExtraFolderInfo &folderInfo = job->_folderInfos.value(folderId);
+  _folderId = folderInfo.fileId;
 
   // Now that we have the folder-id we need it's JSON metadata
   auto metadataJob = new GetMetadataApiJob(_propagator->account(), folderInfo.fileId);
@@ -76,9 +128,16 @@ void PropagateDownloadEncrypted::checkFolderEncryptedMetadata(const QJsonDocumen
 {
   qCDebug(lcPropagateDownloadEncrypted) << "Metadata Received reading" <<
                                            csync_instruction_str(_item->_instruction) << _item->_file << _item->_encryptedFileName;
+  // Decrypts only if the metadata changed since we last saw it
+  auto metadata = _propagator->account()->e2e()->metadataCache()->parse(
+      _propagator->account(), _folderId, json.toJson(QJsonDocument::Compact));
+  findEncryptedInfo(*metadata);
+}
+
+void PropagateDownloadEncrypted::findEncryptedInfo(const FolderMetadata &metadata)
+{
   const QString filename = _info.fileName();
-  auto meta = new FolderMetadata(_propagator->account(), json.toJson(QJsonDocument::Compact));
-  const QVector<EncryptedFile> files = meta->files();
+  const QVector<EncryptedFile> files = metadata.files();
 
   const QString encryptedFilename = _item->_instruction == CSYNC_INSTRUCTION_NEW ?
               _item->_file.section(QLatin1Char('/'), -1) :
@@ -96,44 +155,13 @@ void PropagateDownloadEncrypted::checkFolderEncryptedMetadata(const QJsonDocumen
   qCCritical(lcPropagateDownloadEncrypted) << "Failed to find encrypted metadata information of remote file" << filename;
 }
 
-// TODO: Fix this. Exported in the wrong place.
-QString createDownloadTmpFileName(const QString &previous);
-
-bool PropagateDownloadEncrypted::decryptFile(QFile& tmpFile)
+void PropagateDownloadEncrypted::restoreOriginalFileName()
 {
-    const QString tmpFileName = createDownloadTmpFileName(_item->_file + QLatin1String("_dec"));
-    qCDebug(lcPropagateDownloadEncrypted) << "Content Checksum Computed starting decryption" << tmpFileName;
-
-    tmpFile.close();
-    QFile _tmpOutput(_propagator->getFilePath(tmpFileName), this);
-    EncryptionHelper::fileDecryption(_encryptedInfo.encryptionKey,
-                                     _encryptedInfo.initializationVector,
-                                     &tmpFile,
-                                     &_tmpOutput);
-
-    qCDebug(lcPropagateDownloadEncrypted) << "Decryption finished" << tmpFile.fileName() << _tmpOutput.fileName();
-
-    tmpFile.close();
-    _tmpOutput.close();
-
-    // we decripted the temporary into another temporary, so good bye old one
-    if (!tmpFile.remove()) {
-        qCDebug(lcPropagateDownloadEncrypted) << "Failed to remove temporary file" << tmpFile.errorString();
-        _errorString = tmpFile.errorString();
-        return false;
-    }
-
-    // Let's fool the rest of the logic into thinking this was the actual download
-    tmpFile.setFileName(_tmpOutput.fileName());
-
     //TODO: This seems what's breaking the logic.
     // Let's fool the rest of the logic into thinking this is the right name of the DAV file
     _item->_encryptedFileName = _item->_file;
     _item->_file = _item->_file.section(QLatin1Char('/'), 0, -2)
             + QLatin1Char('/') + _encryptedInfo.originalFilename;
-
-
-    return true;
 }
 
 QString PropagateDownloadEncrypted::errorString() const
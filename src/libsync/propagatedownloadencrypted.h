@@ -3,6 +3,8 @@
 
 #include <QObject>
 #include <QFileInfo>
+#include <QIODevice>
+#include <QScopedPointer>
 
 #include "syncfileitem.h"
 #include "owncloudpropagator.h"
@@ -12,13 +14,52 @@ class QJsonDocument;
 
 namespace OCC {
 
+/**
+ * @brief Write-only device that decrypts what is written to it into a file
+ *
+ * Lets a GETFileJob download an encrypted file straight into the plain
+ * temporary file. Opening the device truncates the output, so a download
+ * can't be resumed. The data is only trustworthy once finish() verified
+ * the authentication tag.
+ */
+class DecryptingDevice : public QIODevice
+{
+    Q_OBJECT
+public:
+    DecryptingDevice(QFile *output, const EncryptedFile &encryptedInfo);
+
+    bool open(OpenMode mode) override;
+    void close() override;
+    bool isSequential() const override { return false; }
+
+    /// Number of encrypted bytes written since the device was opened
+    qint64 received() const { return _received; }
+
+    /// Writes the remaining data, checks the tag and closes the device
+    bool finish();
+
+protected:
+    qint64 readData(char *, qint64) override { return -1; }
+    qint64 writeData(const char *data, qint64 len) override;
+
+private:
+    QFile *_output;
+    QByteArray _key;
+    QByteArray _iv;
+    QScopedPointer<StreamingDecryptor> _decryptor;
+    qint64 _received = 0;
+};
+
 class PropagateDownloadEncrypted : public QObject {
   Q_OBJECT
 public:
   PropagateDownloadEncrypted(OwncloudPropagator *propagator, SyncFileItemPtr item);
   void start();
   void checkFolderId(const QStringList &list);
-  bool decryptFile(QFile& tmpFile);
+  const EncryptedFile &encryptedInfo() const { return _encryptedInfo; }
+
+  /// Once the file is decrypted, continue with its original name
+  void restoreOriginalFileName();
   QString errorString() const;
 
 public slots:
@@ -28,6 +69,10 @@ public slots:
   void folderStatusReceived(const QString &folder, bool isEncrypted);
   void folderStatusError(int httpErrorCode);
   void folderIdError();
+
+private:
+  void findEncryptedInfo(const FolderMetadata &metadata);
+
 signals:
   void folderStatusEncrypted();
   void folderStatusNotEncrypted();
@@ -41,6 +86,7 @@ private:
   QFileInfo _info;
   EncryptedFile _encryptedInfo;
   QString _errorString;
+  QByteArray _folderId;
 };
 
 }
@@ -73,7 +73,7 @@ void PropagateRemoteDelete::start()
         });
         job->start();
     } else {
-        createDeleteJob(_item->_file);
+        createDeleteJob(_item->remoteFileName(_item->_file));
     }
 }
 
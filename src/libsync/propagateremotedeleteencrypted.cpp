@@ -2,6 +2,7 @@
 #include "clientsideencryptionjobs.h"
 #include "clientsideencryption.h"
 #include "owncloudpropagator.h"
+#include "account.h"
 
 #include <QLoggingCategory>
 #include <QMimeDatabase>
@@ -70,8 +71,10 @@ void PropagateRemoteDeleteEncrypted::slotFolderEncryptedMetadataReceived(const Q
 
     qCDebug(PROPAGATE_REMOVE_ENCRYPTED) << "Metadata Received, Preparing it for the new file.";
 
-    // Encrypt File!
-    FolderMetadata metadata(_propagator->account(), json.toJson(QJsonDocument::Compact), statusCode);
+    // Decrypts only if the metadata changed since we last saw it
+    auto metadataCache = _propagator->account()->e2e()->metadataCache();
+    FolderMetadata metadata(*metadataCache->parse(_propagator->account(), _folderId,
+        json.toJson(QJsonDocument::Compact)));
 
     QFileInfo info(_propagator->_localDir + QDir::separator() + _item->_file);
     const QString fileName = info.fileName();
@@ -93,6 +96,7 @@ void PropagateRemoteDeleteEncrypted::slotFolderEncryptedMetadataReceived(const Q
     }
 
     qCDebug(PROPAGATE_REMOVE_ENCRYPTED) << "Metadata updated, sending to the server.";
+    metadataCache->invalidate(_folderId);
 
     auto job = new UpdateMetadataApiJob(_propagator->account(),
                                         _folderId,
@@ -12,6 +12,7 @@
  * for more details.
  */
 
+#include "config.h"
 #include "propagateremotemove.h"
 #include "propagatorjobs.h"
 #include "owncloudpropagator_p.h"
@@ -88,10 +89,16 @@ void PropagateRemoteMove::start()
         return;
     }
 
+    if (_item->remoteFileName(_item->_file) == _item->remoteFileName(_item->_renameTarget)) {
+        // A placeholder that lost its suffix still names the same server file.
+        finalize();
+        return;
+    }
+
     QString destination = QDir::cleanPath(propagator()->account()->url().path() + QLatin1Char('/')
-        + propagator()->account()->davPath() + propagator()->_remoteFolder + _item->_renameTarget);
+        + propagator()->account()->davPath() + propagator()->_remoteFolder + _item->remoteFileName(_item->_renameTarget));
     _job = new MoveJob(propagator()->account(),
-        propagator()->_remoteFolder + _item->_file,
+        propagator()->_remoteFolder + _item->remoteFileName(_item->_file),
         destination, this);
     connect(_job.data(), &MoveJob::finishedSignal, this, &PropagateRemoteMove::slotMoveJobFinished);
     propagator()->_activeJobList.append(this);
@@ -152,6 +159,13 @@ void PropagateRemoteMove::finalize()
 
     SyncJournalFileRecord record = _item->toSyncJournalFileRecordWithInode(propagator()->getFilePath(_item->_renameTarget));
     record._path = _item->_renameTarget.toUtf8();
+    if (record._type == ItemTypeVirtualFile
+        && !_item->_renameTarget.endsWith(QLatin1String(APPLICATION_DOTVIRTUALFILE_SUFFIX))) {
+        // A placeholder renamed to a real name gets the data of its file
+        record._type = ItemTypeVirtualFileDownload;
+        propagator()->_journal->avoidReadFromDbOnNextSync(record._path);
+        propagator()->_anotherSyncNeeded = true;
+    }
     if (oldRecord.isValid()) {
         record._checksumHeader = oldRecord._checksumHeader;
         if (record._fileSize != oldRecord._fileSize) {
@@ -177,8 +177,10 @@ void PropagateUploadFileCommon::start()
         this, &PropagateUploadFileCommon::setupUnencryptedFile);
       connect(_uploadEncryptedHelper, &PropagateUploadEncrypted::finalized,
         this, &PropagateUploadFileCommon::setupEncryptedFile);
-      connect(_uploadEncryptedHelper, &PropagateUploadEncrypted::error,
-        []{ qCDebug(lcPropagateUpload) << "Error setting up encryption."; });
+      connect(_uploadEncryptedHelper, &PropagateUploadEncrypted::error, this, [this] {
+          qCDebug(lcPropagateUpload) << "Error setting up encryption.";
+          done(SyncFileItem::NormalError, tr("Could not prepare the encrypted upload"));
+      });
       _uploadEncryptedHelper->start();
    } else {
       setupUnencryptedFile();
@@ -328,10 +330,7 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
     const QString originalFilePath = propagator()->getFilePath(_item->_file);
 
     if (!FileSystem::fileExists(fullFilePath)) {
-      if (_uploadingEncrypted) {
-        _uploadEncryptedHelper->unlockFolder();
-      }
-    done(SyncFileItem::SoftError, tr("File Removed (start upload) %1").arg(fullFilePath));
+        done(SyncFileItem::SoftError, tr("File Removed (start upload) %1").arg(fullFilePath));
         return;
     }
     time_t prevModtime = _item->_modtime; // the _item value was set in PropagateUploadFile::start()
@@ -341,15 +340,16 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
     _item->_modtime = FileSystem::getModTime(originalFilePath);
     if (prevModtime != _item->_modtime) {
         propagator()->_anotherSyncNeeded = true;
-        if (_uploadingEncrypted) {
-          _uploadEncryptedHelper->unlockFolder();
-        }
         qDebug() << "prevModtime" << prevModtime << "Curr" << _item->_modtime;
         done(SyncFileItem::SoftError, tr("Local file changed during syncing. It will be resumed."));
         return;
     }
 
     quint64 fileSize = FileSystem::getSize(fullFilePath);
+    if (_uploadingEncrypted) {
+        // The encrypted data is the file followed by the authentication tag
+        fileSize = _uploadEncryptedHelper->encryptor()->size();
+    }
     _fileToUpload._size = fileSize;
 
     // But skip the file if the mtime is too close to 'now'!
@@ -357,9 +357,6 @@ void PropagateUploadFileCommon::slotStartUpload(const QByteArray &transmissionCh
     // or not yet fully copied to the destination.
     if (fileIsStillChanging(*_item)) {
         propagator()->_anotherSyncNeeded = true;
-        if (_uploadingEncrypted) {
-          _uploadEncryptedHelper->unlockFolder();
-        }
         done(SyncFileItem::SoftError, tr("Local file changed during sync."));
         return;
     }
@@ -409,6 +406,18 @@ bool UploadDevice::prepareAndOpen(const QString &fileName, qint64 start, qint64
     return QIODevice::open(QIODevice::ReadOnly);
 }
 
+bool UploadDevice::prepareAndOpen(StreamingEncryptor *encryptor, qint64 start, qint64 size)
+{
+    _data.clear();
+    _read = 0;
+
+    if (!encryptor->read(start, size, &_data)) {
+        setErrorString(encryptor->errorString());
+        return false;
+    }
+
+    return QIODevice::open(QIODevice::ReadOnly);
+}
 
 qint64 UploadDevice::writeData(const char *, qint64)
 {
@@ -485,6 +494,12 @@ bool UploadDevice::seek(qint64 pos)
     return true;
 }
 
+qint64 UploadDevice::bandwidthPosition()
+{
+    // Count half of what was read but isn't sent yet
+    return (_readWithProgress + _read) / 2;
+}
+
 void UploadDevice::giveBandwidthQuota(qint64 bwq)
 {
     if (!atEnd()) {
@@ -540,6 +555,8 @@ void PropagateUploadFileCommon::slotPollFinished()
 void PropagateUploadFileCommon::done(SyncFileItem::Status status, const QString &errorString)
 {
     _finished = true;
+    if (_uploadEncryptedHelper)
+        _uploadEncryptedHelper->finish(status == SyncFileItem::Success);
     PropagateItemJob::done(status, errorString);
 }
 
@@ -563,6 +580,16 @@ void PropagateUploadFileCommon::checkResettingErrors()
     }
 }
 
+void PropagateUploadFileCommon::saveUploadInfo(const SyncJournalDb::UploadInfo &info, bool durable)
+{
+    propagator()->_journal->setUploadInfo(_item->_file, info);
+    if (durable) {
+        propagator()->_journal->commit("Upload info");
+    } else {
+        propagator()->groupCommitJournal("Upload info");
+    }
+}
+
 void PropagateUploadFileCommon::commonErrorHandling(AbstractNetworkJob *job)
 {
     QByteArray replyContent;
@@ -671,8 +698,34 @@ QMap<QByteArray, QByteArray> PropagateUploadFileCommon::headers()
     return headers;
 }
 
+bool PropagateUploadFileCommon::prepareUploadDevice(UploadDevice *device, qint64 start, qint64 size)
+{
+    if (_uploadingEncrypted)
+        return device->prepareAndOpen(_uploadEncryptedHelper->encryptor(), start, size);
+    return device->prepareAndOpen(_fileToUpload._path, start, size);
+}
+
 void PropagateUploadFileCommon::finalize()
 {
+    if (_uploadingEncrypted && !_uploadEncryptedHelper->isFinished()) {
+        // The upload only counts once the folder's metadata references the
+        // file, which is stored together with the other uploads into the folder.
+        if (!_uploadEncryptedHelper->finish(true)) {
+            done(SyncFileItem::NormalError, tr("Could not encrypt the file"));
+            return;
+        }
+        connect(_uploadEncryptedHelper, &PropagateUploadEncrypted::committed, this, [this](bool success) {
+            if (!success) {
+                done(SyncFileItem::NormalError, tr("Could not store the encrypted metadata of the folder"));
+                return;
+            }
+            finalize();
+        });
+        // We're not in the active job list while waiting, let other jobs run
+        propagator()->scheduleNextJob();
+        return;
+    }
+
     // Update the quota, if known
     auto quotaIt = propagator()->_folderQuota.find(QFileInfo(_item->_file).path());
     if (quotaIt != propagator()->_folderQuota.end())
@@ -690,9 +743,6 @@ void PropagateUploadFileCommon::finalize()
     propagator()->_journal->setUploadInfo(_item->_file, SyncJournalDb::UploadInfo());
     propagator()->_journal->commit("upload file start");
 
-    if (_uploadingEncrypted) {
-      _uploadEncryptedHelper->unlockFolder();
-    }
     done(SyncFileItem::Success);
 }
 
@@ -27,12 +27,13 @@ Q_DECLARE_LOGGING_CATEGORY(lcPutJob)
 Q_DECLARE_LOGGING_CATEGORY(lcPropagateUpload)
 
 class BandwidthManager;
+class StreamingEncryptor;
 
 /**
  * @brief The UploadDevice class
  * @ingroup libsync
  */
-class UploadDevice : public QIODevice
+class UploadDevice : public QIODevice, public BandwidthLimitedTransfer
 {
     Q_OBJECT
 public:
@@ -42,6 +43,9 @@ public:
     /** Reads the data from the file and opens the device */
     bool prepareAndOpen(const QString &fileName, qint64 start, qint64 size);
 
+    /** Reads the encrypted data from the encryptor and opens the device */
+    bool prepareAndOpen(StreamingEncryptor *encryptor, qint64 start, qint64 size);
+
     qint64 writeData(const char *, qint64) override;
     qint64 readData(char *data, qint64 maxlen) override;
     bool atEnd() const override;
@@ -50,11 +54,13 @@ public:
     bool isSequential() const override;
     bool seek(qint64 pos) override;
 
-    void setBandwidthLimited(bool);
+    qint64 bandwidthPosition() override;
+    qint64 bandwidthQuota() const override { return _bandwidthQuota; }
+    void setBandwidthLimited(bool) override;
     bool isBandwidthLimited() { return _bandwidthLimited; }
-    void setChoked(bool);
+    void setChoked(bool) override;
     bool isChoked() { return _choked; }
-    void giveBandwidthQuota(qint64 bwq);
+    void giveBandwidthQuota(qint64 bwq) override;
 
 signals:
 
@@ -70,7 +76,6 @@ private:
     qint64 _readWithProgress;
     bool _bandwidthLimited; // if _bandwidthQuota will be used
     bool _choked; // if upload is paused (readData() will return 0)
-    friend class BandwidthManager;
 public slots:
     void slotJobUploadProgress(qint64 sent, qint64 t);
 };
@@ -291,6 +296,15 @@ protected:
      */
     void checkResettingErrors();
 
+    /**
+     * Stores the progress of a chunked upload in the journal.
+     *
+     * A durable record is committed right away, which is needed when data
+     * is about to be sent that a resumed upload must know of. The others
+     * are group committed: losing them only means sending a few chunks again.
+     */
+    void saveUploadInfo(const SyncJournalDb::UploadInfo &info, bool durable);
+
     /**
      * Error handling functionality that is shared between jobs.
      */
@@ -309,6 +323,9 @@ protected:
 
     // Bases headers that need to be sent with every chunk
     QMap<QByteArray, QByteArray> headers();
+
+    /** Fills the device with the chunk of _fileToUpload, encrypting it if needed */
+    bool prepareUploadDevice(UploadDevice *device, qint64 start, qint64 size);
 private:
   PropagateUploadEncrypted *_uploadEncryptedHelper;
   bool _uploadingEncrypted;
@@ -371,11 +388,24 @@ class PropagateUploadFileNG : public PropagateUploadFileCommon
 {
     Q_OBJECT
 private:
-    quint64 _sent = 0; /// amount of data (bytes) that was already sent
+    quint64 _sent = 0; /// amount of data (bytes) that was already sent or is being sent
+    quint64 _confirmed = 0; /// amount of data (bytes) the server confirmed to have received
     uint _transferId = 0; /// transfer id (part of the url)
     int _currentChunk = 0; /// Id of the next chunk that will be sent
-    quint64 _currentChunkSize = 0; /// current chunk size
+    int _reservedChunks = 0; /// Chunks below this id are known to the journal, see UploadInfo::_reservedChunks
+    int _leftoverChunks = 0; /// Chunks below this id may be left over on the server from before a resume
     bool _removeJobError = false; /// If not null, there was an error removing the job
+    bool _resumedFromJournal = false; /// Resumed from the journal, without asking the server for the chunks
+    bool _resumeUnverified = false; /// Resumed from the journal, and the server didn't accept a chunk yet
+
+    // The chunks that are currently being uploaded, by chunk id. They may finish in any order.
+    struct RunningChunk
+    {
+        quint64 offset;
+        quint64 size;
+        qint64 progress;
+    };
+    QMap<int, RunningChunk> _runningChunks;
 
     // Map chunk number with its size  from the PROPFIND on resume.
     // (Only used from slotPropfindIterate/slotPropfindFinished because the LsColJob use signals to report data.)
@@ -402,7 +432,23 @@ public:
 
 private:
     void startNewUpload();
+    /// Continues the upload where the journal says the server is, without asking it
+    void resumeFromJournal(const SyncJournalDb::UploadInfo &info);
+    /// Removes the chunks in _serverChunks from the server, then continues
+    void removeServerChunks();
+    /// The upload info for the chunks the server acknowledged so far
+    SyncJournalDb::UploadInfo uploadProgress();
+    /**
+     * Asks the server for its chunks if the error of the last job may come from
+     * resuming with the journal and no other job runs. Returns whether it did.
+     */
+    bool verifyResumeOnError();
+    void startPropfind();
     void startNextChunk();
+    /// Starts the upload of one chunk, returns false if the upload failed
+    bool startChunk();
+    /// How many chunks of this file may be uploaded at the same time
+    int parallelChunks() const;
 public slots:
     void abort(AbortType abortType) override;
 private slots:
@@ -16,261 +16,394 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcPropagateUploadEncrypted, "nextcloud.sync.propagator.upload.encrypted", QtInfoMsg)
 
-PropagateUploadEncrypted::PropagateUploadEncrypted(OwncloudPropagator *propagator, SyncFileItemPtr item)
-: _propagator(propagator),
- _item(item),
- _metadata(nullptr)
+// How long to wait for more uploads to join once none is in flight anymore
+static const int commitDelayMs = 200;
+
+// How long to keep retrying to lock a folder that is locked by someone else
+static const qint64 lockTimeoutMs = 5 * 60 * 1000;
+
+EncryptedFolderTransaction *EncryptedFolderTransaction::forFolder(OwncloudPropagator *propagator, const QString &folder)
 {
+    auto transaction = propagator->_encryptedFolderTransactions.value(folder);
+    if (!transaction) {
+        transaction = new EncryptedFolderTransaction(propagator, folder);
+        propagator->_encryptedFolderTransactions.insert(folder, transaction);
+        transaction->start();
+    }
+    return transaction;
 }
 
-void PropagateUploadEncrypted::start()
+EncryptedFolderTransaction::EncryptedFolderTransaction(OwncloudPropagator *propagator, const QString &folder)
+    : QObject(propagator)
+    , _propagator(propagator)
+    , _account(propagator->account())
+    , _folder(folder)
 {
-  /* If the file is in a encrypted-enabled nextcloud instance, we need to
-      * do the long road: Fetch the folder status of the encrypted bit,
-      * if it's encrypted, find the ID of the folder.
-      * lock the folder using it's id.
-      * download the metadata
-      * update the metadata
-      * upload the file
-      * upload the metadata
-      * unlock the folder.
-      *
-      * If the folder is unencrypted we just follow the old way.
-      */
-      qCDebug(lcPropagateUploadEncrypted) << "Starting to send an encrypted file!";
-      QFileInfo info(_item->_file);
-      auto getEncryptedStatus = new GetFolderEncryptStatusJob(_propagator->account(),
-                                                           info.path());
-
-      connect(getEncryptedStatus, &GetFolderEncryptStatusJob::encryptStatusFolderReceived,
-              this, &PropagateUploadEncrypted::slotFolderEncryptedStatusFetched);
-      connect(getEncryptedStatus, &GetFolderEncryptStatusJob::encryptStatusError,
-             this, &PropagateUploadEncrypted::slotFolderEncryptedStatusError);
-      getEncryptedStatus->start();
+    _commitTimer.setSingleShot(true);
+    _commitTimer.setInterval(commitDelayMs);
+    connect(&_commitTimer, &QTimer::timeout, this, &EncryptedFolderTransaction::slotCommit);
 }
 
-void PropagateUploadEncrypted::slotFolderEncryptedStatusFetched(const QString &folder, bool isEncrypted)
+EncryptedFolderTransaction::~EncryptedFolderTransaction()
 {
-  qCDebug(lcPropagateUploadEncrypted) << "Encrypted Status Fetched" << folder << isEncrypted;
-
-  /* We are inside an encrypted folder, we need to find it's Id. */
-  if (isEncrypted) {
-      qCDebug(lcPropagateUploadEncrypted) << "Folder is encrypted, let's get the Id from it.";
-      auto job = new LsColJob(_propagator->account(), folder, this);
-      job->setProperties({"resourcetype", "http://owncloud.org/ns:fileid"});
-      connect(job, &LsColJob::directoryListingSubfolders, this, &PropagateUploadEncrypted::slotFolderEncryptedIdReceived);
-      connect(job, &LsColJob::finishedWithError, this, &PropagateUploadEncrypted::slotFolderEncryptedIdError);
-      job->start();
-  } else {
-    qCDebug(lcPropagateUploadEncrypted) << "Folder is not encrypted, getting back to default.";
-    emit folerNotEncrypted();
-  }
+    // Don't leave the folder locked when the propagation is torn down early
+    if ((_state == Ready || _state == Committing) && !_unlockStarted) {
+        qCWarning(lcPropagateUploadEncrypted) << "Unlocking" << _folder << "without storing the metadata";
+        auto unlockJob = new UnlockEncryptFolderApiJob(_account, _folderId, _folderToken);
+        unlockJob->start();
+    }
 }
 
+void EncryptedFolderTransaction::start()
+{
+    /* If the file is in a encrypted-enabled nextcloud instance, we need to
+     * do the long road: Fetch the folder status of the encrypted bit,
+     * if it's encrypted, find the ID of the folder.
+     * lock the folder using it's id.
+     * download the metadata
+     * (the uploads update the metadata and upload their files)
+     * upload the metadata
+     * unlock the folder.
+     *
+     * If the folder is unencrypted the uploads just follow the old way.
+     */
+    qCDebug(lcPropagateUploadEncrypted) << "Fetching the encryption status of" << _folder;
+    auto getEncryptedStatus = new GetFolderEncryptStatusJob(_account, _folder, this);
+    connect(getEncryptedStatus, &GetFolderEncryptStatusJob::encryptStatusFolderReceived,
+        this, &EncryptedFolderTransaction::slotEncryptedStatusFetched);
+    connect(getEncryptedStatus, &GetFolderEncryptStatusJob::encryptStatusError,
+        this, &EncryptedFolderTransaction::slotEncryptedStatusError);
+    getEncryptedStatus->start();
+}
 
+void EncryptedFolderTransaction::join()
+{
+    ++_participants;
+    _commitTimer.stop();
+}
 
-/* We try to lock a folder, if it's locked we try again in one second.
- * if it's still locked we try again in one second. looping untill one minute.
- *                                                                      -> fail.
- * the 'loop':                                                         /
- *    slotFolderEncryptedIdReceived -> slotTryLock -> lockError -> stillTime? -> slotTryLock
- *                                        \
- *                                         -> success.
- */
-
-void PropagateUploadEncrypted::slotFolderEncryptedIdReceived(const QStringList &list)
+void EncryptedFolderTransaction::leave(bool changedMetadata)
 {
-  qCDebug(lcPropagateUploadEncrypted) << "Received id of folder, trying to lock it so we can prepare the metadata";
-  auto job = qobject_cast<LsColJob *>(sender());
-  const auto& folderInfo = job->_folderInfos.value(list.first());
-  _folderLockFirstTry.start();
-  slotTryLock(folderInfo.fileId);
+    Q_ASSERT(_participants > 0);
+    --_participants;
+    _metadataChanged |= changedMetadata;
+    if (_participants == 0 && _state == Ready)
+        _commitTimer.start();
 }
 
-void PropagateUploadEncrypted::slotTryLock(const QByteArray& fileId)
+void EncryptedFolderTransaction::slotEncryptedStatusFetched(const QString &folder, bool isEncrypted)
 {
-  auto *lockJob = new LockEncryptFolderApiJob(_propagator->account(), fileId, this);
-  connect(lockJob, &LockEncryptFolderApiJob::success, this, &PropagateUploadEncrypted::slotFolderLockedSuccessfully);
-  connect(lockJob, &LockEncryptFolderApiJob::error, this, &PropagateUploadEncrypted::slotFolderLockedError);
-  lockJob->start();
+    qCDebug(lcPropagateUploadEncrypted) << "Encrypted Status Fetched" << folder << isEncrypted;
+
+    if (!isEncrypted) {
+        // Stays registered with the propagator to answer for later uploads
+        _state = NotEncrypted;
+        emit notEncrypted();
+        return;
+    }
+
+    qCDebug(lcPropagateUploadEncrypted) << "Folder is encrypted, let's get the Id from it.";
+    _state = Locking;
+    auto job = new LsColJob(_account, folder, this);
+    job->setProperties({ "resourcetype", "http://owncloud.org/ns:fileid" });
+    connect(job, &LsColJob::directoryListingSubfolders, this, &EncryptedFolderTransaction::slotFolderIdReceived);
+    connect(job, &LsColJob::finishedWithError, this, &EncryptedFolderTransaction::slotFolderIdError);
+    job->start();
 }
 
-void PropagateUploadEncrypted::slotFolderLockedSuccessfully(const QByteArray& fileId, const QByteArray& token)
+void EncryptedFolderTransaction::slotEncryptedStatusError(int error)
 {
-  qCDebug(lcPropagateUploadEncrypted) << "Folder" << fileId << "Locked Successfully for Upload, Fetching Metadata";
-  // Should I use a mutex here?
-  _currentLockingInProgress = true;
-  _folderToken = token;
-  _folderId = fileId;
-
-  auto job = new GetMetadataApiJob(_propagator->account(), _folderId);
-  connect(job, &GetMetadataApiJob::jsonReceived,
-          this, &PropagateUploadEncrypted::slotFolderEncryptedMetadataReceived);
-  connect(job, &GetMetadataApiJob::error,
-          this, &PropagateUploadEncrypted::slotFolderEncryptedMetadataError);
-
-  job->start();
+    qCWarning(lcPropagateUploadEncrypted) << "Failed to retrieve the encryption status of" << _folder << error;
+    fail();
 }
 
-void PropagateUploadEncrypted::slotFolderEncryptedMetadataError(const QByteArray& fileId, int httpReturnCode)
+/* We try to lock a folder, if it's locked we try again in five seconds,
+ * until five minutes passed.
+ *                                                              -> fail.
+ * the 'loop':                                                 /
+ *    slotFolderIdReceived -> slotTryLock -> lockError -> stillTime? -> slotTryLock
+ *                                \
+ *                                 -> success.
+ */
+void EncryptedFolderTransaction::slotFolderIdReceived(const QStringList &list)
 {
-    Q_UNUSED(fileId);
-    Q_UNUSED(httpReturnCode);
-    qCDebug(lcPropagateUploadEncrypted()) << "Error Getting the encrypted metadata. unlock the folder.";
-    unlockFolder();
+    auto job = qobject_cast<LsColJob *>(sender());
+    _folderId = job->_folderInfos.value(list.first()).fileId;
+    qCDebug(lcPropagateUploadEncrypted) << "Received id" << _folderId << "of" << _folder << ", trying to lock it";
+    _lockFirstTry.start();
+    slotTryLock();
 }
 
-void PropagateUploadEncrypted::slotFolderEncryptedMetadataReceived(const QJsonDocument &json, int statusCode)
+void EncryptedFolderTransaction::slotFolderIdError(QNetworkReply *reply)
 {
-  qCDebug(lcPropagateUploadEncrypted) << "Metadata Received, Preparing it for the new file." << json.toVariant();
+    Q_UNUSED(reply);
+    qCWarning(lcPropagateUploadEncrypted) << "Error retrieving the Id of the encrypted folder" << _folder;
+    fail();
+}
 
-  // Encrypt File!
-  _metadata = new FolderMetadata(_propagator->account(), json.toJson(QJsonDocument::Compact), statusCode);
+void EncryptedFolderTransaction::slotTryLock()
+{
+    auto lockJob = new LockEncryptFolderApiJob(_account, _folderId, this);
+    connect(lockJob, &LockEncryptFolderApiJob::success, this, &EncryptedFolderTransaction::slotLocked);
+    connect(lockJob, &LockEncryptFolderApiJob::error, this, &EncryptedFolderTransaction::slotLockError);
+    lockJob->start();
+}
 
-  QFileInfo info(_propagator->_localDir + QDir::separator() + _item->_file);
-  const QString fileName = info.fileName();
+void EncryptedFolderTransaction::slotLockError(const QByteArray &fileId, int httpErrorCode)
+{
+    qCInfo(lcPropagateUploadEncrypted) << "Folder" << fileId << "couldn't be locked:" << httpErrorCode;
+    if (_lockFirstTry.elapsed() > lockTimeoutMs) {
+        qCWarning(lcPropagateUploadEncrypted) << "Giving up locking" << _folder << ", perhaps another client holds the lock.";
+        fail();
+        return;
+    }
+    QTimer::singleShot(5000, this, &EncryptedFolderTransaction::slotTryLock);
+}
 
-  // Find existing metadata for this file
-  bool found = false;
-  EncryptedFile encryptedFile;
-  const QVector<EncryptedFile> files = _metadata->files();
+void EncryptedFolderTransaction::slotLocked(const QByteArray &fileId, const QByteArray &token)
+{
+    qCDebug(lcPropagateUploadEncrypted) << "Folder" << fileId << "Locked Successfully for Upload, Fetching Metadata";
+    _folderToken = token;
+
+    auto job = new GetMetadataApiJob(_account, _folderId);
+    connect(job, &GetMetadataApiJob::jsonReceived,
+        this, &EncryptedFolderTransaction::slotMetadataReceived);
+    connect(job, &GetMetadataApiJob::error,
+        this, &EncryptedFolderTransaction::slotMetadataError);
+    job->start();
+}
 
-  for(const EncryptedFile &file : files) {
-    if (file.originalFilename == fileName) {
-      encryptedFile = file;
-      found = true;
+void EncryptedFolderTransaction::slotMetadataReceived(const QJsonDocument &json, int statusCode)
+{
+    qCDebug(lcPropagateUploadEncrypted) << "Metadata of" << _folder << "received";
+    if (statusCode == 404) {
+        _metadata.reset(new FolderMetadata(_account, QByteArray(), statusCode));
+    } else {
+        // Decrypts only if the metadata changed since we last saw it
+        auto cached = _account->e2e()->metadataCache()->parse(_account, _folderId,
+            json.toJson(QJsonDocument::Compact));
+        _metadata.reset(new FolderMetadata(*cached));
     }
-  }
+    _metadataStatusCode = statusCode;
+    _state = Ready;
+    emit ready();
 
+    // Everyone may have left in the meantime, don't keep the lock
+    if (_participants == 0)
+        _commitTimer.start();
+}
 
+void EncryptedFolderTransaction::slotMetadataError(const QByteArray &fileId, int httpReturnCode)
+{
+    qCWarning(lcPropagateUploadEncrypted) << "Error getting the encrypted metadata of" << fileId << httpReturnCode;
+    unlock();
+    fail();
+}
 
-  // New encrypted file so set it all up!
-  if (!found) {
-      encryptedFile.encryptionKey = EncryptionHelper::generateRandom(16);
-      encryptedFile.encryptedFilename = EncryptionHelper::generateRandomFilename();
-      encryptedFile.initializationVector = EncryptionHelper::generateRandom(16);
-      encryptedFile.fileVersion = 1;
-      encryptedFile.metadataKey = 1;
-      encryptedFile.originalFilename = fileName;
+void EncryptedFolderTransaction::slotCommit()
+{
+    _state = Committing;
+    detach();
 
-      QMimeDatabase mdb;
-      encryptedFile.mimetype = mdb.mimeTypeForFile(info).name().toLocal8Bit();
-  }
+    if (!_metadataChanged) {
+        _metadataStored = true;
+        unlock();
+        return;
+    }
 
-  _item->_encryptedFileName = _item->_file.section(QLatin1Char('/'), 0, -2)
-          + QLatin1Char('/') + encryptedFile.encryptedFilename;
+    qCInfo(lcPropagateUploadEncrypted) << "Storing the metadata of" << _folder << "with" << _metadata->files().size() << "files";
+    _account->e2e()->metadataCache()->invalidate(_folderId);
+    if (_metadataStatusCode == 404) {
+        auto job = new StoreMetaDataApiJob(_account, _folderId, _metadata->encryptedMetadata());
+        connect(job, &StoreMetaDataApiJob::success, this, &EncryptedFolderTransaction::slotMetadataStored);
+        connect(job, &StoreMetaDataApiJob::error, this, &EncryptedFolderTransaction::slotMetadataStoreError);
+        job->start();
+    } else {
+        auto job = new UpdateMetadataApiJob(_account, _folderId, _metadata->encryptedMetadata(), _folderToken);
+        connect(job, &UpdateMetadataApiJob::success, this, &EncryptedFolderTransaction::slotMetadataStored);
+        connect(job, &UpdateMetadataApiJob::error, this, &EncryptedFolderTransaction::slotMetadataStoreError);
+        job->start();
+    }
+}
 
-  qCDebug(lcPropagateUploadEncrypted) << "Creating the encrypted file.";
+void EncryptedFolderTransaction::slotMetadataStored()
+{
+    _metadataStored = true;
+    unlock();
+}
 
-  QFile input(info.absoluteFilePath());
-  QFile output(QDir::tempPath() + QDir::separator() + encryptedFile.encryptedFilename);
+void EncryptedFolderTransaction::slotMetadataStoreError(const QByteArray &fileId, int httpErrorCode)
+{
+    qCWarning(lcPropagateUploadEncrypted) << "Update metadata error for folder" << fileId << "with error" << httpErrorCode;
+    unlock();
+}
 
-  QByteArray tag;
-  bool encryptionResult = EncryptionHelper::fileEncryption(
-    encryptedFile.encryptionKey,
-    encryptedFile.initializationVector,
-    &input, &output, tag);
+void EncryptedFolderTransaction::unlock()
+{
+    _unlockStarted = true;
+    auto unlockJob = new UnlockEncryptFolderApiJob(_account, _folderId, _folderToken, this);
+    connect(unlockJob, &UnlockEncryptFolderApiJob::success, this, &EncryptedFolderTransaction::slotUnlocked);
+    connect(unlockJob, &UnlockEncryptFolderApiJob::error, this, [this] {
+        // The metadata is what matters for the uploads, a failed unlock
+        // only delays other clients until the lock expires on the server.
+        qCWarning(lcPropagateUploadEncrypted) << "Unlock error for folder" << _folder;
+        slotUnlocked();
+    });
+    unlockJob->start();
+}
 
-  if (!encryptionResult) {
-    qCDebug(lcPropagateUploadEncrypted()) << "There was an error encrypting the file, aborting upload.";
-    unlockFolder();
-    return;
-  }
+void EncryptedFolderTransaction::slotUnlocked()
+{
+    if (_state != Committing)
+        return;
+    emit committed(_metadataStored);
+    deleteLater();
+}
 
-  _completeFileName = output.fileName();
+void EncryptedFolderTransaction::fail()
+{
+    // Stays registered so the other uploads into the folder fail right away,
+    // they are retried with the next sync.
+    _state = Failed;
+    emit failed();
+}
+
+void EncryptedFolderTransaction::detach()
+{
+    auto &transactions = _propagator->_encryptedFolderTransactions;
+    if (transactions.value(_folder) == this)
+        transactions.remove(_folder);
+}
 
-  qCDebug(lcPropagateUploadEncrypted) << "Creating the metadata for the encrypted file.";
 
-  encryptedFile.authenticationTag = tag;
+PropagateUploadEncrypted::PropagateUploadEncrypted(OwncloudPropagator *propagator, SyncFileItemPtr item)
+: _propagator(propagator),
+ _item(item)
+{
+}
 
-  _metadata->addEncryptedFile(encryptedFile);
-  _encryptedFile = encryptedFile;
+void PropagateUploadEncrypted::start()
+{
+    qCDebug(lcPropagateUploadEncrypted) << "Starting to send an encrypted file!";
+    QFileInfo info(_item->_file);
+    _transaction = EncryptedFolderTransaction::forFolder(_propagator, info.path());
 
-  qCDebug(lcPropagateUploadEncrypted) << "Metadata created, sending to the server.";
+    switch (_transaction->state()) {
+    case EncryptedFolderTransaction::NotEncrypted:
+        emit folerNotEncrypted();
+        return;
+    case EncryptedFolderTransaction::Failed:
+        emit error();
+        return;
+    default:
+        break;
+    }
 
-  if (statusCode == 404) {
-    auto job = new StoreMetaDataApiJob(_propagator->account(),
-                                       _folderId,
-                                       _metadata->encryptedMetadata());
-    connect(job, &StoreMetaDataApiJob::success, this, &PropagateUploadEncrypted::slotUpdateMetadataSuccess);
-    connect(job, &StoreMetaDataApiJob::error, this, &PropagateUploadEncrypted::slotUpdateMetadataError);
-    job->start();
-  } else {
-    auto job = new UpdateMetadataApiJob(_propagator->account(),
-                                      _folderId,
-                                      _metadata->encryptedMetadata(),
-                                      _folderToken);
-
-    connect(job, &UpdateMetadataApiJob::success, this, &PropagateUploadEncrypted::slotUpdateMetadataSuccess);
-    connect(job, &UpdateMetadataApiJob::error, this, &PropagateUploadEncrypted::slotUpdateMetadataError);
-    job->start();
-  }
+    _transaction->join();
+    _joined = true;
+    connect(_transaction.data(), &EncryptedFolderTransaction::ready, this, &PropagateUploadEncrypted::slotFolderReady);
+    connect(_transaction.data(), &EncryptedFolderTransaction::notEncrypted, this, &PropagateUploadEncrypted::slotFolderNotEncrypted);
+    connect(_transaction.data(), &EncryptedFolderTransaction::failed, this, &PropagateUploadEncrypted::slotFolderFailed);
+    connect(_transaction.data(), &EncryptedFolderTransaction::committed, this, &PropagateUploadEncrypted::committed);
+    if (_transaction->state() == EncryptedFolderTransaction::Ready)
+        QMetaObject::invokeMethod(this, "slotFolderReady", Qt::QueuedConnection);
 }
 
-void PropagateUploadEncrypted::slotUpdateMetadataSuccess(const QByteArray& fileId)
+void PropagateUploadEncrypted::slotFolderNotEncrypted()
 {
-    Q_UNUSED(fileId);
-    qCDebug(lcPropagateUploadEncrypted) << "Uploading of the metadata success, Encrypting the file";
-    QFileInfo outputInfo(_completeFileName);
-
-    qCDebug(lcPropagateUploadEncrypted) << "Encrypted Info:" << outputInfo.path() << outputInfo.fileName() << outputInfo.size();
-    qCDebug(lcPropagateUploadEncrypted) << "Finalizing the upload part, now the actuall uploader will take over";
-    emit finalized(outputInfo.path() + QLatin1Char('/') + outputInfo.fileName(),
-                   _item->_file.section(QLatin1Char('/'), 0, -2) + QLatin1Char('/') + outputInfo.fileName(),
-                   outputInfo.size());
+    qCDebug(lcPropagateUploadEncrypted) << "Folder is not encrypted, getting back to default.";
+    finish(false);
+    emit folerNotEncrypted();
 }
 
-void PropagateUploadEncrypted::slotUpdateMetadataError(const QByteArray& fileId, int httpErrorResponse)
+void PropagateUploadEncrypted::slotFolderFailed()
 {
-  qCDebug(lcPropagateUploadEncrypted) << "Update metadata error for folder" << fileId << "with error" << httpErrorResponse;
-  qCDebug(lcPropagateUploadEncrypted()) << "Unlocking the folder.";
-  unlockFolder();
+    finish(false);
+    emit error();
 }
 
-void PropagateUploadEncrypted::slotFolderLockedError(const QByteArray& fileId, int httpErrorCode)
+void PropagateUploadEncrypted::slotFolderReady()
 {
-    Q_UNUSED(httpErrorCode);
-    /* try to call the lock from 5 to 5 seconds
-     * and fail if it's more than 5 minutes. */
-    QTimer::singleShot(5000, this, [this, fileId]{
-        if (!_currentLockingInProgress) {
-            qCDebug(lcPropagateUploadEncrypted) << "Error locking the folder while no other update is locking it up.";
-            qCDebug(lcPropagateUploadEncrypted) << "Perhaps another client locked it.";
-            qCDebug(lcPropagateUploadEncrypted) << "Abort";
+    if (!_joined)
         return;
+    qCDebug(lcPropagateUploadEncrypted) << "Metadata available, Preparing it for the new file.";
+    FolderMetadata *metadata = _transaction->metadata();
+
+    QFileInfo info(_propagator->_localDir + QDir::separator() + _item->_file);
+    const QString fileName = info.fileName();
+
+    // Find existing metadata for this file
+    EncryptedFile encryptedFile;
+    const QVector<EncryptedFile> files = metadata->files();
+    for (const EncryptedFile &file : files) {
+        if (file.originalFilename == fileName) {
+            encryptedFile = file;
+            _previousEntry = file;
+            _hadPreviousEntry = true;
         }
+    }
 
-        // Perhaps I should remove the elapsed timer if the lock is from this client?
-        if (_folderLockFirstTry.elapsed() > /* five minutes */ 1000 * 60 * 5 ) {
-            qCDebug(lcPropagateUploadEncrypted) << "One minute passed, ignoring more attemps to lock the folder.";
-        return;
-        }
-        slotTryLock(fileId);
-    });
+    // New encrypted file so set it all up!
+    if (!_hadPreviousEntry) {
+        encryptedFile.encryptionKey = EncryptionHelper::generateRandom(16);
+        encryptedFile.encryptedFilename = EncryptionHelper::generateRandomFilename();
+        encryptedFile.initializationVector = EncryptionHelper::generateRandom(16);
+        encryptedFile.fileVersion = 1;
+        encryptedFile.metadataKey = 1;
+        encryptedFile.originalFilename = fileName;
+
+        QMimeDatabase mdb;
+        encryptedFile.mimetype = mdb.mimeTypeForFile(info).name().toLocal8Bit();
+    }
 
-    qCDebug(lcPropagateUploadEncrypted) << "Folder" << fileId << "Coundn't be locked.";
-}
+    _item->_encryptedFileName = _item->_file.section(QLatin1Char('/'), 0, -2)
+            + QLatin1Char('/') + encryptedFile.encryptedFilename;
+
+    // The file is encrypted while its chunks are read, the tag is only
+    // known once all of them were prepared.
+    const QString localPath = info.absoluteFilePath();
+    _encryptor.reset(new StreamingEncryptor(localPath, encryptedFile.encryptionKey, encryptedFile.initializationVector));
+    if (!_encryptor->isValid()) {
+        qCDebug(lcPropagateUploadEncrypted()) << "There was an error encrypting the file, aborting upload.";
+        finish(false);
+        emit error();
+        return;
+    }
 
-void PropagateUploadEncrypted::slotFolderEncryptedIdError(QNetworkReply *r)
-{
-    Q_UNUSED(r);
-    qCDebug(lcPropagateUploadEncrypted) << "Error retrieving the Id of the encrypted folder.";
-}
+    // Stored on the server together with the entries of the other uploads
+    metadata->addEncryptedFile(encryptedFile);
+    _encryptedFile = encryptedFile;
 
-void PropagateUploadEncrypted::slotFolderEncryptedStatusError(int error)
-{
-    qCDebug(lcPropagateUploadEncrypted) << "Failed to retrieve the status of the folders." << error;
+    qCDebug(lcPropagateUploadEncrypted) << "Finalizing the upload part, now the actuall uploader will take over";
+    emit finalized(localPath, _item->_encryptedFileName, _encryptor->size());
 }
 
-void PropagateUploadEncrypted::unlockFolder()
+bool PropagateUploadEncrypted::finish(bool uploaded)
 {
-    qDebug() << "Calling Unlock";
-    auto *unlockJob = new UnlockEncryptFolderApiJob(_propagator->account(),
-        _folderId, _folderToken, this);
-
-    connect(unlockJob, &UnlockEncryptFolderApiJob::success, []{ qDebug() << "Successfully Unlocked"; });
-    connect(unlockJob, &UnlockEncryptFolderApiJob::error, []{ qDebug() << "Unlock Error"; });
-    unlockJob->start();
+    if (!_joined)
+        return false;
+    _joined = false;
+
+    const bool addedEntry = !_encryptedFile.originalFilename.isEmpty();
+    if (addedEntry && uploaded) {
+        _encryptedFile.authenticationTag = _encryptor->tag();
+        if (_encryptedFile.authenticationTag.isEmpty()) {
+            qCWarning(lcPropagateUploadEncrypted) << "No authentication tag for" << _item->_file << _encryptor->errorString();
+            uploaded = false;
+        } else {
+            _transaction->metadata()->addEncryptedFile(_encryptedFile);
+        }
+    }
+    if (addedEntry && !uploaded) {
+        // The server still has the previous version of the file, if any
+        if (_hadPreviousEntry) {
+            _transaction->metadata()->addEncryptedFile(_previousEntry);
+        } else {
+            _transaction->metadata()->removeEncryptedFile(_encryptedFile);
+        }
+    }
+    _transaction->leave(addedEntry && uploaded);
+    return uploaded;
 }
 
 } // namespace OCC
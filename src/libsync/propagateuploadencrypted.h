@@ -9,6 +9,7 @@
 #include <QNetworkReply>
 #include <QFile>
 #include <QTemporaryFile>
+#include <QScopedPointer>
 
 #include "owncloudpropagator.h"
 #include "clientsideencryption.h"
@@ -16,15 +17,116 @@
 namespace OCC {
 class FolderMetadata;
 
+/**
+ * @brief One lock and metadata round trip shared by the uploads into a folder
+ *
+ * All uploads into the same folder that run at the same time join the same
+ * transaction: the encryption status, the folder id, the lock and the
+ * metadata are fetched once and every upload adds its entry to the shared
+ * metadata while the files are uploaded in parallel. Once no upload is in
+ * flight anymore, and none joined for a short while, the metadata is stored
+ * and the folder is unlocked. Uploads that join later start a new transaction.
+ *
+ * A folder that turns out not to be encrypted is remembered for the rest of
+ * the propagation, so later uploads into it don't ask the server again.
+ */
+class EncryptedFolderTransaction : public QObject
+{
+    Q_OBJECT
+public:
+    enum State {
+        FetchingStatus,
+        NotEncrypted,
+        Locking,
+        Ready, // locked and metadata fetched
+        Committing,
+        Failed
+    };
+
+    /** The transaction uploads into folder should join.
+     *
+     * Creates and starts a new one if there is none that is still open.
+     */
+    static EncryptedFolderTransaction *forFolder(OwncloudPropagator *propagator, const QString &folder);
+
+    ~EncryptedFolderTransaction();
+
+    State state() const { return _state; }
+
+    /// The shared metadata, valid while the state is Ready
+    FolderMetadata *metadata() const { return _metadata.data(); }
+
+    /// Registers an upload, which prevents the commit until it leaves
+    void join();
+
+    /** Unregisters an upload.
+     *
+     * changedMetadata is true if the upload left an entry in the metadata
+     * that needs to be stored.
+     */
+    void leave(bool changedMetadata);
+
+signals:
+    void ready();
+    void notEncrypted();
+    void failed();
+
+    /// The metadata was stored (success) or could not be stored, and the folder unlocked
+    void committed(bool success);
+
+private slots:
+    void slotEncryptedStatusFetched(const QString &folder, bool isEncrypted);
+    void slotEncryptedStatusError(int error);
+    void slotFolderIdReceived(const QStringList &list);
+    void slotFolderIdError(QNetworkReply *reply);
+    void slotTryLock();
+    void slotLocked(const QByteArray &fileId, const QByteArray &token);
+    void slotLockError(const QByteArray &fileId, int httpErrorCode);
+    void slotMetadataReceived(const QJsonDocument &json, int statusCode);
+    void slotMetadataError(const QByteArray &fileId, int httpReturnCode);
+    void slotCommit();
+    void slotMetadataStored();
+    void slotMetadataStoreError(const QByteArray &fileId, int httpErrorCode);
+    void slotUnlocked();
+
+private:
+    EncryptedFolderTransaction(OwncloudPropagator *propagator, const QString &folder);
+    void start();
+    void fail();
+    void unlock();
+    void detach();
+
+    OwncloudPropagator *_propagator;
+    AccountPtr _account; // outlives the propagator's members during destruction
+    QString _folder;
+    State _state = FetchingStatus;
+
+    QByteArray _folderId;
+    QByteArray _folderToken;
+    QElapsedTimer _lockFirstTry;
+    QScopedPointer<FolderMetadata> _metadata;
+    int _metadataStatusCode = 0;
+
+    int _participants = 0;
+    bool _metadataChanged = false;
+    bool _metadataStored = false;
+    bool _unlockStarted = false;
+    QTimer _commitTimer;
+};
+
   /* This class is used if the server supports end to end encryption.
  * It will fire for *any* folder, encrypted or not, because when the
  * client starts the upload request we don't know if the folder is
  * encrypted on the server.
  *
+ * The folder is locked and its metadata updated by the
+ * EncryptedFolderTransaction shared with the other uploads into it.
+ *
  * emits:
  * finalized() if the encrypted file is ready to be uploaded
  * error() if there was an error with the encryption
  * folerNotEncrypted() if the file is within a folder that's not encrypted.
+ * committed() once the metadata referencing the file was stored, after finish(true)
  *
  */
 
@@ -35,45 +137,43 @@ public:
     PropagateUploadEncrypted(OwncloudPropagator *propagator, SyncFileItemPtr item);
     void start();
 
-    /* unlocks the current folder that holds this file */
-    void unlockFolder();
-  // Used by propagateupload
-  QByteArray _folderToken;
-  QByteArray _folderId;
+    /* Reports the end of the upload to the folder's transaction.
+     * If the upload failed the metadata entry of the file is reverted.
+     * Returns whether the entry, with the authentication tag, is kept. */
+    bool finish(bool uploaded);
+    bool isFinished() const { return !_joined; }
+
+    /// Provides the encrypted data of the file, valid after finalized()
+    StreamingEncryptor *encryptor() const { return _encryptor.data(); }
 
 private slots:
-    void slotFolderEncryptedStatusFetched(const QString &folder, bool isEncrypted);
-    void slotFolderEncryptedStatusError(int error);
-    void slotFolderEncryptedIdReceived(const QStringList &list);
-    void slotFolderEncryptedIdError(QNetworkReply *r);
-    void slotFolderLockedSuccessfully(const QByteArray& fileId, const QByteArray& token);
-    void slotFolderLockedError(const QByteArray& fileId, int httpErrorCode);
-    void slotTryLock(const QByteArray& fileId);
-    void slotFolderEncryptedMetadataReceived(const QJsonDocument &json, int statusCode);
-    void slotFolderEncryptedMetadataError(const QByteArray& fileId, int httpReturnCode);
-    void slotUpdateMetadataSuccess(const QByteArray& fileId);
-    void slotUpdateMetadataError(const QByteArray& fileId, int httpReturnCode);
+    void slotFolderReady();
+    void slotFolderNotEncrypted();
+    void slotFolderFailed();
 
 signals:
-    // Emmited after the file is encrypted and everythign is setup.
+    // Emmited once everything is setup; path is the local file, filename the remote
+    // encrypted name and size the size of the encrypted data.
     void finalized(const QString& path, const QString& filename, quint64 size);
     void error();
 
     // Emited if the file is not in a encrypted folder.
     void folerNotEncrypted();
 
+    void committed(bool success);
+
 private:
   OwncloudPropagator *_propagator;
   SyncFileItemPtr _item;
 
-  QElapsedTimer _folderLockFirstTry;
-  bool _currentLockingInProgress = false;
+  QPointer<EncryptedFolderTransaction> _transaction;
+  bool _joined = false;
 
-  QByteArray _generatedKey;
-  QByteArray _generatedIv;
-  FolderMetadata *_metadata;
+  // The entry of the file before this upload, restored if it fails
+  bool _hadPreviousEntry = false;
+  EncryptedFile _previousEntry;
   EncryptedFile _encryptedFile;
-  QString _completeFileName;
+  QScopedPointer<StreamingEncryptor> _encryptor;
 };
 
 
@@ -53,21 +53,21 @@ QUrl PropagateUploadFileNG::chunkUrl(int chunk)
      *----> doStartUpload()
             Check the db: is there an entry?
               /               \
-             no                yes
-            /                   \
-           /                  PROPFIND
-       startNewUpload() <-+        +----------------------------\
-          |               |        |                             \
+             no                yes ------------------------------> resumeFromJournal()
+            /                   \                                           |
+           /                  PROPFIND (entries of older versions)          |
+       startNewUpload() <-+        +----------------------------\           |
+          |               |        |                             \          |
          MKCOL            + slotPropfindFinishedWithError()     slotPropfindFinished()
           |                                                       Is there stale files to remove?
-      slotMkColFinished()                                         |                      |
-          |                                                       no                    yes
-          |                                                       |                      |
-          |                                                       |                  DeleteJob
-          |                                                       |                      |
+      slotMkColFinished()                                         |          |  |
+          |                                                       no        yes |
+          |                                                       |          |  |
+          |                                                       |   removeServerChunks()
+          |                                                       |          |  |
     +-----+<------------------------------------------------------+<---  slotDeleteJobFinished()
-    |
-    +---->  startNextChunk()  ---finished?  --+
+    |                                                                           |
+    +---->  startNextChunk()  ---finished?  --+  <------------------------------+
                   ^               |          |
                   +---------------+          |
                                              |
@@ -75,6 +75,18 @@ QUrl PropagateUploadFileNG::chunkUrl(int chunk)
     |
     +-> MOVE ------> moveJobFinished() ---> finalize()
 
+  startNextChunk() keeps up to parallelChunks() chunk uploads running. They may
+  finish in any order, the server assembles the chunks by their name. The MOVE
+  waits for all of them.
+
+  The journal records the chunks the server acknowledged, so an interrupted
+  upload continues without asking the server. Before a chunk is sent, its id
+  is reserved in the journal; on resume, reserved chunks beyond the last one
+  of the upload are removed before the MOVE, the others are overwritten.
+  The resume is verified lazily: a single chunk is sent until the server
+  accepts one. If that chunk or the MOVE is refused, the chunks on the server
+  are checked with a PROPFIND, like for the entries of older versions.
+
 
  */
 
@@ -85,18 +97,12 @@ void PropagateUploadFileNG::doStartUpload()
     const SyncJournalDb::UploadInfo progressInfo = propagator()->_journal->getUploadInfo(_item->_file);
     if (progressInfo._valid && progressInfo.isChunked() && progressInfo._modtime == _item->_modtime) {
         _transferId = progressInfo._transferid;
-        auto url = chunkUrl();
-        auto job = new LsColJob(propagator()->account(), url, this);
-        _jobs.append(job);
-        job->setProperties(QList<QByteArray>() << "resourcetype"
-                                               << "getcontentlength");
-        connect(job, &LsColJob::finishedWithoutError, this, &PropagateUploadFileNG::slotPropfindFinished);
-        connect(job, &LsColJob::finishedWithError,
-            this, &PropagateUploadFileNG::slotPropfindFinishedWithError);
-        connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
-        connect(job, &LsColJob::directoryListingIterated,
-            this, &PropagateUploadFileNG::slotPropfindIterate);
-        job->start();
+        if (progressInfo._reservedChunks > 0) {
+            resumeFromJournal(progressInfo);
+        } else {
+            // Older versions didn't record the chunks, ask the server
+            startPropfind();
+        }
         return;
     } else if (progressInfo._valid && progressInfo.isChunked()) {
         // The upload info is stale. remove the stale chunks on the server
@@ -109,6 +115,68 @@ void PropagateUploadFileNG::doStartUpload()
     startNewUpload();
 }
 
+void PropagateUploadFileNG::resumeFromJournal(const SyncJournalDb::UploadInfo &info)
+{
+    if (info._size != _fileToUpload._size || info._confirmedBytes > _fileToUpload._size
+        || info._chunk > info._reservedChunks) {
+        qCWarning(lcPropagateUpload) << "Upload info of" << _item->_file << "does not match the file, starting over";
+        // Fire and forget. Any error will be ignored.
+        (new DeleteJob(propagator()->account(), chunkUrl(), this))->start();
+        startNewUpload();
+        return;
+    }
+
+    propagator()->_activeJobList.removeOne(this);
+    _currentChunk = info._chunk;
+    _sent = info._confirmedBytes;
+    _confirmed = _sent;
+    _reservedChunks = info._reservedChunks;
+    _leftoverChunks = info._reservedChunks;
+    _resumedFromJournal = true;
+    _resumeUnverified = true;
+
+    qCInfo(lcPropagateUpload) << "Resuming " << _item->_file << " from chunk " << _currentChunk << "; sent =" << _sent
+                              << "; up to chunk" << _leftoverChunks << "may be on the server";
+    propagator()->reportProgress(*_item, _confirmed);
+    startNextChunk();
+}
+
+bool PropagateUploadFileNG::verifyResumeOnError()
+{
+    const int httpStatus = _item->_httpErrorCode;
+    if (!_resumedFromJournal || !_jobs.isEmpty()
+        || (httpStatus != 400 && httpStatus != 404 && httpStatus != 409))
+        return false;
+
+    // The server may have removed the upload because it expired, or have
+    // other chunks than the journal knows of
+    qCInfo(lcPropagateUpload) << "Error" << httpStatus << "for the resumed upload of" << _item->_file
+                              << ", checking the chunks on the server";
+    _finished = false;
+    _resumedFromJournal = false;
+    _resumeUnverified = false;
+    _leftoverChunks = 0;
+    _runningChunks.clear();
+    propagator()->_activeJobList.append(this);
+    startPropfind();
+    return true;
+}
+
+void PropagateUploadFileNG::startPropfind()
+{
+    auto job = new LsColJob(propagator()->account(), chunkUrl(), this);
+    _jobs.append(job);
+    job->setProperties(QList<QByteArray>() << "resourcetype"
+                                           << "getcontentlength");
+    connect(job, &LsColJob::finishedWithoutError, this, &PropagateUploadFileNG::slotPropfindFinished);
+    connect(job, &LsColJob::finishedWithError,
+        this, &PropagateUploadFileNG::slotPropfindFinishedWithError);
+    connect(job, &QObject::destroyed, this, &PropagateUploadFileCommon::slotJobDestroyed);
+    connect(job, &LsColJob::directoryListingIterated,
+        this, &PropagateUploadFileNG::slotPropfindIterate);
+    job->start();
+}
+
 void PropagateUploadFileNG::slotPropfindIterate(const QString &name, const QMap<QString, QString> &properties)
 {
     if (name == chunkUrl().path()) {
@@ -127,8 +195,9 @@ void PropagateUploadFileNG::slotPropfindFinished()
 {
     auto job = qobject_cast<LsColJob *>(sender());
     slotJobDestroyed(job); // remove it from the _jobs list
-    propagator()->_activeJobList.removeOne(this);
 
+    // Chunks may have been uploaded out of order, only the ones before the
+    // first missing chunk can be used
     _currentChunk = 0;
     _sent = 0;
     while (_serverChunks.contains(_currentChunk)) {
@@ -136,6 +205,7 @@ void PropagateUploadFileNG::slotPropfindFinished()
         _serverChunks.remove(_currentChunk);
         ++_currentChunk;
     }
+    _confirmed = _sent;
 
     if (_sent > _fileToUpload._size) {
         // Normally this can't happen because the size is xor'ed with the transfer id, and it is
@@ -146,30 +216,36 @@ void PropagateUploadFileNG::slotPropfindFinished()
         startNewUpload();
         return;
     }
+    propagator()->_activeJobList.removeOne(this);
 
     qCInfo(lcPropagateUpload) << "Resuming " << _item->_file << " from chunk " << _currentChunk << "; sent =" << _sent;
 
     if (!_serverChunks.isEmpty()) {
-        qCInfo(lcPropagateUpload) << "To Delete" << _serverChunks.keys();
-        propagator()->_activeJobList.append(this);
-        _removeJobError = false;
-
         // Make sure that if there is a "hole" and then a few more chunks, on the server
         // we should remove the later chunks. Otherwise when we do dynamic chunk sizing, we may end up
         // with corruptions if there are too many chunks, or if we abort and there are still stale chunks.
-        for (auto it = _serverChunks.begin(); it != _serverChunks.end(); ++it) {
-            auto job = new DeleteJob(propagator()->account(), Utility::concatUrlPath(chunkUrl(), it->originalName), this);
-            QObject::connect(job, &DeleteJob::finishedSignal, this, &PropagateUploadFileNG::slotDeleteJobFinished);
-            _jobs.append(job);
-            job->start();
-        }
-        _serverChunks.clear();
+        removeServerChunks();
         return;
     }
 
     startNextChunk();
 }
 
+void PropagateUploadFileNG::removeServerChunks()
+{
+    qCInfo(lcPropagateUpload) << "To Delete" << _serverChunks.keys();
+    propagator()->_activeJobList.append(this);
+    _removeJobError = false;
+
+    for (auto it = _serverChunks.begin(); it != _serverChunks.end(); ++it) {
+        auto job = new DeleteJob(propagator()->account(), Utility::concatUrlPath(chunkUrl(), it->originalName), this);
+        QObject::connect(job, &DeleteJob::finishedSignal, this, &PropagateUploadFileNG::slotDeleteJobFinished);
+        _jobs.append(job);
+        job->start();
+    }
+    _serverChunks.clear();
+}
+
 void PropagateUploadFileNG::slotPropfindFinishedWithError()
 {
     auto job = qobject_cast<LsColJob *>(sender());
@@ -206,11 +282,11 @@ void PropagateUploadFileNG::slotDeleteJobFinished()
     }
 
     if (_jobs.isEmpty()) {
-        propagator()->_activeJobList.removeOne(this);
         if (_removeJobError) {
             // There was an error removing some files, just start over
             startNewUpload();
         } else {
+            propagator()->_activeJobList.removeOne(this);
             startNextChunk();
         }
     }
@@ -222,7 +298,13 @@ void PropagateUploadFileNG::startNewUpload()
     ASSERT(propagator()->_activeJobList.count(this) == 1);
     _transferId = qrand() ^ _item->_modtime ^ (_fileToUpload._size << 16) ^ qHash(_fileToUpload._file);
     _sent = 0;
+    _confirmed = 0;
     _currentChunk = 0;
+    _runningChunks.clear();
+    _reservedChunks = 2 * parallelChunks();
+    _leftoverChunks = 0;
+    _resumedFromJournal = false;
+    _resumeUnverified = false;
 
     propagator()->reportProgress(*_item, 0);
 
@@ -230,9 +312,10 @@ void PropagateUploadFileNG::startNewUpload()
     pi._valid = true;
     pi._transferid = _transferId;
     pi._modtime = _item->_modtime;
+    pi._size = _fileToUpload._size;
     pi._contentChecksum = _item->_checksumHeader;
-    propagator()->_journal->setUploadInfo(_item->_file, pi);
-    propagator()->_journal->commit("Upload info");
+    pi._reservedChunks = _reservedChunks;
+    saveUploadInfo(pi, true);
     QMap<QByteArray, QByteArray> headers;
 
     // But we should send the temporary (or something) one.
@@ -262,6 +345,34 @@ void PropagateUploadFileNG::slotMkColFinished(QNetworkReply::NetworkError)
     startNextChunk();
 }
 
+int PropagateUploadFileNG::parallelChunks() const
+{
+    if (propagator()->account()->capabilities().chunkingParallelUploadDisabled())
+        return 1;
+    return qMax(1, propagator()->syncOptions()._parallelChunkUploads);
+}
+
+SyncJournalDb::UploadInfo PropagateUploadFileNG::uploadProgress()
+{
+    auto pi = propagator()->_journal->getUploadInfo(_item->_file);
+    pi._valid = true;
+    pi._transferid = _transferId;
+    pi._modtime = _item->_modtime;
+    pi._size = _fileToUpload._size;
+    pi._contentChecksum = _item->_checksumHeader;
+    pi._reservedChunks = _reservedChunks;
+    // Chunks after the first running one may be done, but a resume can only use
+    // the ones before it
+    if (_runningChunks.isEmpty()) {
+        pi._chunk = _currentChunk;
+        pi._confirmedBytes = _sent;
+    } else {
+        pi._chunk = _runningChunks.firstKey();
+        pi._confirmedBytes = _runningChunks.first().offset;
+    }
+    return pi;
+}
+
 void PropagateUploadFileNG::startNextChunk()
 {
     if (propagator()->_abortRequested.fetchAndAddRelaxed(0))
@@ -270,11 +381,22 @@ void PropagateUploadFileNG::startNextChunk()
     quint64 fileSize = _fileToUpload._size;
     ENFORCE(fileSize >= _sent, "Sent data exceeds file size");
 
-    // prevent situation that chunk size is bigger then required one to send
-    _currentChunkSize = qMin(propagator()->_chunkSize, fileSize - _sent);
-
-    if (_currentChunkSize == 0) {
+    if (_sent == fileSize) {
+        if (!_runningChunks.isEmpty()) {
+            // The MOVE needs all the chunks, wait for the others
+            return;
+        }
         Q_ASSERT(_jobs.isEmpty()); // There should be no running job anymore
+
+        if (_currentChunk < _leftoverChunks) {
+            // Chunks sent before the resume that are beyond the last one of
+            // this upload would become part of the file
+            for (int chunk = _currentChunk; chunk < _leftoverChunks; ++chunk)
+                _serverChunks[chunk] = ServerChunkInfo{ 0, QString::number(chunk).rightJustified(8, '0') };
+            _leftoverChunks = 0;
+            removeServerChunks();
+            return;
+        }
         _finished = true;
 
         // Finish with a MOVE
@@ -305,10 +427,27 @@ void PropagateUploadFileNG::startNextChunk()
         return;
     }
 
+    // Fill the window of parallel chunks, but don't take the slots of other
+    // jobs beyond the propagator's limit. A resumed upload sends one chunk
+    // until the server accepted one.
+    do {
+        if (!startChunk())
+            return;
+    } while (!_resumeUnverified
+        && _sent < fileSize
+        && _runningChunks.size() < parallelChunks()
+        && propagator()->_activeJobList.count() < propagator()->hardMaximumActiveJob());
+}
+
+bool PropagateUploadFileNG::startChunk()
+{
+    // prevent situation that chunk size is bigger then required one to send
+    const quint64 chunkSize = qMin(propagator()->_chunkSize, _fileToUpload._size - _sent);
+
     auto device = std::make_unique<UploadDevice>(&propagator()->_bandwidthManager);
     const QString fileName = _fileToUpload._path;
 
-    if (!device->prepareAndOpen(fileName, _sent, _currentChunkSize)) {
+    if (!prepareUploadDevice(device.get(), _sent, chunkSize)) {
         qCWarning(lcPropagateUpload) << "Could not prepare upload device: " << device->errorString();
 
         // If the file is currently locked, we want to retry the sync
@@ -318,14 +457,21 @@ void PropagateUploadFileNG::startNextChunk()
         }
         // Soft error because this is likely caused by the user modifying his files while syncing
         abortWithError(SyncFileItem::SoftError, device->errorString());
-        return;
+        return false;
+    }
+
+    if (_currentChunk >= _reservedChunks) {
+        // Write-ahead: a resumed upload must know every chunk that may be on the server
+        _reservedChunks = _currentChunk + 2 * parallelChunks();
+        saveUploadInfo(uploadProgress(), true);
     }
 
     QMap<QByteArray, QByteArray> headers;
     headers["OC-Chunk-Offset"] = QByteArray::number(_sent);
 
-    _sent += _currentChunkSize;
     QUrl url = chunkUrl(_currentChunk);
+    _runningChunks.insert(_currentChunk, RunningChunk{ _sent, chunkSize, 0 });
+    _sent += chunkSize;
 
     // job takes ownership of device via a QScopedPointer. Job deletes itself when finishing
     auto devicePtr = device.get(); // for connections later
@@ -340,6 +486,7 @@ void PropagateUploadFileNG::startNextChunk()
     job->start();
     propagator()->_activeJobList.append(this);
     _currentChunk++;
+    return true;
 }
 
 void PropagateUploadFileNG::slotPutFinished()
@@ -360,11 +507,16 @@ void PropagateUploadFileNG::slotPutFinished()
 
     if (err != QNetworkReply::NoError) {
         _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        if (verifyResumeOnError())
+            return;
         commonErrorHandling(job);
         return;
     }
+    _resumeUnverified = false;
 
     ENFORCE(_sent <= _fileToUpload._size, "can't send more than size");
+    const quint64 chunkSize = _runningChunks.take(job->_chunk).size;
+    _confirmed += chunkSize;
 
     // Adjust the chunk size for the time taken.
     //
@@ -373,11 +525,13 @@ void PropagateUploadFileNG::slotPutFinished()
     auto targetDuration = propagator()->syncOptions()._targetChunkUploadDuration;
     if (targetDuration.count() > 0) {
         auto uploadTime = ++job->msSinceStart(); // add one to avoid div-by-zero
-        qint64 predictedGoodSize = (_currentChunkSize * targetDuration) / uploadTime;
+        qint64 predictedGoodSize = (chunkSize * targetDuration) / uploadTime;
 
         // The whole targeting is heuristic. The predictedGoodSize will fluctuate
         // quite a bit because of external factors (like available bandwidth)
-        // and internal factors (like number of parallel uploads).
+        // and internal factors (like number of parallel uploads). Parallel
+        // chunks share the bandwidth, so each one takes longer and the size
+        // is lowered to still reach the target duration per chunk.
         //
         // We use an exponential moving average here as a cheap way of smoothing
         // the chunk sizes a bit.
@@ -389,13 +543,13 @@ void PropagateUploadFileNG::slotPutFinished()
             targetSize,
             propagator()->syncOptions()._maxChunkSize);
 
-        qCInfo(lcPropagateUpload) << "Chunked upload of" << _currentChunkSize << "bytes took" << uploadTime.count()
+        qCInfo(lcPropagateUpload) << "Chunked upload of" << chunkSize << "bytes took" << uploadTime.count()
                                   << "ms, desired is" << targetDuration.count() << "ms, expected good chunk size is"
                                   << predictedGoodSize << "bytes and nudged next chunk size to "
                                   << propagator()->_chunkSize << "bytes";
     }
 
-    _finished = _sent == _item->_size;
+    _finished = _confirmed == _fileToUpload._size;
 
     // Check if the file still exists
     const QString fullFilePath(propagator()->getFilePath(_item->_file));
@@ -424,11 +578,10 @@ void PropagateUploadFileNG::slotPutFinished()
             _item->_hasBlacklistEntry = false;
         }
 
-        // Reset the error count on successful chunk upload
-        auto uploadInfo = propagator()->_journal->getUploadInfo(_item->_file);
+        // Record the progress and reset the error count on successful chunk upload
+        auto uploadInfo = uploadProgress();
         uploadInfo._errorCount = 0;
-        propagator()->_journal->setUploadInfo(_item->_file, uploadInfo);
-        propagator()->_journal->commit("Upload info");
+        saveUploadInfo(uploadInfo, false);
     }
     startNextChunk();
 }
@@ -442,6 +595,8 @@ void PropagateUploadFileNG::slotMoveJobFinished()
     _item->_httpErrorCode = job->reply()->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
 
     if (err != QNetworkReply::NoError) {
+        if (verifyResumeOnError())
+            return;
         commonErrorHandling(job);
         return;
     }
@@ -483,7 +638,17 @@ void PropagateUploadFileNG::slotUploadProgress(qint64 sent, qint64 total)
     if (sent == 0 && total == 0) {
         return;
     }
-    propagator()->reportProgress(*_item, _sent + sent - total);
+    auto job = qobject_cast<PUTFileJob *>(sender());
+    ASSERT(job);
+    auto chunk = _runningChunks.find(job->_chunk);
+    if (chunk == _runningChunks.end())
+        return;
+    chunk->progress = sent;
+
+    quint64 progress = _confirmed;
+    for (const auto &running : _runningChunks)
+        progress += running.progress;
+    propagator()->reportProgress(*_item, progress);
 }
 
 void PropagateUploadFileNG::abort(PropagatorJob::AbortType abortType)
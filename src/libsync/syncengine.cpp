@@ -26,6 +26,7 @@
 #include "propagateremotedelete.h"
 #include "propagatedownload.h"
 #include "common/asserts.h"
+#include "common/tracing.h"
 #include "configfile.h"
 
 
@@ -70,6 +71,7 @@ SyncEngine::SyncEngine(AccountPtr account, const QString &localPath,
     , _localPath(localPath)
     , _remotePath(remotePath)
     , _journal(journal)
+    , _recordSweepActive(false)
     , _progressInfo(new ProgressInfo)
     , _hasNoneFiles(false)
     , _hasRemoveFile(false)
@@ -326,6 +328,15 @@ void SyncEngine::deleteStaleErrorBlacklistEntries(const SyncFileItemVector &sync
     _journal->deleteStaleErrorBlacklistEntries(blacklist_file_paths);
 }
 
+void SyncEngine::keepFileRecord(const QString &path)
+{
+    if (_recordSweepActive) {
+        _journal->keepFileRecord(path);
+    } else {
+        _seenFiles.insert(path);
+    }
+}
+
 void SyncEngine::conflictRecordMaintenance()
 {
     // Remove stale conflict entries from the database
@@ -344,10 +355,7 @@ void SyncEngine::conflictRecordMaintenance()
     //
     // This happens when the conflicts table is new or when conflict files
     // are downlaoded but the server doesn't send conflict headers.
-    for (const auto &path : _seenFiles) {
-        if (!Utility::isConflictFile(path))
-            continue;
-
+    for (const auto &path : _seenConflictFiles) {
         auto bapath = path.toUtf8();
         if (!conflictRecordPaths.contains(bapath)) {
             ConflictRecord record;
@@ -472,10 +480,14 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
     }
 
     // record the seen files to be able to clean the journal later
-    _seenFiles.insert(item->_file);
+    keepFileRecord(item->_file);
+    if (Utility::isConflictFile(item->_file))
+        _seenConflictFiles.insert(item->_file);
     if (!renameTarget.isEmpty()) {
         // Yes, this records both the rename renameTarget and the original so we keep both in case of a rename
-        _seenFiles.insert(renameTarget);
+        keepFileRecord(renameTarget);
+        if (Utility::isConflictFile(renameTarget))
+            _seenConflictFiles.insert(renameTarget);
     }
 
     switch (file->error_status) {
@@ -621,8 +633,9 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
                     // Even if the mtime is different on the server, we always want to keep the mtime from
                     // the file system in the DB, this is to avoid spurious upload on the next sync
                     item->_modtime = other->modtime;
-                    // same for the size
-                    item->_size = other->size;
+                    // same for the size, except that placeholders don't have the data
+                    if (item->_type != ItemTypeVirtualFile)
+                        item->_size = other->size;
                 }
 
                 // If the 'W' remote permission changed, update the local filesystem
@@ -697,6 +710,17 @@ int SyncEngine::treewalkFile(csync_file_stat_t *file, csync_file_stat_t *other,
     }
 
     item->_direction = dir;
+
+    // A virtual file is downloaded under its real name, its placeholder is
+    // removed once the data is in place. Dehydration works the other way round.
+    if (item->_type == ItemTypeVirtualFileDownload && dir == SyncFileItem::Down
+        && item->_file.endsWith(APPLICATION_DOTVIRTUALFILE_SUFFIX)) {
+        item->_file.chop(qstrlen(APPLICATION_DOTVIRTUALFILE_SUFFIX));
+        keepFileRecord(item->_file);
+    } else if (item->_type == ItemTypeVirtualFileDehydration && dir == SyncFileItem::Down) {
+        keepFileRecord(item->_file + APPLICATION_DOTVIRTUALFILE_SUFFIX);
+    }
+
     if (instruction != CSYNC_INSTRUCTION_NONE) {
         // check for blacklisting of this item.
         // if the item is on blacklist, the instruction was set to ERROR
@@ -779,6 +803,7 @@ void SyncEngine::startSync()
     _syncRunning = true;
     _anotherSyncNeeded = NoFollowUpSync;
     _clearTouchedFilesTimer.stop();
+    _remoteRootEtag.clear();
 
     _progressInfo->reset();
 
@@ -815,6 +840,11 @@ void SyncEngine::startSync()
     _syncItemMap.clear();
     _needsUpdate = false;
 
+    // The connections get established while the local discovery runs
+    if (_syncOptions._warmUpConnections > 0) {
+        _account->warmUpConnections(_syncOptions._warmUpConnections);
+    }
+
     csync_resume(_csync_ctx.data());
 
     if (!_journal->exists()) {
@@ -849,6 +879,11 @@ void SyncEngine::startSync()
 
     _csync_ctx->read_remote_from_db = true;
 
+    // Existing placeholders are always recognized, even when new files are
+    // downloaded normally.
+    _csync_ctx->virtual_file_suffix = APPLICATION_DOTVIRTUALFILE_SUFFIX;
+    _csync_ctx->new_files_are_virtual = _syncOptions._newFilesAreVirtual;
+
     _lastLocalDiscoveryStyle = _localDiscoveryStyle;
     _csync_ctx->should_discover_locally_fn = [this](const QByteArray &path) {
         return shouldDiscoverLocally(path);
@@ -978,9 +1013,12 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     _progressInfo->_status = ProgressInfo::Reconcile;
     emit transmissionProgress(*_progressInfo);
 
-    if (csync_reconcile(_csync_ctx.data()) < 0) {
-        handleSyncError(_csync_ctx.data(), "csync_reconcile");
-        return;
+    {
+        TraceSpan span("engine", "reconcile");
+        if (csync_reconcile(_csync_ctx.data()) < 0) {
+            handleSyncError(_csync_ctx.data(), "csync_reconcile");
+            return;
+        }
     }
 
     qCInfo(lcEngine) << "#### Reconcile end #################################################### " << _stopWatch.addLapTime(QLatin1String("Reconcile Finished")) << "ms";
@@ -990,16 +1028,24 @@ void SyncEngine::slotDiscoveryJobFinished(int discoveryResult)
     _hasForwardInTimeFiles = false;
     _backInTimeFiles = 0;
     bool walkOk = true;
+    _recordSweepActive = _journal->beginRecordSweep();
+    if (!_recordSweepActive) {
+        qCWarning(lcEngine) << "Could not start tracking the journal records in use, the cleanup will read all of them";
+    }
     _seenFiles.clear();
+    _seenConflictFiles.clear();
     _temporarilyUnavailablePaths.clear();
     _renamedFolders.clear();
 
-    if (csync_walk_local_tree(_csync_ctx.data(), [this](csync_file_stat_t *f, csync_file_stat_t *o) { return treewalkFile(f, o, false); } ) < 0) {
-        qCWarning(lcEngine) << "Error in local treewalk.";
-        walkOk = false;
-    }
-    if (walkOk && csync_walk_remote_tree(_csync_ctx.data(), [this](csync_file_stat_t *f, csync_file_stat_t *o) { return treewalkFile(f, o, true); } ) < 0) {
-        qCWarning(lcEngine) << "Error in remote treewalk.";
+    {
+        TraceSpan span("engine", "treewalk");
+        if (csync_walk_local_tree(_csync_ctx.data(), [this](csync_file_stat_t *f, csync_file_stat_t *o) { return treewalkFile(f, o, false); } ) < 0) {
+            qCWarning(lcEngine) << "Error in local treewalk.";
+            walkOk = false;
+        }
+        if (walkOk && csync_walk_remote_tree(_csync_ctx.data(), [this](csync_file_stat_t *f, csync_file_stat_t *o) { return treewalkFile(f, o, true); } ) < 0) {
+            qCWarning(lcEngine) << "Error in remote treewalk.";
+        }
     }
 
     qCInfo(lcEngine) << "Permissions of the root folder: " << _csync_ctx->remote.root_perms.toString();
@@ -1162,6 +1208,7 @@ void SyncEngine::setNetworkLimits(int upload, int download)
 void SyncEngine::slotItemCompleted(const SyncFileItemPtr &item)
 {
     _progressInfo->setProgressComplete(*item);
+    _progressInfo->setBytesReusedLocally(_propagator->_bytesReusedLocally);
 
     if (item->_status == SyncFileItem::FatalError) {
         csyncError(item->_errorString);
@@ -1179,10 +1226,14 @@ void SyncEngine::slotFinished(bool success)
 
     if (success) {
         _journal->setDataFingerprint(_discoveryMainThread->_dataFingerprint);
+        _journal->setRootEtag(_remoteRootEtag.toUtf8());
     }
 
-    if (!_journal->postSyncCleanup(_seenFiles, _temporarilyUnavailablePaths)) {
-        qCDebug(lcEngine) << "Cleaning of synced ";
+    bool cleanedUp = _recordSweepActive
+        ? _journal->postSyncCleanup(_temporarilyUnavailablePaths)
+        : _journal->postSyncCleanup(_seenFiles, _temporarilyUnavailablePaths);
+    if (!cleanedUp) {
+        qCWarning(lcEngine) << "Cleaning of the sync journal failed";
     }
 
     conflictRecordMaintenance();
@@ -1208,6 +1259,9 @@ void SyncEngine::finalize(bool success)
     _journal->close();
 
     qCInfo(lcEngine) << "CSync run took " << _stopWatch.addLapTime(QLatin1String("Sync Finished")) << "ms";
+    if (_propagator && _propagator->_bytesReusedLocally > 0) {
+        qCInfo(lcEngine) << "Saved downloading" << _propagator->_bytesReusedLocally << "bytes by reusing local files";
+    }
     _stopWatch.stop();
 
     s_anySyncRunning = false;
@@ -1217,6 +1271,7 @@ void SyncEngine::finalize(bool success)
     // Delete the propagator only after emitting the signal.
     _propagator.clear();
     _seenFiles.clear();
+    _seenConflictFiles.clear();
     _temporarilyUnavailablePaths.clear();
     _renamedFolders.clear();
     _uniqueErrors.clear();
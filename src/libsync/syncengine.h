@@ -22,6 +22,7 @@
 #include <QThread>
 #include <QString>
 #include <QSet>
+#include <QHash>
 #include <QMap>
 #include <QStringList>
 #include <QSharedPointer>
@@ -216,6 +217,9 @@ private:
     // Removes stale error blacklist entries from the journal.
     void deleteStaleErrorBlacklistEntries(const SyncFileItemVector &syncItems);
 
+    // Marks the journal record for path as still in use, see _recordSweepActive
+    void keepFileRecord(const QString &path);
+
     // Removes stale and adds missing conflict records after sync
     void conflictRecordMaintenance();
 
@@ -224,8 +228,9 @@ private:
 
     static bool s_anySyncRunning; //true when one sync is running somewhere (for debugging)
 
-    // Must only be acessed during update and reconcile
-    QMap<QString, SyncFileItemPtr> _syncItemMap;
+    // Must only be acessed during update and reconcile.
+    // Only used to merge the two tree walks, the items get sorted afterwards.
+    QHash<QString, SyncFileItemPtr> _syncItemMap;
 
     AccountPtr _account;
     QScopedPointer<CSYNC> _csync_ctx;
@@ -238,8 +243,14 @@ private:
     QPointer<DiscoveryMainThread> _discoveryMainThread;
     QSharedPointer<OwncloudPropagator> _propagator;
 
-    // After a sync, only the syncdb entries whose filenames appear in this
-    // set will be kept. See _temporarilyUnavailablePaths.
+    // Conflict files seen during the sync, for conflictRecordMaintenance().
+    // The seen paths in general are tracked in the journal, after a sync only
+    // the syncdb entries for those will be kept. See _temporarilyUnavailablePaths.
+    QSet<QString> _seenConflictFiles;
+
+    // Whether the journal tracks the seen paths. If it couldn't start doing
+    // that, they are collected in _seenFiles for a full cleanup instead.
+    bool _recordSweepActive;
     QSet<QString> _seenFiles;
 
     // Some paths might be temporarily unavailable on the server, for
@@ -12,6 +12,7 @@
  * for more details.
  */
 
+#include "config.h"
 #include "syncfileitem.h"
 #include "common/syncjournalfilerecord.h"
 #include "common/utility.h"
@@ -23,6 +24,14 @@ namespace OCC {
 
 Q_LOGGING_CATEGORY(lcFileItem, "nextcloud.sync.fileitem", QtInfoMsg)
 
+QString SyncFileItem::remoteFileName(const QString &fileName) const
+{
+    const QLatin1String suffix(APPLICATION_DOTVIRTUALFILE_SUFFIX);
+    if ((_type == ItemTypeVirtualFile || _type == ItemTypeVirtualFileDownload) && fileName.endsWith(suffix))
+        return fileName.left(fileName.size() - suffix.size());
+    return fileName;
+}
+
 SyncJournalFileRecord SyncFileItem::toSyncJournalFileRecordWithInode(const QString &localFileName)
 {
     SyncJournalFileRecord rec;
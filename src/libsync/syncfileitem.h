@@ -169,6 +169,22 @@ public:
         return _type == ItemTypeDirectory;
     }
 
+    /**
+     * True if propagating the item only writes the placeholder of a virtual
+     * file, no data is transferred.
+     */
+    bool isVirtualFilePlaceholder() const
+    {
+        return _type == ItemTypeVirtualFile || _type == ItemTypeVirtualFileDehydration;
+    }
+
+    /**
+     * The path on the server for the local path \a fileName of this item.
+     *
+     * They differ for virtual files only, their placeholders have a suffix.
+     */
+    QString remoteFileName(const QString &fileName) const;
+
     /**
      * True if the item had any kind of error.
      */
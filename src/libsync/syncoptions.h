@@ -57,8 +57,40 @@ struct SyncOptions
      */
     std::chrono::milliseconds _targetChunkUploadDuration = std::chrono::minutes(1);
 
+    /** The number of chunks of one file that chunkingNG uploads at the same time.
+     *
+     * Set to 1 to upload the chunks one after the other.
+     */
+    int _parallelChunkUploads = 3;
+
+    /** Files of at least this size are downloaded as several byte ranges at
+     * the same time. Set to 0 to always download files in one request.
+     */
+    quint64 _minRangedDownloadSize = 100 * 1000 * 1000; // 100MB
+
+    /** The number of byte ranges of one file that are downloaded at the same time. */
+    int _parallelDownloadRanges = 3;
+
+    /** Files of at least this size are downloaded as a delta against the
+     * local file when the server offers block signatures. Set to 0 to
+     * always download the whole file.
+     */
+    quint64 _minDeltaDownloadSize = 10 * 1000 * 1000; // 10MB
+
+    /** The number of connections to the server opened when a sync starts,
+     * so they are ready once the discovery needs them. 0 to not open any. */
+    int _warmUpConnections = 4;
+
+    /** The number of directory listings the remote discovery requests before
+     * the directories are walked. 0 to only request them when needed. */
+    int _discoveryPipelineDepth = 4;
+
     /** Whether parallel network jobs are allowed. */
     bool _parallelNetworkJobs = true;
+
+    /** Create a placeholder for files that are new on the server instead of
+     * downloading them. See ItemTypeVirtualFile. */
+    bool _newFilesAreVirtual = false;
 };
 
 
@@ -0,0 +1,82 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QDebug>
+
+#include <random>
+
+#include "deltasync.h"
+
+using namespace OCC;
+
+// Fixed seed, so every run measures the same data
+static std::mt19937 generator(42);
+
+static QByteArray randomData(int size)
+{
+    std::uniform_int_distribution<int> byte(0, 255);
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i)
+        data[i] = char(byte(generator));
+    return data;
+}
+
+// Reports how many bytes a delta transfer of target would need with seed
+// available locally, compared to transferring the whole file.
+static void measure(const char *name, const QByteArray &seedData, const QByteArray &target, int blockSize)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QBuffer targetBuffer;
+    targetBuffer.setData(target);
+    targetBuffer.open(QIODevice::ReadOnly);
+    auto signatures = BlockSignatures::compute(&targetBuffer, blockSize);
+    qint64 signatureTime = timer.restart();
+
+    QBuffer seed;
+    seed.setData(seedData);
+    seed.open(QIODevice::ReadOnly);
+    auto plan = DeltaPlan::compute(signatures, &seed);
+    qint64 planTime = timer.restart();
+
+    qint64 onTheWire = plan.bytesToFetch() + signatures.serialize().size();
+    qDebug() << name << "BLOCK" << blockSize
+             << "FULL" << target.size() << "DELTA" << onTheWire
+             << "RATIO" << double(onTheWire) / qMax(1, target.size())
+             << "SIGNATURES MS" << signatureTime << "PLAN MS" << planTime;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    const int size = 64 * 1024 * 1024;
+    const QByteArray base = randomData(size);
+
+    for (int blockSize : { 4096, 64 * 1024 }) {
+        QByteArray scattered = base;
+        std::uniform_int_distribution<int> position(0, size - 1);
+        for (int i = 0; i < 20; ++i)
+            scattered[position(generator)] = char(generator());
+        measure("SCATTERED BYTE EDITS", base, scattered, blockSize);
+
+        QByteArray inserted = base;
+        inserted.insert(size / 3, randomData(1000));
+        measure("INSERT IN THE MIDDLE", base, inserted, blockSize);
+
+        QByteArray rewritten = base;
+        rewritten.replace(size / 2, 4 * 1024 * 1024, randomData(4 * 1024 * 1024));
+        measure("REWRITTEN 4MB REGION", base, rewritten, blockSize);
+
+        measure("APPENDED 1MB", base, base + randomData(1024 * 1024), blockSize);
+    }
+    return 0;
+}
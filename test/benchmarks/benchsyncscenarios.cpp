@@ -0,0 +1,275 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+#include <QCommandLineParser>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QProcess>
+
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
+using namespace OCC;
+
+struct Options
+{
+    int filesPerDir = 10;
+    int dirsPerDir = 8;
+    int depth = 3;
+    qint64 hugeFileSize = 64 * 1024 * 1024;
+    FakeNetworkConditions network;
+    SyncOptions syncOptions;
+};
+
+struct Scenario
+{
+    QString name;
+    QString description;
+    // Brings the folder into the state right before the measured sync
+    std::function<void(FakeFolder &, const Options &)> prepare;
+};
+
+static int addTree(FileModifier &fi, const QString &path, const Options &options, qint64 fileSize, int depth = 0)
+{
+    int count = 0;
+    for (int fileNum = 1; fileNum <= options.filesPerDir; ++fileNum) {
+        QString name = QStringLiteral("file") + QString::number(fileNum);
+        fi.insert(path.isEmpty() ? name : path + "/" + name, fileSize);
+        ++count;
+    }
+    if (depth >= options.depth)
+        return count;
+    for (int dirNum = 1; dirNum <= options.dirsPerDir; ++dirNum) {
+        QString name = QStringLiteral("dir") + QString::number(dirNum);
+        QString subPath = path.isEmpty() ? name : path + "/" + name;
+        fi.mkdir(subPath);
+        count += addTree(fi, subPath, options, fileSize, depth + 1);
+    }
+    return count;
+}
+
+static QList<Scenario> scenarios()
+{
+    return {
+        { "cold-sync", "Download a whole remote tree into an empty folder",
+            [](FakeFolder &folder, const Options &options) {
+                addTree(folder.remoteModifier(), QString(), options, 64);
+            } },
+        { "noop-resync", "Sync an already synced tree without any changes",
+            [](FakeFolder &folder, const Options &options) {
+                addTree(folder.remoteModifier(), QString(), options, 64);
+                folder.syncOnce();
+            } },
+        { "many-small-files", "Upload a tree of one byte files",
+            [](FakeFolder &folder, const Options &options) {
+                addTree(folder.localModifier(), QString(), options, 1);
+            } },
+        { "few-huge-files", "Download two and upload two huge files",
+            [](FakeFolder &folder, const Options &options) {
+                folder.remoteModifier().insert("remote1", options.hugeFileSize);
+                folder.remoteModifier().insert("remote2", options.hugeFileSize);
+                folder.localModifier().insert("local1", options.hugeFileSize);
+                folder.localModifier().insert("local2", options.hugeFileSize);
+            } },
+        { "deep-renames", "Rename a top level directory remotely and a deeply nested one locally",
+            [](FakeFolder &folder, const Options &options) {
+                addTree(folder.remoteModifier(), QString(), options, 64);
+                folder.syncOnce();
+                folder.remoteModifier().rename("dir1", "renamed1");
+                QString nested = QStringLiteral("dir2");
+                for (int i = 1; i < options.depth; ++i)
+                    nested += QStringLiteral("/dir2");
+                folder.localModifier().rename(nested, nested + "_renamed");
+            } },
+        { "mixed-transfers", "Download and upload a few huge files next to a tree of small downloads",
+            [](FakeFolder &folder, const Options &options) {
+                // Sorts before the small files, as it would in tree order
+                folder.remoteModifier().mkdir("a-huge");
+                folder.remoteModifier().insert("a-huge/huge1", options.hugeFileSize);
+                folder.remoteModifier().insert("a-huge/huge2", options.hugeFileSize);
+                folder.localModifier().insert("a-local-huge", options.hugeFileSize);
+                folder.remoteModifier().mkdir("small");
+                addTree(folder.remoteModifier(), "small", options, 4 * 1024);
+            } },
+    };
+}
+
+// Peak resident set size of the whole process so far, in KiB. Run a single
+// scenario per process to attribute it to that scenario.
+static qint64 peakRssKiB()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#ifdef Q_OS_MAC
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+static QJsonObject runScenario(const Scenario &scenario, const Options &options)
+{
+    FakeFolder fakeFolder{ FileInfo() };
+    scenario.prepare(fakeFolder, options);
+
+    fakeFolder.requestCounts().clear();
+    fakeFolder.setNetworkConditions(options.network);
+    fakeFolder.syncEngine().setSyncOptions(options.syncOptions);
+    QElapsedTimer timer;
+    QVector<qint64> fileCompletionMs;
+    QObject::connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted,
+        [&](const SyncFileItemPtr &item) {
+            if (!item->isDirectory())
+                fileCompletionMs.append(timer.elapsed());
+        });
+    // When the first directory listing arrived, the fake replies come in one piece
+    qint64 firstListingMs = -1;
+    QObject::connect(fakeFolder.syncEngine().account()->networkAccessManager(), &QNetworkAccessManager::finished,
+        [&](QNetworkReply *reply) {
+            if (firstListingMs < 0
+                && reply->request().attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND"
+                && reply->request().rawHeader("Depth") == "1")
+                firstListingMs = timer.elapsed();
+        });
+    timer.start();
+    bool success = fakeFolder.syncOnce();
+    qint64 totalMs = timer.elapsed();
+    fakeFolder.setNetworkConditions(FakeNetworkConditions());
+
+    // The engine's laps are relative to the start of the sync
+    const auto &stopWatch = fakeFolder.syncEngine().stopWatch();
+    qint64 discovery = stopWatch.durationOfLap(QStringLiteral("Discovery Finished"));
+    qint64 reconcile = stopWatch.durationOfLap(QStringLiteral("Reconcile Finished"));
+    qint64 postReconcile = stopWatch.durationOfLap(QStringLiteral("Post-Reconcile Finished"));
+    qint64 finished = stopWatch.durationOfLap(QStringLiteral("Sync Finished"));
+    QJsonObject phases{
+        { "discovery", discovery },
+        { "reconcile", reconcile - discovery },
+        { "postReconcile", postReconcile - reconcile },
+        { "propagation", finished - postReconcile },
+    };
+
+    // How long until most of the files are there, which is what users notice
+    std::sort(fileCompletionMs.begin(), fileCompletionMs.end());
+    qint64 timeTo90Percent = -1;
+    if (!fileCompletionMs.isEmpty())
+        timeTo90Percent = fileCompletionMs.at((fileCompletionMs.size() * 9 + 9) / 10 - 1);
+
+    QJsonObject requests;
+    for (auto it = fakeFolder.requestCounts().constBegin(); it != fakeFolder.requestCounts().constEnd(); ++it)
+        requests.insert(it.key(), it.value());
+
+    return QJsonObject{
+        { "success", success },
+        { "totalMs", totalMs },
+        { "firstListingMs", firstListingMs },
+        { "phasesMs", phases },
+        { "filesCompleted", fileCompletionMs.size() },
+        { "timeTo90PercentFilesMs", timeTo90Percent },
+        { "requests", requests },
+        { "peakRssKiB", peakRssKiB() },
+    };
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Runs sync scenarios against a fake server and reports timings as JSON.");
+    parser.addHelpOption();
+    QCommandLineOption listOption("list", "List the available scenarios.");
+    QCommandLineOption scenarioOption("scenario", "Run only this scenario, can be repeated.", "name");
+    QCommandLineOption repeatOption("repeat", "Number of runs of each scenario.", "count", "1");
+    QCommandLineOption latencyOption("latency", "Delay added to each request.", "ms", "0");
+    QCommandLineOption bandwidthOption("bandwidth", "Transfer rate of each request, 0 for unlimited.", "KiB/s", "0");
+    QCommandLineOption handshakeOption("handshake-rtts", "Round trips to open a connection, 0 to not model connections.", "count", "0");
+    QCommandLineOption warmUpOption("warm-up-connections", "Connections opened when the sync starts.", "count",
+        QString::number(SyncOptions()._warmUpConnections));
+    QCommandLineOption pipelineOption("pipeline-depth", "Directory listings requested ahead of the discovery.", "count",
+        QString::number(SyncOptions()._discoveryPipelineDepth));
+    QCommandLineOption depthOption("depth", "Depth of the generated directory trees.", "levels", "3");
+    QCommandLineOption hugeSizeOption("huge-size", "Size of the files in few-huge-files.", "MiB", "64");
+    QCommandLineOption outputOption("output", "Where to write the JSON report, - for stdout.", "file", "-");
+    QCommandLineOption logOption("log", "Where to write the sync log, discarded by default.", "file", QProcess::nullDevice());
+    parser.addOptions({ listOption, scenarioOption, repeatOption, latencyOption, bandwidthOption,
+        handshakeOption, warmUpOption, pipelineOption, depthOption, hugeSizeOption, outputOption, logOption });
+    parser.process(app);
+
+    if (parser.isSet(listOption)) {
+        for (const auto &scenario : scenarios())
+            printf("%-20s %s\n", qPrintable(scenario.name), qPrintable(scenario.description));
+        return 0;
+    }
+
+    Options options;
+    options.depth = parser.value(depthOption).toInt();
+    options.hugeFileSize = parser.value(hugeSizeOption).toLongLong() * 1024 * 1024;
+    options.network.latencyMs = parser.value(latencyOption).toInt();
+    options.network.bytesPerSecond = parser.value(bandwidthOption).toLongLong() * 1024;
+    options.network.handshakeRoundTrips = parser.value(handshakeOption).toInt();
+    options.syncOptions._warmUpConnections = parser.value(warmUpOption).toInt();
+    options.syncOptions._discoveryPipelineDepth = parser.value(pipelineOption).toInt();
+    const int repeat = qMax(1, parser.value(repeatOption).toInt());
+    const QStringList selected = parser.values(scenarioOption);
+
+    // Set up before the first FakeFolder, which would log to stdout otherwise
+    Logger::instance()->setLogFile(parser.value(logOption));
+
+    bool allSucceeded = true;
+    QJsonArray results;
+    for (const auto &scenario : scenarios()) {
+        if (!selected.isEmpty() && !selected.contains(scenario.name))
+            continue;
+        QJsonArray runs;
+        for (int i = 0; i < repeat; ++i) {
+            auto run = runScenario(scenario, options);
+            allSucceeded &= run.value("success").toBool();
+            runs.append(run);
+        }
+        results.append(QJsonObject{ { "name", scenario.name }, { "runs", runs } });
+    }
+
+    QJsonObject report{
+        { "latencyMs", options.network.latencyMs },
+        { "bytesPerSecond", options.network.bytesPerSecond },
+        { "handshakeRoundTrips", options.network.handshakeRoundTrips },
+        { "warmUpConnections", options.syncOptions._warmUpConnections },
+        { "discoveryPipelineDepth", options.syncOptions._discoveryPipelineDepth },
+        { "filesPerDir", options.filesPerDir },
+        { "dirsPerDir", options.dirsPerDir },
+        { "depth", options.depth },
+        { "scenarios", results },
+    };
+    QFile output;
+    const QString outputPath = parser.value(outputOption);
+    bool opened = false;
+    if (outputPath == QLatin1String("-")) {
+        opened = output.open(stdout, QIODevice::WriteOnly);
+    } else {
+        output.setFileName(outputPath);
+        opened = output.open(QIODevice::WriteOnly);
+    }
+    if (!opened) {
+        qCritical() << "Could not open" << outputPath << output.errorString();
+        return -1;
+    }
+    output.write(QJsonDocument(report).toJson());
+    return allSucceeded ? 0 : -1;
+}
@@ -23,6 +23,12 @@
 #include <string.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <QElapsedTimer>
 
 #include "csync_private.h"
 #include "std/c_utf8.h"
@@ -453,6 +459,84 @@ static void check_readdir_bigunicode(void **state)
     assert_int_equal(files_cnt, 0);
 }
 
+/*
+ * Counts the entries below dir, stat'ing every one of them through the vio.
+ */
+static void count_entries(CSYNC *csync, const QByteArray &dir, qint64 *cnt)
+{
+    csync_vio_handle_t *dh = csync_vio_opendir(csync, dir.constData());
+    assert_non_null(dh);
+
+    std::unique_ptr<csync_file_stat_t> dirent;
+    while ((dirent = csync_vio_readdir(csync, dh))) {
+        ++*cnt;
+        if (dirent->type == ItemTypeDirectory) {
+            count_entries(csync, dir + '/' + dirent->path, cnt);
+        }
+    }
+    assert_int_equal(csync_vio_closedir(csync, dh), 0);
+}
+
+/*
+ * Benchmark of the local discovery on a large tree, serial and with the
+ * directories read ahead by the LocalDirectoryPrefetcher.
+ *
+ * Only runs when CSYNC_VIO_BENCH_ENTRIES is set, e.g. to 1000000, since
+ * creating the tree takes a while.
+ */
+static void check_readdir_benchmark(void **state)
+{
+    statevar *sv = (statevar*) *state;
+    const qint64 entries = qEnvironmentVariableIntValue("CSYNC_VIO_BENCH_ENTRIES");
+    if (entries <= 0) {
+        skip();
+    }
+
+#ifndef _WIN32
+    const qint64 perDir = 1000;
+    assert_int_equal(mkdir(CSYNC_TEST_DIR "/bench", MKDIR_MASK), 0);
+    for (qint64 i = 0; i < entries; ++i) {
+        QByteArray dir = QByteArray(CSYNC_TEST_DIR "/bench/d") + QByteArray::number(i / perDir);
+        if (i % perDir == 0) {
+            assert_int_equal(mkdir(dir.constData(), MKDIR_MASK), 0);
+        }
+        QByteArray file = dir + "/file" + QByteArray::number(i);
+        int fd = open(file.constData(), O_CREAT | O_WRONLY, 0644);
+        assert_true(fd >= 0);
+        close(fd);
+    }
+
+    const int threads = qMax(2, LocalDirectoryPrefetcher::defaultThreadCount());
+    auto run = [&](bool prefetching) {
+        if (prefetching) {
+            sv->csync->local.prefetcher.reset(new LocalDirectoryPrefetcher(threads, nullptr));
+        }
+        qint64 cnt = 0;
+        QElapsedTimer timer;
+        timer.start();
+        count_entries(sv->csync, CSYNC_TEST_DIR "/bench", &cnt);
+        const qint64 elapsed = timer.elapsed();
+        sv->csync->local.prefetcher.reset();
+
+        printf("Local discovery (%s) of %lld entries took %lld ms (%.2f us per entry)\n",
+            prefetching ? "prefetching" : "serial", (long long)cnt, (long long)elapsed,
+            cnt ? elapsed * 1000. / cnt : 0.);
+        assert_true(cnt >= entries);
+    };
+
+    // The first walk fills the caches, so it is not measured. The modes
+    // then take turns going first, neither one always reads the tree right
+    // after the other did.
+    qint64 warmup = 0;
+    count_entries(sv->csync, CSYNC_TEST_DIR "/bench", &warmup);
+    for (int round = 0; round < 4; ++round) {
+        const bool prefetchFirst = round % 2;
+        run(prefetchFirst);
+        run(!prefetchFirst);
+    }
+#endif
+}
+
 int torture_run_tests(void)
 {
     const struct CMUnitTest tests[] = {
@@ -460,6 +544,7 @@ int torture_run_tests(void)
         cmocka_unit_test_setup_teardown(check_readdir_with_content, setup_testenv, teardown),
         cmocka_unit_test_setup_teardown(check_readdir_longtree, setup_testenv, teardown),
         cmocka_unit_test_setup_teardown(check_readdir_bigunicode, setup_testenv, teardown),
+        cmocka_unit_test_setup_teardown(check_readdir_benchmark, setup_testenv, teardown),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -12,6 +12,7 @@
 #include "filesystem.h"
 #include "syncengine.h"
 #include "common/syncjournaldb.h"
+#include "deltasync.h"
 
 #include <QDir>
 #include <QNetworkReply>
@@ -27,6 +28,7 @@
 static const QUrl sRootUrl("owncloud://somehost/owncloud/remote.php/webdav/");
 static const QUrl sRootUrl2("owncloud://somehost/owncloud/remote.php/dav/files/admin/");
 static const QUrl sUploadUrl("owncloud://somehost/owncloud/remote.php/dav/uploads/admin/");
+static const QUrl sSignaturesUrl("owncloud://somehost/owncloud/remote.php/dav/signatures/admin/");
 
 inline QString getFilePathFromUrl(const QUrl &url) {
     QString path = url.path();
@@ -36,6 +38,8 @@ inline QString getFilePathFromUrl(const QUrl &url) {
         return path.mid(sRootUrl2.path().length());
     if (path.startsWith(sUploadUrl.path()))
         return path.mid(sUploadUrl.path().length());
+    if (path.startsWith(sSignaturesUrl.path()))
+        return path.mid(sSignaturesUrl.path().length());
     return {};
 }
 
@@ -540,7 +544,7 @@ public:
         QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
     }
 
-    Q_INVOKABLE void respond() {
+    Q_INVOKABLE virtual void respond() {
         setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 201);
         emit metaDataChanged();
         emit finished();
@@ -555,8 +559,8 @@ class FakeGetReply : public QNetworkReply
     Q_OBJECT
 public:
     const FileInfo *fileInfo;
-    char payload;
-    int size;
+    char payload = 0;
+    int size = 0;
     bool aborted = false;
 
     FakeGetReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
@@ -572,28 +576,50 @@ public:
         QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
     }
 
-    Q_INVOKABLE void respond() {
-        if (aborted) {
-            setError(OperationCanceledError, "Operation Canceled");
-            emit metaDataChanged();
-            emit finished();
+    Q_INVOKABLE virtual void respond() {
+        if (aborted)
             return;
-        }
         payload = fileInfo->contentChar;
         size = fileInfo->size;
+        int status = 200;
+        QRegularExpression rangeRx("^bytes=(\\d+)-(\\d*)$");
+        auto range = rangeRx.match(QString::fromLatin1(request().rawHeader("Range")));
+        if (range.hasMatch()) {
+            qint64 start = range.captured(1).toLongLong();
+            qint64 end = range.captured(2).isEmpty() ? fileInfo->size - 1 : range.captured(2).toLongLong();
+            end = std::min(end, fileInfo->size - 1);
+            if (start <= end) {
+                status = 206;
+                size = end - start + 1;
+                setRawHeader("Content-Range", "bytes " + QByteArray::number(start) + "-" + QByteArray::number(end)
+                        + "/" + QByteArray::number(fileInfo->size));
+            }
+        }
         setHeader(QNetworkRequest::ContentLengthHeader, size);
-        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, status);
         setRawHeader("OC-ETag", fileInfo->etag.toLatin1());
         setRawHeader("ETag", fileInfo->etag.toLatin1());
         setRawHeader("OC-FileId", fileInfo->fileId);
         emit metaDataChanged();
+        // The receiver may abort from any of these signals
+        if (aborted)
+            return;
         if (bytesAvailable())
             emit readyRead();
+        if (aborted)
+            return;
+        setFinished(true);
         emit finished();
     }
 
+    // Like QNetworkReply, an abort finishes the reply right away
     void abort() override {
+        if (aborted || isFinished())
+            return;
         aborted = true;
+        setError(OperationCanceledError, "Operation Canceled");
+        setFinished(true);
+        emit finished();
     }
     qint64 bytesAvailable() const override {
         if (aborted)
@@ -693,6 +719,23 @@ public:
         emit finished();
     }
 
+    // Like the server, the upload must exist and its chunks must add up to the
+    // OC-Total-Length. Returns the HTTP error code, or 0.
+    static int checkChunks(FileInfo &uploadsFileInfo, const QNetworkRequest &request)
+    {
+        QString source = getFilePathFromUrl(request.url());
+        source = source.left(source.length() - qstrlen("/.file"));
+        auto sourceFolder = uploadsFileInfo.find(source);
+        if (!sourceFolder)
+            return 404;
+        if (!request.hasRawHeader("OC-Total-Length"))
+            return 0;
+        qint64 size = 0;
+        for (const auto &chunk : sourceFolder->children)
+            size += chunk.size;
+        return size == request.rawHeader("OC-Total-Length").toLongLong() ? 0 : 400;
+    }
+
     Q_INVOKABLE void respondPreconditionFailed() {
         setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 412);
         setError(InternalServerError, "Precondition Failed");
@@ -710,6 +753,55 @@ public:
 };
 
 
+// Serves the block signatures of a file, like servers with the blockSignatures capability
+class FakeSignaturesReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    static const int blockSize = 64 * 1024;
+    QByteArray payload;
+
+    FakeSignaturesReply(FileInfo &remoteRootFileInfo, QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
+    : QNetworkReply{parent} {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+
+        FileInfo *fileInfo = remoteRootFileInfo.find(getFilePathFromUrl(request.url()));
+        if (!fileInfo || fileInfo->isDir) {
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 404);
+            setError(ContentNotFoundError, "Not Found");
+        } else {
+            QBuffer content;
+            content.setData(QByteArray(fileInfo->size, fileInfo->contentChar));
+            content.open(QIODevice::ReadOnly);
+            payload = OCC::BlockSignatures::compute(&content, blockSize).serialize();
+            setAttribute(QNetworkRequest::HttpStatusCodeAttribute, 200);
+            setRawHeader("ETag", fileInfo->etag.toLatin1());
+        }
+        setHeader(QNetworkRequest::ContentLengthHeader, payload.size());
+        QMetaObject::invokeMethod(this, "respond", Qt::QueuedConnection);
+    }
+
+    Q_INVOKABLE void respond() {
+        emit metaDataChanged();
+        if (bytesAvailable())
+            emit readyRead();
+        setFinished(true);
+        emit finished();
+    }
+
+    void abort() override { }
+    qint64 bytesAvailable() const override { return payload.size() + QIODevice::bytesAvailable(); }
+    qint64 readData(char *data, qint64 maxlen) override {
+        qint64 len = std::min(qint64{payload.size()}, maxlen);
+        memcpy(data, payload.constData(), len);
+        payload.remove(0, len);
+        return len;
+    }
+};
+
 class FakeErrorReply : public QNetworkReply
 {
     Q_OBJECT
@@ -790,6 +882,109 @@ public:
     }
 };
 
+// Properties of the simulated link between the client and the fake server
+struct FakeNetworkConditions
+{
+    // Added to every request, like a round trip would be
+    int latencyMs = 0;
+    // Transfer rate for the request and reply bodies of each request, 0 for unlimited
+    qint64 bytesPerSecond = 0;
+    // Round trips to open a connection, like the TCP and TLS handshakes.
+    // When set, requests wait for one of at most maxConnections connections.
+    int handshakeRoundTrips = 0;
+    int maxConnections = 6; // like QNetworkAccessManager for one host
+
+    bool isActive() const { return latencyMs > 0 || bytesPerSecond > 0; }
+    int delayMs(qint64 bytes) const
+    {
+        return latencyMs + (bytesPerSecond > 0 ? int(bytes * 1000 / bytesPerSecond) : 0);
+    }
+};
+
+// Holds back the result of another reply for as long as the network conditions require
+class FakeShapedReply : public QNetworkReply
+{
+    Q_OBJECT
+    QNetworkReply *_inner;
+    bool _aborted = false;
+
+public:
+    // connectionWaitMs: time until a connection is available for the request
+    FakeShapedReply(QNetworkReply *inner, qint64 uploadBytes, int connectionWaitMs, const FakeNetworkConditions &conditions, QObject *parent)
+        : QNetworkReply{ parent }
+        , _inner(inner)
+    {
+        setRequest(inner->request());
+        setUrl(inner->url());
+        setOperation(inner->operation());
+        open(QIODevice::ReadOnly);
+        inner->setParent(this);
+
+        connect(inner, &QNetworkReply::finished, this, [this, uploadBytes, connectionWaitMs, conditions] {
+            int delay = connectionWaitMs + conditions.delayMs(uploadBytes + _inner->bytesAvailable());
+            QTimer::singleShot(delay, this, &FakeShapedReply::respond);
+        });
+    }
+
+    void respond()
+    {
+        for (const auto &header : _inner->rawHeaderPairs())
+            setRawHeader(header.first, header.second);
+        setAttribute(QNetworkRequest::HttpStatusCodeAttribute, _inner->attribute(QNetworkRequest::HttpStatusCodeAttribute));
+        if (_aborted)
+            setError(OperationCanceledError, "Operation Canceled");
+        else if (_inner->error() != NoError)
+            setError(_inner->error(), _inner->errorString());
+        setFinished(true);
+        emit metaDataChanged();
+        if (bytesAvailable())
+            emit readyRead();
+        emit finished();
+    }
+
+    void abort() override
+    {
+        _aborted = true;
+        _inner->abort();
+    }
+
+    qint64 bytesAvailable() const override
+    {
+        if (!isFinished() || _aborted)
+            return 0;
+        return _inner->bytesAvailable() + QIODevice::bytesAvailable();
+    }
+
+    qint64 readData(char *data, qint64 maxlen) override { return _inner->read(data, maxlen); }
+};
+
+// Reply to QNetworkAccessManager::connectToHost(), finishes once the connection is open
+class FakePreconnectReply : public QNetworkReply
+{
+    Q_OBJECT
+public:
+    FakePreconnectReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request, int delayMs, QObject *parent)
+        : QNetworkReply{ parent }
+    {
+        setRequest(request);
+        setUrl(request.url());
+        setOperation(op);
+        open(QIODevice::ReadOnly);
+        QTimer::singleShot(delayMs, this, &FakePreconnectReply::respond);
+    }
+
+    void respond()
+    {
+        setFinished(true);
+        emit finished();
+        // Nobody holds on to it
+        deleteLater();
+    }
+
+    void abort() override { }
+    qint64 readData(char *, qint64) override { return 0; }
+};
+
 class FakeQNAM : public QNetworkAccessManager
 {
 public:
@@ -802,9 +997,15 @@ private:
     QHash<QString, int> _errorPaths;
     // monitor requests and optionally provide custom replies
     Override _override;
+    FakeNetworkConditions _networkConditions;
+    // number of requests per verb
+    QMap<QString, int> _requestCounts;
+    // when each open connection is done with its last request, on _clock
+    QVector<qint64> _connectionsFreeAt;
+    QElapsedTimer _clock;
 
 public:
-    FakeQNAM(FileInfo initialRoot) : _remoteRootFileInfo{std::move(initialRoot)} { }
+    FakeQNAM(FileInfo initialRoot) : _remoteRootFileInfo{std::move(initialRoot)} { _clock.start(); }
     FileInfo &currentRemoteState() { return _remoteRootFileInfo; }
     FileInfo &uploadState() { return _uploadFileInfo; }
 
@@ -812,9 +1013,80 @@ public:
 
     void setOverride(const Override &override) { _override = override; }
 
+    void setNetworkConditions(const FakeNetworkConditions &conditions)
+    {
+        // A new link, nothing is connected yet
+        _networkConditions = conditions;
+        _connectionsFreeAt.clear();
+    }
+    QMap<QString, int> &requestCounts() { return _requestCounts; }
+
 protected:
     QNetworkReply *createRequest(Operation op, const QNetworkRequest &request,
                                          QIODevice *outgoingData = 0) {
+        // From connectToHost() and connectToHostEncrypted()
+        if (request.url().scheme().startsWith(QLatin1String("preconnect-"))) {
+            ++_requestCounts[QStringLiteral("PRECONNECT")];
+            return new FakePreconnectReply{ op, request, openConnection(), this };
+        }
+
+        QString verb = request.attribute(QNetworkRequest::CustomVerbAttribute).toString();
+        if (verb.isEmpty()) {
+            switch (op) {
+            case GetOperation: verb = QStringLiteral("GET"); break;
+            case PutOperation: verb = QStringLiteral("PUT"); break;
+            case PostOperation: verb = QStringLiteral("POST"); break;
+            case DeleteOperation: verb = QStringLiteral("DELETE"); break;
+            case HeadOperation: verb = QStringLiteral("HEAD"); break;
+            default: verb = QStringLiteral("UNKNOWN"); break;
+            }
+        }
+        ++_requestCounts[verb];
+
+        qint64 uploadBytes = outgoingData ? outgoingData->size() : 0;
+        QNetworkReply *reply = createFakeReply(op, request, outgoingData);
+        if (!_networkConditions.isActive())
+            return reply;
+        int connectionWaitMs = takeConnection(uploadBytes);
+        return new FakeShapedReply{ reply, uploadBytes, connectionWaitMs, _networkConditions, this };
+    }
+
+    int handshakeMs() const { return _networkConditions.handshakeRoundTrips * _networkConditions.latencyMs; }
+
+    // Opens a connection if there is room for one, returns when it is ready
+    int openConnection()
+    {
+        if (handshakeMs() <= 0 || _connectionsFreeAt.size() >= _networkConditions.maxConnections)
+            return 0;
+        _connectionsFreeAt.append(_clock.elapsed() + handshakeMs());
+        return handshakeMs();
+    }
+
+    // Picks the connection that can send the request first, opening a new
+    // one when that is faster, returns how long the request has to wait
+    int takeConnection(qint64 uploadBytes)
+    {
+        if (handshakeMs() <= 0)
+            return 0;
+        const qint64 now = _clock.elapsed();
+        int best = -1;
+        for (int i = 0; i < _connectionsFreeAt.size(); ++i) {
+            if (best < 0 || _connectionsFreeAt[i] < _connectionsFreeAt[best])
+                best = i;
+        }
+        qint64 start = best >= 0 ? qMax(now, _connectionsFreeAt[best]) : 0;
+        if (_connectionsFreeAt.size() < _networkConditions.maxConnections
+            && (best < 0 || now + handshakeMs() < start)) {
+            _connectionsFreeAt.append(0);
+            best = _connectionsFreeAt.size() - 1;
+            start = now + handshakeMs();
+        }
+        _connectionsFreeAt[best] = start + _networkConditions.delayMs(uploadBytes);
+        return int(start - now);
+    }
+
+    QNetworkReply *createFakeReply(Operation op, const QNetworkRequest &request, QIODevice *outgoingData)
+    {
         if (_override) {
             if (auto reply = _override(op, request, outgoingData))
                 return reply;
@@ -828,21 +1100,30 @@ protected:
         FileInfo &info = isUpload ? _uploadFileInfo : _remoteRootFileInfo;
 
         auto verb = request.attribute(QNetworkRequest::CustomVerbAttribute);
+        if (request.url().path().startsWith(sSignaturesUrl.path()))
+            return new FakeSignaturesReply{_remoteRootFileInfo, op, request, this};
         if (verb == "PROPFIND")
             // Ignore outgoingData always returning somethign good enough, works for now.
             return new FakePropfindReply{info, op, request, this};
         else if (verb == QLatin1String("GET") || op == QNetworkAccessManager::GetOperation)
             return new FakeGetReply{info, op, request, this};
-        else if (verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation)
+        else if (verb == QLatin1String("PUT") || op == QNetworkAccessManager::PutOperation) {
+            // Like the server, refuse chunks for an upload that doesn't exist
+            if (isUpload && !info.find(PathComponents(fileName).parentDirComponents()))
+                return new FakeErrorReply{op, request, this, 409};
             return new FakePutReply{info, op, request, outgoingData->readAll(), this};
+        }
         else if (verb == QLatin1String("MKCOL"))
             return new FakeMkcolReply{info, op, request, this};
         else if (verb == QLatin1String("DELETE") || op == QNetworkAccessManager::DeleteOperation)
             return new FakeDeleteReply{info, op, request, this};
         else if (verb == QLatin1String("MOVE") && !isUpload)
             return new FakeMoveReply{info, op, request, this};
-        else if (verb == QLatin1String("MOVE") && isUpload)
+        else if (verb == QLatin1String("MOVE") && isUpload) {
+            if (int error = FakeChunkMoveReply::checkChunks(info, request))
+                return new FakeErrorReply{op, request, this, error};
             return new FakeChunkMoveReply{ info, _remoteRootFileInfo, op, request, this };
+        }
         else {
             qDebug() << verb << outgoingData;
             Q_UNREACHABLE();
@@ -883,7 +1164,8 @@ public:
     {
         // Needs to be done once
         OCC::SyncEngine::minimumFileAgeForUpload = 0;
-        OCC::Logger::instance()->setLogFile("-");
+        if (!OCC::Logger::instance()->isLoggingToFile())
+            OCC::Logger::instance()->setLogFile("-");
 
         QDir rootDir{_tempDir.path()};
         qDebug() << "FakeFolder operating on" << rootDir;
@@ -928,6 +1210,8 @@ public:
     };
     ErrorList serverErrorPaths() { return {_fakeQnam}; }
     void setServerOverride(const FakeQNAM::Override &override) { _fakeQnam->setOverride(override); }
+    void setNetworkConditions(const FakeNetworkConditions &conditions) { _fakeQnam->setNetworkConditions(conditions); }
+    QMap<QString, int> &requestCounts() { return _fakeQnam->requestCounts(); }
 
     QString localPath() const {
         // SyncEngine wants a trailing slash
@@ -0,0 +1,218 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "bandwidthmanager.h"
+
+using namespace OCC;
+
+// Limits without a propagator
+class FakeBandwidthManager : public BandwidthManager
+{
+public:
+    FakeBandwidthManager()
+        : BandwidthManager(nullptr)
+    {
+    }
+    qint64 uploadLimit() const override { return _uploadLimit; }
+    qint64 downloadLimit() const override { return _downloadLimit; }
+
+    qint64 _uploadLimit = 0;
+    qint64 _downloadLimit = 0;
+};
+
+// A transfer that can move at most `capability` bytes between two ticks
+class FakeTransfer : public QObject, public BandwidthLimitedTransfer
+{
+public:
+    explicit FakeTransfer(qint64 capability)
+        : _capability(capability)
+    {
+    }
+
+    qint64 bandwidthPosition() override { return _position; }
+    qint64 bandwidthQuota() const override { return _quota; }
+    void setBandwidthLimited(bool limited) override { _limited = limited; }
+    void setChoked(bool) override {}
+    void giveBandwidthQuota(qint64 quota) override { _quota = quota; }
+
+    // Moves what the quota and the speed allow until the next tick
+    qint64 run()
+    {
+        const qint64 bytes = _limited ? qMin(_quota, _capability) : _capability;
+        if (_limited)
+            _quota -= bytes;
+        _position += bytes;
+        return bytes;
+    }
+
+    qint64 _capability;
+    qint64 _position = 0;
+    qint64 _quota = 0;
+    bool _limited = false;
+};
+
+// Ticks the scheduler with the tick lengths from `ticks` and returns the bytes
+// moved after each tick
+static QVector<qint64> runTicks(BandwidthScheduler &scheduler, const std::vector<std::unique_ptr<FakeTransfer>> &transfers, const QVector<int> &ticks)
+{
+    QVector<qint64> moved;
+    for (int msec : ticks) {
+        scheduler.tick(msec);
+        qint64 tickTotal = 0;
+        for (auto &t : transfers)
+            tickTotal += t->run();
+        moved.append(tickTotal);
+    }
+    return moved;
+}
+
+class TestBandwidthManager : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRefill()
+    {
+        TokenBucket bucket;
+        bucket.setRate(1000);
+        QCOMPARE(bucket.capacity(), qint64(250));
+
+        // Fractions of a token are carried over
+        for (int i = 0; i < 3; ++i)
+            bucket.refill(1);
+        QCOMPARE(bucket.tokens(), qint64(3));
+
+        // The burst is bounded
+        bucket.refill(10 * 1000);
+        QCOMPARE(bucket.tokens(), bucket.capacity());
+        bucket.putBack(100);
+        QCOMPARE(bucket.tokens(), bucket.capacity());
+
+        // Lowering the rate drops the excess
+        bucket.setRate(100);
+        QCOMPARE(bucket.tokens(), qint64(25));
+    }
+
+    void testDistributeIsMaxMinFair()
+    {
+        TokenBucket bucket;
+        bucket.setRate(4000);
+        bucket.refill(250);
+        QCOMPARE(bucket.tokens(), qint64(1000));
+
+        // The small demand is served fully, the rest is split evenly
+        auto grants = bucket.distribute({ 600, 100, 600 });
+        QCOMPARE(grants, (QVector<qint64>{ 450, 100, 450 }));
+        QCOMPARE(bucket.tokens(), qint64(0));
+
+        // Nobody gets more than asked for
+        bucket.refill(250);
+        grants = bucket.distribute({ 10, 20 });
+        QCOMPARE(grants, (QVector<qint64>{ 10, 20 }));
+        QCOMPARE(bucket.tokens(), qint64(970));
+    }
+
+    void testRateAccuracyAndJitter_data()
+    {
+        QTest::addColumn<qint64>("rate");
+        QTest::addColumn<bool>("irregularTicks");
+
+        QTest::newRow("100 kB/s") << qint64(100 * 1000) << false;
+        QTest::newRow("100 kB/s, late timers") << qint64(100 * 1000) << true;
+        QTest::newRow("3 kB/s") << qint64(3 * 1000) << false;
+        QTest::newRow("10 MB/s, late timers") << qint64(10 * 1000 * 1000) << true;
+    }
+
+    void testRateAccuracyAndJitter()
+    {
+        QFETCH(qint64, rate);
+        QFETCH(bool, irregularTicks);
+
+        FakeBandwidthManager manager;
+        manager._downloadLimit = rate;
+        BandwidthScheduler scheduler(false);
+
+        // Two transfers that could go much faster and a slow one
+        const qint64 slow = rate / 100 + 1;
+        std::vector<std::unique_ptr<FakeTransfer>> transfers;
+        for (qint64 capability : { rate, rate, slow }) {
+            transfers.emplace_back(new FakeTransfer(capability));
+            scheduler.registerDownload(transfers.back().get(), transfers.back().get(), &manager);
+        }
+
+        const int seconds = 20;
+        QVector<int> ticks;
+        int elapsed = 0;
+        while (elapsed < seconds * 1000) {
+            int msec = BandwidthScheduler::tickMsec;
+            if (irregularTicks)
+                msec += (ticks.size() * 7) % 23; // timers firing up to 22ms late
+            ticks.append(msec);
+            elapsed += msec;
+        }
+        const auto moved = runTicks(scheduler, transfers, ticks);
+
+        // Rate accuracy over the whole time
+        qint64 total = 0;
+        for (auto bytes : moved)
+            total += bytes;
+        const double actualRate = total * 1000.0 / elapsed;
+        QVERIFY2(qAbs(actualRate - rate) <= rate * 0.02,
+            qPrintable(QString("rate %1 instead of %2").arg(actualRate).arg(rate)));
+
+        // Jitter: the bytes per tick stay close to what the tick length allows,
+        // the first ticks are still ramping up
+        double sumSquares = 0;
+        int count = 0;
+        for (int i = 10; i < moved.size(); ++i) {
+            const double expected = rate * ticks[i] / 1000.0;
+            sumSquares += std::pow((moved[i] - expected) / expected, 2);
+            ++count;
+        }
+        const double jitter = std::sqrt(sumSquares / count);
+        QVERIFY2(jitter < 0.05, qPrintable(QString("jitter %1").arg(jitter)));
+
+        // Fairness: the slow transfer is served, the fast ones share the rest evenly
+        QVERIFY(transfers[2]->_position >= slow * (moved.size() - 10));
+        const double ratio = double(transfers[0]->_position) / transfers[1]->_position;
+        QVERIFY2(qAbs(ratio - 1) < 0.05, qPrintable(QString("ratio %1").arg(ratio)));
+    }
+
+    void testRelativeLimit()
+    {
+        FakeBandwidthManager manager;
+        manager._uploadLimit = -50;
+        BandwidthScheduler scheduler(false);
+
+        // 20 kB/s at full speed
+        std::vector<std::unique_ptr<FakeTransfer>> transfers;
+        transfers.emplace_back(new FakeTransfer(1000));
+        scheduler.registerUpload(transfers.back().get(), transfers.back().get(), &manager);
+
+        // The probes run at full speed, the rest of each cycle makes up for it
+        const int cycles = 3;
+        const QVector<int> ticks(cycles * BandwidthScheduler::cycleMsec / BandwidthScheduler::tickMsec, BandwidthScheduler::tickMsec);
+        const auto moved = runTicks(scheduler, transfers, ticks);
+        QCOMPARE(moved.first(), qint64(1000));
+
+        const double actualRate = transfers[0]->_position * 1000.0 / (cycles * BandwidthScheduler::cycleMsec);
+        QVERIFY2(qAbs(actualRate - 10000) <= 10000 * 0.02,
+            qPrintable(QString("rate %1 instead of 10000").arg(actualRate)));
+
+        // Destroyed transfers are unregistered
+        transfers.clear();
+        scheduler.tick(BandwidthScheduler::tickMsec);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestBandwidthManager)
+#include "testbandwidthmanager.moc"
@@ -36,10 +36,25 @@ static void partialUpload(FakeFolder &fakeFolder, const QString &name, int size)
 
     QCOMPARE(fakeFolder.uploadState().children.count(), 1); // the transfer was done with chunking
     auto upStateChildren = fakeFolder.uploadState().children.first().children;
-    QCOMPARE(sizeWhenAbort, std::accumulate(upStateChildren.cbegin(), upStateChildren.cend(), 0,
+    // The chunks that were still being uploaded in parallel may have reached the server too
+    QVERIFY(sizeWhenAbort <= std::accumulate(upStateChildren.cbegin(), upStateChildren.cend(), 0,
                                             [](int s, const FileInfo &i) { return s + i.size; }));
 }
 
+static void setFixedChunkSize(FakeFolder &fakeFolder, quint64 chunkSize, int parallelChunks)
+{
+    SyncOptions options;
+    options._initialChunkSize = chunkSize;
+    options._targetChunkUploadDuration = std::chrono::milliseconds(0); // no dynamic chunk sizing
+    options._parallelChunkUploads = parallelChunks;
+    fakeFolder.syncEngine().setSyncOptions(options);
+}
+
+static bool isChunkUpload(QNetworkAccessManager::Operation op, const QNetworkRequest &request)
+{
+    return op == QNetworkAccessManager::PutOperation && request.url().path().contains("/uploads/");
+}
+
 
 class TestChunkingNG : public QObject
 {
@@ -76,18 +91,26 @@ private slots:
         quint64 uploadedSize = std::accumulate(chunkMap.begin(), chunkMap.end(), 0LL, [](quint64 s, const FileInfo &f) { return s + f.size; });
         QVERIFY(uploadedSize > 50 * 1000 * 1000); // at least 50 MB
 
+        // The chunks that were running when aborting are not known to be on the server
+        const quint64 confirmedSize = fakeFolder.syncJournal().getUploadInfo("A/a0")._confirmedBytes;
+        QVERIFY(confirmedSize > 0);
+        QVERIFY(confirmedSize <= uploadedSize);
+
         // Add a fake file to make sure it gets deleted
         fakeFolder.uploadState().children.first().insert("10000", size);
 
+        bool sentPastData = false;
         fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
             if (op == QNetworkAccessManager::PutOperation) {
                 // Test that we properly resuming and are not sending past data again.
-                Q_ASSERT(request.rawHeader("OC-Chunk-Offset").toULongLong() >= uploadedSize);
+                if (request.rawHeader("OC-Chunk-Offset").toULongLong() < confirmedSize)
+                    sentPastData = true;
             }
             return nullptr;
         });
 
         QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!sentPastData);
 
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
         QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
@@ -362,6 +385,143 @@ private slots:
         QVERIFY(fakeFolder.uploadState().children.first().name != chunkingId);
     }
 
+    // The chunks of a file are uploaded in parallel and may finish in any order
+    void testParallelChunks() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
+        const int chunkSize = 10 * 1000 * 1000;
+        setFixedChunkSize(fakeFolder, chunkSize, 3);
+        const int size = 10 * chunkSize;
+
+        int running = 0;
+        int maxRunning = 0;
+        QVector<int> finishOrder;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *outgoingData) -> QNetworkReply * {
+            if (!isChunkUpload(op, request))
+                return nullptr;
+            const int chunk = request.url().fileName().toInt();
+            // Every third chunk has a higher latency, the next ones overtake it
+            auto reply = new DelayedReply<FakePutReply>(chunk % 3 == 0 ? 100 : 20, fakeFolder.uploadState(), op, request, outgoingData->readAll(), &fakeFolder.syncEngine());
+            maxRunning = qMax(maxRunning, ++running);
+            QObject::connect(reply, &QNetworkReply::finished, [&running, &finishOrder, chunk] {
+                --running;
+                finishOrder.append(chunk);
+            });
+            return reply;
+        });
+
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
+
+        QCOMPARE(maxRunning, 3);
+        QCOMPARE(finishOrder.size(), 10);
+        QVERIFY(!std::is_sorted(finishOrder.begin(), finishOrder.end()));
+    }
+
+    // A chunk fails while the later ones reach the server, the resume must
+    // continue at the first missing chunk
+    void testResumeWithMissingChunk() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
+        const int chunkSize = 10 * 1000 * 1000;
+        setFixedChunkSize(fakeFolder, chunkSize, 3);
+        const int size = 10 * chunkSize;
+
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *outgoingData) -> QNetworkReply * {
+            if (!isChunkUpload(op, request))
+                return nullptr;
+            if (request.url().fileName() == "00000001")
+                return new FakeErrorReply(op, request, &fakeFolder.syncEngine(), 500);
+            return new FakePutReply(fakeFolder.uploadState(), op, request, outgoingData->readAll(), &fakeFolder.syncEngine());
+        });
+
+        fakeFolder.localModifier().insert("A/a0", size);
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.uploadState().children.count(), 1);
+        auto chunkingId = fakeFolder.uploadState().children.first().name;
+        const auto &chunks = fakeFolder.uploadState().children.first().children;
+        QVERIFY(chunks.contains("00000000"));
+        QVERIFY(!chunks.contains("00000001"));
+        QVERIFY(chunks.contains("00000002"));
+
+        QStringList uploadedChunks;
+        bool sentFirstChunk = false;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (isChunkUpload(op, request)) {
+                if (request.rawHeader("OC-Chunk-Offset").toInt() < chunkSize)
+                    sentFirstChunk = true;
+                uploadedChunks.append(request.url().fileName());
+            }
+            return nullptr;
+        });
+
+        fakeFolder.syncEngine().journal()->wipeErrorBlacklistEntry("A/a0");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!sentFirstChunk);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
+
+        // The chunks after the hole were uploaded again
+        QVERIFY(uploadedChunks.contains("00000001"));
+        QVERIFY(uploadedChunks.contains("00000002"));
+        QVERIFY(!uploadedChunks.contains("00000000"));
+        QCOMPARE(fakeFolder.uploadState().children.count(), 1);
+        QCOMPARE(fakeFolder.uploadState().children.first().name, chunkingId);
+    }
+
+    // The upload continues with the chunks recorded in the journal, without a PROPFIND
+    void testResumeFromJournal() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ {"chunking", "1.0"} } } });
+        const int chunkSize = 10 * 1000 * 1000;
+        setFixedChunkSize(fakeFolder, chunkSize, 3);
+        const int size = 30 * chunkSize;
+        partialUpload(fakeFolder, "A/a0", size);
+        auto chunkingId = fakeFolder.uploadState().children.first().name;
+
+        const auto info = fakeFolder.syncJournal().getUploadInfo("A/a0");
+        QVERIFY(info._valid);
+        QVERIFY(info._chunk > 0);
+        QCOMPARE(info._confirmedBytes, quint64(info._chunk) * chunkSize);
+        QVERIFY(info._reservedChunks >= info._chunk);
+
+        int nPropfind = 0;
+        bool sentConfirmedData = false;
+        int running = 0;
+        QVector<int> runningAtStart;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *outgoingData) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) == "PROPFIND" && request.url().path().contains("/uploads/"))
+                ++nPropfind;
+            if (!isChunkUpload(op, request))
+                return nullptr;
+            if (request.rawHeader("OC-Chunk-Offset").toULongLong() < info._confirmedBytes)
+                sentConfirmedData = true;
+            runningAtStart.append(running++);
+            auto reply = new FakePutReply(fakeFolder.uploadState(), op, request, outgoingData->readAll(), &fakeFolder.syncEngine());
+            QObject::connect(reply, &QNetworkReply::finished, [&running] { --running; });
+            return reply;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(fakeFolder.currentRemoteState().find("A/a0")->size, size);
+        QCOMPARE(nPropfind, 0);
+        QVERIFY(!sentConfirmedData);
+        QCOMPARE(fakeFolder.uploadState().children.first().name, chunkingId);
+
+        // A single chunk is sent until the server accepted one, then they run in parallel
+        QVERIFY(runningAtStart.size() > 2);
+        QCOMPARE(runningAtStart[0], 0);
+        QCOMPARE(runningAtStart[1], 0);
+        int maxRunning = 0;
+        for (int r : runningAtStart)
+            maxRunning = qMax(maxRunning, r);
+        QCOMPARE(maxRunning, 2);
+        QVERIFY(!fakeFolder.syncJournal().getUploadInfo("A/a0")._valid);
+    }
+
     // Check what happens when the connection is dropped on the PUT (non-chunking) or MOVE (chunking)
     // for on the issue #5106
     void connectionDroppedBeforeEtagRecieved_data()
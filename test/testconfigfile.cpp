@@ -0,0 +1,63 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QSettings>
+
+#include "configfile.h"
+
+using namespace OCC;
+
+class TestConfigFile : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _dir;
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_dir.isValid());
+        ConfigFile::setConfDir(_dir.path()); // we don't want to pollute the user's config file
+    }
+
+    void testWriteThenRead()
+    {
+        ConfigFile cfg;
+        QCOMPARE(cfg.promptDeleteFiles(), false);
+        cfg.setPromptDeleteFiles(true);
+        QCOMPARE(cfg.promptDeleteFiles(), true);
+        QCOMPARE(ConfigFile().promptDeleteFiles(), true);
+
+        cfg.setRemotePollInterval(std::chrono::seconds(42));
+        QCOMPARE(cfg.remotePollInterval(), std::chrono::milliseconds(42000));
+    }
+
+    void testExternalChange()
+    {
+        ConfigFile cfg;
+        cfg.setMaxLogLines(100);
+        QCOMPARE(cfg.maxLogLines(), 100);
+
+        {
+            QSettings settings(cfg.configFile(), QSettings::IniFormat);
+            settings.setValue("Logging/maxLogLines", 200);
+        }
+        ConfigFile::invalidateCache();
+        QCOMPARE(cfg.maxLogLines(), 200);
+
+        // Changes on disk are picked up by the file watcher
+        {
+            QSettings settings(cfg.configFile(), QSettings::IniFormat);
+            settings.setValue("Logging/maxLogLines", 300);
+        }
+        QTRY_COMPARE(cfg.maxLogLines(), 300);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestConfigFile)
+#include "testconfigfile.moc"
@@ -0,0 +1,152 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QBuffer>
+
+#include "deltasync.h"
+
+using namespace OCC;
+
+static QByteArray randomData(int size, uint seed)
+{
+    qsrand(seed);
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i)
+        data[i] = char(qrand());
+    return data;
+}
+
+// Builds target from seed the way a delta download would, fetching the
+// missing ranges straight out of target.
+static QByteArray rebuild(const QByteArray &seedData, const QByteArray &target, int blockSize, qint64 *fetched)
+{
+    QBuffer targetBuffer;
+    targetBuffer.setData(target);
+    targetBuffer.open(QIODevice::ReadOnly);
+    auto signatures = BlockSignatures::compute(&targetBuffer, blockSize);
+
+    QBuffer seed;
+    seed.setData(seedData);
+    seed.open(QIODevice::ReadOnly);
+    auto plan = DeltaPlan::compute(signatures, &seed);
+
+    *fetched = 0;
+    QBuffer output;
+    output.open(QIODevice::WriteOnly);
+    bool ok = plan.assemble(&seed, [&](qint64 offset, qint64 length) {
+        *fetched += length;
+        return target.mid(offset, length);
+    }, &output);
+    if (!ok)
+        return QByteArray();
+    if (*fetched != plan.bytesToFetch())
+        return QByteArray();
+    return output.data();
+}
+
+class TestDeltaSync : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testRollingChecksum()
+    {
+        auto data = randomData(300, 1);
+        // Rolling over the data must agree with computing each window fresh
+        const int blockSize = 64;
+        quint32 a = 0, b = 0;
+        for (int i = 0; i < blockSize; ++i) {
+            a += uchar(data[i]);
+            b += a;
+        }
+        for (int pos = 0; pos + blockSize < data.size(); ++pos) {
+            QCOMPARE((a & 0xffff) | (b << 16), BlockSignatures::weakChecksum(data.constData() + pos, blockSize));
+            quint32 out = uchar(data[pos]);
+            quint32 in = uchar(data[pos + blockSize]);
+            a += in - out;
+            b += a - blockSize * out;
+        }
+    }
+
+    void testSerialize()
+    {
+        QBuffer buffer;
+        buffer.setData(randomData(10000, 2));
+        buffer.open(QIODevice::ReadOnly);
+        auto signatures = BlockSignatures::compute(&buffer, 1024);
+        QCOMPARE(signatures.blocks.size(), 10);
+        QCOMPARE(signatures.fileSize, qint64(10000));
+
+        auto copy = BlockSignatures::deserialize(signatures.serialize());
+        QVERIFY(copy.isValid());
+        QCOMPARE(copy.blockSize, 1024);
+        QCOMPARE(copy.fileSize, qint64(10000));
+        QCOMPARE(copy.blocks.size(), 10);
+        for (int i = 0; i < copy.blocks.size(); ++i) {
+            QCOMPARE(copy.blocks[i].weak, signatures.blocks[i].weak);
+            QCOMPARE(copy.blocks[i].strong, signatures.blocks[i].strong);
+        }
+
+        QVERIFY(!BlockSignatures::deserialize("garbage").isValid());
+        QVERIFY(!BlockSignatures::deserialize(signatures.serialize().left(100)).isValid());
+    }
+
+    void testEdits_data()
+    {
+        QTest::addColumn<QByteArray>("seed");
+        QTest::addColumn<QByteArray>("target");
+        QTest::addColumn<qint64>("maxFetched");
+
+        const int size = 200 * 1024 + 123;
+        auto base = randomData(size, 3);
+
+        QTest::newRow("unchanged") << base << base << qint64(0);
+
+        auto modified = base;
+        modified[50000] = char(modified[50000] + 1);
+        QTest::newRow("byte modified") << base << modified << qint64(4096);
+
+        auto inserted = base;
+        inserted.insert(70000, randomData(100, 4));
+        QTest::newRow("inserted") << base << inserted << qint64(2 * 4096);
+
+        auto removed = base;
+        removed.remove(90000, 5000);
+        QTest::newRow("removed") << base << removed << qint64(2 * 4096);
+
+        QTest::newRow("appended") << base << base + randomData(10000, 5) << qint64(10000 + 4096);
+        QTest::newRow("prepended") << base << randomData(777, 6) + base << qint64(777 + 2 * 4096);
+        QTest::newRow("truncated") << base << base.left(size / 2) << qint64(4096);
+        QTest::newRow("empty seed") << QByteArray() << base << qint64(size);
+        QTest::newRow("empty target") << base << QByteArray() << qint64(0);
+        QTest::newRow("unrelated") << base << randomData(size, 7) << qint64(size);
+    }
+
+    void testEdits()
+    {
+        QFETCH(QByteArray, seed);
+        QFETCH(QByteArray, target);
+        QFETCH(qint64, maxFetched);
+
+        qint64 fetched = 0;
+        QCOMPARE(rebuild(seed, target, 4096, &fetched), target);
+        QVERIFY(fetched <= maxFetched);
+    }
+
+    void testRepeatedBlocks()
+    {
+        auto block = randomData(1024, 8);
+        QByteArray target = block + block + block + randomData(500, 9);
+        qint64 fetched = 0;
+        QCOMPARE(rebuild(block, target, 1024, &fetched), target);
+        QCOMPARE(fetched, qint64(500));
+    }
+};
+
+QTEST_APPLESS_MAIN(TestDeltaSync)
+#include "testdeltasync.moc"
@@ -50,6 +50,45 @@ SyncFileItemPtr getItem(const QSignalSpy &spy, const QString &path)
     return {};
 }
 
+static int itemCount(const QSignalSpy &spy, const QString &path)
+{
+    int count = 0;
+    for (const QList<QVariant> &args : spy) {
+        if (args[0].value<SyncFileItemPtr>()->destination() == path)
+            ++count;
+    }
+    return count;
+}
+
+
+static void setRangedDownload(FakeFolder &fakeFolder, qint64 minSize, int parallelRanges)
+{
+    SyncOptions options;
+    options._minRangedDownloadSize = minSize;
+    options._parallelDownloadRanges = parallelRanges;
+    fakeFolder.syncEngine().setSyncOptions(options);
+}
+
+static QByteArray rangeHeader(qint64 start, qint64 end)
+{
+    return "bytes=" + QByteArray::number(start) + "-" + QByteArray::number(end - 1);
+}
+
+static void enableBlockSignatures(FakeFolder &fakeFolder)
+{
+    fakeFolder.syncEngine().account()->setCapabilities({ { "dav", QVariantMap{ { "blockSignatures", "1.0" } } } });
+}
+
+// The number of bytes a GET asks for
+static qint64 requestedBytes(const QNetworkRequest &request, qint64 fileSize)
+{
+    QRegularExpression rangeRx("^bytes=(\\d+)-(\\d+)$");
+    auto range = rangeRx.match(QString::fromLatin1(request.rawHeader("Range")));
+    if (!range.hasMatch())
+        return fileSize;
+    return range.captured(2).toLongLong() - range.captured(1).toLongLong() + 1;
+}
+
 
 class TestDownload : public QObject
 {
@@ -91,6 +130,124 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    void testRangedDownload()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().setIgnoreHiddenFiles(true);
+        setRangedDownload(fakeFolder, 1000 * 1000, 3);
+        const qint64 size = 50 * 1000 * 1000;
+        fakeFolder.remoteModifier().insert("A/big", size);
+
+        QList<QByteArray> ranges;
+        int running = 0;
+        int maxRunning = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("A/big")) {
+                ranges.append(request.rawHeader("Range"));
+                auto reply = new FakeGetReply(fakeFolder.remoteModifier(), op, request, this);
+                maxRunning = qMax(maxRunning, ++running);
+                connect(reply, &QNetworkReply::finished, [&] { --running; });
+                return reply;
+            }
+            return nullptr;
+        });
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // The ranges are at least 10 MB and cover the file exactly
+        QList<QByteArray> expected;
+        for (qint64 start = 0; start < size; start += 10 * 1000 * 1000)
+            expected.append(rangeHeader(start, start + 10 * 1000 * 1000));
+        std::sort(ranges.begin(), ranges.end());
+        QCOMPARE(ranges, expected);
+        QCOMPARE(maxRunning, 3);
+
+        // Smaller files are downloaded in one request
+        ranges.clear();
+        setRangedDownload(fakeFolder, size + 1, 3);
+        fakeFolder.remoteModifier().setContents("A/big", 'B');
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(ranges, QList<QByteArray>{ QByteArray() });
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testRangedDownloadResume()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().setIgnoreHiddenFiles(true);
+        setRangedDownload(fakeFolder, 1000 * 1000, 3);
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        const qint64 size = 50 * 1000 * 1000;
+        const qint64 rangeSize = 10 * 1000 * 1000;
+        fakeFolder.remoteModifier().insert("A/big", size);
+
+        // The second range stops early, which stops the whole download
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.rawHeader("Range") == rangeHeader(rangeSize, 2 * rangeSize)) {
+                return new BrokenFakeGetReply(fakeFolder.remoteModifier(), op, request, this);
+            }
+            return nullptr;
+        });
+        QVERIFY(!fakeFolder.syncOnce());
+        QCOMPARE(getItem(completeSpy, "A/big")->_status, SyncFileItem::SoftError);
+        // Stopping the other ranges doesn't report the item again
+        QCOMPARE(itemCount(completeSpy, "A/big"), 1);
+        QVERIFY(fakeFolder.syncEngine().isAnotherSyncNeeded());
+
+        // What was received before is remembered
+        const auto info = fakeFolder.syncJournal().getDownloadInfo("A/big");
+        QVERIFY(info._valid);
+        QVERIFY(info._ranged);
+        QCOMPARE(info._completedRanges, (QVector<QPair<qint64, qint64>>{ { 0, rangeSize + stopAfter } }));
+
+        // Only the missing data is downloaded now
+        QList<QByteArray> ranges;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("A/big"))
+                ranges.append(request.rawHeader("Range"));
+            return nullptr;
+        });
+        QVERIFY(fakeFolder.syncOnce());
+        QList<QByteArray> expected;
+        for (qint64 start = rangeSize + stopAfter; start < size; start += rangeSize)
+            expected.append(rangeHeader(start, qMin(start + rangeSize, size)));
+        std::sort(ranges.begin(), ranges.end());
+        QCOMPARE(ranges, expected);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(!fakeFolder.syncJournal().getDownloadInfo("A/big")._valid);
+    }
+
+    void testRangedDownloadNotSupported()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().setIgnoreHiddenFiles(true);
+        setRangedDownload(fakeFolder, 1000 * 1000, 3);
+        QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
+        fakeFolder.remoteModifier().insert("A/big", 30 * 1000 * 1000);
+
+        // A server that always sends the whole file
+        QList<QByteArray> ranges;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation && request.url().path().endsWith("A/big")) {
+                ranges.append(request.rawHeader("Range"));
+                QNetworkRequest withoutRange = request;
+                withoutRange.setRawHeader("Range", QByteArray());
+                return new FakeGetReply(fakeFolder.remoteModifier(), op, withoutRange, this);
+            }
+            return nullptr;
+        });
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        // The ranged requests were stopped and the file came in one request
+        QVERIFY(ranges.size() > 1);
+        QCOMPARE(ranges.first(), rangeHeader(0, 10 * 1000 * 1000));
+        QCOMPARE(ranges.last(), QByteArray());
+        QCOMPARE(ranges.count(QByteArray()), 1);
+        QCOMPARE(itemCount(completeSpy, "A/big"), 1);
+        QCOMPARE(getItem(completeSpy, "A/big")->_status, SyncFileItem::Success);
+    }
+
     void testErrorMessage () {
         // This test's main goal is to test that the error string from the server is shown in the UI
 
@@ -242,6 +399,121 @@ private slots:
         QCOMPARE(getItem(completeSpy, "A/resendme")->_status, SyncFileItem::NormalError);
         QVERIFY(getItem(completeSpy, "A/resendme")->_errorString.contains(serverMessage));
     }
+
+    void testReuseIdenticalLocalFile()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.remoteModifier().insert("A/original", 1000, 'X');
+        QVERIFY(fakeFolder.syncOnce());
+
+        // A server-side copy: same content, but a new fileid
+        fakeFolder.remoteModifier().insert("B/copy", 1000, 'X');
+        fakeFolder.remoteModifier().find("B/copy")->checksums =
+            "SHA1:" + QCryptographicHash::hash(QByteArray(1000, 'X'), QCryptographicHash::Sha1).toHex();
+
+        int nGET = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++nGET;
+            return nullptr;
+        });
+        quint64 bytesReused = 0;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::transmissionProgress,
+            [&](const ProgressInfo &pi) { bytesReused = pi.bytesReusedLocally(); });
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 0);
+        QCOMPARE(bytesReused, quint64(1000));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testDeltaDownload()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().setIgnoreHiddenFiles(true);
+        enableBlockSignatures(fakeFolder);
+        const qint64 size = 20 * 1000 * 1000;
+        fakeFolder.remoteModifier().insert("A/big", size);
+
+        int nSignatures = 0;
+        qint64 fetched = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation)
+                return nullptr;
+            if (request.url().path().startsWith(sSignaturesUrl.path()))
+                ++nSignatures;
+            else if (request.url().path().endsWith("A/big"))
+                fetched += requestedBytes(request, fakeFolder.remoteModifier().find("A/big")->size);
+            return nullptr;
+        });
+        quint64 bytesReused = 0;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::transmissionProgress,
+            [&](const ProgressInfo &pi) { bytesReused = pi.bytesReusedLocally(); });
+
+        // Without a local file there is nothing to compare
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nSignatures, 0);
+        QCOMPARE(fetched, size);
+
+        // All blocks of the new version are in the local file, even the last one
+        nSignatures = 0;
+        fetched = 0;
+        fakeFolder.remoteModifier().appendByte("A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nSignatures, 1);
+        QCOMPARE(fetched, qint64(0));
+        QCOMPARE(bytesReused, quint64(size + 1));
+
+        // No block matches, all of it is downloaded
+        nSignatures = 0;
+        fetched = 0;
+        fakeFolder.remoteModifier().setContents("A/big", 'X');
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nSignatures, 1);
+        QCOMPARE(fetched, size + 1);
+        QVERIFY(!fakeFolder.syncJournal().getDownloadInfo("A/big")._valid);
+    }
+
+    void testDeltaDownloadFallback()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        fakeFolder.syncEngine().setIgnoreHiddenFiles(true);
+        const qint64 size = 20 * 1000 * 1000;
+        fakeFolder.remoteModifier().insert("A/big", size);
+        QVERIFY(fakeFolder.syncOnce());
+
+        int nSignatures = 0;
+        qint64 fetched = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (op != QNetworkAccessManager::GetOperation)
+                return nullptr;
+            if (request.url().path().startsWith(sSignaturesUrl.path())) {
+                ++nSignatures;
+                return new FakeErrorReply(op, request, this, 500);
+            }
+            if (request.url().path().endsWith("A/big"))
+                fetched += requestedBytes(request, fakeFolder.remoteModifier().find("A/big")->size);
+            return nullptr;
+        });
+
+        // Servers without the capability aren't asked
+        fakeFolder.remoteModifier().appendByte("A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nSignatures, 0);
+        QCOMPARE(fetched, size + 1);
+
+        // Without signatures the whole file is downloaded
+        enableBlockSignatures(fakeFolder);
+        fetched = 0;
+        fakeFolder.remoteModifier().appendByte("A/big");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(nSignatures, 1);
+        QCOMPARE(fetched, size + 2);
+    }
 };
 
 QTEST_GUILESS_MAIN(TestDownload)
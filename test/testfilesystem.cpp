@@ -70,6 +70,28 @@ private slots:
         QCOMPARE(sSum, sum);
     }
 
+    void testCopyFile()
+    {
+        QString source(_root.path() + "/file_c.bin");
+        QString copy(_root.path() + "/file_c_copy.bin");
+        QVERIFY(writeRandomFile(source, 3 * 1024 * 1024 + 17));
+
+        QString error;
+        QVERIFY(copyFile(source, copy, &error));
+        QVERIFY(fileEquals(source, copy));
+
+        // An existing destination is replaced
+        QVERIFY(writeRandomFile(source, 1000));
+        QVERIFY(!fileEquals(source, copy));
+        QVERIFY(copyFile(source, copy, &error));
+        QCOMPARE(getSize(copy), qint64(1000));
+        QVERIFY(fileEquals(source, copy));
+
+        QVERIFY(!copyFile(_root.path() + "/nonexisting", copy + "2", &error));
+        QVERIFY(!error.isEmpty());
+        QVERIFY(!QFile::exists(copy + "2"));
+    }
+
 };
 
 QTEST_APPLESS_MAIN(TestFileSystem)
@@ -0,0 +1,181 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+#include <owncloudpropagator.h>
+
+using namespace OCC;
+
+static void disableParallelNetworkJobs(FakeFolder &fakeFolder)
+{
+    SyncOptions options;
+    options._parallelNetworkJobs = false;
+    fakeFolder.syncEngine().setSyncOptions(options);
+}
+
+static QString requestVerb(QNetworkAccessManager::Operation op, const QNetworkRequest &request)
+{
+    switch (op) {
+    case QNetworkAccessManager::GetOperation:
+        return QStringLiteral("GET");
+    case QNetworkAccessManager::PutOperation:
+        return QStringLiteral("PUT");
+    case QNetworkAccessManager::DeleteOperation:
+        return QStringLiteral("DELETE");
+    default:
+        return request.attribute(QNetworkRequest::CustomVerbAttribute).toString();
+    }
+}
+
+class TestPropagationOrder : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testMetadataBeforeTransfers()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        // One job at a time, so the requests are in scheduling order
+        disableParallelNetworkJobs(fakeFolder);
+
+        QStringList verbs;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            verbs.append(requestVerb(op, request));
+            return nullptr;
+        });
+
+        // The upload comes first in the tree
+        fakeFolder.localModifier().insert("A/new", 1000);
+        fakeFolder.localModifier().remove("A/a1");
+        fakeFolder.localModifier().rename("B/b1", "B/b1x");
+        fakeFolder.localModifier().mkdir("D");
+        verbs.clear();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        verbs.removeAll(QStringLiteral("PROPFIND"));
+        QCOMPARE(verbs.size(), 4);
+        QCOMPARE(verbs.last(), QStringLiteral("PUT"));
+        QVERIFY(verbs.contains("DELETE"));
+        QVERIFY(verbs.contains("MOVE"));
+        QVERIFY(verbs.contains("MKCOL"));
+    }
+
+    void testSmallFilesBeforeLargeOnes()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        disableParallelNetworkJobs(fakeFolder);
+
+        // The large file comes first in the tree
+        fakeFolder.remoteModifier().insert("A/large", 11 * 1000 * 1000);
+        fakeFolder.remoteModifier().insert("B/small1", 100);
+        fakeFolder.remoteModifier().insert("C/small2", 100);
+
+        QStringList completed;
+        connect(&fakeFolder.syncEngine(), &SyncEngine::itemCompleted, this, [&](const SyncFileItemPtr &item) {
+            if (!item->isDirectory())
+                completed.append(item->_file);
+        });
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        QCOMPARE(completed.size(), 3);
+        QCOMPARE(completed.last(), QStringLiteral("A/large"));
+    }
+
+    void testLargeTransferLanes()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        for (int i = 0; i < 5; ++i)
+            fakeFolder.remoteModifier().insert(QStringLiteral("A/large%1").arg(i), 11 * 1000 * 1000);
+
+        int lanes = 0;
+        int maxTransfers = 0;
+        int running = 0;
+        int maxRunning = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (requestVerb(op, request) != QLatin1String("GET"))
+                return nullptr;
+            if (auto propagator = fakeFolder.syncEngine().getPropagator()) {
+                lanes = propagator->largeTransferLanes();
+                maxTransfers = propagator->maximumActiveTransferJob();
+            }
+            auto reply = new DelayedReply<FakeGetReply>(50, fakeFolder.remoteModifier(), op, request, &fakeFolder.syncEngine());
+            maxRunning = qMax(maxRunning, ++running);
+            connect(reply, &QNetworkReply::finished, this, [&running] { --running; });
+            return reply;
+        });
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(lanes > 1);
+        QVERIFY(lanes < maxTransfers);
+        QCOMPARE(maxRunning, lanes);
+    }
+
+    void testDependenciesAreKept()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+
+        // Requests as they are sent, and "done" entries for the ones that
+        // must finish before others may start
+        QStringList log;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            const QString path = getFilePathFromUrl(request.url());
+            const QString verb = requestVerb(op, request);
+            if (verb == QLatin1String("PUT")) {
+                log.append("PUT " + path);
+            } else if (verb == QLatin1String("MKCOL")) {
+                log.append("MKCOL " + path);
+                auto reply = new FakeMkcolReply(fakeFolder.remoteModifier(), op, request, &fakeFolder.syncEngine());
+                connect(reply, &QNetworkReply::finished, this, [&log, path] { log.append("done MKCOL " + path); });
+                return reply;
+            } else if (verb == QLatin1String("MOVE")) {
+                log.append("MOVE " + path);
+                auto reply = new DelayedReply<FakeMoveReply>(100, fakeFolder.remoteModifier(), op, request, &fakeFolder.syncEngine());
+                connect(reply, &QNetworkReply::finished, this, [&log, path] { log.append("done MOVE " + path); });
+                return reply;
+            }
+            return nullptr;
+        });
+
+        // A new directory tree: each directory is created before its contents
+        fakeFolder.localModifier().mkdir("N");
+        fakeFolder.localModifier().insert("N/f1");
+        fakeFolder.localModifier().mkdir("N/sub");
+        fakeFolder.localModifier().insert("N/sub/f2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        QVERIFY(log.contains("PUT N/f1"));
+        QVERIFY(log.contains("PUT N/sub/f2"));
+        QVERIFY(log.indexOf("done MKCOL N") >= 0);
+        QVERIFY(log.indexOf("done MKCOL N") < log.indexOf("MKCOL N/sub"));
+        QVERIFY(log.indexOf("done MKCOL N") < log.indexOf("PUT N/f1"));
+        QVERIFY(log.indexOf("done MKCOL N/sub") >= 0);
+        QVERIFY(log.indexOf("done MKCOL N/sub") < log.indexOf("PUT N/sub/f2"));
+
+        // A directory move waits for nothing to run beside it, the uploads
+        // after it in the tree only start once it is done
+        log.clear();
+        fakeFolder.localModifier().rename("A", "A2");
+        fakeFolder.localModifier().insert("B/new");
+        fakeFolder.localModifier().insert("C/new");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+
+        const int moveDone = log.indexOf("done MOVE A");
+        QVERIFY(moveDone >= 0);
+        QVERIFY(log.indexOf("PUT B/new") > moveDone);
+        QVERIFY(log.indexOf("PUT C/new") > moveDone);
+    }
+};
+
+QTEST_GUILESS_MAIN(TestPropagationOrder)
+#include "testpropagationorder.moc"
@@ -0,0 +1,294 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QTemporaryDir>
+
+#include "clientsideencryption.h"
+#include "propagatedownloadencrypted.h"
+
+using namespace OCC;
+
+static QByteArray makeData(int size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    for (int i = 0; i < size; ++i)
+        data[i] = char(i * 7 + i / 251);
+    return data;
+}
+
+static bool writeFile(const QString &path, const QByteArray &data)
+{
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly) && file.write(data) == data.size();
+}
+
+static QByteArray readFile(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+// Reads the whole encrypted stream in parts, like the upload devices of the chunks do
+static QByteArray readInChunks(StreamingEncryptor &encryptor, qint64 chunkSize)
+{
+    QByteArray result;
+    QByteArray chunk;
+    for (qint64 start = 0; start < encryptor.size(); start += chunkSize) {
+        if (!encryptor.read(start, chunkSize, &chunk))
+            return QByteArray();
+        result.append(chunk);
+    }
+    return result;
+}
+
+static bool decrypt(const QByteArray &key, const QByteArray &iv, const QByteArray &stream, int chunkSize, QByteArray *plaintext)
+{
+    StreamingDecryptor decryptor(key, iv);
+    plaintext->clear();
+    QByteArray part;
+    for (int start = 0; start < stream.size(); start += chunkSize) {
+        if (!decryptor.update(stream.constData() + start, qMin(chunkSize, stream.size() - start), &part))
+            return false;
+        plaintext->append(part);
+    }
+    if (!decryptor.finish(&part))
+        return false;
+    plaintext->append(part);
+    return true;
+}
+
+class TestStreamingEncryption : public QObject
+{
+    Q_OBJECT
+
+    QTemporaryDir _dir;
+    QByteArray _key = EncryptionHelper::generateRandom(16);
+    QByteArray _iv = EncryptionHelper::generateRandom(16);
+
+    QString plainFile(const QByteArray &data)
+    {
+        const QString path = _dir.path() + "/plain";
+        writeFile(path, data);
+        return path;
+    }
+
+    // The encrypted file EncryptionHelper::fileEncryption() makes of data
+    QByteArray encryptWithHelper(const QByteArray &data, QByteArray *tag)
+    {
+        QFile input(plainFile(data));
+        QFile output(_dir.path() + "/encrypted");
+        if (!EncryptionHelper::fileEncryption(_key, _iv, &input, &output, *tag))
+            return QByteArray();
+        return readFile(output.fileName());
+    }
+
+private slots:
+    void initTestCase()
+    {
+        QVERIFY(_dir.isValid());
+    }
+
+    void testMatchesFileEncryption_data()
+    {
+        QTest::addColumn<int>("size");
+        QTest::newRow("empty") << 0;
+        QTest::newRow("one byte") << 1;
+        QTest::newRow("one cipher block") << 16;
+        QTest::newRow("one read buffer") << 64 * 1024;
+        QTest::newRow("past the read buffer") << 64 * 1024 + 1;
+        QTest::newRow("large") << 300 * 1000;
+    }
+
+    void testMatchesFileEncryption()
+    {
+        QFETCH(int, size);
+        const QByteArray data = makeData(size);
+        QByteArray helperTag;
+        const QByteArray expected = encryptWithHelper(data, &helperTag);
+        QCOMPARE(expected.size(), size + int(StreamingEncryptor::TagSize));
+
+        StreamingEncryptor encryptor(plainFile(data), _key, _iv);
+        QVERIFY(encryptor.isValid());
+        QCOMPARE(encryptor.size(), qint64(expected.size()));
+        QByteArray encrypted;
+        QVERIFY(encryptor.read(0, encryptor.size(), &encrypted));
+        QCOMPARE(encrypted, expected);
+        QCOMPARE(encryptor.tag(), helperTag);
+
+        QByteArray decrypted;
+        QVERIFY(decrypt(_key, _iv, encrypted, 1000, &decrypted));
+        QCOMPARE(decrypted, data);
+    }
+
+    void testChunkedReads_data()
+    {
+        QTest::addColumn<int>("size");
+        QTest::addColumn<int>("chunkSize");
+        QTest::newRow("many chunks") << 100 * 1000 << 7000;
+        QTest::newRow("tag is a chunk of its own") << 1000 << 1000;
+        QTest::newRow("tag split over two chunks") << 1000 << 1008;
+        QTest::newRow("tag ends the only chunk") << 1000 << 1016;
+        QTest::newRow("chunks smaller than the tag") << 100 << 5;
+        QTest::newRow("empty file in small chunks") << 0 << 5;
+    }
+
+    void testChunkedReads()
+    {
+        QFETCH(int, size);
+        QFETCH(int, chunkSize);
+        const QByteArray data = makeData(size);
+        QByteArray helperTag;
+        const QByteArray expected = encryptWithHelper(data, &helperTag);
+
+        StreamingEncryptor encryptor(plainFile(data), _key, _iv);
+        QCOMPARE(readInChunks(encryptor, chunkSize), expected);
+        QCOMPARE(encryptor.tag(), helperTag);
+
+        // Reading past the end only gives the rest of the stream
+        QByteArray tail;
+        QVERIFY(encryptor.read(expected.size() - 3, chunkSize + 3, &tail));
+        QCOMPARE(tail, expected.right(3));
+        QVERIFY(encryptor.read(expected.size(), chunkSize, &tail));
+        QVERIFY(tail.isEmpty());
+
+        QByteArray decrypted;
+        QVERIFY(decrypt(_key, _iv, expected, chunkSize, &decrypted));
+        QCOMPARE(decrypted, data);
+    }
+
+    // A chunk that is sent again, or an upload that starts over, reads
+    // before the current position and the encryption restarts
+    void testRestart()
+    {
+        const int chunkSize = 10 * 1000;
+        const QByteArray data = makeData(35 * 1000);
+        QByteArray helperTag;
+        const QByteArray expected = encryptWithHelper(data, &helperTag);
+
+        StreamingEncryptor encryptor(plainFile(data), _key, _iv);
+        QByteArray chunk;
+        QVERIFY(encryptor.read(0, chunkSize, &chunk));
+        QVERIFY(encryptor.read(chunkSize, chunkSize, &chunk));
+        QCOMPARE(chunk, expected.mid(chunkSize, chunkSize));
+
+        // The same chunk again
+        QVERIFY(encryptor.read(chunkSize, chunkSize, &chunk));
+        QCOMPARE(chunk, expected.mid(chunkSize, chunkSize));
+
+        // The tag is known once everything was read, reading from the
+        // start gives the same stream again
+        QCOMPARE(encryptor.tag(), helperTag);
+        QCOMPARE(readInChunks(encryptor, chunkSize), expected);
+        QCOMPARE(encryptor.tag(), helperTag);
+    }
+
+    void testZeroByteFile()
+    {
+        QByteArray helperTag;
+        const QByteArray expected = encryptWithHelper(QByteArray(), &helperTag);
+        QCOMPARE(expected, helperTag);
+
+        StreamingEncryptor encryptor(plainFile(QByteArray()), _key, _iv);
+        QCOMPARE(encryptor.size(), qint64(StreamingEncryptor::TagSize));
+        QByteArray encrypted;
+        QVERIFY(encryptor.read(0, encryptor.size(), &encrypted));
+        QCOMPARE(encrypted, expected);
+
+        QByteArray decrypted = "not empty";
+        QVERIFY(decrypt(_key, _iv, encrypted, 3, &decrypted));
+        QVERIFY(decrypted.isEmpty());
+    }
+
+    void testDecryptingDevice_data()
+    {
+        QTest::addColumn<int>("size");
+        QTest::addColumn<int>("writeSize");
+        QTest::newRow("empty") << 0 << 16;
+        QTest::newRow("whole stream at once") << 5000 << 5016;
+        QTest::newRow("small writes") << 5000 << 7;
+        QTest::newRow("tag in its own write") << 5000 << 5000;
+    }
+
+    void testDecryptingDevice()
+    {
+        QFETCH(int, size);
+        QFETCH(int, writeSize);
+        const QByteArray data = makeData(size);
+        QByteArray helperTag;
+        const QByteArray encrypted = encryptWithHelper(data, &helperTag);
+
+        EncryptedFile info;
+        info.encryptionKey = _key;
+        info.initializationVector = _iv;
+        QFile output(_dir.path() + "/decrypted");
+        DecryptingDevice device(&output, info);
+        QVERIFY(device.open(QIODevice::WriteOnly));
+        for (int start = 0; start < encrypted.size(); start += writeSize)
+            QCOMPARE(device.write(encrypted.mid(start, writeSize)), qint64(qMin(writeSize, encrypted.size() - start)));
+        QCOMPARE(device.received(), qint64(encrypted.size()));
+        QVERIFY(device.finish());
+        QCOMPARE(readFile(output.fileName()), data);
+
+        // Opening it again starts over
+        QVERIFY(device.open(QIODevice::WriteOnly));
+        QCOMPARE(device.received(), qint64(0));
+        QCOMPARE(device.write(encrypted), qint64(encrypted.size()));
+        QVERIFY(device.finish());
+        QCOMPARE(readFile(output.fileName()), data);
+    }
+
+    void testFinishFailsOnBadInput_data()
+    {
+        QTest::addColumn<int>("size");
+        QTest::addColumn<QString>("change");
+        for (int size : { 0, 5000 }) {
+            const QByteArray name = QByteArray::number(size);
+            if (size > 0)
+                QTest::newRow(QByteArray(name + " tampered data").constData()) << size << QStringLiteral("data");
+            QTest::newRow(QByteArray(name + " tampered tag").constData()) << size << QStringLiteral("tag");
+            QTest::newRow(QByteArray(name + " truncated").constData()) << size << QStringLiteral("truncate");
+            QTest::newRow(QByteArray(name + " tag missing").constData()) << size << QStringLiteral("notag");
+        }
+    }
+
+    void testFinishFailsOnBadInput()
+    {
+        QFETCH(int, size);
+        QFETCH(QString, change);
+        const QByteArray data = makeData(size);
+        QByteArray helperTag;
+        QByteArray encrypted = encryptWithHelper(data, &helperTag);
+
+        if (change == "data") {
+            encrypted[size / 2] = char(encrypted[size / 2] ^ 1);
+        } else if (change == "tag") {
+            encrypted[encrypted.size() - 1] = char(encrypted[encrypted.size() - 1] ^ 1);
+        } else if (change == "truncate") {
+            encrypted.chop(1);
+        } else {
+            encrypted.chop(StreamingEncryptor::TagSize);
+        }
+
+        QByteArray decrypted;
+        QVERIFY(!decrypt(_key, _iv, encrypted, 1000, &decrypted));
+
+        EncryptedFile info;
+        info.encryptionKey = _key;
+        info.initializationVector = _iv;
+        QFile output(_dir.path() + "/decrypted");
+        DecryptingDevice device(&output, info);
+        QVERIFY(device.open(QIODevice::WriteOnly));
+        QCOMPARE(device.write(encrypted), qint64(encrypted.size()));
+        QVERIFY(!device.finish());
+    }
+};
+
+QTEST_GUILESS_MAIN(TestStreamingEncryption)
+#include "teststreamingencryption.moc"
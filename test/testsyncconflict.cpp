@@ -49,6 +49,24 @@ QStringList findConflicts(const FileInfo &dir)
     return conflicts;
 }
 
+// Records a content checksum for the local file, like an upload that was started
+static void setLocalChecksum(FakeFolder &fakeFolder, const QString &path, const QByteArray &checksumHeader)
+{
+    const QDateTime modTime = QDateTime::currentDateTime();
+    fakeFolder.localModifier().setModTime(path, modTime);
+
+    SyncJournalDb::UploadInfo uploadInfo;
+    uploadInfo._valid = true;
+    uploadInfo._modtime = Utility::qDateTimeToTime_t(modTime);
+    uploadInfo._contentChecksum = checksumHeader;
+    fakeFolder.syncJournal().setUploadInfo(path, uploadInfo);
+}
+
+static QByteArray sha1Header(char contentChar, int size)
+{
+    return "SHA1:" + QCryptographicHash::hash(QByteArray(size, contentChar), QCryptographicHash::Sha1).toHex();
+}
+
 bool expectAndWipeConflict(FileModifier &local, FileInfo state, const QString path)
 {
     PathComponents pathComponents(path);
@@ -588,6 +606,40 @@ private slots:
         QVERIFY(fakeFolder.syncOnce());
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
+
+    // A checksum known for the local file decides a conflict, the data isn't
+    // compared. The recorded checksum doesn't match the local data here, so
+    // only the checksum can have made the files equal.
+    void testConflictDecidedByMatchingChecksum()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        const int size = int(fakeFolder.remoteModifier().find("A/a1")->size);
+
+        fakeFolder.localModifier().setContents("A/a1", 'L');
+        fakeFolder.remoteModifier().setContents("A/a1", 'R');
+        setLocalChecksum(fakeFolder, "A/a1", sha1Header('R', size));
+        QVERIFY(fakeFolder.syncOnce());
+
+        QVERIFY(findConflicts(fakeFolder.currentLocalState().children["A"]).isEmpty());
+        QCOMPARE(fakeFolder.currentLocalState().find("A/a1")->contentChar, 'R');
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    // A differing checksum makes a conflict, even though the data is the same
+    void testConflictDecidedByDifferingChecksum()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        const int size = int(fakeFolder.remoteModifier().find("A/a1")->size);
+
+        fakeFolder.localModifier().setContents("A/a1", 'R');
+        fakeFolder.remoteModifier().setContents("A/a1", 'R');
+        setLocalChecksum(fakeFolder, "A/a1", sha1Header('L', size));
+        QVERIFY(fakeFolder.syncOnce());
+
+        QCOMPARE(findConflicts(fakeFolder.currentLocalState().children["A"]).size(), 1);
+        QVERIFY(expectAndWipeConflict(fakeFolder.localModifier(), fakeFolder.currentLocalState(), "A/a1"));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
 };
 
 QTEST_GUILESS_MAIN(TestSyncConflict)
@@ -54,6 +54,19 @@ private slots:
         QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
     }
 
+    void testRootEtagIsStored() {
+        FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
+        QVERIFY(fakeFolder.syncOnce());
+        const auto etag = fakeFolder.syncJournal().rootEtag();
+        QVERIFY(!etag.isEmpty());
+
+        // The next sync stores the etag of the changed server
+        fakeFolder.remoteModifier().setContents("A/a1", 'Z');
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.syncJournal().rootEtag().isEmpty());
+        QVERIFY(fakeFolder.syncJournal().rootEtag() != etag);
+    }
+
     void testDirDownload() {
         FakeFolder fakeFolder{FileInfo::A12_B12_C12_S12()};
         QSignalSpy completeSpy(&fakeFolder.syncEngine(), SIGNAL(itemCompleted(const SyncFileItemPtr &)));
@@ -664,6 +677,77 @@ private slots:
         QVERIFY(fakeFolder.currentRemoteState().find("B/.hidden"));
     }
 
+    void testWarmUpConnections()
+    {
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions options;
+        options._warmUpConnections = 3;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        fakeFolder.requestCounts().clear();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.requestCounts().value("PRECONNECT"), 3);
+
+        options._warmUpConnections = 0;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        fakeFolder.requestCounts().clear();
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.requestCounts().value("PRECONNECT"), 0);
+    }
+
+    void testDiscoveryPipeline_data()
+    {
+        QTest::addColumn<int>("pipelineDepth");
+
+        QTest::newRow("off") << 0;
+        QTest::newRow("1") << 1;
+        QTest::newRow("2") << 2;
+    }
+
+    void testDiscoveryPipeline()
+    {
+        QFETCH(int, pipelineDepth);
+
+        FakeFolder fakeFolder{ FileInfo::A12_B12_C12_S12() };
+        SyncOptions options;
+        options._discoveryPipelineDepth = pipelineDepth;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        // The listing of A is requested, but not needed
+        fakeFolder.syncEngine().excludedFiles().addManualExclude("A");
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        fakeFolder.remoteModifier().appendByte("C/c1");
+        fakeFolder.remoteModifier().insert("S/s3");
+
+        QStringList listed;
+        int running = 0;
+        int maxRunning = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &request, QIODevice *) -> QNetworkReply * {
+            if (request.attribute(QNetworkRequest::CustomVerbAttribute) != "PROPFIND")
+                return nullptr;
+            listed.append(getFilePathFromUrl(request.url()));
+            maxRunning = qMax(maxRunning, ++running);
+            auto reply = new FakePropfindReply(fakeFolder.remoteModifier(), op, request, &fakeFolder.syncEngine());
+            QObject::connect(reply, &QNetworkReply::finished, [&running] { --running; });
+            return reply;
+        });
+        QVERIFY(fakeFolder.syncOnce());
+
+        // Unchanged directories are not listed
+        QVERIFY(!listed.contains("B"));
+        QCOMPARE(listed.contains("A"), pipelineDepth > 0);
+        QVERIFY(listed.contains("C"));
+        QVERIFY(listed.contains("S"));
+        if (pipelineDepth == 0)
+            QCOMPARE(maxRunning, 1);
+        else if (pipelineDepth > 1)
+            QVERIFY(maxRunning >= 2);
+
+        QVERIFY(fakeFolder.currentLocalState().find("S/s3"));
+        QVERIFY(fakeFolder.currentLocalState().find("C/c1")->size == fakeFolder.currentRemoteState().find("C/c1")->size);
+        QVERIFY(fakeFolder.currentLocalState().find("A/a1")->size != fakeFolder.currentRemoteState().find("A/a1")->size);
+    }
+
     void testNoLocalEncoding()
     {
         auto utf8Locale = QTextCodec::codecForLocale();
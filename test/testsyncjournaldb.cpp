@@ -143,6 +143,13 @@ private slots:
         Info storedRecord = _db.getDownloadInfo("foo");
         QVERIFY(storedRecord == record);
 
+        // The ranges of a ranged download are kept
+        record._ranged = true;
+        record._completedRanges = { qMakePair(qint64(0), qint64(1000)), qMakePair(qint64(5000), qint64(6000000000)) };
+        _db.setDownloadInfo("foo", record);
+        storedRecord = _db.getDownloadInfo("foo");
+        QVERIFY(storedRecord == record);
+
         _db.setDownloadInfo("foo", Info());
         Info wipedRecord = _db.getDownloadInfo("foo");
         QVERIFY(!wipedRecord._valid);
@@ -160,6 +167,8 @@ private slots:
         record._size = 12894789147;
         record._modtime = dropMsecs(QDateTime::currentDateTime());
         record._valid = true;
+        record._confirmedBytes = 5000000000;
+        record._reservedChunks = 18;
         _db.setUploadInfo("foo", record);
 
         Info storedRecord = _db.getUploadInfo("foo");
@@ -320,6 +329,113 @@ private slots:
         QVERIFY(checkElements());
     }
 
+    void testCommittedFileRecord()
+    {
+        SyncJournalFileRecord record;
+        record._path = "committed";
+        QVERIFY(_db.setFileRecord(record));
+        _db.commit("test");
+
+        // Written inside the transaction that commit() started
+        record._path = "uncommitted";
+        QVERIFY(_db.setFileRecord(record));
+
+        SyncJournalFileRecord result;
+        QVERIFY(_db.getCommittedFileRecord(QByteArray("committed"), &result));
+        QVERIFY(result.isValid());
+        QVERIFY(_db.getCommittedFileRecord(QByteArray("uncommitted"), &result));
+        QVERIFY(!result.isValid());
+        QVERIFY(_db.getFileRecord(QByteArray("uncommitted"), &result));
+        QVERIFY(result.isValid());
+
+        _db.commit("test");
+        QVERIFY(_db.getCommittedFileRecord(QByteArray("uncommitted"), &result));
+        QVERIFY(result.isValid());
+
+        // Without an open journal the lookup goes through the main connection
+        _db.close();
+        QVERIFY(_db.getCommittedFileRecord(QByteArray("committed"), &result));
+        QVERIFY(result.isValid());
+    }
+
+    void testFilesInDirectory()
+    {
+        auto makeEntry = [&](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            _db.setFileRecord(record);
+        };
+        for (const auto &path : { "lsdir", "lsdir/a", "lsdir/b", "lsdir/b/c", "lsdir/b-2", "lsdir-2", "lsdir-2/d", "lsdirx", "lsdir/\xc3\xa4/e", "lsdir/\xc3\xa4-2" })
+            makeEntry(path);
+
+        auto list = [&](const QByteArray &path) {
+            QSet<QByteArray> result;
+            _db.getFilesInDirectory(path, [&](const SyncJournalFileRecord &rec) { result.insert(rec._path); });
+            return result;
+        };
+
+        // "lsdir/\xc3\xa4" has no record of its own
+        QCOMPARE(list("lsdir"), QSet<QByteArray>() << "lsdir/a" << "lsdir/b" << "lsdir/b-2" << "lsdir/\xc3\xa4-2");
+        QCOMPARE(list("lsdir/b"), QSet<QByteArray>() << "lsdir/b/c");
+        QCOMPARE(list("lsdir/\xc3\xa4"), QSet<QByteArray>() << "lsdir/\xc3\xa4/e");
+        QVERIFY(list("lsdir/a").isEmpty());
+
+        auto root = list("");
+        QVERIFY(root.contains("lsdir"));
+        QVERIFY(root.contains("lsdir-2"));
+        QVERIFY(root.contains("lsdirx"));
+        QVERIFY(!root.contains("lsdir/a"));
+    }
+
+    void testPostSyncCleanup()
+    {
+        auto makeEntry = [&](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            record._path = path;
+            _db.setFileRecord(record);
+        };
+        auto hasEntry = [&](const QByteArray &path) {
+            SyncJournalFileRecord record;
+            _db.getFileRecord(path, &record);
+            return record.isValid();
+        };
+
+        for (const auto &path : { "sweep", "sweep/kept", "sweep/gone", "sweepx", "unavail", "unavail/file", "unavailx" })
+            makeEntry(path);
+
+        // Without a sweep nothing is removed
+        QVERIFY(!_db.postSyncCleanup({}));
+        QVERIFY(hasEntry("sweep/gone"));
+
+        QVERIFY(_db.beginRecordSweep());
+        _db.keepFileRecord("sweep");
+        _db.keepFileRecord("sweep/kept");
+        QVERIFY(_db.postSyncCleanup({ QStringLiteral("unavail") }));
+
+        QVERIFY(hasEntry("sweep"));
+        QVERIFY(hasEntry("sweep/kept"));
+        QVERIFY(!hasEntry("sweep/gone"));
+        QVERIFY(!hasEntry("sweepx"));
+        QVERIFY(hasEntry("unavail"));
+        QVERIFY(hasEntry("unavail/file"));
+        QVERIFY(!hasEntry("unavailx"));
+
+        // Closing the database cancels a running sweep
+        QVERIFY(_db.beginRecordSweep());
+        _db.close();
+        QVERIFY(!_db.postSyncCleanup({}));
+        QVERIFY(hasEntry("sweep/kept"));
+
+        // The full cleanup doesn't need a sweep
+        makeEntry("unavailx");
+        QVERIFY(_db.postSyncCleanup({ QStringLiteral("sweep") }, { QStringLiteral("unavail") }));
+        QVERIFY(hasEntry("sweep"));
+        QVERIFY(!hasEntry("sweep/kept"));
+        QVERIFY(hasEntry("unavail"));
+        QVERIFY(hasEntry("unavail/file"));
+        QVERIFY(!hasEntry("unavailx"));
+    }
+
 private:
     SyncJournalDb _db;
 };
@@ -0,0 +1,274 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include "config.h"
+#include "syncenginetestutils.h"
+#include <syncengine.h>
+
+using namespace OCC;
+
+static const QString suffix = QStringLiteral(APPLICATION_DOTVIRTUALFILE_SUFFIX);
+
+static SyncJournalFileRecord dbRecord(FakeFolder &folder, const QString &path)
+{
+    SyncJournalFileRecord record;
+    folder.syncJournal().getFileRecord(path, &record);
+    return record;
+}
+
+// Same as Folder::downloadVirtualFile() and Folder::dehydrateFile()
+static void requestType(FakeFolder &folder, const QString &path, ItemType type)
+{
+    auto record = dbRecord(folder, path);
+    QVERIFY(record.isValid());
+    record._type = type;
+    folder.syncJournal().setFileRecord(record);
+    folder.syncJournal().avoidReadFromDbOnNextSync(record._path);
+}
+
+class TestSyncVirtualFiles : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void testVirtualFileLifecycle()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        SyncOptions options;
+        options._newFilesAreVirtual = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        int nGET = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++nGET;
+            return nullptr;
+        });
+
+        // A new remote file only gets a placeholder
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1", 64);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a1"));
+        QVERIFY(fakeFolder.currentLocalState().find("A/a1" + suffix));
+        QCOMPARE(dbRecord(fakeFolder, "A/a1" + suffix)._type, ItemTypeVirtualFile);
+        QCOMPARE(dbRecord(fakeFolder, "A/a1" + suffix)._fileSize, qint64(64));
+        QCOMPARE(nGET, 0);
+
+        // Nothing happens on the next sync
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(fakeFolder.currentLocalState().find("A/a1" + suffix));
+        QVERIFY(fakeFolder.currentRemoteState().find("A/a1"));
+        QVERIFY(!fakeFolder.currentRemoteState().find("A/a1" + suffix));
+
+        // A remote change keeps it virtual
+        fakeFolder.remoteModifier().appendByte("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a1"));
+        QCOMPARE(dbRecord(fakeFolder, "A/a1" + suffix)._fileSize, qint64(65));
+        QCOMPARE(nGET, 0);
+
+        // Hydrate on request
+        requestType(fakeFolder, "A/a1" + suffix, ItemTypeVirtualFileDownload);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 1);
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a1" + suffix));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QVERIFY(!dbRecord(fakeFolder, "A/a1" + suffix).isValid());
+        QCOMPARE(dbRecord(fakeFolder, "A/a1")._type, ItemTypeFile);
+
+        // Dehydrate on request
+        requestType(fakeFolder, "A/a1", ItemTypeVirtualFileDehydration);
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a1"));
+        QVERIFY(fakeFolder.currentLocalState().find("A/a1" + suffix));
+        QVERIFY(fakeFolder.currentRemoteState().find("A/a1"));
+        QCOMPARE(dbRecord(fakeFolder, "A/a1" + suffix)._type, ItemTypeVirtualFile);
+        QVERIFY(!dbRecord(fakeFolder, "A/a1").isValid());
+
+        // A remote removal removes the placeholder
+        fakeFolder.remoteModifier().remove("A/a1");
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("A/a1" + suffix));
+        QVERIFY(!dbRecord(fakeFolder, "A/a1" + suffix).isValid());
+    }
+
+    void testVirtualFileLocalChanges()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        SyncOptions options;
+        options._newFilesAreVirtual = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1", 64);
+        fakeFolder.remoteModifier().insert("A/a2", 64);
+        fakeFolder.remoteModifier().insert("A/a3", 64);
+        QVERIFY(fakeFolder.syncOnce());
+
+        // Writing to a placeholder turns it into a file of its own
+        fakeFolder.localModifier().appendByte("A/a1" + suffix);
+        // Renaming a placeholder renames the remote file
+        fakeFolder.localModifier().rename("A/a2" + suffix, "A/renamed" + suffix);
+        // Removing a placeholder removes the remote file
+        fakeFolder.localModifier().remove("A/a3" + suffix);
+        QVERIFY(fakeFolder.syncOnce());
+
+        auto remote = fakeFolder.currentRemoteState();
+        QCOMPARE(remote.find("A/a1")->size, qint64(64));
+        QCOMPARE(remote.find("A/a1" + suffix)->size, qint64(2));
+        QCOMPARE(dbRecord(fakeFolder, "A/a1" + suffix)._type, ItemTypeFile);
+        QVERIFY(!remote.find("A/a2"));
+        QCOMPARE(remote.find("A/renamed")->size, qint64(64));
+        QVERIFY(!remote.find("A/renamed" + suffix));
+        QVERIFY(!remote.find("A/a3"));
+        QCOMPARE(dbRecord(fakeFolder, "A/renamed" + suffix)._type, ItemTypeVirtualFile);
+    }
+
+    void testChangedPlaceholderIsNotOverwritten()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        SyncOptions options;
+        options._newFilesAreVirtual = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        fakeFolder.remoteModifier().insert("a1", 64);
+        QVERIFY(fakeFolder.syncOnce());
+
+        // The user writes to the placeholder while the server's file changes
+        fakeFolder.localModifier().setContents("a1" + suffix, 'L');
+        fakeFolder.localModifier().appendByte("a1" + suffix);
+        fakeFolder.remoteModifier().appendByte("a1");
+        QVERIFY(fakeFolder.syncOnce());
+
+        // Both versions are kept, nothing was truncated
+        auto local = fakeFolder.currentLocalState();
+        QCOMPARE(local.find("a1" + suffix)->size, qint64(2));
+        QCOMPARE(local.find("a1" + suffix)->contentChar, 'L');
+        QCOMPARE(local.find("a1")->size, qint64(65));
+        auto remote = fakeFolder.currentRemoteState();
+        QCOMPARE(remote.find("a1")->size, qint64(65));
+        QCOMPARE(remote.find("a1" + suffix)->size, qint64(2));
+        QCOMPARE(dbRecord(fakeFolder, "a1" + suffix)._type, ItemTypeFile);
+
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+    }
+
+    void testRenamePlaceholderToRealName()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        SyncOptions options;
+        options._newFilesAreVirtual = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1", 64);
+        fakeFolder.remoteModifier().insert("A/a2", 64);
+        QVERIFY(fakeFolder.syncOnce());
+
+        int nPUT = 0;
+        int nDELETE = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::PutOperation)
+                ++nPUT;
+            if (op == QNetworkAccessManager::DeleteOperation)
+                ++nDELETE;
+            return nullptr;
+        });
+
+        // Dropping the suffix neither uploads the placeholder nor deletes the file
+        fakeFolder.localModifier().rename("A/a1" + suffix, "A/a1");
+        fakeFolder.localModifier().rename("A/a2" + suffix, "A/b2");
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nPUT, 0);
+        QCOMPARE(nDELETE, 0);
+        auto remote = fakeFolder.currentRemoteState();
+        QCOMPARE(remote.find("A/a1")->size, qint64(64));
+        QCOMPARE(remote.find("A/b2")->size, qint64(64));
+        QVERIFY(!remote.find("A/a2"));
+        QCOMPARE(dbRecord(fakeFolder, "A/a1")._type, ItemTypeVirtualFileDownload);
+        QCOMPARE(dbRecord(fakeFolder, "A/b2")._type, ItemTypeVirtualFileDownload);
+
+        // The next sync puts the data in place
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nPUT, 0);
+        QCOMPARE(nDELETE, 0);
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(dbRecord(fakeFolder, "A/a1")._type, ItemTypeFile);
+        QCOMPARE(dbRecord(fakeFolder, "A/b2")._type, ItemTypeFile);
+    }
+
+    void testExistingLocalFileIsNotVirtual()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        SyncOptions options;
+        options._newFilesAreVirtual = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+
+        fakeFolder.remoteModifier().insert("a1", 64, 'A');
+        fakeFolder.localModifier().insert("a1", 64, 'A');
+        QVERIFY(fakeFolder.syncOnce());
+        QVERIFY(!fakeFolder.currentLocalState().find("a1" + suffix));
+        QCOMPARE(fakeFolder.currentLocalState(), fakeFolder.currentRemoteState());
+        QCOMPARE(dbRecord(fakeFolder, "a1")._type, ItemTypeFile);
+    }
+
+    void testPlaceholdersSurviveDisablingVirtualFiles()
+    {
+        FakeFolder fakeFolder{ FileInfo() };
+        SyncOptions options;
+        options._newFilesAreVirtual = true;
+        fakeFolder.syncEngine().setSyncOptions(options);
+        fakeFolder.remoteModifier().mkdir("A");
+        fakeFolder.remoteModifier().insert("A/a1", 64);
+        fakeFolder.remoteModifier().insert("A/a2", 64);
+        fakeFolder.remoteModifier().insert("A/a3", 64);
+        QVERIFY(fakeFolder.syncOnce());
+
+        int nGET = 0;
+        int nPUT = 0;
+        fakeFolder.setServerOverride([&](QNetworkAccessManager::Operation op, const QNetworkRequest &, QIODevice *) -> QNetworkReply * {
+            if (op == QNetworkAccessManager::GetOperation)
+                ++nGET;
+            if (op == QNetworkAccessManager::PutOperation)
+                ++nPUT;
+            return nullptr;
+        });
+
+        // New files are downloaded again, the existing placeholders stay
+        fakeFolder.syncEngine().setSyncOptions(SyncOptions());
+        fakeFolder.remoteModifier().insert("A/new", 64);
+        fakeFolder.remoteModifier().appendByte("A/a2");
+        fakeFolder.localModifier().rename("A/a3" + suffix, "A/renamed" + suffix);
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 1);
+        QCOMPARE(nPUT, 0);
+
+        auto local = fakeFolder.currentLocalState();
+        QCOMPARE(local.find("A/new")->size, qint64(64));
+        QCOMPARE(dbRecord(fakeFolder, "A/new")._type, ItemTypeFile);
+        QVERIFY(!local.find("A/a1"));
+        QVERIFY(local.find("A/a1" + suffix));
+        QCOMPARE(dbRecord(fakeFolder, "A/a1" + suffix)._type, ItemTypeVirtualFile);
+        QVERIFY(!local.find("A/a2"));
+        QCOMPARE(dbRecord(fakeFolder, "A/a2" + suffix)._fileSize, qint64(65));
+        auto remote = fakeFolder.currentRemoteState();
+        QVERIFY(!remote.find("A/a3"));
+        QCOMPARE(remote.find("A/renamed")->size, qint64(64));
+        QVERIFY(!remote.find("A/a1" + suffix));
+        QVERIFY(!remote.find("A/renamed" + suffix));
+        QCOMPARE(dbRecord(fakeFolder, "A/renamed" + suffix)._type, ItemTypeVirtualFile);
+
+        // Nothing happens on the next sync
+        QVERIFY(fakeFolder.syncOnce());
+        QCOMPARE(nGET, 1);
+        QCOMPARE(nPUT, 0);
+        QVERIFY(fakeFolder.currentLocalState().find("A/a1" + suffix));
+    }
+};
+
+QTEST_GUILESS_MAIN(TestSyncVirtualFiles)
+#include "testsyncvirtualfiles.moc"
@@ -0,0 +1,82 @@
+/*
+ *    This software is in the public domain, furnished "as is", without technical
+ *    support, and with no warranty, express or implied, as to its usefulness for
+ *    any purpose.
+ *
+ */
+
+#include <QtTest>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "common/tracing.h"
+
+using namespace OCC;
+
+static QJsonArray traceEvents()
+{
+    return QJsonDocument::fromJson(Tracing::chromeTraceJson()).object().value("traceEvents").toArray();
+}
+
+class TestTracing : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void init()
+    {
+        Tracing::setCapacity(100);
+    }
+
+    void testDisabled()
+    {
+        Tracing::setEnabled(false);
+        {
+            TraceSpan span("test", "disabled");
+        }
+        QVERIFY(traceEvents().isEmpty());
+    }
+
+    void testSpans()
+    {
+        Tracing::setEnabled(true);
+        {
+            TraceSpan outer("test", "outer", QStringLiteral("some/path"));
+            TraceSpan inner("test", "inner");
+        }
+        Tracing::setEnabled(false);
+
+        auto events = traceEvents();
+        QCOMPARE(events.size(), 2);
+        // Spans are recorded when they end
+        auto inner = events[0].toObject();
+        auto outer = events[1].toObject();
+        QCOMPARE(inner.value("name").toString(), QStringLiteral("inner"));
+        QCOMPARE(outer.value("name").toString(), QStringLiteral("outer"));
+        QCOMPARE(outer.value("ph").toString(), QStringLiteral("X"));
+        QCOMPARE(outer.value("cat").toString(), QStringLiteral("test"));
+        QCOMPARE(outer.value("args").toObject().value("detail").toString(), QStringLiteral("some/path"));
+        QVERIFY(outer.value("ts").toDouble() <= inner.value("ts").toDouble());
+        QVERIFY(outer.value("dur").toDouble() >= inner.value("dur").toDouble());
+    }
+
+    void testRingBuffer()
+    {
+        Tracing::setCapacity(3);
+        for (int i = 0; i < 5; ++i)
+            Tracing::addSpan("test", "span", QString::number(i), i, 1);
+
+        auto events = traceEvents();
+        QCOMPARE(events.size(), 3);
+        // The oldest spans were dropped, the rest is in order
+        for (int i = 0; i < 3; ++i)
+            QCOMPARE(events[i].toObject().value("args").toObject().value("detail").toString(), QString::number(i + 2));
+
+        Tracing::clear();
+        QVERIFY(traceEvents().isEmpty());
+    }
+};
+
+QTEST_APPLESS_MAIN(TestTracing)
+#include "testtracing.moc"